@@ -0,0 +1,646 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "simulation.h"
+#include "initialconditions.h"
+#include "snapshotwriter.h"
+#include "profiler.h"
+#include "splat.h"
+#include "sharedframes.h"
+#include "autotune.h"
+#include "fof.h"
+#include "fieldgrid.h"
+#include "omp.h"
+
+struct BatchOptions
+{
+    int particles = 10000;
+    int steps = 100;
+    int nodeCapacity = 0;
+    bool compactNodes = false;
+    float dt = 0.01f;
+    float theta = 0.5f;
+    float softening = SOFTENING;
+    float damping = 1.0f;
+    Integrator integrator = Integrator::LEAPFROG;
+
+    Distribution distribution = Distribution::UNIFORM;
+    float radius = 1000.0f;
+    float totalMass = 10000.0f;
+    unsigned int seed = 1;
+
+    int threads = 0;
+
+    int diagnosticsEvery = 0;
+    float collideRadius = 0.0f;
+    int treepmMesh = 0;
+    float treepmSplit = PM_DEFAULT_SPLIT;
+    float boxSize = 0.0f;
+    std::string ewaldTable = "ewald.tab";
+
+    double autotuneBudget = 0.0;
+    std::string tuneCache = "nbody_tune.cache";
+
+    int snapshotEvery = 0;
+    std::string snapshotPrefix = "snapshot";
+    bool compress = false;
+    SnapshotCodecOptions codec;
+    bool directIO = false;
+
+    int fofEvery = 0;
+    float fofLink = 0.0f;
+    float fofFactor = FOF_LINKING_FACTOR;
+    int fofMin = FOF_MIN_MEMBERS;
+    bool fofMembers = false;
+    std::string fofPrefix = "groups";
+
+    int fieldEvery = 0;
+    int fieldSize = 128;
+    DepositKernel fieldKernel = DepositKernel::CIC;
+    int fieldProject = 2;
+    float fieldExtent = 0.0f;
+    bool fieldPotential = false;
+    std::string fieldPrefix = "field";
+
+    int renderEvery = 0;
+    std::string renderPrefix = "frame";
+    std::string renderFormat = "ppm";
+    int renderWidth = 1280;
+    int renderHeight = 720;
+    float renderFov = 45.0f;
+    float renderDistance = 0.0f;
+    float renderKernel = 1.0f;
+
+    std::string shareName;
+    int shareEvery = 1;
+
+    std::string metricsCsv;
+    std::string metricsJson;
+};
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --particles N        number of bodies (default 10000)\n"
+              << "  --steps N            fixed steps to run (default 100)\n"
+              << "  --dt DT              step size (default 0.01)\n"
+              << "  --theta T            opening angle (default 0.5)\n"
+              << "  --softening E        softening length (default 0.5)\n"
+              << "  --damping D          velocity damping per step (default 1)\n"
+              << "  --integrator NAME    leapfrog (2 force passes a step), yoshida (4th order, 3 passes) or\n"
+              << "                       hermite (4th order, 1 pass with jerk; not with --treepm or --box)\n"
+              << "                       (default leapfrog)\n"
+              << "  --distribution NAME  initial conditions: uniform, plummer, clustered, cube\n"
+              << "  --radius R           initial radius (default 1000)\n"
+              << "  --mass M             total mass (default 10000)\n"
+              << "  --seed S             random seed (default 1)\n"
+              << "  --nodes N            octree node capacity (default 4 * particles + 64)\n"
+              << "  --compact-nodes      walk 16-byte node records (bfloat16 mass, quantised centre of mass)\n"
+              << "  --threads N          OpenMP threads (default: runtime)\n"
+              << "  --diagnostics-every K  print energy, momentum and angular momentum drift every K steps\n"
+              << "  --collide R          merge overlapping bodies; R is the radius of a unit-mass body\n"
+              << "                       (default off; cannot be combined with --box)\n"
+              << "  --treepm MESH        TreePM: long-range forces from a MESH^3 particle mesh, MESH a power of two\n"
+              << "                       (default off)\n"
+              << "  --split S            TreePM split scale in mesh cells (default 1.25)\n"
+              << "  --box L              periodic cube of side L centred on the origin, with Ewald corrections\n"
+              << "                       (default off; cannot be combined with --treepm or --collide)\n"
+              << "  --ewald-table PATH   Ewald table cache, computed on first use (default ewald.tab)\n"
+              << "  --autotune E         calibrate theta, node layout, solver, walk chunk and threads on the initial\n"
+              << "                       conditions for a 99th percentile relative force error of at most E;\n"
+              << "                       overrides --theta and --compact-nodes, and may switch to TreePM unless\n"
+              << "                       --box, --treepm or --integrator hermite is given (default off)\n"
+              << "  --tune-cache PATH    tuning choices by machine and problem, read and updated by --autotune\n"
+              << "                       (default nbody_tune.cache; empty to always calibrate)\n"
+              << "  --snapshot-every K   write a snapshot every K steps (default off)\n"
+              << "  --snapshot-prefix P  snapshot file prefix (default snapshot)\n"
+              << "  --compress           use the Morton-quantized snapshot codec\n"
+              << "  --position-error E   largest absolute position error of compressed snapshots (default 0.001)\n"
+              << "  --velocity-error E   largest absolute velocity error of compressed snapshots (default 0.001)\n"
+              << "  --direct-io          write snapshots with O_DIRECT\n"
+              << "  --fof-every K        find friends-of-friends groups every K steps (default off; not with --box)\n"
+              << "  --fof-link L         linking length (default --fof-b times the mean interparticle separation)\n"
+              << "  --fof-b B            linking length in mean interparticle separations (default 0.2)\n"
+              << "  --fof-min N          smallest group catalogued (default 20)\n"
+              << "  --fof-members        also write each group's member indices\n"
+              << "  --fof-prefix P       group catalogue file prefix (default groups)\n"
+              << "  --field-every K      deposit mass onto a grid every K steps (default off)\n"
+              << "  --field-size N       grid cells per side (default 128)\n"
+              << "  --field-kernel NAME  ngp, cic or tsc (default cic)\n"
+              << "  --field-project AXIS project along x, y or z onto a 2D map, or none for a 3D grid (default z)\n"
+              << "  --field-extent L     side of the gridded cube centred on the origin (default the periodic box,\n"
+              << "                       else 2 * radius)\n"
+              << "  --field-potential    also write the tree potential at the cell centres (mid-plane of a map)\n"
+              << "  --field-prefix P     field file prefix (default field)\n"
+              << "  --render-every K     splat a density image every K steps (default off)\n"
+              << "  --render-prefix P    image file prefix, or the raw stream path without extension (default frame)\n"
+              << "  --render-format F    ppm, png or raw (one RGB24 stream) (default ppm)\n"
+              << "  --render-size WxH    image size (default 1280x720)\n"
+              << "  --render-fov DEG     vertical field of view (default 45)\n"
+              << "  --render-distance D  camera distance from the origin on +z (default 3 * radius)\n"
+              << "  --render-kernel PX   splat radius in pixels (default 1, bilinear)\n"
+              << "  --share NAME         publish frames to the shared-memory ring /NAME for NBody3D --attach NAME\n"
+              << "  --share-every K      publish every K steps (default 1)\n"
+              << "  --metrics-csv PATH   per-step phase timings and counters as CSV (NBODY_PROFILE builds)\n"
+              << "  --metrics-json PATH  per-step phase timings and counters as JSON lines (NBODY_PROFILE builds)\n";
+}
+
+static void printSnapshotReports(SnapshotWriter &writer)
+{
+    for (const SnapshotReport &report: writer.reports())
+    {
+        std::cout << "snapshot " << report.step << ": " << report.bytes << " bytes, stall "
+                  << report.stallSeconds * 1.0e3 << " ms, copy " << report.copySeconds * 1.0e3 << " ms, encode "
+                  << report.encodeSeconds * 1.0e3 << " ms, write " << report.writeSeconds * 1.0e3 << " ms ("
+                  << report.throughputMBs << " MB/s)" << std::endl;
+    }
+}
+
+static bool parseOptions(int argc, char **argv, BatchOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--particles")
+            options.particles = std::atoi(value());
+        else if (arg == "--steps")
+            options.steps = std::atoi(value());
+        else if (arg == "--dt")
+            options.dt = std::strtof(value(), nullptr);
+        else if (arg == "--theta")
+            options.theta = std::strtof(value(), nullptr);
+        else if (arg == "--softening")
+            options.softening = std::strtof(value(), nullptr);
+        else if (arg == "--damping")
+            options.damping = std::strtof(value(), nullptr);
+        else if (arg == "--integrator")
+        {
+            if (!parseIntegrator(value(), options.integrator))
+            {
+                std::cerr << "Unknown integrator " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--distribution")
+        {
+            if (!parseDistribution(value(), options.distribution))
+            {
+                std::cerr << "Unknown distribution " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--radius")
+            options.radius = std::strtof(value(), nullptr);
+        else if (arg == "--mass")
+            options.totalMass = std::strtof(value(), nullptr);
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned int>(std::strtoul(value(), nullptr, 10));
+        else if (arg == "--nodes")
+            options.nodeCapacity = std::atoi(value());
+        else if (arg == "--compact-nodes")
+            options.compactNodes = true;
+        else if (arg == "--threads")
+            options.threads = std::atoi(value());
+        else if (arg == "--diagnostics-every")
+            options.diagnosticsEvery = std::atoi(value());
+        else if (arg == "--collide")
+            options.collideRadius = std::strtof(value(), nullptr);
+        else if (arg == "--treepm")
+            options.treepmMesh = std::atoi(value());
+        else if (arg == "--split")
+            options.treepmSplit = std::strtof(value(), nullptr);
+        else if (arg == "--box")
+            options.boxSize = std::strtof(value(), nullptr);
+        else if (arg == "--ewald-table")
+            options.ewaldTable = value();
+        else if (arg == "--autotune")
+            options.autotuneBudget = std::strtod(value(), nullptr);
+        else if (arg == "--tune-cache")
+            options.tuneCache = value();
+        else if (arg == "--snapshot-every")
+            options.snapshotEvery = std::atoi(value());
+        else if (arg == "--snapshot-prefix")
+            options.snapshotPrefix = value();
+        else if (arg == "--compress")
+            options.compress = true;
+        else if (arg == "--position-error")
+            options.codec.positionError = std::strtof(value(), nullptr);
+        else if (arg == "--velocity-error")
+            options.codec.velocityError = std::strtof(value(), nullptr);
+        else if (arg == "--direct-io")
+            options.directIO = true;
+        else if (arg == "--fof-every")
+            options.fofEvery = std::atoi(value());
+        else if (arg == "--fof-link")
+            options.fofLink = std::strtof(value(), nullptr);
+        else if (arg == "--fof-b")
+            options.fofFactor = std::strtof(value(), nullptr);
+        else if (arg == "--fof-min")
+            options.fofMin = std::atoi(value());
+        else if (arg == "--fof-members")
+            options.fofMembers = true;
+        else if (arg == "--fof-prefix")
+            options.fofPrefix = value();
+        else if (arg == "--field-every")
+            options.fieldEvery = std::atoi(value());
+        else if (arg == "--field-size")
+            options.fieldSize = std::atoi(value());
+        else if (arg == "--field-kernel")
+        {
+            if (!parseDepositKernel(value(), options.fieldKernel))
+            {
+                std::cerr << "Unknown deposit kernel " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--field-project")
+        {
+            std::string axis = value();
+            if (axis == "none")
+                options.fieldProject = -1;
+            else if (axis == "x" || axis == "y" || axis == "z")
+                options.fieldProject = axis[0] - 'x';
+            else
+            {
+                std::cerr << "Projection axis must be x, y, z or none" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--field-extent")
+            options.fieldExtent = std::strtof(value(), nullptr);
+        else if (arg == "--field-potential")
+            options.fieldPotential = true;
+        else if (arg == "--field-prefix")
+            options.fieldPrefix = value();
+        else if (arg == "--render-every")
+            options.renderEvery = std::atoi(value());
+        else if (arg == "--render-prefix")
+            options.renderPrefix = value();
+        else if (arg == "--render-format")
+            options.renderFormat = value();
+        else if (arg == "--render-size")
+        {
+            if (std::sscanf(value(), "%dx%d", &options.renderWidth, &options.renderHeight) != 2)
+            {
+                std::cerr << "Render size must be WxH" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--render-fov")
+            options.renderFov = std::strtof(value(), nullptr);
+        else if (arg == "--render-distance")
+            options.renderDistance = std::strtof(value(), nullptr);
+        else if (arg == "--render-kernel")
+            options.renderKernel = std::strtof(value(), nullptr);
+        else if (arg == "--share")
+            options.shareName = value();
+        else if (arg == "--share-every")
+            options.shareEvery = std::atoi(value());
+        else if (arg == "--metrics-csv")
+            options.metricsCsv = value();
+        else if (arg == "--metrics-json")
+            options.metricsJson = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.particles <= 0 || options.steps < 0)
+    {
+        std::cerr << "Particle count must be positive and step count non-negative" << std::endl;
+        return false;
+    }
+    if (options.renderFormat != "ppm" && options.renderFormat != "png" && options.renderFormat != "raw")
+    {
+        std::cerr << "Unknown render format " << options.renderFormat << std::endl;
+        return false;
+    }
+    if (options.treepmMesh != 0 && (options.treepmMesh < 8 || (options.treepmMesh & (options.treepmMesh - 1)) != 0))
+    {
+        std::cerr << "TreePM mesh size must be a power of two of at least 8" << std::endl;
+        return false;
+    }
+    if (options.treepmSplit <= 0.0f)
+    {
+        std::cerr << "Split scale must be positive" << std::endl;
+        return false;
+    }
+    if (options.boxSize < 0.0f || (options.boxSize > 0.0f && options.treepmMesh != 0))
+    {
+        std::cerr << "Box size must be non-negative and a periodic box cannot be combined with TreePM" << std::endl;
+        return false;
+    }
+    if (options.integrator == Integrator::HERMITE && (options.boxSize > 0.0f || options.treepmMesh != 0))
+    {
+        std::cerr << "The Hermite integrator cannot be combined with TreePM or a periodic box" << std::endl;
+        return false;
+    }
+    if (options.collideRadius > 0.0f && options.boxSize > 0.0f)
+    {
+        std::cerr << "Collisions cannot be combined with a periodic box" << std::endl;
+        return false;
+    }
+    if (options.fofEvery > 0 && options.boxSize > 0.0f)
+    {
+        std::cerr << "Friends-of-friends groups cannot be found in a periodic box" << std::endl;
+        return false;
+    }
+    if (options.autotuneBudget < 0.0)
+    {
+        std::cerr << "Force error budget must not be negative" << std::endl;
+        return false;
+    }
+    if (!(options.codec.positionError > 0.0f) || !(options.codec.velocityError > 0.0f))
+    {
+        std::cerr << "Snapshot position and velocity errors must be positive" << std::endl;
+        return false;
+    }
+    if (options.fofLink < 0.0f || options.fofFactor <= 0.0f || options.fofMin <= 0)
+    {
+        std::cerr << "Linking length must not be negative, and the linking factor and group size must be positive"
+                  << std::endl;
+        return false;
+    }
+    if (options.fieldEvery > 0 && (options.fieldSize < 2 * FIELD_SLAB_CELLS || options.fieldExtent < 0.0f))
+    {
+        std::cerr << "Field grid must have at least " << 2 * FIELD_SLAB_CELLS
+                  << " cells per side and a non-negative extent" << std::endl;
+        return false;
+    }
+    if (options.shareEvery <= 0)
+    {
+        std::cerr << "Share interval must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BatchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (options.threads > 0)
+        omp_set_num_threads(options.threads);
+
+    Simulation simulation(options.particles, options.nodeCapacity);
+    SimulationData &data = simulation.data();
+    data.theta = options.theta;
+    data.softening = options.softening;
+
+    generateParticles(data, options.distribution, options.radius, options.totalMass, options.seed);
+    simulation.diagnosticsSetup(options.diagnosticsEvery);
+    simulation.collisionSetup(options.collideRadius);
+    simulation.integratorSetup(options.integrator);
+    simulation.treePMSetup(options.treepmMesh, options.treepmSplit);
+    simulation.periodicSetup(options.boxSize, options.ewaldTable);
+    simulation.compactNodesSetup(options.compactNodes);
+
+    if (options.autotuneBudget > 0.0)
+    {
+        TuneOptions tune;
+        tune.errorBudget = options.autotuneBudget;
+        tune.searchTreePM = options.boxSize <= 0.0f && options.treepmMesh == 0 &&
+                            options.integrator != Integrator::HERMITE;
+        tune.cachePath = options.tuneCache;
+
+        auto tuneStart = std::chrono::steady_clock::now();
+        TuneResult tuned = autotune(simulation, tune);
+        double tuneSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tuneStart).count();
+
+        const TuneConfig &config = tuned.config;
+        std::cout << "autotune " << (tuned.cached ? "cached" : "calibrated") << " in " << tuneSeconds << " s ("
+                  << tuned.candidates << " candidates): theta " << config.theta << ", "
+                  << (config.compactNodes ? "compact" : "full") << " nodes, ";
+        if (config.treepmMesh > 0)
+            std::cout << "TreePM mesh " << config.treepmMesh;
+        else
+            std::cout << "tree";
+        std::cout << ", walk chunk " << config.walkChunk << ", threads " << config.threads << ", "
+                  << tuned.seconds << " s per force pass, force error " << tuned.forceError
+                  << (tuned.withinBudget ? "" : " (over budget)") << std::endl;
+        options.theta = config.theta;
+    }
+
+    std::unique_ptr<SnapshotWriter> writer;
+    if (options.snapshotEvery > 0)
+    {
+        writer = std::make_unique<SnapshotWriter>(options.snapshotPrefix, options.directIO);
+        if (options.compress)
+            writer->enableCompression(options.codec);
+    }
+
+    std::unique_ptr<FriendsOfFriends> fof;
+    FofCatalogue groups;
+    if (options.fofEvery > 0)
+    {
+        float link = options.fofLink > 0.0f ? options.fofLink : fofLinkingLength(data, options.fofFactor);
+        fof = std::make_unique<FriendsOfFriends>(link, options.fofMin);
+        std::cout << "friends-of-friends linking length " << link << std::endl;
+    }
+
+    std::unique_ptr<FieldGrid> field;
+    if (options.fieldEvery > 0)
+    {
+        // The periodic box is wrapped around when it is the gridded cube
+        float extent = options.fieldExtent > 0.0f ? options.fieldExtent
+                                                  : (options.boxSize > 0.0f ? options.boxSize : 2.0f * options.radius);
+        bool periodic = options.boxSize > 0.0f && extent == options.boxSize;
+        field = std::make_unique<FieldGrid>(options.fieldSize, extent, options.fieldKernel, options.fieldProject,
+                                            periodic);
+    }
+
+    std::unique_ptr<SplatRenderer> splat;
+    std::FILE *rawStream = nullptr;
+    float viewProjection[16];
+    if (options.renderEvery > 0)
+    {
+        splat = std::make_unique<SplatRenderer>(options.renderWidth, options.renderHeight);
+        splat->kernelPixels = options.renderKernel;
+
+        // Looking down -z at the origin with the viewer's projection
+        float distance = options.renderDistance > 0.0f ? options.renderDistance : 3.0f * options.radius;
+        float eye[3] = {0.0f, 0.0f, distance}, center[3] = {0.0f, 0.0f, 0.0f}, up[3] = {0.0f, 1.0f, 0.0f};
+        float view[16], projection[16];
+        lookAtMatrix(eye, center, up, view);
+        perspectiveMatrix(options.renderFov * 3.14159265f / 180.0f,
+                          static_cast<float>(options.renderWidth) / static_cast<float>(options.renderHeight),
+                          0.1f, 60000.0f, projection);
+        multiplyMatrix(projection, view, viewProjection);
+
+        if (options.renderFormat == "raw")
+        {
+            std::string path = options.renderPrefix + ".rgb";
+            rawStream = std::fopen(path.c_str(), "wb");
+            if (rawStream == nullptr)
+            {
+                std::cerr << "Failed to open " << path << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::unique_ptr<SharedFrameWriter> share;
+    if (!options.shareName.empty())
+    {
+        share = std::make_unique<SharedFrameWriter>(options.shareName, data.particleCount);
+        share->publish(data, simulation.steps(), simulation.time());
+    }
+
+    if (!options.metricsCsv.empty() || !options.metricsJson.empty())
+    {
+#ifdef NBODY_PROFILE
+        if (!options.metricsCsv.empty())
+            Profiler::instance().openCsv(options.metricsCsv);
+        if (!options.metricsJson.empty())
+            Profiler::instance().openJson(options.metricsJson);
+#else
+        std::cerr << "Metrics requested but this build has NBODY_PROFILE disabled" << std::endl;
+#endif
+    }
+
+    std::cout << "particles " << options.particles << ", steps " << options.steps << ", dt " << options.dt
+              << ", theta " << options.theta << ", distribution " << distributionName(options.distribution)
+              << ", integrator " << integratorName(options.integrator) << ", precision " << Precision::name
+              << ", threads " << omp_get_max_threads() << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < options.steps; ++i)
+    {
+        PROFILE_STEP_BEGIN(simulation.steps() + 1);
+        simulation.step(options.dt, options.damping);
+
+        if (const Diagnostics *diagnostics = simulation.diagnostics())
+            printDiagnostics(std::cout, *diagnostics);
+
+        if (writer && simulation.steps() % options.snapshotEvery == 0)
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            writer->submit(data, simulation.steps(), simulation.time());
+            printSnapshotReports(*writer);
+        }
+
+        // Group finding and fields query the tree, which the step left on the positions of its last force pass
+        bool fofDue = fof && simulation.steps() % options.fofEvery == 0;
+        bool fieldDue = field && simulation.steps() % options.fieldEvery == 0;
+        if (fofDue || fieldDue)
+            simulation.rebuildTree();
+
+        if (fofDue)
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            auto fofStart = std::chrono::steady_clock::now();
+            fof->find(data, simulation.tree(), options.fofMembers, groups);
+            double fofSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fofStart).count();
+
+            char path[512];
+            std::snprintf(path, sizeof(path), "%s_%08llu.csv", options.fofPrefix.c_str(),
+                          static_cast<unsigned long long>(simulation.steps()));
+            std::ofstream catalogue(path);
+            writeFofCatalogue(catalogue, groups);
+            if (options.fofMembers)
+            {
+                std::snprintf(path, sizeof(path), "%s_%08llu_members.txt", options.fofPrefix.c_str(),
+                              static_cast<unsigned long long>(simulation.steps()));
+                std::ofstream members(path);
+                writeFofMembers(members, groups);
+                if (!members)
+                    catalogue.setstate(std::ios::failbit);
+            }
+            if (!catalogue)
+                std::cerr << "Failed to write groups " << simulation.steps() << std::endl;
+
+            std::cout << "step " << simulation.steps() << ": " << groups.groups.size() << " groups, "
+                      << groups.grouped << " bodies grouped, largest "
+                      << (groups.groups.empty() ? 0 : groups.groups.front().members) << ", " << fofSeconds << " s"
+                      << std::endl;
+        }
+
+        if (fieldDue)
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            field->deposit(data);
+            if (options.fieldPotential)
+                field->evaluatePotential(data);
+
+            char path[512];
+            std::snprintf(path, sizeof(path), "%s_%08llu.field", options.fieldPrefix.c_str(),
+                          static_cast<unsigned long long>(simulation.steps()));
+            if (!field->write(path, simulation.steps(), simulation.time()))
+                std::cerr << "Failed to write field " << simulation.steps() << std::endl;
+        }
+
+        if (splat && simulation.steps() % options.renderEvery == 0)
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            splat->render(data.particleX, data.particleY, data.particleZ, data.particleMass, data.particleCount,
+                          viewProjection);
+
+            bool written;
+            if (rawStream != nullptr)
+            {
+                written = splat->writeRaw(rawStream);
+            }
+            else
+            {
+                char path[512];
+                std::snprintf(path, sizeof(path), "%s_%08llu.%s", options.renderPrefix.c_str(),
+                              static_cast<unsigned long long>(simulation.steps()), options.renderFormat.c_str());
+                written = options.renderFormat == "png" ? splat->writePng(path) : splat->writePpm(path);
+            }
+            if (!written)
+                std::cerr << "Failed to write frame " << simulation.steps() << std::endl;
+        }
+        if (share && simulation.steps() % options.shareEvery == 0)
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            share->publish(data, simulation.steps(), simulation.time());
+        }
+        PROFILE_STEP_END(simulation.tree().size(), simulation.tree().depth());
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (writer)
+    {
+        writer->flush();
+        printSnapshotReports(*writer);
+    }
+    if (rawStream != nullptr)
+        std::fclose(rawStream);
+
+    if (const CollisionStats *collisions = simulation.collisionStats())
+        std::cout << "merged " << collisions->totalMerged << " bodies, " << data.particleCount << " remaining"
+                  << std::endl;
+
+    std::cout << "wall " << seconds << " s, " << options.steps / seconds << " steps/s, "
+              << static_cast<double>(options.particles) * options.steps / seconds << " particle-steps/s, "
+              << simulation.forcePasses() << " force passes" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,718 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "simulation.h"
+#include "bhtree.h"
+#include "integrator.h"
+#include "initialconditions.h"
+#include "spatialquery.h"
+#include "particlemesh.h"
+#include "fof.h"
+#include "fieldgrid.h"
+#include "omp.h"
+
+#ifndef NBODY_GIT_COMMIT
+#define NBODY_GIT_COMMIT "unknown"
+#endif
+
+// Bytes streamed per particle by one Velocity_Verlet step with an acceleration that reads the position and
+// writes the acceleration: index + pos/acc (force pass), pos/vel/acc in, pos out (drift, in storage order),
+// index + acc in, pos in/acc out, vel in/out (kick); two indices and 33 scalars of the body precision
+constexpr double VERLET_BYTES_PER_PARTICLE = 2.0 * sizeof(unsigned int) + 33.0 * sizeof(Real);
+
+struct BenchOptions
+{
+    std::vector<int> particles{1000, 10000, 100000};
+    std::vector<Distribution> distributions{Distribution::UNIFORM, Distribution::PLUMMER, Distribution::CLUSTERED};
+    std::vector<float> thetas{0.3f, 0.5f, 0.7f};
+    std::vector<int> threads{omp_get_max_threads()};
+    std::vector<std::string> kernels{"build", "force", "gravity", "verlet"};
+    std::vector<int> meshes{64};
+    float split = PM_DEFAULT_SPLIT;
+    float box = 0.0f;       // periodic box side, 0 for open boundaries
+    std::vector<Integrator> integrators{Integrator::LEAPFROG, Integrator::YOSHIDA, Integrator::HERMITE};
+    std::vector<float> steps{0.005f, 0.01f, 0.02f};     // orbit step sizes in crossing times
+    float span = 0.5f;                                  // orbit length in crossing times
+    float softening = SOFTENING;
+    std::string ewaldTable = "ewald.tab";
+
+    int repeats = 5;
+    int neighbours = 16;    // k of the knn kernel, and the uniform-density neighbour count of the radius kernel
+    float radius = 1000.0f;
+    unsigned int seed = 1;
+
+    std::string format = "csv";
+    std::string output;
+    std::string label = NBODY_GIT_COMMIT;
+};
+
+struct BenchResult
+{
+    std::string kernel;
+    Distribution distribution;
+    int particles;
+    float theta;        // NaN for kernels that do not depend on it
+    int threads;
+
+    double seconds;     // median over the repeats
+    double nsPerParticle;
+    double interactionsPerSecond;
+    double bandwidthGBs;
+    double efficiency;  // against the smallest thread count of the same configuration
+
+    int mesh = 0;           // TreePM mesh size, 0 for the pure tree
+    double forceError = NAN; // RMS relative force error against direct summation, force kernels only
+    double layoutError = NAN; // compact kernel: RMS relative difference from the walk over the full node streams
+
+    // Orbit kernel only: the integrator, its step in crossing times, the force passes of the whole run and the
+    // relative energy drift at its end
+    std::string integrator;
+    double dt = NAN;
+    uint64_t forcePasses = 0;
+    double energyError = NAN;
+};
+
+// Bodies sampled for the force error
+constexpr int ERROR_SAMPLES = 256;
+
+// Cells per side of the field kernel's grid
+constexpr int FIELD_BENCH_CELLS = 128;
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --particles LIST      comma separated counts (default 1000,10000,100000)\n"
+              << "  --distributions LIST  uniform, plummer, clustered, cube (default all but cube)\n"
+              << "  --theta LIST          opening angles for the force kernel (default 0.3,0.5,0.7)\n"
+              << "  --threads LIST        OpenMP thread counts (default: runtime maximum)\n"
+              << "  --kernels LIST        build, force, gravity, verlet, treepm, knn, radius, fof, field,\n"
+              << "                        orbit, compact (default build, force, gravity, verlet; knn, radius, fof\n"
+              << "                        and field (CIC onto 128^3 cells) report bodies per second; orbit runs once per point and reports the\n"
+              << "                        energy drift; compact is the force kernel on compact node records)\n"
+              << "  --mesh LIST           TreePM mesh sizes, powers of two (default 64)\n"
+              << "  --split S             TreePM split scale in mesh cells (default 1.25)\n"
+              << "  --box L               periodic cube of side L with Ewald corrections; pair with the cube\n"
+              << "                        distribution and L = 2 * radius (default off, not with treepm)\n"
+              << "  --ewald-table PATH    Ewald table cache (default ewald.tab)\n"
+              << "  --integrators LIST    orbit integrators: leapfrog, yoshida, hermite (default all)\n"
+              << "  --dt LIST             orbit step sizes in crossing times R^1.5 / sqrt(G M)\n"
+              << "                        (default 0.005,0.01,0.02)\n"
+              << "  --span T              orbit length in crossing times (default 0.5)\n"
+              << "  --softening E         softening length (default 0.5)\n"
+              << "  --repeats N           timed repetitions per point, median reported (default 5)\n"
+              << "  --neighbours K        k of the knn kernel; the radius kernel uses the radius holding K\n"
+              << "                        bodies at uniform density (default 16)\n"
+              << "  --radius R            initial radius (default 1000)\n"
+              << "  --seed S              random seed (default 1)\n"
+              << "  --format csv|json     output format (default csv)\n"
+              << "  --output PATH         write results to PATH instead of stdout\n"
+              << "  --label TEXT          label stored with every row (default: git commit)\n";
+}
+
+static std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--particles")
+        {
+            options.particles.clear();
+            for (auto &item: splitList(value()))
+                options.particles.push_back(static_cast<int>(std::strtod(item.c_str(), nullptr)));
+        }
+        else if (arg == "--distributions")
+        {
+            options.distributions.clear();
+            for (auto &item: splitList(value()))
+            {
+                Distribution distribution;
+                if (!parseDistribution(item, distribution))
+                {
+                    std::cerr << "Unknown distribution " << item << std::endl;
+                    return false;
+                }
+                options.distributions.push_back(distribution);
+            }
+        }
+        else if (arg == "--theta")
+        {
+            options.thetas.clear();
+            for (auto &item: splitList(value()))
+                options.thetas.push_back(std::strtof(item.c_str(), nullptr));
+        }
+        else if (arg == "--integrators")
+        {
+            options.integrators.clear();
+            for (auto &item: splitList(value()))
+            {
+                Integrator integrator;
+                if (!parseIntegrator(item, integrator))
+                {
+                    std::cerr << "Unknown integrator " << item << std::endl;
+                    return false;
+                }
+                options.integrators.push_back(integrator);
+            }
+        }
+        else if (arg == "--dt")
+        {
+            options.steps.clear();
+            for (auto &item: splitList(value()))
+                options.steps.push_back(std::strtof(item.c_str(), nullptr));
+        }
+        else if (arg == "--span")
+            options.span = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--softening")
+            options.softening = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--threads")
+        {
+            options.threads.clear();
+            for (auto &item: splitList(value()))
+                options.threads.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--kernels")
+            options.kernels = splitList(value());
+        else if (arg == "--repeats")
+            options.repeats = std::max(1, std::atoi(value().c_str()));
+        else if (arg == "--mesh")
+        {
+            options.meshes.clear();
+            for (auto &item: splitList(value()))
+                options.meshes.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--split")
+            options.split = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--box")
+            options.box = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--ewald-table")
+            options.ewaldTable = value();
+        else if (arg == "--neighbours")
+            options.neighbours = std::atoi(value().c_str());
+        else if (arg == "--radius")
+            options.radius = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned int>(std::strtoul(value().c_str(), nullptr, 10));
+        else if (arg == "--format")
+            options.format = value();
+        else if (arg == "--output")
+            options.output = value();
+        else if (arg == "--label")
+            options.label = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    for (auto &kernel: options.kernels)
+    {
+        if (kernel != "build" && kernel != "force" && kernel != "gravity" && kernel != "verlet" &&
+            kernel != "treepm" && kernel != "knn" && kernel != "radius" && kernel != "fof" && kernel != "field" &&
+            kernel != "orbit" && kernel != "compact")
+        {
+            std::cerr << "Unknown kernel " << kernel << std::endl;
+            return false;
+        }
+    }
+
+    for (int mesh: options.meshes)
+    {
+        if (mesh < 8 || (mesh & (mesh - 1)) != 0)
+        {
+            std::cerr << "Mesh size " << mesh << " is not a power of two of at least 8" << std::endl;
+            return false;
+        }
+    }
+    if (options.split <= 0.0f)
+    {
+        std::cerr << "--split must be positive" << std::endl;
+        return false;
+    }
+    if (options.box < 0.0f ||
+        (options.box > 0.0f &&
+         std::find(options.kernels.begin(), options.kernels.end(), "treepm") != options.kernels.end()))
+    {
+        std::cerr << "--box must be non-negative and cannot be combined with the treepm kernel" << std::endl;
+        return false;
+    }
+
+    if (options.span <= 0.0f ||
+        std::any_of(options.steps.begin(), options.steps.end(), [](float dt) { return dt <= 0.0f; }))
+    {
+        std::cerr << "--span and every --dt must be positive" << std::endl;
+        return false;
+    }
+    if (options.box > 0.0f &&
+        std::find(options.kernels.begin(), options.kernels.end(), "orbit") != options.kernels.end())
+    {
+        std::cerr << "--box cannot be combined with the orbit kernel" << std::endl;
+        return false;
+    }
+
+    if (options.neighbours < 1)
+    {
+        std::cerr << "--neighbours must be at least 1" << std::endl;
+        return false;
+    }
+
+    if (options.format != "csv" && options.format != "json")
+    {
+        std::cerr << "Unknown format " << options.format << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Runs body once untimed, then repeats times; returns the median wall time
+template<typename Setup, typename Body>
+static double timeMedian(int repeats, Setup setup, Body body)
+{
+    std::vector<double> samples;
+    for (int r = 0; r <= repeats; ++r)
+    {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (r > 0)
+            samples.push_back(seconds);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+static void clearAcceleration(const SimulationData &data)
+{
+    std::fill(data.accX, data.accX + data.particleCount, 0.0f);
+    std::fill(data.accY, data.accY + data.particleCount, 0.0f);
+    std::fill(data.accZ, data.accZ + data.particleCount, 0.0f);
+}
+
+// RMS relative difference between the accelerations just computed and direct summation over a sample of the
+// bodies; the sample's accelerations are overwritten
+static double forceError(const SimulationData &data)
+{
+    int stride = std::max(1, data.particleCount / ERROR_SAMPLES);
+    double sum = 0.0;
+    int samples = 0;
+    for (int i = 0; i < data.particleCount; i += stride)
+    {
+        Real ax = data.accX[i], ay = data.accY[i], az = data.accZ[i];
+        directAcceleration(i, data);
+        double dx = ax - data.accX[i], dy = ay - data.accY[i], dz = az - data.accZ[i];
+        double reference = static_cast<double>(data.accX[i]) * data.accX[i] +
+                           static_cast<double>(data.accY[i]) * data.accY[i] +
+                           static_cast<double>(data.accZ[i]) * data.accZ[i];
+        if (reference > 0.0)
+        {
+            sum += (dx * dx + dy * dy + dz * dz) / reference;
+            ++samples;
+        }
+    }
+    return samples > 0 ? std::sqrt(sum / samples) : 0.0;
+}
+
+// RMS relative difference between the accelerations just computed and a reference over every body
+static double layoutError(const SimulationData &data, const std::vector<Real> reference[3])
+{
+    double sum = 0.0;
+    int samples = 0;
+#pragma omp parallel for schedule(static) reduction(+:sum, samples)
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        double dx = data.accX[i] - reference[0][i], dy = data.accY[i] - reference[1][i];
+        double dz = data.accZ[i] - reference[2][i];
+        double norm = static_cast<double>(reference[0][i]) * reference[0][i] +
+                      static_cast<double>(reference[1][i]) * reference[1][i] +
+                      static_cast<double>(reference[2][i]) * reference[2][i];
+        if (norm > 0.0)
+        {
+            sum += (dx * dx + dy * dy + dz * dz) / norm;
+            ++samples;
+        }
+    }
+    return samples > 0 ? std::sqrt(sum / samples) : 0.0;
+}
+
+static void runPoint(const BenchOptions &options, const std::string &kernel, Distribution distribution, int particles,
+                     int threads, std::vector<BenchResult> &results)
+{
+    omp_set_num_threads(threads);
+
+    Simulation simulation(particles);
+    SimulationData &data = simulation.data();
+    generateParticles(data, distribution, options.radius, static_cast<float>(particles), options.seed);
+    data.softening = options.softening;
+    simulation.periodicSetup(options.box, options.ewaldTable);
+
+    // Snapshot the initial state so every repetition starts from the same particles
+    std::vector<Real> initial[6];
+    Real *streams[6] = {data.particleX, data.particleY, data.particleZ,
+                        data.particleVelX, data.particleVelY, data.particleVelZ};
+    for (int s = 0; s < 6; ++s)
+        initial[s].assign(streams[s], streams[s] + particles);
+    auto restore = [&]() {
+        for (int s = 0; s < 6; ++s)
+            std::copy(initial[s].begin(), initial[s].end(), streams[s]);
+    };
+
+    auto record = [&](float theta, double seconds, double interactions, double bytes) {
+        BenchResult result{};
+        result.kernel = kernel;
+        result.distribution = distribution;
+        result.particles = particles;
+        result.theta = theta;
+        result.threads = threads;
+        result.seconds = seconds;
+        result.nsPerParticle = seconds * 1.0e9 / particles;
+        result.interactionsPerSecond = interactions / seconds;
+        result.bandwidthGBs = bytes / seconds / 1.0e9;
+        results.push_back(result);
+    };
+
+    Octree tree;
+
+    if (kernel == "build")
+    {
+        double seconds = timeMedian(options.repeats, [] {}, [&] { tree.buildTree(data); });
+        record(NAN, seconds, 0.0, 0.0);
+    }
+    else if (kernel == "force")
+    {
+        tree.buildTree(data);
+        for (float theta: options.thetas)
+        {
+            data.theta = theta;
+            long long interactions = 0;
+            double seconds = timeMedian(options.repeats, [&] { clearAcceleration(data); interactions = 0; }, [&] {
+#pragma omp parallel for schedule(dynamic) reduction(+:interactions)
+                for (int i = 0; i < data.particleCount; ++i)
+                    interactions += netAcceleration(static_cast<int>(data.idxSorted[i]), data);
+            });
+            record(theta, seconds, static_cast<double>(interactions), 0.0);
+            results.back().forceError = forceError(data);
+        }
+    }
+    else if (kernel == "compact")
+    {
+        // The force kernel walking the 16-byte node records, against the full streams of the same tree
+        for (float theta: options.thetas)
+        {
+            data.theta = theta;
+            simulation.compactNodesSetup(false);
+            tree.buildTree(data);
+#pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < data.particleCount; ++i)
+                netAcceleration(static_cast<int>(data.idxSorted[i]), data);
+            std::vector<Real> reference[3] = {{data.accX, data.accX + particles}, {data.accY, data.accY + particles},
+                                              {data.accZ, data.accZ + particles}};
+
+            simulation.compactNodesSetup(true);
+            tree.buildTree(data);
+            long long interactions = 0;
+            double seconds = timeMedian(options.repeats, [&] { clearAcceleration(data); interactions = 0; }, [&] {
+#pragma omp parallel for schedule(dynamic) reduction(+:interactions)
+                for (int i = 0; i < data.particleCount; ++i)
+                    interactions += netAcceleration(static_cast<int>(data.idxSorted[i]), data);
+            });
+            record(theta, seconds, static_cast<double>(interactions), 0.0);
+            results.back().layoutError = layoutError(data, reference);
+            results.back().forceError = forceError(data);
+        }
+        simulation.compactNodesSetup(false);
+    }
+    else if (kernel == "treepm")
+    {
+        // A mesh solve plus the short-range walk, as one force pass of a TreePM step
+        tree.buildTree(data);
+        for (int meshSize: options.meshes)
+        {
+            ParticleMesh mesh(meshSize, options.split);
+            mesh.fit(data);
+            for (float theta: options.thetas)
+            {
+                data.theta = theta;
+                long long interactions = 0;
+                double seconds = timeMedian(options.repeats, [&] { clearAcceleration(data); interactions = 0; }, [&] {
+                    mesh.solve(data);
+#pragma omp parallel for schedule(dynamic) reduction(+:interactions)
+                    for (int i = 0; i < data.particleCount; ++i)
+                    {
+                        auto p = static_cast<int>(data.idxSorted[i]);
+                        interactions += netAcceleration(p, data);
+                        mesh.addAcceleration(p, data);
+                    }
+                });
+                record(theta, seconds, static_cast<double>(interactions), 0.0);
+                results.back().mesh = meshSize;
+                results.back().forceError = forceError(data);
+            }
+        }
+        data.splitRadius = 0.0f;
+    }
+    else if (kernel == "gravity")
+    {
+        // One softened interaction per particle against a node at its own position offset
+        std::mt19937 rng(options.seed);
+        std::uniform_real_distribution<float> unit(-options.radius, options.radius);
+        std::vector<float> dx(particles), dy(particles), dz(particles);
+        for (int i = 0; i < particles; ++i)
+        {
+            dx[i] = unit(rng);
+            dy[i] = unit(rng);
+            dz[i] = unit(rng);
+        }
+
+        double seconds = timeMedian(options.repeats, [] {}, [&] {
+            Gravitational gravity{data.softening};
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < particles; ++i)
+            {
+                vec a = gravity(data.particleMass[i], dx[i], dy[i], dz[i]);
+                data.accX[i] = a.x;
+                data.accY[i] = a.y;
+                data.accZ[i] = a.z;
+            }
+        });
+        record(NAN, seconds, particles, 0.0);
+    }
+    else if (kernel == "verlet")
+    {
+        // A cheap harmonic acceleration isolates the integrator's own streaming cost
+        auto harmonic = [](int i, const SimulationData &d) {
+            d.accX[i] = -d.particleX[i];
+            d.accY[i] = -d.particleY[i];
+            d.accZ[i] = -d.particleZ[i];
+        };
+        tree.buildTree(data);
+        double seconds = timeMedian(options.repeats, restore, [&] {
+            Velocity_Verlet(harmonic, 1.0f, 0.01f, data);
+        });
+        record(NAN, seconds, 0.0, VERLET_BYTES_PER_PARTICLE * particles);
+    }
+    else if (kernel == "orbit")
+    {
+        // Whole runs over a fixed span, one per integrator and step. Units are crossing times R^1.5 / sqrt(M)
+        // of the initial conditions (total mass = particles), so the steps mean the same at every N
+        double crossing = std::sqrt(static_cast<double>(options.radius) * options.radius * options.radius / particles);
+        for (float theta: options.thetas)
+        {
+            for (Integrator integrator: options.integrators)
+            {
+                for (float dt: options.steps)
+                {
+                    Simulation run(particles);
+                    SimulationData &runData = run.data();
+                    generateParticles(runData, distribution, options.radius, static_cast<float>(particles),
+                                      options.seed);
+                    runData.theta = theta;
+                    runData.softening = options.softening;
+                    run.integratorSetup(integrator);
+
+                    int steps = std::max(1, static_cast<int>(std::lround(options.span / dt)));
+                    run.diagnosticsSetup(steps);
+                    auto start = std::chrono::steady_clock::now();
+                    for (int s = 0; s < steps; ++s)
+                        run.step(static_cast<float>(dt * crossing));
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                    record(theta, seconds, 0.0, 0.0);
+                    results.back().integrator = integratorName(integrator);
+                    results.back().dt = dt;
+                    results.back().forcePasses = run.forcePasses();
+                    results.back().energyError = std::fabs(run.diagnostics()->energyDrift);
+                }
+            }
+        }
+    }
+    else if (kernel == "knn" || kernel == "radius")
+    {
+        // Every body queries its neighbours; the interactions column counts queries
+        tree.buildTree(data);
+        SpatialQuery query;
+        query.update(data, tree);
+        NeighbourList neighbours;
+
+        double seconds;
+        if (kernel == "knn")
+        {
+            seconds = timeMedian(options.repeats, [] {}, [&] {
+                query.nearestParticles(options.neighbours, neighbours);
+            });
+        }
+        else
+        {
+            float reach = options.radius * std::cbrt(static_cast<float>(options.neighbours) / particles);
+            seconds = timeMedian(options.repeats, [] {}, [&] { query.withinParticles(reach, neighbours); });
+        }
+        record(NAN, seconds, particles, 0.0);
+    }
+    else if (kernel == "fof")
+    {
+        // Linking length 0.2 of the mean separation in the initial sphere; the interactions column counts bodies
+        tree.buildTree(data);
+        double volume = 4.0 / 3.0 * M_PI * options.radius * options.radius * options.radius;
+        FriendsOfFriends fof(FOF_LINKING_FACTOR * static_cast<float>(std::cbrt(volume / particles)));
+        FofCatalogue groups;
+        double seconds = timeMedian(options.repeats, [] {}, [&] { fof.find(data, tree, false, groups); });
+        record(NAN, seconds, particles, 0.0);
+    }
+    else if (kernel == "field")
+    {
+        // The whole initial sphere onto a 3D grid; the interactions column counts bodies
+        tree.buildTree(data);
+        FieldGrid field(FIELD_BENCH_CELLS, 2.0f * options.radius, DepositKernel::CIC);
+        double seconds = timeMedian(options.repeats, [] {}, [&] { field.deposit(data); });
+        record(NAN, seconds, particles, 0.0);
+    }
+}
+
+static void writeResults(const BenchOptions &options, const std::vector<BenchResult> &results, std::ostream &out)
+{
+    // Empty for NaN, which marks columns a kernel does not fill
+    auto optional = [](double value) {
+        std::ostringstream text;
+        if (!std::isnan(value))
+            text << value;
+        return text.str();
+    };
+
+    if (options.format == "csv")
+    {
+        out << "label,kernel,distribution,particles,theta,threads,seconds,ns_per_particle,interactions_per_second,"
+               "bandwidth_gbs,scaling_efficiency,mesh,box,force_error,integrator,dt,force_passes,energy_error,"
+               "precision,layout_error\n";
+        for (const auto &r: results)
+        {
+            out << options.label << "," << r.kernel << "," << distributionName(r.distribution) << "," << r.particles
+                << "," << optional(r.theta) << "," << r.threads << "," << r.seconds << "," << r.nsPerParticle << ","
+                << r.interactionsPerSecond << "," << r.bandwidthGBs << "," << r.efficiency << "," << r.mesh << ","
+                << options.box << "," << optional(r.forceError) << "," << r.integrator << "," << optional(r.dt) << ","
+                << r.forcePasses << "," << optional(r.energyError) << "," << Precision::name << ","
+                << optional(r.layoutError) << "\n";
+        }
+    }
+    else
+    {
+        for (const auto &r: results)
+        {
+            out << "{\"label\":\"" << options.label << "\",\"kernel\":\"" << r.kernel << "\",\"distribution\":\""
+                << distributionName(r.distribution) << "\",\"particles\":" << r.particles << ",\"theta\":"
+                << (std::isnan(r.theta) ? "null" : optional(r.theta)) << ",\"threads\":" << r.threads
+                << ",\"seconds\":" << r.seconds << ",\"ns_per_particle\":" << r.nsPerParticle
+                << ",\"interactions_per_second\":" << r.interactionsPerSecond << ",\"bandwidth_gbs\":"
+                << r.bandwidthGBs << ",\"scaling_efficiency\":" << r.efficiency << ",\"mesh\":" << r.mesh
+                << ",\"box\":" << options.box << ",\"force_error\":"
+                << (std::isnan(r.forceError) ? "null" : optional(r.forceError)) << ",\"integrator\":\""
+                << r.integrator << "\",\"dt\":" << (std::isnan(r.dt) ? "null" : optional(r.dt))
+                << ",\"force_passes\":" << r.forcePasses << ",\"energy_error\":"
+                << (std::isnan(r.energyError) ? "null" : optional(r.energyError)) << ",\"precision\":\""
+                << Precision::name << "\",\"layout_error\":"
+                << (std::isnan(r.layoutError) ? "null" : optional(r.layoutError)) << "}\n";
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::sort(options.threads.begin(), options.threads.end());
+
+    std::vector<BenchResult> results;
+    for (auto &kernel: options.kernels)
+    {
+        for (Distribution distribution: options.distributions)
+        {
+            for (int particles: options.particles)
+            {
+                size_t first = results.size();
+                for (int threads: options.threads)
+                {
+                    std::cerr << kernel << " " << distributionName(distribution) << " N=" << particles
+                              << " threads=" << threads << std::endl;
+                    runPoint(options, kernel, distribution, particles, threads, results);
+                }
+
+                // Scaling efficiency of each row against the same kernel/theta/mesh/integrator/dt at the smallest
+                // thread count
+                for (size_t i = first; i < results.size(); ++i)
+                {
+                    for (size_t j = first; j < results.size(); ++j)
+                    {
+                        bool sameTheta = (std::isnan(results[i].theta) && std::isnan(results[j].theta)) ||
+                                         results[i].theta == results[j].theta;
+                        bool sameStep = (std::isnan(results[i].dt) && std::isnan(results[j].dt)) ||
+                                        results[i].dt == results[j].dt;
+                        if (sameTheta && sameStep && results[i].mesh == results[j].mesh &&
+                            results[i].integrator == results[j].integrator &&
+                            results[j].threads == options.threads.front())
+                        {
+                            results[i].efficiency = results[j].seconds * results[j].threads /
+                                                    (results[i].seconds * results[i].threads);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (options.output.empty())
+    {
+        writeResults(options, results, std::cout);
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            return EXIT_FAILURE;
+        }
+        writeResults(options, results, file);
+    }
+
+    return EXIT_SUCCESS;
+}
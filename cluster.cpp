@@ -0,0 +1,236 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <mpi.h>
+#include "domain.h"
+#include "initialconditions.h"
+#include "omp.h"
+
+// Distributed runner: one DomainDecomposition per MPI rank. Launch with a local MPI launcher, e.g.
+//   mpirun -np 4 ./nbody_mpi --particles 200000 --steps 20               (strong scaling)
+//   mpirun -np 4 ./nbody_mpi --particles-per-rank 50000 --steps 20       (weak scaling)
+// Rank 0 prints the timings as the maximum over ranks, or one CSV row per run with --format csv.
+
+struct ClusterOptions
+{
+    long long particles = 100000;
+    long long particlesPerRank = 0;
+    int steps = 20;
+    float dt = 0.01f;
+    float theta = 0.5f;
+    float softening = SOFTENING;
+    float imbalance = 0.1f;
+
+    Distribution distribution = Distribution::UNIFORM;
+    float radius = 1000.0f;
+    float totalMass = 10000.0f;
+    unsigned int seed = 1;
+
+    int threads = 0;
+    int diagnosticsEvery = 0;
+    std::string format = "text";
+};
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: mpirun -np R " << program << " [options]\n"
+              << "  --particles N           total bodies, fixed across rank counts (default 100000)\n"
+              << "  --particles-per-rank N  bodies per rank instead, for weak scaling\n"
+              << "  --steps N               fixed steps to run (default 20)\n"
+              << "  --dt DT                 step size (default 0.01)\n"
+              << "  --theta T               opening angle (default 0.5)\n"
+              << "  --softening E           softening length (default 0.5)\n"
+              << "  --imbalance F           rebalance when max/mean cost exceeds 1 + F (default 0.1)\n"
+              << "  --distribution NAME     initial conditions: uniform, plummer, clustered\n"
+              << "  --radius R              initial radius (default 1000)\n"
+              << "  --mass M                total mass (default 10000)\n"
+              << "  --seed S                random seed (default 1)\n"
+              << "  --threads N             OpenMP threads per rank (default: runtime)\n"
+              << "  --diagnostics-every K   print global energy and momentum drift every K steps\n"
+              << "  --format text|csv       summary format (default text)\n";
+}
+
+static bool parseOptions(int argc, char **argv, ClusterOptions &options, bool quiet)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc)
+            {
+                if (!quiet)
+                    std::cerr << "Missing value for " << arg << std::endl;
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--particles")
+            options.particles = std::atoll(value());
+        else if (arg == "--particles-per-rank")
+            options.particlesPerRank = std::atoll(value());
+        else if (arg == "--steps")
+            options.steps = std::atoi(value());
+        else if (arg == "--dt")
+            options.dt = std::strtof(value(), nullptr);
+        else if (arg == "--theta")
+            options.theta = std::strtof(value(), nullptr);
+        else if (arg == "--softening")
+            options.softening = std::strtof(value(), nullptr);
+        else if (arg == "--imbalance")
+            options.imbalance = std::strtof(value(), nullptr);
+        else if (arg == "--distribution")
+        {
+            if (!parseDistribution(value(), options.distribution))
+            {
+                if (!quiet)
+                    std::cerr << "Unknown distribution " << argv[i] << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--radius")
+            options.radius = std::strtof(value(), nullptr);
+        else if (arg == "--mass")
+            options.totalMass = std::strtof(value(), nullptr);
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned int>(std::strtoul(value(), nullptr, 10));
+        else if (arg == "--threads")
+            options.threads = std::atoi(value());
+        else if (arg == "--diagnostics-every")
+            options.diagnosticsEvery = std::atoi(value());
+        else if (arg == "--format")
+            options.format = value();
+        else
+        {
+            if (!quiet)
+                std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.format != "text" && options.format != "csv")
+    {
+        if (!quiet)
+            std::cerr << "Unknown format " << options.format << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The domain frees its MPI datatypes on destruction, so the run lives here and ends before MPI_Finalize
+static void run(const ClusterOptions &options, int rank, int ranks)
+{
+    long long particles = options.particlesPerRank > 0 ? options.particlesPerRank * ranks : options.particles;
+
+    DomainDecomposition domain(MPI_COMM_WORLD, options.imbalance);
+    domain.diagnosticsSetup(options.diagnosticsEvery);
+    {
+        // Every rank generates the same set and keeps its slice, so results do not depend on the rank count
+        Simulation initial(static_cast<int>(particles), 1);
+        generateParticles(initial.data(), options.distribution, options.radius, options.totalMass, options.seed);
+        domain.distribute(initial.data(), options.theta, options.softening);
+    }
+
+    if (rank == 0 && options.format == "text")
+    {
+        std::cout << "ranks " << ranks << ", threads " << omp_get_max_threads() << ", particles " << particles
+                  << ", steps " << options.steps << ", theta " << options.theta << ", distribution "
+                  << distributionName(options.distribution) << std::endl;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+
+    long long imports = 0;
+    double imbalance = 0.0;
+    for (int i = 0; i < options.steps; ++i)
+    {
+        domain.step(options.dt);
+        imports += domain.importCount();
+        imbalance += domain.imbalance();
+
+        const Diagnostics *diagnostics = domain.diagnostics();
+        if (diagnostics && rank == 0)
+            printDiagnostics(std::cout, *diagnostics);
+    }
+
+    double seconds = MPI_Wtime() - start;
+    MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    const DomainTimings &timings = domain.timings();
+    double phases[5] = {timings.migrate, timings.essentialTree, timings.build, timings.force, timings.integrate};
+    MPI_Allreduce(MPI_IN_PLACE, phases, 5, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &imports, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    long long count = domain.globalCount();
+    int steps = std::max(options.steps, 1);
+
+    if (rank == 0)
+    {
+        double particleSteps = static_cast<double>(particles) * options.steps / seconds;
+        if (options.format == "csv")
+        {
+            std::cout << "ranks,threads,particles,steps,theta,distribution,wall_seconds,steps_per_second,"
+                         "particle_steps_per_second,migrate_seconds,essential_tree_seconds,build_seconds,"
+                         "force_seconds,integrate_seconds,imports_per_rank_step,mean_imbalance,rebalances\n"
+                      << ranks << "," << omp_get_max_threads() << "," << particles << "," << options.steps << ","
+                      << options.theta << "," << distributionName(options.distribution) << "," << seconds << ","
+                      << options.steps / seconds << "," << particleSteps << "," << phases[0] << "," << phases[1]
+                      << "," << phases[2] << "," << phases[3] << "," << phases[4] << ","
+                      << static_cast<double>(imports) / ranks / steps << "," << imbalance / steps << ","
+                      << domain.rebalances() << std::endl;
+        }
+        else
+        {
+            std::cout << "wall " << seconds << " s, " << options.steps / seconds << " steps/s, " << particleSteps
+                      << " particle-steps/s\n"
+                      << "max over ranks: migrate " << phases[0] << " s, essential tree " << phases[1]
+                      << " s, build " << phases[2] << " s, force " << phases[3] << " s, integrate " << phases[4]
+                      << " s\n"
+                      << "imports per rank-step " << static_cast<double>(imports) / ranks / steps
+                      << ", mean imbalance " << imbalance / steps << ", rebalances " << domain.rebalances()
+                      << std::endl;
+        }
+
+        if (count != particles)
+            std::cerr << "Particle count changed from " << particles << " to " << count << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-h")
+        {
+            if (rank == 0)
+                printUsage(argv[0]);
+            MPI_Finalize();
+            return EXIT_SUCCESS;
+        }
+    }
+
+    ClusterOptions options;
+    if (!parseOptions(argc, argv, options, rank != 0))
+    {
+        if (rank == 0)
+            printUsage(argv[0]);
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+
+    if (options.threads > 0)
+        omp_set_num_threads(options.threads);
+
+    run(options, rank, ranks);
+
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+}
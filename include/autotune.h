@@ -0,0 +1,68 @@
+#ifndef NBODY3D_AUTOTUNE_H
+#define NBODY3D_AUTOTUNE_H
+
+#include <string>
+#include "simulation.h"
+
+// Opening angles tried, most accurate first; the force error grows with theta, so the scan of a solver stops
+// at the first one over budget
+constexpr float TUNE_THETAS[] = {0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 0.9f, 1.0f};
+constexpr int TUNE_CHUNKS[] = {1, 4, 16, 64};
+
+// Bodies compared against the direct sum for the force error
+constexpr int TUNE_SAMPLES = 1000;
+
+// Solver settings the tuner chooses between
+struct TuneConfig
+{
+    float theta = 0.5f;
+    bool compactNodes = false;
+    int treepmMesh = 0;  // 0 for the pure tree
+    int walkChunk = 1;
+    int threads = 1;
+};
+
+struct TuneOptions
+{
+    // 99th percentile relative force error against the direct sum on a sample of the bodies, as nbody_validate
+    // gates it
+    double errorBudget = 1.0e-3;
+
+    // Also try TreePM meshes while the simulation runs the pure tree; open boundaries and not Hermite only.
+    // A simulation already set up for TreePM keeps its mesh
+    bool searchTreePM = false;
+
+    // Timed force passes per candidate, fastest kept
+    int passes = 3;
+
+    // Choices keyed by machine and problem signature; empty neither reads nor writes a cache
+    std::string cachePath;
+};
+
+struct TuneResult
+{
+    TuneConfig config;
+    double seconds = 0.0;     // per force pass
+    double forceError = 0.0;
+    bool cached = false;
+    bool withinBudget = true;
+    int candidates = 0;       // configurations evaluated
+    std::string key;
+};
+
+// Calibrates on the current positions with single force passes, which leave the bodies where they are: scans
+// theta for every solver and layout, keeps the fastest within the budget, then times the walk chunk and the
+// thread count around it. The choice is applied to simulation and omp_set_num_threads, and cached. Call it
+// after the initial conditions and the other setup methods
+TuneResult autotune(Simulation &simulation, const TuneOptions &options);
+
+void applyTuneConfig(Simulation &simulation, const TuneConfig &config);
+
+// CPU model and processor count
+std::string machineSignature();
+
+// Body count to a factor of sqrt(2), the depth of the current tree as the clustering, boundaries, solver
+// choices, integrator, precision and budget
+std::string problemSignature(const Simulation &simulation, const TuneOptions &options);
+
+#endif //NBODY3D_AUTOTUNE_H
@@ -5,32 +5,76 @@
 #include "simulationdata.h"
 #include "integrator.h"
 
-bool isParticleInNode(float pX, float pY, float pZ, float nX, float nY, float nZ, float nW, float nH, float nD);
+bool isParticleInNode(Real pX, Real pY, Real pZ, NodeReal nX, NodeReal nY, NodeReal nZ, NodeReal nW, NodeReal nH,
+                      NodeReal nD);
 
 bool noChildren(const SimulationData &data, int nodeIndex);
 
 struct vec
 {
-    float x;
-    float y;
-    float z;
+    ForceReal x;
+    ForceReal y;
+    ForceReal z;
 };
 
 class Gravitational
 {
 public:
-    vec operator()(const float rootMass, const float distX, const float distY, const float distZ)
+    ForceReal softening = SOFTENING;
+
+    vec operator()(const ForceReal rootMass, const ForceReal distX, const ForceReal distY, const ForceReal distZ)
     {
-        float dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
+        ForceReal dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
 
-        float tmp = -((1.0f * rootMass) / std::pow((dist * dist) + (0.5f * 0.5f), 1.5f));
+        ForceReal tmp = -((1.0f * rootMass) / std::pow((dist * dist) + (softening * softening), 1.5f));
+        return {tmp * distX, tmp * distY, tmp * distZ};
+    }
+
+    // Same acceleration, also adding the softened potential -m / sqrt(r^2 + eps^2) to potential; it falls out
+    // of the force factor with one extra multiply
+    vec operator()(const ForceReal rootMass, const ForceReal distX, const ForceReal distY, const ForceReal distZ,
+                   ForceReal &potential)
+    {
+        ForceReal soft = distX * distX + distY * distY + distZ * distZ + softening * softening;
+
+        ForceReal tmp = -((1.0f * rootMass) / std::pow(soft, 1.5f));
+        potential += tmp * soft;
+        return {tmp * distX, tmp * distY, tmp * distZ};
+    }
+
+    // Same acceleration and potential, also adding its time derivative for the relative velocity
+    // (velX, velY, velZ) to jerk: -m (v / s^1.5 - 3 (r.v) r / s^2.5) with s = r^2 + eps^2
+    vec operator()(const ForceReal rootMass, const ForceReal distX, const ForceReal distY, const ForceReal distZ,
+                   const ForceReal velX, const ForceReal velY, const ForceReal velZ, vec &jerk, ForceReal &potential)
+    {
+        ForceReal soft = distX * distX + distY * distY + distZ * distZ + softening * softening;
+
+        ForceReal tmp = -((1.0f * rootMass) / std::pow(soft, 1.5f));
+        ForceReal radial = 3.0f * (distX * velX + distY * velY + distZ * velZ) / soft;
+        jerk.x += tmp * (velX - radial * distX);
+        jerk.y += tmp * (velY - radial * distY);
+        jerk.z += tmp * (velZ - radial * distZ);
+        potential += tmp * soft;
         return {tmp * distX, tmp * distY, tmp * distZ};
     }
 };
 
-void netAcceleration(int particleIdx, const SimulationData &data);
+// Computes the tree force on one particle into acc, its potential if data.potential is set and its jerk if
+// data.jerkX is set (open boundaries without TreePM only); returns the number of interactions evaluated
+int netAcceleration(int particleIdx, const SimulationData &data);
+
+// Tree potential at an arbitrary point, such as a field grid node: the monopole walk of netAcceleration on the
+// full Newtonian potential (no TreePM split), with each accepted node Ewald-corrected in a periodic box
+Real treePotential(Real px, Real py, Real pz, const SimulationData &data);
+
+// Exact softened sum over every other particle, over all periodic images in a periodic box; the O(N) per
+// particle reference for the tree walk. Fills the potential if data.potential is set; returns the number of
+// interactions evaluated
+int directAcceleration(int particleIdx, const SimulationData &data);
 
-void boundaryDetection(int particleIdx, float offset, const SimulationData &data);
+// Wraps every position into the periodic box; a no-op while data.boxSize is 0. The drift of Velocity_Verlet
+// wraps as it goes, so this is only needed after positions are set from outside
+void wrapPositions(const SimulationData &data);
 
 void updateAllParticles(float damping, float dt, const SimulationData &data);
 
@@ -1,7 +1,6 @@
 #ifndef NBODY3D_CAMERA_H
 #define NBODY3D_CAMERA_H
 
-#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -27,6 +26,8 @@ constexpr float ROLL = 0.0f;
 constexpr float SPEED = 2.5f;
 constexpr float SENSITIVITY = 0.1f;
 constexpr float ZOOM = 45.0f;
+constexpr float NEAR_PLANE = 0.1f;
+constexpr float FAR_PLANE = 60000.0f;
 
 class Camera
 {
@@ -60,6 +61,12 @@ public:
         return glm::lookAt(position, position + front, up);
     }
 
+    // Same matrix perspectiveMatrix() in splat.h builds for tools without glm
+    glm::mat4 getProjectionMatrix(float aspect) const
+    {
+        return glm::perspective(glm::radians(zoom), aspect, NEAR_PLANE, FAR_PLANE);
+    }
+
     void processKeyboard(CameraMovement direction, float deltaTime)
     {
         float velocity = movementSpeed * deltaTime;
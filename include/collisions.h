@@ -0,0 +1,55 @@
+#ifndef NBODY3D_COLLISIONS_H
+#define NBODY3D_COLLISIONS_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "simulationdata.h"
+#include "spatialquery.h"
+
+struct CollisionStats
+{
+    int candidates = 0;     // overlapping pairs found by the last pass
+    int merged = 0;         // bodies absorbed by the last pass
+    uint64_t totalMerged = 0;
+};
+
+// Merges overlapping bodies. Bodies have constant density, so a body of mass m has radius
+// radius * cbrt(m). The broad phase is a SpatialQuery walk over the octree just built from the current
+// positions, reaching as far as the body's radius plus the largest one. Overlapping groups (chains included)
+// become one body at their centre of mass with their summed mass and momentum, and absorbed bodies are
+// compacted out of the particle streams so later steps no longer carry them.
+class CollisionStage
+{
+public:
+    explicit CollisionStage(float radius);
+
+    // tree must have just been built from data; returns the number of bodies removed, data.particleCount is
+    // reduced to match and the tree is stale
+    int apply(SimulationData &data, const Octree &tree);
+
+    const CollisionStats &stats() const { return lastStats; }
+
+    float radius() const { return unitRadius; }
+
+private:
+    void findPairs(const SimulationData &data, const Octree &tree);
+
+    int mergeGroups(SimulationData &data);
+
+    int compact(SimulationData &data);
+
+    float unitRadius;
+
+    SpatialQuery query;
+    std::vector<std::vector<std::pair<int, int>>> threadPairs;
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> parent;
+    std::vector<uint8_t> removed;
+    std::vector<int> destination;
+    std::vector<Real> scratch;
+
+    CollisionStats lastStats;
+};
+
+#endif //NBODY3D_COLLISIONS_H
@@ -0,0 +1,63 @@
+#ifndef NBODY3D_COMPACTNODE_H
+#define NBODY3D_COMPACTNODE_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include "octree.h"
+
+// Depth of the unit cells below the root cell [-32768, 32768)^3
+constexpr int COMPACT_UNIT_DEPTH = 16;
+constexpr float COMPACT_ROOT_CORNER = -32768.0f;
+
+// Set in the code of nodes without children, above the 61 bits a code of OCTREE_MAX_DEPTH needs
+constexpr uint64_t COMPACT_LEAF = uint64_t(1) << 63;
+
+// Quantisation steps of the centre of mass across a cell
+constexpr float COMPACT_OFFSET_SCALE = 65535.0f;
+
+// 16-byte node record for the force walk. The cell is not stored: its depth and position follow from the
+// level-marked Morton code (a 1 bit above 3 * depth interleaved bits). The centre of mass is an offset from
+// the cell's low corner, the mass a bfloat16, so it keeps the float range at 8 significant bits
+struct CompactNode
+{
+    uint64_t code;
+    uint16_t com[3];
+    uint16_t mass;
+};
+
+static_assert(sizeof(CompactNode) == 16);
+
+// Round to nearest even on the upper half of the float bits
+inline uint16_t toBFloat16(float value)
+{
+    auto bits = std::bit_cast<uint32_t>(value);
+    bits += 0x7fffu + ((bits >> 16) & 1u);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float fromBFloat16(uint16_t value)
+{
+    return std::bit_cast<float>(static_cast<uint32_t>(value) << 16);
+}
+
+inline uint16_t quantiseOffset(NodeReal offset)
+{
+    return static_cast<uint16_t>(std::lround(std::clamp(offset, NodeReal(0.0), NodeReal(1.0)) *
+                                             COMPACT_OFFSET_SCALE));
+}
+
+// Low corner and width of the cell of a level-marked code, leaf flag ignored
+inline void compactCell(uint64_t code, NodeReal &x, NodeReal &y, NodeReal &z, NodeReal &width)
+{
+    code &= ~COMPACT_LEAF;
+    int depth = (std::bit_width(code) - 1) / 3;
+    uint64_t cell = code ^ (uint64_t(1) << (3 * depth));
+    width = std::ldexp(NodeReal(1.0), COMPACT_UNIT_DEPTH - depth);
+    x = COMPACT_ROOT_CORNER + static_cast<NodeReal>(Octree::compactBits(cell)) * width;
+    y = COMPACT_ROOT_CORNER + static_cast<NodeReal>(Octree::compactBits(cell >> 1)) * width;
+    z = COMPACT_ROOT_CORNER + static_cast<NodeReal>(Octree::compactBits(cell >> 2)) * width;
+}
+
+#endif //NBODY3D_COMPACTNODE_H
@@ -0,0 +1,36 @@
+#ifndef NBODY3D_DIAGNOSTICS_H
+#define NBODY3D_DIAGNOSTICS_H
+
+#include <cstdint>
+#include <ostream>
+#include "simulationdata.h"
+
+// Conserved quantities of one step. Potential energy comes from the per-particle potential the tree walk
+// fills while data.potential is set, so it carries the same opening-angle error as the forces.
+struct Diagnostics
+{
+    uint64_t step = 0;
+    double time = 0.0;
+
+    double kinetic = 0.0;
+    double potential = 0.0;
+    double total = 0.0;
+
+    double momentum[3] = {};
+    double angularMomentum[3] = {};
+
+    // Against the first record of the run: energy relative, momentum and angular momentum absolute
+    double energyDrift = 0.0;
+    double momentumDrift = 0.0;
+    double angularMomentumDrift = 0.0;
+};
+
+// Reductions over the SoA streams; data.potential must hold the potentials of the current positions
+Diagnostics computeDiagnostics(const SimulationData &data);
+
+// Fills the drift fields of current against the reference record
+void diagnosticsDrift(const Diagnostics &reference, Diagnostics &current);
+
+void printDiagnostics(std::ostream &out, const Diagnostics &diagnostics);
+
+#endif //NBODY3D_DIAGNOSTICS_H
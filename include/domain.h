@@ -0,0 +1,122 @@
+#ifndef NBODY3D_DOMAIN_H
+#define NBODY3D_DOMAIN_H
+
+#include <cstdint>
+#include <vector>
+#include <mpi.h>
+#include "simulation.h"
+#include "diagnostics.h"
+
+// Seconds spent in each part of the distributed step on this rank, accumulated over the run
+struct DomainTimings
+{
+    double migrate = 0.0;       // splitters and particle exchange
+    double essentialTree = 0.0; // locally essential tree selection and exchange
+    double build = 0.0;         // local and local-plus-imported tree builds
+    double force = 0.0;
+    double integrate = 0.0;
+};
+
+// One MPI rank's share of a distributed run. Ranks own contiguous ranges of the global Morton order, split
+// so that each holds an equal share of the interaction count of the previous force walk. Remote ranks send
+// the cells of their tree that every one of our particles would accept (their locally essential tree); those
+// are appended after the local particles as pseudo-particles and inserted into the same Octree.
+class DomainDecomposition
+{
+public:
+    explicit DomainDecomposition(MPI_Comm comm, float imbalanceTolerance = 0.1f);
+
+    ~DomainDecomposition();
+
+    DomainDecomposition(const DomainDecomposition &) = delete;
+    DomainDecomposition &operator=(const DomainDecomposition &) = delete;
+
+    // Keeps this rank's slice of a set every rank generated identically, then balances by particle count
+    void distribute(const SimulationData &global, float theta, float softening);
+
+    // Kick-drift-kick step with one distributed force evaluation; particles migrate to their owner after
+    // the drift and the splitters are recomputed when the cost imbalance exceeds the tolerance
+    void step(float dt);
+
+    // As Simulation::diagnosticsSetup; the reductions are summed over all ranks
+    void diagnosticsSetup(int cadence) { diagnosticsCadence = cadence; }
+
+    const Diagnostics *diagnostics() const { return diagnosticsDue ? &lastDiagnostics : nullptr; }
+
+    int localCount() const { return local; }
+
+    int importCount() const { return imported; }
+
+    long long globalCount() const;
+
+    // Maximum over mean of the per-rank interaction counts of the last force walk
+    double imbalance() const { return lastImbalance; }
+
+    int rebalances() const { return rebalanceCount; }
+
+    const DomainTimings &timings() const { return phaseTimings; }
+
+    uint64_t steps() const { return stepCount; }
+
+private:
+    // Both travel as runs of the particle precision
+    struct Body
+    {
+        Real x, y, z;
+        Real vx, vy, vz;
+        Real mass;
+        Real cost;
+    };
+
+    struct Pseudo
+    {
+        Real x, y, z;
+        Real mass;
+    };
+
+    void setCount(int count);
+
+    void computeSplitters();
+
+    void migrate();
+
+    void selectEssential(const Real box[6], std::vector<Pseudo> &out);
+
+    void exchangeEssentialTree();
+
+    void computeForces(bool withPotential);
+
+    void reduceDiagnostics();
+
+    MPI_Comm comm;
+    MPI_Datatype bodyType;
+    MPI_Datatype pseudoType;
+    int rank = 0;
+    int ranks = 1;
+    float tolerance;
+
+    Simulation simulation{0};
+    Octree octree;
+    int capacity = 0;
+    int local = 0;
+    int imported = 0;
+
+    std::vector<float> cost;
+    std::vector<Real> potential;
+    std::vector<uint64_t> splitters;
+
+    bool forcesReady = false;
+    double lastImbalance = 1.0;
+    int rebalanceCount = 0;
+    uint64_t stepCount = 0;
+    double simulationTime = 0.0;
+
+    int diagnosticsCadence = 0;
+    bool diagnosticsDue = false;
+    Diagnostics firstDiagnostics;
+    Diagnostics lastDiagnostics;
+
+    DomainTimings phaseTimings;
+};
+
+#endif //NBODY3D_DOMAIN_H
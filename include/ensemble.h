@@ -0,0 +1,112 @@
+#ifndef NBODY3D_ENSEMBLE_H
+#define NBODY3D_ENSEMBLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "simulationdata.h"
+#include "initialconditions.h"
+#include "integrator.h"
+#include "diagnostics.h"
+
+// Systems of at most this many bodies use the direct sum instead of building a tree every force pass; the
+// leapfrog crossover of a Plummer sphere at theta 0.5 on one core
+constexpr int ENSEMBLE_DIRECT_LIMIT = 320;
+
+// One member of a sweep, generated at the start of the run
+struct EnsembleSystem
+{
+    int particleCount = 100;
+    Distribution distribution = Distribution::PLUMMER;
+    float radius = 1000.0f;
+    float totalMass = 10000.0f;
+    unsigned int seed = 1;
+};
+
+struct EnsembleOptions
+{
+    int steps = 100;
+    float dt = 0.01f;
+    float theta = 0.5f;
+    float softening = SOFTENING;
+    Integrator integrator = Integrator::LEAPFROG;
+    int directLimit = ENSEMBLE_DIRECT_LIMIT;
+    int threads = 0;
+};
+
+struct EnsembleResult
+{
+    bool direct = false;
+    int thread = 0;
+    uint64_t forcePasses = 0;
+    double seconds = 0.0;
+
+    // After the first and the last step; last carries the drifts against first
+    Diagnostics first;
+    Diagnostics last;
+};
+
+// Many small independent systems in one process. Splitting the loops of a system of a few hundred bodies across
+// threads costs more than it saves, so each system runs whole on one thread and the threads share the sweep:
+// every worker starts on a contiguous run of systems of about equal cost and, once it is drained, steals half of
+// what is left of another worker's run. The particle streams of all systems live back to back in one arena; the
+// tree nodes are per-worker scratch, reused by every system the worker runs. Open boundaries, leapfrog or
+// Yoshida; profile builds run on one thread, since the phase timers assume one system at a time.
+class Ensemble
+{
+public:
+    explicit Ensemble(std::vector<EnsembleSystem> systems);
+
+    Ensemble(const Ensemble &) = delete;
+    Ensemble &operator=(const Ensemble &) = delete;
+
+    // Generates every system and advances it options.steps steps; results are in system order
+    void run(const EnsembleOptions &options);
+
+    int size() const { return static_cast<int>(systems.size()); }
+
+    const EnsembleSystem &system(int index) const { return systems[index]; }
+
+    // Particle streams of one system; the node streams are bound only while it runs
+    const SimulationData &data(int index) const { return systemData[index]; }
+
+    const std::vector<EnsembleResult> &results() const { return systemResults; }
+
+    // Runs taken from another worker in the last run
+    uint64_t steals() const { return stealCount; }
+
+    // Bodies times steps over every system of the last run
+    double particleSteps() const;
+
+    // One row or JSON line per system in system order, the consolidated output of a sweep
+    void writeResults(std::ostream &out, bool json) const;
+
+private:
+    struct alignas(64) WorkQueue
+    {
+        // Next and end system of the worker's run, packed so the owner and thieves claim with one CAS
+        std::atomic<uint64_t> range{0};
+    };
+
+    struct Worker;
+
+    // Next system of the worker's own run, or the first of the back half stolen from another worker's run;
+    // false once every run is drained
+    bool claim(int self, int &index);
+
+    void runSystem(int index, const EnsembleOptions &options, Worker &worker);
+
+    std::vector<EnsembleSystem> systems;
+    std::vector<SimulationData> systemData;
+    std::vector<Real *> potentials;
+    std::vector<Real> arena;
+    std::vector<unsigned int> indexArena;
+
+    std::vector<EnsembleResult> systemResults;
+    std::vector<WorkQueue> queues;
+    std::atomic<uint64_t> stealCount{0};
+    EnsembleOptions lastOptions;
+};
+
+#endif //NBODY3D_ENSEMBLE_H
@@ -0,0 +1,77 @@
+#ifndef NBODY3D_EWALD_H
+#define NBODY3D_EWALD_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Cells per side of the default table over half a box
+constexpr int EWALD_TABLE_SIZE = 64;
+
+// Difference between the periodic and the plain Newtonian field of a unit mass in a unit box, tabulated over
+// the octant [0, 1/2]^3 of minimum-image separations and trilinearly interpolated; the other octants follow
+// by symmetry (the force components are odd in their own axis, the potential is even). Tables are scale
+// free, so one file serves every box size and is computed once from Ewald sums and cached.
+class EwaldTable
+{
+public:
+    explicit EwaldTable(int size = EWALD_TABLE_SIZE);
+
+    // Reads a cached table, or computes one and writes it to path; an empty path skips the cache
+    void loadOrCompute(const std::string &path);
+
+    // Correction to the acceleration and potential from unit mass at minimum-image separation (dx, dy, dz)
+    // in a box of side 1 / invBox
+    void correction(float dx, float dy, float dz, float invBox, float &ax, float &ay, float &az,
+                    float &potential) const
+    {
+        float u[3] = {std::fabs(dx) * invBox, std::fabs(dy) * invBox, std::fabs(dz) * invBox};
+        int cell[3];
+        float weight[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float s = std::min(u[axis] * scale, static_cast<float>(size) - 1.0e-3f);
+            cell[axis] = static_cast<int>(s);
+            weight[axis] = s - static_cast<float>(cell[axis]);
+        }
+
+        float sum[4] = {};
+        for (int c = 0; c < 8; ++c)
+        {
+            float w = (c & 1 ? weight[0] : 1.0f - weight[0]) * (c & 2 ? weight[1] : 1.0f - weight[1]) *
+                      (c & 4 ? weight[2] : 1.0f - weight[2]);
+            const float *entry = &table[4 * index(cell[0] + (c & 1), cell[1] + (c & 2 ? 1 : 0),
+                                                  cell[2] + (c & 4 ? 1 : 0))];
+            for (int k = 0; k < 4; ++k)
+                sum[k] += w * entry[k];
+        }
+
+        // Unit-box values scale as 1 / box^2 for the field and 1 / box for the potential
+        float fieldScale = invBox * invBox;
+        ax = (dx < 0.0f ? -sum[0] : sum[0]) * fieldScale;
+        ay = (dy < 0.0f ? -sum[1] : sum[1]) * fieldScale;
+        az = (dz < 0.0f ? -sum[2] : sum[2]) * fieldScale;
+        potential = sum[3] * invBox;
+    }
+
+    int tableSize() const { return size; }
+
+private:
+    size_t index(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z) * (size + 1) + y) * (size + 1) + x;
+    }
+
+    void compute();
+
+    bool load(const std::string &path);
+
+    void save(const std::string &path) const;
+
+    int size;
+    float scale;               // table cells per unit separation
+    std::vector<float> table;  // ax, ay, az, potential per node of the (size + 1)^3 lattice
+};
+
+#endif //NBODY3D_EWALD_H
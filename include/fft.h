@@ -0,0 +1,38 @@
+#ifndef NBODY3D_FFT_H
+#define NBODY3D_FFT_H
+
+#include <complex>
+#include <vector>
+
+// In-place complex FFT of an n^3 cube stored x fastest, n a power of two. Each axis is a batch of
+// independent 1D radix-2 transforms split across the OpenMP threads; lines along y and z are gathered into a
+// per-thread buffer so the butterflies always run on contiguous memory. Neither direction is normalised.
+// For zero-padded convolutions the forward pass starts on the occupied corner and the inverse pass ends on
+// it, so lines that are known to be zero, or are never read, are not transformed.
+class FFT3D
+{
+public:
+    explicit FFT3D(int n);
+
+    int size() const { return n; }
+
+    // Lines that are all zero are skipped when only the [0, occupied)^3 corner of the input is non-zero
+    void forward(std::complex<float> *grid, int occupied = 0) { transform(grid, false, occupied > 0 ? occupied : n); }
+
+    // Only the [0, needed)^3 corner of the output is computed exactly; lines leading elsewhere are skipped
+    void inverse(std::complex<float> *grid, int needed = 0) { transform(grid, true, needed > 0 ? needed : n); }
+
+private:
+    void transform(std::complex<float> *grid, bool inverse, int limit);
+
+    // One axis over the lines whose other two coordinates are below the given limits
+    void axis(std::complex<float> *grid, int axis, int limitA, int limitB, bool inverse);
+
+    void line(std::complex<float> *data, bool inverse) const;
+
+    int n;
+    std::vector<int> bitReverse;
+    std::vector<std::complex<float>> twiddles;  // exp(-2 pi i k / n) for k < n / 2
+};
+
+#endif //NBODY3D_FFT_H
@@ -0,0 +1,103 @@
+#ifndef NBODY3D_FIELDGRID_H
+#define NBODY3D_FIELDGRID_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "simulationdata.h"
+
+// Mass assignment: nearest grid point, cloud-in-cell and triangular-shaped cloud, reaching 1, 2 and 3 cells
+// along each axis
+enum class DepositKernel { NGP, CIC, TSC };
+
+bool parseDepositKernel(const std::string &name, DepositKernel &kernel);
+
+const char *depositKernelName(DepositKernel kernel);
+
+// Field file layout: the header, then the density as a float array with x fastest, then the potential in the
+// same layout when hasPotential is set. Sizes depend only on the grid, not on the body count
+constexpr char FIELD_MAGIC[8] = {'N', 'B', 'F', 'I', 'E', 'L', '0', '1'};
+constexpr uint32_t FIELD_VERSION = 1;
+
+struct FieldHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kernel;         // DepositKernel
+    uint32_t size[3];        // cells along x, y and z; 1 along a projected axis
+    int32_t projectAxis;     // -1 for a 3D grid
+    uint32_t hasPotential;
+    uint32_t reserved;
+    uint64_t step;
+    double time;
+    double origin[3];        // low corner of the grid
+    double cellSize;
+};
+
+// Cells per slab of the deposit; a body writes at most one cell beyond its own on either side, so slabs two
+// cells thick of the same colour never write the same cell
+constexpr int FIELD_SLAB_CELLS = 2;
+
+// Gridded density and potential for monitoring. Mass is deposited onto a cube of size^3 cells, or projected
+// along one axis onto size^2 cells, in parallel without atomics: bodies are bucketed, in the tree's Morton
+// order, into slabs along the slowest axis of the grid, and every other slab is deposited at once. The
+// potential is the tree potential at the cell centres, in the plane through the cube's centre for a
+// projection.
+class FieldGrid
+{
+public:
+    // A cube of side extent centred on the origin; projectAxis 0, 1 or 2 projects along x, y or z, -1 keeps
+    // the 3D grid. With periodic the kernels wrap around the cube, which should then be the periodic box;
+    // otherwise the parts of them outside it are dropped. size must be at least 2 * FIELD_SLAB_CELLS
+    FieldGrid(int size, float extent, DepositKernel kernel, int projectAxis = -1, bool periodic = false);
+
+    // Mass per unit volume, or per unit area for a projection. The tree must have been built from the current
+    // positions, for its Morton order
+    void deposit(const SimulationData &data);
+
+    // Tree potential at every cell, from the tree deposit() read; kept until the next deposit
+    void evaluatePotential(const SimulationData &data);
+
+    const std::vector<float> &density() const { return densityGrid; }
+
+    // Empty unless evaluatePotential ran since the last deposit
+    const std::vector<float> &potential() const { return potentialGrid; }
+
+    size_t cells() const { return static_cast<size_t>(dims[0]) * dims[1] * dims[2]; }
+
+    float cellSize() const { return spacing; }
+
+    bool write(const std::string &path, uint64_t step, double time) const;
+
+private:
+    template<DepositKernel Kernel>
+    void depositSlabs(const SimulationData &data);
+
+    // Grid coordinate of a position along an axis, in cells from the low edge
+    float gridCoordinate(Real position) const
+    {
+        return static_cast<float>((position - origin) / spacing);
+    }
+
+    int size;
+    int dims[3];
+    int slabAxis;
+    int slabCount;
+    int slabCells;
+    int projectAxis;
+    bool periodic;
+    DepositKernel kernel;
+    float spacing;
+    float origin;
+
+    std::vector<float> densityGrid;
+    std::vector<float> potentialGrid;
+
+    // Bodies bucketed by slab, each slab in Morton order; per-thread counts make the bucketing parallel
+    std::vector<int> slabStart;
+    std::vector<int> slabBodies;
+    std::vector<int> bodySlab;
+    std::vector<int> threadCounts;
+};
+
+#endif //NBODY3D_FIELDGRID_H
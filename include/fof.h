@@ -0,0 +1,74 @@
+#ifndef NBODY3D_FOF_H
+#define NBODY3D_FOF_H
+
+#include <ostream>
+#include <vector>
+#include "simulationdata.h"
+#include "octree.h"
+#include "spatialquery.h"
+
+// Groups smaller than this are not catalogued
+constexpr int FOF_MIN_MEMBERS = 20;
+
+// Linking length in mean interparticle separations, the conventional choice for haloes
+constexpr float FOF_LINKING_FACTOR = 0.2f;
+
+struct FofGroup
+{
+    int members = 0;
+    double mass = 0.0;
+    double com[3] = {};
+    double velocity[3] = {};  // mass-weighted mean
+};
+
+// Groups by decreasing member count, ties by lowest member index, so the order does not depend on the thread
+// count. Members of group g are memberIndices[memberOffsets[g] .. memberOffsets[g + 1]), stream indices in
+// ascending order, filled only when requested
+struct FofCatalogue
+{
+    std::vector<FofGroup> groups;
+    std::vector<size_t> memberOffsets;
+    std::vector<int> memberIndices;
+
+    int grouped = 0;  // bodies in catalogued groups
+};
+
+// In-situ friends-of-friends: bodies closer than the linking length are friends, and groups are the connected
+// components. Every body walks the octree through SpatialQuery for its friends, in Morton order in parallel,
+// and joins them in a lock-free union-find (CAS linking of the larger root under the smaller, path halving),
+// so each group's root ends up its lowest index. Separations are not wrapped across a periodic box.
+class FriendsOfFriends
+{
+public:
+    explicit FriendsOfFriends(float linkingLength, int minMembers = FOF_MIN_MEMBERS);
+
+    // tree must have been built from data's current positions
+    void find(const SimulationData &data, const Octree &tree, bool withMembers, FofCatalogue &out);
+
+    float linkingLength() const { return link; }
+
+private:
+    int root(int i);
+
+    void unite(int a, int b);
+
+    float link;
+    int minMembers;
+
+    SpatialQuery query;
+    std::vector<int> parent;
+    std::vector<std::vector<int>> stacks;
+    std::vector<int> groupOf;
+};
+
+// factor times the mean interparticle separation: of the periodic box while there is one, else of the bodies'
+// bounding box
+float fofLinkingLength(const SimulationData &data, float factor = FOF_LINKING_FACTOR);
+
+// One CSV row per group: group, members, mass, centre of mass, velocity
+void writeFofCatalogue(std::ostream &out, const FofCatalogue &catalogue);
+
+// One line per group of its space-separated member indices
+void writeFofMembers(std::ostream &out, const FofCatalogue &catalogue);
+
+#endif //NBODY3D_FOF_H
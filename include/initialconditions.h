@@ -0,0 +1,18 @@
+#ifndef NBODY3D_INITIALCONDITIONS_H
+#define NBODY3D_INITIALCONDITIONS_H
+
+#include <string>
+#include "simulationdata.h"
+
+// CUBE fills [-radius, radius)^3 uniformly, the periodic box of side 2 * radius
+enum class Distribution { UNIFORM, PLUMMER, CLUSTERED, CUBE };
+
+bool parseDistribution(const std::string &name, Distribution &distribution);
+
+const char *distributionName(Distribution distribution);
+
+// Fills every particle of data with equal-mass bodies of the given distribution, deterministic in seed
+void generateParticles(const SimulationData &data, Distribution distribution, float radius, float totalMass,
+                       unsigned int seed);
+
+#endif //NBODY3D_INITIALCONDITIONS_H
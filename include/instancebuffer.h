@@ -0,0 +1,48 @@
+#ifndef NBODY3D_INSTANCEBUFFER_H
+#define NBODY3D_INSTANCEBUFFER_H
+
+#include <cstddef>
+#include <vector>
+#include <glad/glad.h>
+#include "sphereinstance.h"
+
+// Ring of instance regions in one GL buffer, refilled every frame. Each region is fenced after the draw that
+// reads it, so the CPU only waits when it laps the GPU. With GL 4.4 or ARB_buffer_storage the buffer stays
+// persistently mapped; otherwise each region is mapped unsynchronized for the frame it is written in.
+class InstanceBuffer
+{
+public:
+    explicit InstanceBuffer(int capacity, int regionCount = 3);
+
+    ~InstanceBuffer();
+
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+    // Waits until the GPU has released the next region and returns it for up to capacity() instances
+    SphereInstance *map();
+
+    // Ends writing; returns the byte offset of the region to source the instance attributes from
+    size_t unmap();
+
+    // Call after the draw reading the region returned by the last unmap()
+    void fence();
+
+    unsigned int buffer() const { return VBO; }
+
+    int capacity() const { return instanceCapacity; }
+
+    bool persistent() const { return persistentMapping != nullptr; }
+
+private:
+    unsigned int VBO = 0;
+    int instanceCapacity;
+    int regions;
+    int current = 0;
+    size_t regionBytes;
+
+    SphereInstance *persistentMapping = nullptr;
+    std::vector<GLsync> fences;
+};
+
+#endif //NBODY3D_INSTANCEBUFFER_H
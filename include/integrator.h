@@ -1,39 +1,256 @@
 #ifndef NBODY3D_INTEGRATOR_H
 #define NBODY3D_INTEGRATOR_H
 
+#include <cmath>
+#include <string>
+#include <vector>
+#include "simulationdata.h"
+#include "profiler.h"
+#include "omp.h"
+
+// LEAPFROG is Velocity_Verlet, two force passes a step at second order. YOSHIDA is the fourth-order
+// Forest-Ruth composition of three leapfrog steps, three passes a step. HERMITE is the fourth-order
+// predictor-corrector, one pass a step that also computes the jerk; open boundaries and the pure tree only
+enum class Integrator { LEAPFROG, YOSHIDA, HERMITE };
+
+bool parseIntegrator(const std::string &name, Integrator &integrator);
+
+const char *integratorName(Integrator integrator);
+
+// What the fourth-order integrators carry between steps. The accelerations (and jerks) of the last pass are
+// reused by the next step while primed; anything that moves bodies outside a step must clear it. Hermite
+// keeps the start-of-step positions and velocities here while the streams hold the prediction
+struct IntegratorState
+{
+    bool primed = false;
+    std::vector<Real> x, y, z, velX, velY, velZ;
+};
+
+// Force functors with a prepare(data) member get it called before every force pass, for state that depends on
+// all the current positions (the TreePM mesh)
 template<typename Acc>
-void Velocity_Verlet(Acc acc, const float damping, const float dt, const SimulationData &data)
+void prepareForces(Acc &acc, const SimulationData &data)
 {
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+    if constexpr (requires { acc.prepare(data); })
+        acc.prepare(data);
+}
+
+// One force evaluation over every body in tree order. after(i) runs on a body as soon as its own walk is done;
+// walks read only their own body's stream entries besides the tree, so it may update them in place
+template<typename Acc, typename After>
+void forcePass(Acc &acc, const SimulationData &data, After after)
+{
+    prepareForces(acc, data);
+
+    PROFILE_PARALLEL_PHASE(Phase::FORCE_WALK);
+#pragma omp parallel
     {
-        unsigned int particleIndex = data.idxSorted[i];
-        acc(particleIndex, data);
+        PROFILE_THREAD_BEGIN();
+#pragma omp for schedule(dynamic, data.walkChunk) nowait
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            unsigned int particleIndex = data.idxSorted[i];
+            after(particleIndex, [&]() { acc(particleIndex, data); });
+        }
+        PROFILE_THREAD_END();
     }
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+}
+
+template<typename Acc>
+void forcePass(Acc &acc, const SimulationData &data)
+{
+    forcePass(acc, data, [](unsigned int, auto evaluate) { evaluate(); });
+}
+
+// Nearest copy of a coordinate inside the periodic box; unchanged while the box is open
+inline Real wrapCoordinate(Real x, Real box, Real invBox)
+{
+    return box > 0.0f ? x - box * std::floor(x * invBox + Real(0.5)) : x;
+}
+
+// Kick by kick * dt with the current accelerations, then drift by drift * dt, in storage order
+inline void kickDrift(float kick, float drift, const float damping, const float dt, const SimulationData &data)
+{
+    PROFILE_PARALLEL_PHASE(Phase::INTEGRATE);
+    Real box = data.boxSize;
+    Real invBox = box > 0.0f ? 1.0 / box : 0.0;
+    float kickStep = kick * dt * damping;
+    float driftStep = drift * dt;
+#pragma omp parallel
     {
-        unsigned int particleIndex = data.idxSorted[i];
+        PROFILE_THREAD_BEGIN();
+#pragma omp for simd schedule(static) nowait
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            Real vx = data.particleVelX[i] + data.accX[i] * kickStep;
+            Real vy = data.particleVelY[i] + data.accY[i] * kickStep;
+            Real vz = data.particleVelZ[i] + data.accZ[i] * kickStep;
+            data.particleVelX[i] = vx;
+            data.particleVelY[i] = vy;
+            data.particleVelZ[i] = vz;
+            data.particleX[i] = wrapCoordinate(data.particleX[i] + vx * driftStep, box, invBox);
+            data.particleY[i] = wrapCoordinate(data.particleY[i] + vy * driftStep, box, invBox);
+            data.particleZ[i] = wrapCoordinate(data.particleZ[i] + vz * driftStep, box, invBox);
+        }
+        PROFILE_THREAD_END();
+    }
+}
 
-        data.particleX[particleIndex] += data.particleVelX[particleIndex] * dt + 0.5f * data.accX[particleIndex] * dt * dt;
-        data.particleY[particleIndex] += data.particleVelY[particleIndex] * dt + 0.5f * data.accY[particleIndex] * dt * dt;
-        data.particleZ[particleIndex] += data.particleVelZ[particleIndex] * dt + 0.5f * data.accZ[particleIndex] * dt * dt;
+// Returns the number of force passes taken
+template<typename Acc>
+int Velocity_Verlet(Acc acc, const float damping, const float dt, const SimulationData &data)
+{
+    forcePass(acc, data);
+    {
+        // The drift is elementwise, so it streams the arrays in storage order and wraps into the periodic box in
+        // the same pass
+        PROFILE_PARALLEL_PHASE(Phase::INTEGRATE);
+        Real box = data.boxSize;
+        Real invBox = box > 0.0f ? 1.0 / box : 0.0;
+#pragma omp parallel
+        {
+            PROFILE_THREAD_BEGIN();
+#pragma omp for simd schedule(static) nowait
+            for (int i = 0; i < data.particleCount; ++i)
+            {
+                Real x = data.particleX[i] + data.particleVelX[i] * dt + 0.5f * data.accX[i] * dt * dt;
+                Real y = data.particleY[i] + data.particleVelY[i] * dt + 0.5f * data.accY[i] * dt * dt;
+                Real z = data.particleZ[i] + data.particleVelZ[i] * dt + 0.5f * data.accZ[i] * dt * dt;
+                data.particleX[i] = wrapCoordinate(x, box, invBox);
+                data.particleY[i] = wrapCoordinate(y, box, invBox);
+                data.particleZ[i] = wrapCoordinate(z, box, invBox);
+            }
+            PROFILE_THREAD_END();
+        }
     }
 
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+    // The closing kick is fused with the second force evaluation, so it is booked as force walk
+    forcePass(acc, data, [&](unsigned int i, auto evaluate) {
+        Real acc_oldX = data.accX[i];
+        Real acc_oldY = data.accY[i];
+        Real acc_oldZ = data.accZ[i];
+
+        evaluate();
+
+        data.particleVelX[i] += 0.5f * (acc_oldX + data.accX[i]) * dt * damping;
+        data.particleVelY[i] += 0.5f * (acc_oldY + data.accY[i]) * dt * damping;
+        data.particleVelZ[i] += 0.5f * (acc_oldZ + data.accZ[i]) * dt * damping;
+    });
+    return 2;
+}
+
+// Kick-drift-kick leapfrog steps of w1 dt, w0 dt and w1 dt with w1 = 1 / (2 - 2^(1/3)) and w0 = 1 - 2 w1.
+// Adjacent half kicks merge, so each step takes three force passes, the last at the end-of-step positions,
+// and starts from the accelerations the previous step ended with. Returns the number of force passes taken
+template<typename Acc>
+int Yoshida4(Acc acc, const float damping, const float dt, const SimulationData &data, IntegratorState &state)
+{
+    const float w1 = static_cast<float>(1.0 / (2.0 - std::cbrt(2.0)));
+    const float w0 = 1.0f - 2.0f * w1;
+    const float kicks[4] = {0.5f * w1, 0.5f * (w0 + w1), 0.5f * (w0 + w1), 0.5f * w1};
+    const float drifts[3] = {w1, w0, w1};
+
+    int passes = 0;
+    if (!state.primed)
+    {
+        forcePass(acc, data);
+        state.primed = true;
+        ++passes;
+    }
+
+    kickDrift(kicks[0], drifts[0], damping, dt, data);
+    for (int stage = 1; stage < 4; ++stage)
+    {
+        float kickStep = kicks[stage] * dt * damping;
+        forcePass(acc, data, [&](unsigned int i, auto evaluate) {
+            evaluate();
+            data.particleVelX[i] += data.accX[i] * kickStep;
+            data.particleVelY[i] += data.accY[i] * kickStep;
+            data.particleVelZ[i] += data.accZ[i] * kickStep;
+        });
+        ++passes;
+
+        if (stage < 3)
+            kickDrift(0.0f, drifts[stage], damping, dt, data);
+    }
+    return passes;
+}
+
+// Hermite predictor-corrector (Makino & Aarseth 1992): predict to third order in dt from the acceleration and
+// jerk of the last pass, evaluate both at the prediction, and correct to fourth order from the two pairs.
+// The walk must fill data.jerkX/Y/Z. Returns the number of force passes taken
+template<typename Acc>
+int Hermite4(Acc acc, const float damping, const float dt, const SimulationData &data, IntegratorState &state)
+{
+    int passes = 0;
+    if (!state.primed)
     {
-        unsigned int particleIndex = data.idxSorted[i];
-        float acc_oldX = data.accX[particleIndex];
-        float acc_oldY = data.accY[particleIndex];
-        float acc_oldZ = data.accZ[particleIndex];
+        forcePass(acc, data);
+        state.primed = true;
+        ++passes;
+    }
 
-        acc(particleIndex, data);
+    size_t n = data.particleCount;
+    for (auto *stream: {&state.x, &state.y, &state.z, &state.velX, &state.velY, &state.velZ})
+        stream->resize(n);
 
-        data.particleVelX[particleIndex] += 0.5f * (acc_oldX + data.accX[particleIndex]) * dt * damping;
-        data.particleVelY[particleIndex] += 0.5f * (acc_oldY + data.accY[particleIndex]) * dt * damping;
-        data.particleVelZ[particleIndex] += 0.5f * (acc_oldZ + data.accZ[particleIndex]) * dt * damping;
+    Real *x0 = state.x.data(), *y0 = state.y.data(), *z0 = state.z.data();
+    Real *vx0 = state.velX.data(), *vy0 = state.velY.data(), *vz0 = state.velZ.data();
+    float dt2 = dt * dt / 2.0f;
+    float dt3 = dt * dt * dt / 6.0f;
+    {
+        PROFILE_PARALLEL_PHASE(Phase::INTEGRATE);
+#pragma omp parallel
+        {
+            PROFILE_THREAD_BEGIN();
+#pragma omp for simd schedule(static) nowait
+            for (int i = 0; i < data.particleCount; ++i)
+            {
+                x0[i] = data.particleX[i];
+                y0[i] = data.particleY[i];
+                z0[i] = data.particleZ[i];
+                vx0[i] = data.particleVelX[i];
+                vy0[i] = data.particleVelY[i];
+                vz0[i] = data.particleVelZ[i];
+
+                data.particleX[i] += vx0[i] * dt + data.accX[i] * dt2 + data.jerkX[i] * dt3;
+                data.particleY[i] += vy0[i] * dt + data.accY[i] * dt2 + data.jerkY[i] * dt3;
+                data.particleZ[i] += vz0[i] * dt + data.accZ[i] * dt2 + data.jerkZ[i] * dt3;
+                data.particleVelX[i] += data.accX[i] * dt + data.jerkX[i] * dt2;
+                data.particleVelY[i] += data.accY[i] * dt + data.jerkY[i] * dt2;
+                data.particleVelZ[i] += data.accZ[i] * dt + data.jerkZ[i] * dt2;
+            }
+            PROFILE_THREAD_END();
+        }
     }
+
+    // The corrector is fused with the evaluation at the predicted state
+    float dt2Twelfth = dt * dt / 12.0f;
+    forcePass(acc, data, [&](unsigned int i, auto evaluate) {
+        Real a0[3] = {data.accX[i], data.accY[i], data.accZ[i]};
+        Real j0[3] = {data.jerkX[i], data.jerkY[i], data.jerkZ[i]};
+
+        evaluate();
+
+        Real a1[3] = {data.accX[i], data.accY[i], data.accZ[i]};
+        Real j1[3] = {data.jerkX[i], data.jerkY[i], data.jerkZ[i]};
+        Real v0[3] = {vx0[i], vy0[i], vz0[i]};
+        Real p0[3] = {x0[i], y0[i], z0[i]};
+        Real v1[3], p1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            v1[k] = v0[k] + ((a0[k] + a1[k]) * 0.5f * dt + (j0[k] - j1[k]) * dt2Twelfth) * damping;
+            p1[k] = p0[k] + (v0[k] + v1[k]) * 0.5f * dt + (a0[k] - a1[k]) * dt2Twelfth;
+        }
+
+        data.particleVelX[i] = v1[0];
+        data.particleVelY[i] = v1[1];
+        data.particleVelZ[i] = v1[2];
+        data.particleX[i] = p1[0];
+        data.particleY[i] = p1[1];
+        data.particleZ[i] = p1[2];
+    });
+    return passes + 1;
 }
 
 #endif //NBODY3D_INTEGRATOR_H
@@ -0,0 +1,50 @@
+#ifndef NBODY3D_LOD_H
+#define NBODY3D_LOD_H
+
+#include <memory>
+#include "sphere.h"
+#include "instancebuffer.h"
+#include "lodselect.h"
+
+// Draws a frame with the instances a LodSelector picks, streamed straight into the mapped instance ring: one
+// instanced draw per mesh level and one for the sprites. The work per frame follows what is on screen rather
+// than the particle count.
+class LodRenderer
+{
+public:
+    LodRenderer(int maxSubdivision, float sphereSize, int capacity);
+
+    ~LodRenderer();
+
+    LodRenderer(const LodRenderer &) = delete;
+    LodRenderer &operator=(const LodRenderer &) = delete;
+
+    // Selects frame's instances into the next ring region; frame is not read again after this returns
+    void prepare(const FrameView &frame, const glm::mat4 &projection, const glm::mat4 &view, const glm::vec3 &eye,
+                 float fovY, int screenHeight);
+
+    // Draws what the last prepare() selected. The sphere shader is expected to have its view, projection and
+    // lighting uniforms set; the sprite shader receives view and projection here
+    void draw(const Shader &sphereShader, const Shader &spriteShader, const glm::mat4 &projection,
+              const glm::mat4 &view);
+
+    const LodStats &stats() const { return selector.stats(); }
+
+    bool persistent() const { return instances.persistent(); }
+
+    // Thresholds (impostorPixels, pointPixels, levelPixels) are set here
+    LodSelector selector;
+
+private:
+    std::unique_ptr<Sphere> levels[LOD_LEVELS];
+
+    InstanceBuffer instances;
+    unsigned int spriteVAO = 0;
+
+    // Layout of the prepared region: byte offset of every list and how many instances it holds
+    size_t base = 0;
+    size_t offsets[LOD_LISTS] = {};
+    size_t written[LOD_LISTS] = {};
+};
+
+#endif //NBODY3D_LOD_H
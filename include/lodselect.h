@@ -0,0 +1,67 @@
+#ifndef NBODY3D_LODSELECT_H
+#define NBODY3D_LODSELECT_H
+
+#include <cstddef>
+#include "sphereinstance.h"
+#include "simulationthread.h"
+
+constexpr int LOD_LEVELS = 3;
+
+// Instance lists of a selection: one per mesh level, coarsest first, then the sprites (points and impostors)
+constexpr int LOD_LISTS = LOD_LEVELS + 1;
+
+// What the last selection wrote; meshes are per level, coarsest first
+struct LodStats
+{
+    int culledNodes = 0;
+    int impostors = 0;
+    int points = 0;
+    int meshes[LOD_LEVELS] = {};
+};
+
+// CPU half of the level-of-detail renderer, free of GL: walks a frame's published octree, culling nodes outside
+// the view frustum whole, collapsing nodes projecting below impostorPixels into one point sprite at their COM
+// with brightness from their mass, and giving visible bodies a mesh level, or a point sprite, by projected
+// radius. Frames without a tree are culled per body. Matrices are column-major, as in splat.h.
+//
+// A selection runs twice, once counting the instances of every list and once writing them, so the caller can
+// lay the lists out in the destination (a mapped instance buffer) and nothing is staged in between.
+class LodSelector
+{
+public:
+    explicit LodSelector(float sphereSize) : sphereSize(sphereSize) {}
+
+    // pixelScale is the projected size in pixels of one world unit at unit distance
+    void count(const FrameView &frame, const float viewProjection[16], const float eye[3], float pixelScale,
+               size_t counts[LOD_LISTS]);
+
+    // Writes list l to lists[l], at most limits[l] instances, and how many it wrote to written[l]. The view should
+    // be the one counted; a frame that changed in between (read from shared memory) only loses instances
+    void write(const FrameView &frame, const float viewProjection[16], const float eye[3], float pixelScale,
+               SphereInstance *const lists[LOD_LISTS], const size_t limits[LOD_LISTS], size_t written[LOD_LISTS]);
+
+    const LodStats &stats() const { return lastStats; }
+
+    float sphereSize;
+
+    // Projected size below which a whole node collapses into one impostor
+    float impostorPixels = 2.0f;
+
+    // Projected radii where bodies move from sprites to the coarsest mesh and on to finer ones
+    float pointPixels = 1.5f;
+    float levelPixels[LOD_LEVELS - 1] = {8.0f, 32.0f};
+
+private:
+    // Calls emit(list, instance) for every selected instance
+    template<typename Emit>
+    void select(const FrameView &frame, const float viewProjection[16], const float eye[3], float pixelScale,
+                LodStats &stats, Emit &&emit) const;
+
+    template<typename Emit>
+    void selectBody(const FrameView &frame, int p, float relative, const float eye[3], float pixelScale,
+                    LodStats &stats, Emit &&emit) const;
+
+    LodStats lastStats;
+};
+
+#endif //NBODY3D_LODSELECT_H
@@ -2,15 +2,20 @@
 #define NBODY3D_OCTREE_H
 
 #include "simulationdata.h"
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// Deepest cell level below the root cell [-32768, 32768): unit cells sit at 16, and the levels below give bodies
+// closer than a unit their own leaves instead of dropping all but one of them
+constexpr int OCTREE_MAX_DEPTH = 20;
 
 class Octree
 {
 private:
     static uint64_t expandBits(uint64_t v);
 
-    static uint64_t  morton3D(float x, float y, float z);
-
-    int createNode(float x, float y, float z, float size, uint64_t mortonCode,
+    int createNode(NodeReal x, NodeReal y, NodeReal z, NodeReal size, uint64_t mortonCode,
                    const SimulationData &data);
 
     static bool noChildren(const SimulationData& data, int nodeIndex);
@@ -26,10 +31,45 @@ private:
 
     void makeLeafNode(SimulationData& data);
 
+    // Mass-weighted mean velocity of every node, children before parents
+    void nodeVelocities(SimulationData &data) const;
+
+    // Encodes every node into data.compactNodes, after the moments are final
+    void packCompactNodes(SimulationData &data) const;
+
     int nodeCount = 0;
+    int treeDepth = 0;
 
 public:
+    // Every third bit of v from bit 0, packed; inline for the compact node decode in the force walk
+    static uint64_t compactBits(uint64_t v)
+    {
+#ifdef __BMI2__
+        return _pext_u64(v, 0x1249249249249249);
+#else
+        v &= 0x1249249249249249;
+        v = (v | v >> 2) & 0x10c30c30c30c30c3;
+        v = (v | v >> 4) & 0x100f00f00f00f00f;
+        v = (v | v >> 8) & 0x1f0000ff0000ff;
+        v = (v | v >> 16) & 0x1f00000000ffff;
+        v = (v | v >> 32) & 0x1fffff;
+
+        return v;
+#endif
+    }
+
+    static uint64_t morton3D(Real x, Real y, Real z);
+
+    static uint64_t morton3D(unsigned int x, unsigned int y, unsigned int z);
+
+    static void mortonDecode3D(uint64_t code, unsigned int &x, unsigned int &y, unsigned int &z);
+
     void buildTree(SimulationData &data);
+
+    int size() const { return nodeCount; }
+
+    // Deepest level holding a leaf cell, counting the unit cells added by makeLeafNode
+    int depth() const { return treeDepth + 1; }
 };
 
 #endif //NBODY3D_OCTREE_H
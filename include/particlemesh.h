@@ -0,0 +1,108 @@
+#ifndef NBODY3D_PARTICLEMESH_H
+#define NBODY3D_PARTICLEMESH_H
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+#include "simulationdata.h"
+#include "bhtree.h"
+#include "fft.h"
+
+// Long-range half of the TreePM split. The force of a body is split with a Gaussian of scale r_s: the tree
+// sums m / r^2 * (erfc(r / 2r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4r_s^2)) out to PM_CUTOFF * r_s, and the
+// mesh supplies the smooth remainder. Mass is deposited with cloud-in-cell onto a meshSize^3 grid that
+// follows the bodies, convolved through the bundled FFT with the isolated (zero-padded, 2 * meshSize per side)
+// long-range Green's function erf(r / 2r_s) / r with the cloud-in-cell window deconvolved, differentiated
+// with a four-point stencil and interpolated back with the same cloud-in-cell weights.
+class ParticleMesh
+{
+public:
+    // r_s is splitCells mesh cells
+    ParticleMesh(int meshSize, float splitCells);
+
+    // Fits the mesh spacing to the current bodies and publishes r_s and the cutoff to data, for the tree
+    // walk; once per step, before the force passes. The spacing only changes (and the Green's function is
+    // only rebuilt) when the bodies outgrow the mesh or shrink well inside it.
+    void fit(SimulationData &data);
+
+    // Deposits the bodies and solves the long-range field for their current positions
+    void solve(const SimulationData &data);
+
+    // Adds the interpolated long-range acceleration of body i, and its potential when data.potential is set
+    void addAcceleration(int i, const SimulationData &data) const;
+
+    int meshSize() const { return n; }
+
+    float cellSize() const { return spacing; }
+
+    float splitRadius() const { return splitCells * spacing; }
+
+private:
+    void buildGreen();
+
+    void deposit(const SimulationData &data);
+
+    // Mesh cell of a body along one axis and its weight on the upper neighbour
+    void locate(Real position, float origin, int &cell, float &weight) const
+    {
+        auto u = static_cast<float>((position - origin) / spacing);
+        u = std::min(std::max(u, static_cast<float>(PM_MARGIN)), static_cast<float>(n - PM_MARGIN - 1) - 1.0e-3f);
+        cell = static_cast<int>(u);
+        weight = u - static_cast<float>(cell);
+    }
+
+    size_t meshIndex(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z) * n + y) * n + x;
+    }
+
+    size_t paddedIndex(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z) * padded + y) * padded + x;
+    }
+
+    // Empty cells kept on each side of the bodies so the four-point stencil never reads the padding
+    static constexpr int PM_MARGIN = 2;
+
+    // Cells a cloud-in-cell body reaches; bits 0, 1 and 2 of a corner offset it by one cell along x, y and z
+    static constexpr int CIC_CORNERS = 8;
+
+    int n;
+    int padded;
+    float splitCells;
+    float spacing = 0.0f;
+    float origin[3] = {};
+
+    FFT3D fft;
+    std::vector<std::complex<float>> grid;  // padded^3 density, then potential
+    std::vector<float> green;               // Green's function spectrum, real by symmetry
+
+    std::vector<float> potential, forceX, forceY, forceZ;
+
+    // Bodies bucketed by x cell for the slab-coloured deposit
+    std::vector<int> slabStart;
+    std::vector<int> slabBodies;
+};
+
+// Bodies are deposited with r_s in cells and the tree cuts the short-range force off beyond PM_CUTOFF * r_s,
+// where erfc has fallen below 1e-3 of Newtonian
+constexpr float PM_DEFAULT_SPLIT = 1.25f;
+constexpr float PM_CUTOFF = 4.5f;
+
+// Force functor for Velocity_Verlet: the short-range tree walk plus the interpolated mesh force, with the
+// mesh re-solved before every force pass
+struct TreePMForce
+{
+    ParticleMesh &mesh;
+
+    void prepare(const SimulationData &data) { mesh.solve(data); }
+
+    int operator()(int particleIdx, const SimulationData &data) const
+    {
+        int interactions = netAcceleration(particleIdx, data);
+        mesh.addAcceleration(particleIdx, data);
+        return interactions;
+    }
+};
+
+#endif //NBODY3D_PARTICLEMESH_H
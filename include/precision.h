@@ -0,0 +1,45 @@
+#ifndef NBODY3D_PRECISION_H
+#define NBODY3D_PRECISION_H
+
+// Scalar precision of the solver, one policy per build (CMake NBODY_PRECISION = float, double or mixed).
+// Real holds particle positions, velocities and masses and the acceleration, potential and jerk accumulators;
+// NodeReal the node geometry and moments; ForceReal the arithmetic of a single interaction. Mixed keeps the
+// bodies and the sums in double, so small drifts far from the origin are not rounded away, while the tree
+// and the interaction kernel stay in float and keep their bandwidth and SIMD width.
+struct FloatPrecision
+{
+    using Real = float;
+    using NodeReal = float;
+    using ForceReal = float;
+    static constexpr const char *name = "float";
+};
+
+struct DoublePrecision
+{
+    using Real = double;
+    using NodeReal = double;
+    using ForceReal = double;
+    static constexpr const char *name = "double";
+};
+
+struct MixedPrecision
+{
+    using Real = double;
+    using NodeReal = float;
+    using ForceReal = float;
+    static constexpr const char *name = "mixed";
+};
+
+#if defined(NBODY_PRECISION_DOUBLE)
+using Precision = DoublePrecision;
+#elif defined(NBODY_PRECISION_MIXED)
+using Precision = MixedPrecision;
+#else
+using Precision = FloatPrecision;
+#endif
+
+using Real = Precision::Real;
+using NodeReal = Precision::NodeReal;
+using ForceReal = Precision::ForceReal;
+
+#endif //NBODY3D_PRECISION_H
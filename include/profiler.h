@@ -0,0 +1,159 @@
+#ifndef NBODY3D_PROFILER_H
+#define NBODY3D_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Per-step hot-path instrumentation. Everything below is only active when the tree is configured with
+// -DNBODY_PROFILE=ON; otherwise the PROFILE_* macros expand to nothing and the solver carries no overhead.
+
+enum class Phase
+{
+    MORTON_KEYS,
+    SORT,
+    TREE_BUILD,
+    MOMENTS,
+    FORCE_WALK,
+    INTEGRATE,
+    COLLIDE,
+    MESH,
+    OUTPUT,
+    COUNT
+};
+
+enum class Counter
+{
+    NODES_VISITED,
+    PARTICLE_PARTICLE,
+    PARTICLE_NODE,
+    COUNT
+};
+
+constexpr int PHASE_COUNT = static_cast<int>(Phase::COUNT);
+constexpr int COUNTER_COUNT = static_cast<int>(Counter::COUNT);
+constexpr int MAX_PROFILE_THREADS = 256;
+
+const char *phaseName(Phase phase);
+
+const char *counterName(Counter counter);
+
+struct StepMetrics
+{
+    uint64_t step = 0;
+    double stepSeconds = 0.0;
+    double phaseSeconds[PHASE_COUNT] = {};
+    uint64_t counters[COUNTER_COUNT] = {};
+
+    int nodeCount = 0;
+    int treeDepth = 0;
+
+    // Busy is time spent inside parallel phases doing work; idle is the rest of those phases' wall time
+    std::vector<double> threadBusy;
+    std::vector<double> threadIdle;
+};
+
+class Profiler
+{
+public:
+    static Profiler &instance();
+
+    void openCsv(const std::string &path);
+
+    void openJson(const std::string &path);
+
+    void beginStep(uint64_t step);
+
+    void endStep(int nodeCount, int treeDepth);
+
+    void addPhase(Phase phase, double seconds, bool parallel);
+
+    void addBusy(int thread, double seconds)
+    {
+        slots[thread].busy += seconds;
+    }
+
+    void count(int thread, Counter counter, uint64_t n)
+    {
+        slots[thread].counters[static_cast<int>(counter)] += n;
+    }
+
+    // Most recent steps, oldest first; the ring keeps the last RING_CAPACITY steps
+    std::vector<StepMetrics> recent() const;
+
+    static constexpr size_t RING_CAPACITY = 1024;
+
+private:
+    Profiler();
+
+    struct alignas(64) ThreadSlot
+    {
+        uint64_t counters[COUNTER_COUNT];
+        double busy;
+    };
+
+    void writeCsv(const StepMetrics &metrics);
+
+    void writeJson(const StepMetrics &metrics);
+
+    ThreadSlot slots[MAX_PROFILE_THREADS];
+    int threads;
+
+    StepMetrics current;
+    double parallelSeconds = 0.0;
+    std::chrono::steady_clock::time_point stepStart;
+
+    std::vector<StepMetrics> ring;
+    size_t ringHead = 0;
+    size_t ringSize = 0;
+
+    std::ofstream csv;
+    std::ofstream json;
+};
+
+class ScopedPhase
+{
+public:
+    explicit ScopedPhase(Phase phase, bool parallel = false)
+            : phase(phase), parallel(parallel), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedPhase()
+    {
+        Profiler::instance().addPhase(phase, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count(), parallel);
+    }
+
+private:
+    Phase phase;
+    bool parallel;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define NBODY_PROFILE_CONCAT_(a, b) a##b
+#define NBODY_PROFILE_CONCAT(a, b) NBODY_PROFILE_CONCAT_(a, b)
+
+#ifdef NBODY_PROFILE
+#define PROFILE_STEP_BEGIN(step) Profiler::instance().beginStep(step)
+#define PROFILE_STEP_END(nodes, depth) Profiler::instance().endStep(nodes, depth)
+#define PROFILE_PHASE(phase) ScopedPhase NBODY_PROFILE_CONCAT(profilePhase, __LINE__)(phase)
+#define PROFILE_PARALLEL_PHASE(phase) ScopedPhase NBODY_PROFILE_CONCAT(profilePhase, __LINE__)(phase, true)
+// Bracket one thread's share of a parallel phase; use with "omp for nowait" so the barrier wait counts as idle
+#define PROFILE_THREAD_BEGIN() auto profileThreadStart = std::chrono::steady_clock::now()
+#define PROFILE_THREAD_END() Profiler::instance().addBusy(omp_get_thread_num(), std::chrono::duration<double>( \
+        std::chrono::steady_clock::now() - profileThreadStart).count())
+#define PROFILE_COUNT(counter, n) Profiler::instance().count(omp_get_thread_num(), counter, n)
+#else
+#define PROFILE_STEP_BEGIN(step)
+#define PROFILE_STEP_END(nodes, depth)
+#define PROFILE_PHASE(phase)
+#define PROFILE_PARALLEL_PHASE(phase)
+#define PROFILE_THREAD_BEGIN()
+#define PROFILE_THREAD_END()
+#define PROFILE_COUNT(counter, n) static_cast<void>(n)
+#endif
+
+#endif //NBODY3D_PROFILER_H
@@ -1,24 +1,44 @@
 #ifndef NBODY3D_RENDER_H
 #define NBODY3D_RENDER_H
 
+#include <memory>
+#include <string>
 #include "shader.h"
 #include "camera.h"
 #include "sphere.h"
-#include "octree.h"
-#include "bhtree.h"
 #include "light.h"
+#include "lod.h"
+#include "simulationthread.h"
+#include "sharedframes.h"
+#include "snapshotplayer.h"
+#include "splat.h"
 
 class Render
 {
 public:
-    Render(int scrWidth, int scrHeight);
+    // A hidden window renders off screen without vsync, e.g. on a software GL under a virtual display
+    Render(int scrWidth, int scrHeight, bool hidden = false);
 
     void cameraSetup(Camera &worldCamera);
 
+    // Shared meshes up to the given subdivision and base radius, instanced for up to number bodies
     void sphereSetup(int subdivision, float size, int number);
     void lightSetup(Light& light);
+    void snapshotSetup(SnapshotWriter &writer, int interval);
 
-    void draw(Shader &sphereShader, SimulationData &data, Octree &tree);
+    // Closes the window after frames frames and prints the mean frame time; 0 runs until closed
+    void frameLimitSetup(int frames);
+
+    // Runs the simulation on its own thread with a fixed dt and draws its latest frame at display rate
+    // Bodies and distant impostors below the mesh levels are drawn as point sprites with spriteShader
+    void draw(Shader &sphereShader, Shader &spriteShader, Simulation &simulation, float dt, float damping = 0.99f);
+
+    // Viewer only: draws the newest frame a solver publishes to the shared-memory ring name, in place
+    void drawShared(Shader &sphereShader, Shader &spriteShader, const std::string &name);
+
+    // Plays back an opened snapshot sequence. Space pauses, left and right step a frame (ten with shift),
+    // up and down double and halve the speed, R reverses, Home and End and the digit keys seek
+    void drawReplay(Shader &sphereShader, Shader &spriteShader, SnapshotPlayer &player);
 
 private:
     void frameBufferSizeCallback(int width, int height);
@@ -31,11 +51,32 @@ private:
 
     void processInput(GLFWwindow *pWindow);
 
+    // True on the frame the key goes down
+    bool keyPressed(int key);
+
+    void processReplayInput(SnapshotPlayer &player);
+
     GLFWwindow *window;
 
-    std::vector<Sphere> spheres;
+    // P writes a CPU splat of the current view as splat_<step>.ppm
+    void writeSplat(const SplatRenderer &splat, uint64_t step) const;
+
+    // One window frame of frame's bodies; source goes into the title statistics. A frame read in place from
+    // reader's ring is checked once it has been copied out and before anything is drawn: if the writer lapped
+    // it, nothing is drawn or shown and false is returned
+    bool drawFrame(Shader &sphereShader, Shader &spriteShader, const FrameView &frame, const std::string &source,
+                   const SharedFrameReader *reader = nullptr);
+
+    std::unique_ptr<LodRenderer> lod;
     Light *lightSource;
 
+    SnapshotWriter *snapshotWriter = nullptr;
+    int snapshotInterval = 0;
+
+    int frameLimit = 0;
+    int framesDrawn = 0;
+    float firstFrameTime = -1.0f;
+
     Camera camera;
 
     bool firstMouse = true;
@@ -48,8 +89,15 @@ private:
     float deltaTime = 0.0f;
     float lastFrame = 0.0f;
 
+    float titleTime = 0.0f;
+    int titleFrames = 0;
+
     glm::vec2 lastMousePosition;
     bool isDragging = false;
+    bool splatRequested = false;
+    bool keyDown[GLFW_KEY_LAST + 1] = {};
+
+    double replaySpeed = 0.0;
 };
 
 #endif //NBODY3D_RENDER_H
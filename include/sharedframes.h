@@ -0,0 +1,95 @@
+#ifndef NBODY3D_SHAREDFRAMES_H
+#define NBODY3D_SHAREDFRAMES_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "simulationdata.h"
+#include "simulationthread.h"
+
+// Live frames for viewers in other processes: a POSIX shared-memory object holding a ring of position and
+// mass frames. Every slot is guarded by a seqlock sequence (odd while it is written), and the header names
+// the newest complete frame. The writer never waits for readers; a reader that is still using a slot when
+// the writer laps the ring sees the sequence change and drops that frame.
+
+constexpr char SHARED_FRAMES_MAGIC[8] = {'N', 'B', 'S', 'H', 'M', '0', '0', '1'};
+constexpr uint32_t SHARED_FRAMES_VERSION = 1;
+constexpr int SHARED_FRAMES_SLOTS = 4;
+
+struct alignas(64) SharedFrameSlot
+{
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    uint64_t step;
+    double time;
+    uint64_t count;
+};
+
+struct SharedFramesHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slotCount;
+    uint64_t capacity;      // particles per slot
+    uint64_t slotBytes;     // four float streams of capacity, each 64-byte aligned
+
+    // Frame number of the newest complete frame, plus one; 0 while nothing has been published
+    alignas(64) std::atomic<uint64_t> published;
+
+    SharedFrameSlot slots[SHARED_FRAMES_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs lock-free 64-bit atomics");
+
+class SharedFrameWriter
+{
+public:
+    // Creates (or replaces) /name sized for capacity particles per frame
+    SharedFrameWriter(const std::string &name, int capacity);
+
+    ~SharedFrameWriter();
+
+    SharedFrameWriter(const SharedFrameWriter &) = delete;
+    SharedFrameWriter &operator=(const SharedFrameWriter &) = delete;
+
+    // Copies positions and masses into the next slot; bodies beyond capacity are left out
+    void publish(const SimulationData &data, uint64_t step, double time);
+
+private:
+    std::string name;
+    size_t mappedBytes = 0;
+    SharedFramesHeader *header = nullptr;
+    uint64_t frameCount = 0;
+};
+
+// Zero-copy reader. acquire() returns a view straight into the shared slot; check it with valid() once done
+// with the data, since the writer may have reused the slot meanwhile.
+class SharedFrameReader
+{
+public:
+    SharedFrameReader() = default;
+
+    ~SharedFrameReader();
+
+    SharedFrameReader(const SharedFrameReader &) = delete;
+    SharedFrameReader &operator=(const SharedFrameReader &) = delete;
+
+    // False if the object does not exist (yet) or is not a frame ring
+    bool attach(const std::string &name);
+
+    bool attached() const { return header != nullptr; }
+
+    // Newest complete frame, or false if none has been published or the writer was mid-way through it
+    bool acquire(FrameView &view);
+
+    // True if the slot behind the last acquired view was not rewritten since
+    bool valid() const;
+
+private:
+    size_t mappedBytes = 0;
+    const SharedFramesHeader *header = nullptr;
+    int currentSlot = -1;
+    uint64_t currentSequence = 0;
+};
+
+#endif //NBODY3D_SHAREDFRAMES_H
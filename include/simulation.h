@@ -0,0 +1,134 @@
+#ifndef NBODY3D_SIMULATION_H
+#define NBODY3D_SIMULATION_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "simulationdata.h"
+#include "octree.h"
+#include "compactnode.h"
+#include "diagnostics.h"
+#include "collisions.h"
+#include "particlemesh.h"
+#include "ewald.h"
+#include "integrator.h"
+
+// Owns the SoA particle and node streams for a runtime particle count and advances them without any
+// windowing or GL dependency.
+class Simulation
+{
+public:
+    explicit Simulation(int particleCount, int nodeCapacity = 0);
+
+    Simulation(const Simulation &) = delete;
+    Simulation &operator=(const Simulation &) = delete;
+
+    // Grows or shrinks the streams, keeping the leading particles; pointers in data() are rebound
+    void resize(int particleCount, int nodeCapacity = 0);
+
+    SimulationData &data() { return simData; }
+
+    const SimulationData &data() const { return simData; }
+
+    const Octree &tree() const { return octree; }
+
+    // Rebuilds the tree on the current positions, for spatial queries between steps
+    const Octree &rebuildTree();
+
+    void step(float dt, float damping = 1.0f);
+
+    // One force pass of the configured solver at the current positions without moving the bodies, filling the
+    // accelerations (and jerks); for calibration
+    void evaluateForces();
+
+    uint64_t steps() const { return stepCount; }
+
+    double time() const { return simulationTime; }
+
+    // Accumulate potentials in the force walk and reduce the conserved quantities on the first step and every
+    // cadence steps after it; 0 disables
+    void diagnosticsSetup(int cadence);
+
+    // Record of the most recent step that ran diagnostics, or null when the last step did not
+    const Diagnostics *diagnostics() const { return diagnosticsDue ? &lastDiagnostics : nullptr; }
+
+    // Merge overlapping bodies before every force evaluation, with radius for a body of unit mass growing as
+    // cbrt(mass); merged bodies are removed, so particleCount can drop between steps. 0 disables; not combined
+    // with a periodic box
+    void collisionSetup(float radius);
+
+    // Null while collisions are disabled
+    const CollisionStats *collisionStats() const { return collisions ? &collisions->stats() : nullptr; }
+
+    // TreePM: long-range forces from a meshSize^3 particle mesh, the tree walk summing only the short-range
+    // part within PM_CUTOFF split scales; splitCells is the split scale in mesh cells. 0 disables
+    void treePMSetup(int meshSize, float splitCells = PM_DEFAULT_SPLIT);
+
+    // Null while TreePM is disabled
+    const ParticleMesh *particleMesh() const { return mesh.get(); }
+
+    // Integrator for the following steps; Hermite allocates the jerk and node velocity streams and needs open
+    // boundaries without TreePM
+    void integratorSetup(Integrator kind);
+
+    Integrator integrator() const { return integratorKind; }
+
+    // Force passes over all bodies taken so far, the cost measure that differs between integrators
+    uint64_t forcePasses() const { return forcePassCount; }
+
+    // Periodic box of side boxSize centred on the origin, with Ewald corrections from a table read from
+    // ewaldCache (computed and written there on first use; empty computes without caching). Wraps the
+    // current positions, so call it after the initial conditions are set. 0 disables; not combined with TreePM
+    // or collisions
+    void periodicSetup(float boxSize, const std::string &ewaldCache = "");
+
+    // Force walks read 16-byte compact node records built with every tree instead of the full node streams:
+    // less traffic per visit for a bfloat16 mass and a quantised centre of mass
+    void compactNodesSetup(bool enabled);
+
+    bool compactNodesEnabled() const { return simData.compactNodes != nullptr; }
+
+    static int defaultNodeCapacity(int particleCount);
+
+private:
+    template<typename Acc>
+    void advance(Acc acc, float dt, float damping, bool fresh);
+
+    std::vector<NodeReal> nodeX, nodeY, nodeZ;
+    std::vector<NodeReal> nodeWidth, nodeHeight, nodeDepth;
+    std::vector<int> nodeParticleIndex;
+    std::vector<int> nodeChildren;
+    std::vector<NodeReal> nodeTotalMass, nodeCOM_X, nodeCOM_Y, nodeCOM_Z;
+    std::vector<uint64_t> nodeMortonCode;
+
+    std::vector<Real> particleX, particleY, particleZ;
+    std::vector<Real> particleVelX, particleVelY, particleVelZ;
+    std::vector<Real> particleMass;
+    std::vector<Real> accX, accY, accZ;
+    std::vector<unsigned int> idxSorted;
+    std::vector<Real> potential;
+    std::vector<Real> jerkX, jerkY, jerkZ;
+    std::vector<NodeReal> nodeVelX, nodeVelY, nodeVelZ;
+    std::vector<CompactNode> compactNodes;
+
+    SimulationData simData{};
+    Octree octree;
+
+    uint64_t stepCount = 0;
+    uint64_t forcePassCount = 0;
+    double simulationTime = 0.0;
+
+    std::unique_ptr<CollisionStage> collisions;
+    std::unique_ptr<ParticleMesh> mesh;
+    std::unique_ptr<EwaldTable> ewald;
+
+    Integrator integratorKind = Integrator::LEAPFROG;
+    IntegratorState integratorState;
+
+    int diagnosticsCadence = 0;
+    bool diagnosticsDue = false;
+    Diagnostics firstDiagnostics;
+    Diagnostics lastDiagnostics;
+};
+
+#endif //NBODY3D_SIMULATION_H
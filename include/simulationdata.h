@@ -2,50 +2,91 @@
 #define NBODY3D_SIMULATIONDATA_H
 
 #include <cstdint>
+#include "precision.h"
+
+class EwaldTable;
+struct CompactNode;
 
 constexpr unsigned int OCT_CHILD = 8;
 
+constexpr int NULL_INDEX = -1;
+
+constexpr int MAX_NODES = 1000;
+constexpr int MAX_PARTICLES = 1000;
+
+constexpr float THETA = 0.f;
+constexpr float SOFTENING = 0.5f;
+
 struct SimulationData
 {
-    float *nodeX;
-    float *nodeY;
-    float *nodeZ;
+    NodeReal *nodeX;
+    NodeReal *nodeY;
+    NodeReal *nodeZ;
 
-    float *nodeWidth;
-    float *nodeHeight;
-    float *nodeDepth;
+    NodeReal *nodeWidth;
+    NodeReal *nodeHeight;
+    NodeReal *nodeDepth;
 
     int *nodeParticleIndex;
     int (*nodeChildren)[OCT_CHILD];
 
-    float *nodeTotalMass;
-    float *nodeCOM_X;
-    float *nodeCOM_Y;
-    float *nodeCOM_Z;
+    NodeReal *nodeTotalMass;
+    NodeReal *nodeCOM_X;
+    NodeReal *nodeCOM_Y;
+    NodeReal *nodeCOM_Z;
+
+    Real *particleX;
+    Real *particleY;
+    Real *particleZ;
+
+    Real *particleVelX;
+    Real *particleVelY;
+    Real *particleVelZ;
 
-    float *particleX;
-    float *particleY;
-    float *particleZ;
+    Real *particleMass;
+    Real *accX;
+    Real *accY;
+    Real *accZ;
 
-    float *particleVelX;
-    float *particleVelY;
-    float *particleVelZ;
+    // Optional per-particle potential, filled by the force walk only while non-null
+    Real *potential = nullptr;
 
-    float *particleMass;
-    float *accX;
-    float *accY;
-    float *accZ;
+    // Optional per-particle jerk for the Hermite integrator, filled by the force walk only while non-null; the
+    // walk then needs the nodes' centre-of-mass velocities, which the tree build fills while nodeVelX is set
+    Real *jerkX = nullptr;
+    Real *jerkY = nullptr;
+    Real *jerkZ = nullptr;
+    NodeReal *nodeVelX = nullptr;
+    NodeReal *nodeVelY = nullptr;
+    NodeReal *nodeVelZ = nullptr;
 
     unsigned int *idxSorted;
 
+    // Level-marked Morton code of each node's cell: a 1 bit followed by three bits per level below the root
     uint64_t *nodeMortonCode;
-};
 
-constexpr int NULL_INDEX = -1;
+    // Optional 16-byte copy of each node for the force walk, filled by the tree build only while non-null; the
+    // walk then reads the cell, centre of mass and mass from it instead of the full streams
+    CompactNode *compactNodes = nullptr;
 
-constexpr int MAX_NODES = 1000;
-constexpr int MAX_PARTICLES = 1000;
+    int particleCount = MAX_PARTICLES;
+    int nodeCapacity = MAX_NODES;
 
-constexpr float THETA = 0.f;
+    float theta = THETA;
+    float softening = SOFTENING;
+
+    // Bodies per dynamic chunk of a force pass; larger chunks trade load balance for scheduling overhead
+    int walkChunk = 1;
+
+    // TreePM split scale r_s: while positive the tree walk sums only the short-range part of the force and
+    // stops at splitCutoff, the mesh adding the rest
+    float splitRadius = 0.0f;
+    float splitCutoff = 0.0f;
+
+    // Periodic box [-boxSize / 2, boxSize / 2)^3 while positive: positions wrap, distances are minimum-image
+    // and the Ewald correction comes from the table
+    float boxSize = 0.0f;
+    const EwaldTable *ewald = nullptr;
+};
 
 #endif //NBODY3D_SIMULATIONDATA_H
@@ -0,0 +1,106 @@
+#ifndef NBODY3D_SIMULATIONTHREAD_H
+#define NBODY3D_SIMULATIONTHREAD_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "simulation.h"
+#include "snapshotwriter.h"
+#include "triplebuffer.h"
+
+// Octree node as published for rendering: nodes are in depth-first order and next is the index just past
+// the node's subtree, so a traversal that accepts or culls a node skips to next without a stack. Particle
+// nodes carry the particle index and have no published children.
+struct RenderNode
+{
+    float x, y, z;
+    float width;
+    float comX, comY, comZ;
+    float mass;
+    int particle;
+    int next;
+};
+
+// Non-owning view of a frame, either a PositionFrame or one read in place from shared memory
+struct FrameView
+{
+    const float *x, *y, *z;
+    const float *mass;
+    size_t count;
+
+    const RenderNode *nodes;
+    size_t nodeCount;
+
+    uint64_t step;
+    double time;
+};
+
+struct PositionFrame
+{
+    std::vector<float> x, y, z;
+    std::vector<float> mass;
+
+    // Tree of the step's last force pass, rebuilt after the drift, so node bounds match the positions above;
+    // empty unless renderTreeSetup(true)
+    std::vector<RenderNode> nodes;
+
+    uint64_t step = 0;
+    double time = 0.0;
+
+    FrameView view() const
+    {
+        return {x.data(), y.data(), z.data(), mass.data(), x.size(), nodes.data(), nodes.size(), step, time};
+    }
+};
+
+// Depth-first copy of the massive nodes of a tree built from data, with the skip indices filled in
+void publishRenderNodes(const SimulationData &data, const Octree &tree, std::vector<RenderNode> &nodes);
+
+// Runs Simulation::step with a fixed dt on its own thread (and OpenMP team) and publishes every completed
+// step as a PositionFrame, so a consumer running at display rate never throttles the solver.
+class SimulationThread
+{
+public:
+    SimulationThread(Simulation &simulation, float dt, float damping);
+
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    void snapshotSetup(SnapshotWriter &writer, int interval);
+
+    // Also publish the octree with every frame, for renderers that cull and aggregate hierarchically
+    void renderTreeSetup(bool enabled) { publishTree = enabled; }
+
+    void start();
+
+    void stop();
+
+    // Consumer side: the newest published frame, never blocks the solver
+    const PositionFrame &latestFrame();
+
+    double stepsPerSecond() const { return stepRate.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    void publish();
+
+    Simulation &simulation;
+    float dt;
+    float damping;
+
+    SnapshotWriter *snapshotWriter = nullptr;
+    int snapshotInterval = 0;
+
+    bool publishTree = false;
+
+    TripleBuffer<PositionFrame> frames;
+
+    std::atomic<bool> running{false};
+    std::atomic<double> stepRate{0.0};
+    std::thread thread;
+};
+
+#endif //NBODY3D_SIMULATIONTHREAD_H
@@ -0,0 +1,64 @@
+#ifndef NBODY3D_SNAPSHOT_H
+#define NBODY3D_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk snapshot layout: one 4 KiB header page followed by the particle streams.
+// Raw snapshots store every stream as a plain float array at snapshotStreamOffset(), so a reader
+// can mmap the file and use the arrays in place.
+
+constexpr char SNAPSHOT_MAGIC[8] = {'N', 'B', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+constexpr size_t SNAPSHOT_ALIGNMENT = 4096;
+constexpr size_t SNAPSHOT_STREAM_ALIGNMENT = 64;
+
+constexpr uint32_t SNAPSHOT_RAW = 0;
+
+enum SnapshotStream
+{
+    SNAP_X,
+    SNAP_Y,
+    SNAP_Z,
+    SNAP_VX,
+    SNAP_VY,
+    SNAP_VZ,
+    SNAP_MASS,
+    SNAP_STREAM_COUNT
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t encoding;
+    uint64_t step;
+    double time;
+    uint64_t particleCount;
+    uint64_t payloadBytes;
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_ALIGNMENT);
+
+inline size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+inline size_t snapshotStreamStride(size_t particleCount)
+{
+    return alignUp(particleCount * sizeof(float), SNAPSHOT_STREAM_ALIGNMENT);
+}
+
+inline size_t snapshotStreamOffset(size_t particleCount, int stream)
+{
+    return SNAPSHOT_ALIGNMENT + static_cast<size_t>(stream) * snapshotStreamStride(particleCount);
+}
+
+inline size_t snapshotRawSize(size_t particleCount)
+{
+    return alignUp(snapshotStreamOffset(particleCount, SNAP_STREAM_COUNT), SNAPSHOT_ALIGNMENT);
+}
+
+#endif //NBODY3D_SNAPSHOT_H
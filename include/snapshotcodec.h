@@ -0,0 +1,67 @@
+#ifndef NBODY3D_SNAPSHOTCODEC_H
+#define NBODY3D_SNAPSHOTCODEC_H
+
+#include <string>
+#include <vector>
+#include "snapshot.h"
+
+// Lossy snapshot encoding for analysis dumps. Particles are written in Morton (idxSorted) order in
+// independent blocks: each position is its unit Morton cell, delta-coded against the previous key, plus a
+// quantized offset inside the cell; velocities are quantized to the requested bound and varint coded.
+// Positions outside the root cell [-32768, 32768) are clamped to it.
+
+constexpr uint32_t SNAPSHOT_MORTON_QUANTIZED = 1;
+
+constexpr uint32_t CODEC_STORE_IDS = 1;
+
+struct SnapshotCodecOptions
+{
+    float positionError = 1.0e-3f;  // max absolute error per position component, no finer than 2^-20
+    float velocityError = 1.0e-3f;  // max absolute error per velocity component
+    uint32_t blockSize = 4096;
+    bool storeIds = false;
+};
+
+struct CompressedSnapshotInfo
+{
+    float positionError;
+    float velocityQuantum;
+    uint32_t fractionBits;
+    uint32_t blockSize;
+    uint64_t particleCount;
+    uint64_t blockCount;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// Encodes particles in the given order (normally idxSorted) into a payload that follows the header page. Both
+// errors must be positive
+std::vector<char> encodeSnapshot(const float *const streams[SNAP_STREAM_COUNT], const unsigned int *order,
+                                 size_t particleCount, const SnapshotCodecOptions &options);
+
+// Read-only view over an encoded payload; blocks decode independently so any block can be fetched alone
+class CompressedSnapshot
+{
+public:
+    bool open(const char *payload, size_t bytes);
+
+    const CompressedSnapshotInfo &info() const { return header; }
+
+    size_t blockCount() const { return header.blockCount; }
+
+    // Writes the particles of one block at [block * blockSize, ...) of each output stream
+    void decodeBlock(size_t block, float *const streams[SNAP_STREAM_COUNT], unsigned int *ids = nullptr) const;
+
+    void decodeAll(float *const streams[SNAP_STREAM_COUNT], unsigned int *ids = nullptr) const;
+
+private:
+    CompressedSnapshotInfo header{};
+    const uint64_t *offsets = nullptr;
+    const char *blocks = nullptr;
+};
+
+// Loads a raw or compressed snapshot file into SoA streams; ids are filled only if the file stores them
+bool loadSnapshot(const std::string &path, SnapshotHeader &header, std::vector<float> (&streams)[SNAP_STREAM_COUNT],
+                  std::vector<unsigned int> *ids = nullptr);
+
+#endif //NBODY3D_SNAPSHOTCODEC_H
@@ -0,0 +1,123 @@
+#ifndef NBODY3D_SNAPSHOTPLAYER_H
+#define NBODY3D_SNAPSHOTPLAYER_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "snapshot.h"
+#include "simulationthread.h"
+
+// Plays back a snapshot sequence written by SnapshotWriter. Raw snapshots are memory-mapped and presented in
+// place with no parsing; compressed ones are decoded once into the frame's own buffers. A background thread
+// maps (or decodes) the frames ahead of the playhead in the playing direction, faults in the position and
+// mass pages, and releases frames that fall out of the window, so presenting never waits on the disk.
+class SnapshotPlayer
+{
+public:
+    explicit SnapshotPlayer(int prefetch = 8);
+
+    ~SnapshotPlayer();
+
+    SnapshotPlayer(const SnapshotPlayer &) = delete;
+    SnapshotPlayer &operator=(const SnapshotPlayer &) = delete;
+
+    // Indexes the prefix_<step>.nbs files in step order; false if there are none. An open player is closed
+    // first
+    bool open(const std::string &prefix);
+
+    // Stops the prefetcher and drops every frame, presented ones included
+    void close();
+
+    size_t frameCount() const { return entries.size(); }
+
+    size_t maxParticles() const;
+
+    uint64_t step(size_t frame) const { return entries[frame].step; }
+
+    double time(size_t frame) const { return entries[frame].time; }
+
+    // Playhead in frames; a fractional position presents the frame below it
+    double position();
+
+    void seek(double frame);
+
+    // First frame at or after the given simulation time
+    void seekTime(double time);
+
+    // Frames per second of wall time; negative plays backwards, 0 pauses
+    void setSpeed(double framesPerSecond);
+
+    double speed() const { return playSpeed; }
+
+    // Wrap around at either end instead of stopping there
+    void setLoop(bool enabled);
+
+    // Moves the playhead by speed * seconds
+    void advance(double seconds);
+
+    // The playhead frame if it is resident, otherwise the last presented one, which stays valid until the
+    // next call; false until the first frame is resident, and while the playhead frame failed to load
+    bool present(FrameView &view);
+
+    // True once the prefetcher tried the frame and could not read it; such frames are not retried
+    bool loadFailed(size_t frame);
+
+    // Presents that had to fall back to an older frame because the prefetcher was behind
+    size_t misses() const { return missCount; }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        uint64_t step;
+        double time;
+        uint64_t particleCount;
+        uint32_t encoding;
+    };
+
+    struct Frame
+    {
+        ~Frame();
+
+        void *mapping = nullptr;
+        size_t mappedBytes = 0;
+        std::vector<float> decoded[SNAP_STREAM_COUNT];
+
+        FrameView view{};
+    };
+
+    // Null when the file cannot be mapped or decoded
+    std::shared_ptr<Frame> load(size_t index) const;
+
+    void prefetchLoop();
+
+    // Window of frames to keep resident, nearest to the playhead first; called with the mutex held
+    std::vector<size_t> window(size_t center) const;
+
+    void moveTo(double frame);
+
+    std::vector<Entry> entries;
+    int prefetch;
+
+    std::mutex mutex;
+    std::condition_variable moved;
+    double playhead = 0.0;
+    double playSpeed = 30.0;
+    bool loop = false;
+    // Frames that failed to load stay here as null, so the window counts them as done
+    std::map<size_t, std::shared_ptr<Frame>> resident;
+    bool stopping = false;
+
+    // Render-thread side
+    std::shared_ptr<Frame> current;
+    size_t currentIndex = 0;
+    size_t missCount = 0;
+
+    std::thread prefetcher;
+};
+
+#endif //NBODY3D_SNAPSHOTPLAYER_H
@@ -0,0 +1,90 @@
+#ifndef NBODY3D_SNAPSHOTWRITER_H
+#define NBODY3D_SNAPSHOTWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "simulationdata.h"
+#include "snapshotcodec.h"
+
+struct SnapshotReport
+{
+    uint64_t step;
+    size_t bytes;
+
+    double stallSeconds;    // time submit() waited for a free buffer
+    double copySeconds;     // parallel copy at the step boundary
+    double encodeSeconds;   // background compression, zero for raw snapshots
+    double writeSeconds;    // background write, open to close
+    double throughputMBs;
+};
+
+// Double-buffered snapshot output. submit() copies the particle state into a spare buffer and returns;
+// a background thread streams filled buffers to disk while the next steps run.
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::string prefix, bool directIO = false, int bufferCount = 2);
+
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    // Switches later snapshots to the Morton-quantized codec; encoding runs on the writer thread
+    void enableCompression(const SnapshotCodecOptions &options);
+
+    void submit(const SimulationData &data, uint64_t step, double time);
+
+    void flush();
+
+    // Reports of the snapshots finished since the last call, in write order; the writer thread prints nothing
+    std::vector<SnapshotReport> reports();
+
+private:
+    struct Buffer
+    {
+        char *memory = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+
+        size_t particleCount = 0;
+        uint64_t step = 0;
+        double stallSeconds = 0.0;
+        double copySeconds = 0.0;
+    };
+
+    void reserve(Buffer &buffer, size_t bytes);
+
+    void writerLoop();
+
+    size_t encode(const Buffer &buffer, const SnapshotCodecOptions &options);
+
+    bool writeBuffer(const char *memory, size_t size, uint64_t step, double &writeSeconds);
+
+    std::string prefix;
+    bool directIO;
+
+    bool compress = false;
+    SnapshotCodecOptions codecOptions;
+    Buffer encoded;
+
+    std::vector<Buffer> buffers;
+    std::vector<int> freeBuffers;
+    std::deque<int> filledBuffers;
+    int writing = 0;
+
+    std::vector<SnapshotReport> finished;
+
+    std::mutex mutex;
+    std::condition_variable bufferFreed;
+    std::condition_variable bufferFilled;
+    bool stopping = false;
+
+    std::thread writer;
+};
+
+#endif //NBODY3D_SNAPSHOTWRITER_H
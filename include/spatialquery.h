@@ -0,0 +1,191 @@
+#ifndef NBODY3D_SPATIALQUERY_H
+#define NBODY3D_SPATIALQUERY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "simulationdata.h"
+#include "octree.h"
+
+// Neighbour lists in CSR form: the neighbours of target t are indices[offsets[t] .. offsets[t + 1]), with
+// the matching distances
+struct NeighbourList
+{
+    std::vector<size_t> offsets;
+    std::vector<int> indices;
+    std::vector<float> distances;
+
+    size_t targets() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    size_t count(size_t target) const { return offsets[target + 1] - offsets[target]; }
+};
+
+// Batched spatial queries over a built octree. update() keeps a Morton-ordered copy of the positions; the
+// walk prunes tree nodes by their distance to the target and reads small cells, and octants the tree has no
+// node for, as runs of the sorted keys, so bodies the tree dropped at its depth limit are still found.
+// Targets are processed in Morton order in parallel, with per-thread scratch that is reused between calls.
+class SpatialQuery
+{
+public:
+    // tree must have been built from data's current positions (Octree::buildTree also sorts idxSorted)
+    void update(const SimulationData &data, const Octree &tree);
+
+    // The k nearest particles of each target, nearest first
+    void nearest(const float *x, const float *y, const float *z, int count, int k, NeighbourList &out);
+
+    // The k nearest other particles of every particle
+    void nearestParticles(int k, NeighbourList &out);
+
+    // Every particle within radius of each target, in no particular order
+    void within(const float *x, const float *y, const float *z, int count, float radius, NeighbourList &out);
+
+    // Every other particle within radius of every particle
+    void withinParticles(float radius, NeighbourList &out);
+
+    // Particle index at Morton position k
+    int particle(size_t k) const { return static_cast<int>(data->idxSorted[k]); }
+
+    float x(size_t k) const { return sortedX[k]; }
+
+    float y(size_t k) const { return sortedY[k]; }
+
+    float z(size_t k) const { return sortedZ[k]; }
+
+    // Calls visit(k) for the Morton position of every particle in the cells that may lie within sqrt(bound())
+    // of (px, py, pz), nearest cells first; bound() is re-read during the walk, so it may shrink. The caller
+    // tests the actual distance.
+    template<typename Bound, typename Visit>
+    void walk(float px, float py, float pz, std::vector<int> &stack, Bound &&bound, Visit &&visit) const;
+
+private:
+    struct Scratch
+    {
+        std::vector<int> stack;
+        std::vector<std::pair<float, int>> heap;
+        std::vector<int> indices;
+        std::vector<float> distances;
+    };
+
+    static float boxDistance2(float px, float py, float pz, float x, float y, float z, float width)
+    {
+        float dx = std::max(std::max(x - px, px - x - width), 0.0f);
+        float dy = std::max(std::max(y - py, py - y - width), 0.0f);
+        float dz = std::max(std::max(z - pz, pz - z - width), 0.0f);
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    // Morton positions of the particles inside an aligned cube
+    std::pair<size_t, size_t> keyRange(float x, float y, float z, float width) const
+    {
+        uint64_t first = Octree::morton3D(x, y, z);
+        auto side = static_cast<uint64_t>(width);
+        auto begin = std::lower_bound(sortedKeys.begin(), sortedKeys.end(), first);
+        auto end = std::lower_bound(begin, sortedKeys.end(), first + side * side * side);
+        return {static_cast<size_t>(begin - sortedKeys.begin()), static_cast<size_t>(end - sortedKeys.begin())};
+    }
+
+    // Fills order with the targets sorted by Morton key
+    void targetOrder(const float *x, const float *y, const float *z, int count);
+
+    void particleOrder();
+
+    // With excludeSelf the targets are the particles themselves and each skips its own index. Coord is the
+    // particle precision then; the search itself runs in float either way
+    template<typename Coord>
+    void nearestBatch(const Coord *x, const Coord *y, const Coord *z, int count, bool excludeSelf, int k,
+                      NeighbourList &out);
+
+    template<typename Coord>
+    void withinBatch(const Coord *x, const Coord *y, const Coord *z, int count, bool excludeSelf, float radius,
+                     NeighbourList &out);
+
+    const SimulationData *data = nullptr;
+    std::vector<uint64_t> sortedKeys;
+    std::vector<float> sortedX, sortedY, sortedZ;
+
+    // Morton positions [nodeBegin, nodeEnd) of every node's particles
+    std::vector<uint32_t> nodeBegin, nodeEnd;
+
+    // Set where the child nodes do not account for all of a node's particles
+    std::vector<uint8_t> nodeLoose;
+
+    std::vector<int> order;
+    std::vector<uint64_t> targetKeys;
+    std::vector<Scratch> scratch;
+
+    // Where each target's radius results sit in its thread's scratch
+    std::vector<int> resultThread;
+    std::vector<size_t> resultStart;
+};
+
+// Cells holding at most this many particles are read whole instead of descended
+constexpr size_t QUERY_LEAF_PARTICLES = 32;
+
+template<typename Bound, typename Visit>
+void SpatialQuery::walk(float px, float py, float pz, std::vector<int> &stack, Bound &&bound, Visit &&visit) const
+{
+    auto visitRange = [&](std::pair<size_t, size_t> range) {
+        for (size_t k = range.first; k < range.second; ++k)
+            visit(k);
+    };
+
+    stack.assign(1, 0);
+    while (!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+
+        float x = data->nodeX[node], y = data->nodeY[node], z = data->nodeZ[node];
+        float width = data->nodeWidth[node];
+        if (boxDistance2(px, py, pz, x, y, z, width) > bound())
+            continue;
+
+        std::pair<size_t, size_t> range(nodeBegin[node], nodeEnd[node]);
+        if (range.second - range.first <= QUERY_LEAF_PARTICLES || width <= 1.0f)
+        {
+            visitRange(range);
+            continue;
+        }
+
+        // Children go on the stack farthest first, so the nearest is walked first and tightens bound() early
+        std::pair<float, int> children[OCT_CHILD];
+        int childCount = 0;
+        float half = 0.5f * width;
+        bool loose = nodeLoose[node];
+        for (unsigned c = 0; c < OCT_CHILD; ++c)
+        {
+            int child = data->nodeChildren[node][c];
+            if (child == NULL_INDEX && !loose)
+                continue;
+
+            float cx = x + (c & 1 ? half : 0.0f);
+            float cy = y + (c & 2 ? half : 0.0f);
+            float cz = z + (c & 4 ? half : 0.0f);
+            float distance2 = boxDistance2(px, py, pz, cx, cy, cz, half);
+            if (distance2 > bound())
+                continue;
+
+            if (child == NULL_INDEX)
+            {
+                visitRange(keyRange(cx, cy, cz, half));
+                continue;
+            }
+
+            // Insertion into at most eight entries, farthest first
+            int slot = childCount++;
+            while (slot > 0 && children[slot - 1].first < distance2)
+            {
+                children[slot] = children[slot - 1];
+                --slot;
+            }
+            children[slot] = {distance2, child};
+        }
+
+        for (int c = 0; c < childCount; ++c)
+            stack.push_back(children[c].second);
+    }
+}
+
+#endif //NBODY3D_SPATIALQUERY_H
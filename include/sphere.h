@@ -4,6 +4,7 @@
 #include <vector>
 #include "glm/glm.hpp"
 #include "shader.h"
+#include "instancebuffer.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -18,6 +19,11 @@ public:
     void draw(const Shader& shader, const glm::vec3& diffuse, const glm::vec3& specular, const glm::vec3& ambient,
               const glm::vec3& emit, DrawType drawType = DrawType::TRIANGLES);
 
+    // One call for count copies of the mesh, each placed, scaled and coloured by the SphereInstance records
+    // starting at offset in the instance buffer; the mesh should be built with unit size
+    void drawInstanced(const Shader& shader, const InstanceBuffer& instances, size_t offset, int count,
+                       const glm::vec3& specular, const glm::vec3& ambient, const glm::vec3& emit);
+
     glm::mat4 worldMatrix;
 private:
     void buildSphere(int subdivision, float size);
@@ -0,0 +1,13 @@
+#ifndef NBODY3D_SPHEREINSTANCE_H
+#define NBODY3D_SPHEREINSTANCE_H
+
+// Per-instance attributes of one drawn body: position and radius, then colour
+struct SphereInstance
+{
+    float x, y, z;
+    float radius;
+    float r, g, b;
+    float alpha;
+};
+
+#endif //NBODY3D_SPHEREINSTANCE_H
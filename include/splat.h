@@ -0,0 +1,70 @@
+#ifndef NBODY3D_SPLAT_H
+#define NBODY3D_SPLAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Column-major 4x4 matrices laid out as glm stores them, so Camera matrices can be passed with
+// glm::value_ptr. The helpers build the same view and projection as Camera and Render for tools without glm.
+void lookAtMatrix(const float eye[3], const float center[3], const float up[3], float out[16]);
+
+void perspectiveMatrix(float fovY, float aspect, float zNear, float zFar, float out[16]);
+
+void multiplyMatrix(const float a[16], const float b[16], float out[16]);
+
+// Headless density images: bodies are projected through a view-projection matrix and splatted, weighted by
+// mass, into one full-frame accumulation image per thread (width * height floats each); the images are summed
+// in parallel bands of rows, log tone mapped and written as PPM, PNG or raw RGB frames.
+class SplatRenderer
+{
+public:
+    SplatRenderer(int width, int height);
+
+    // Kernel radius in pixels; 1 or less deposits bilinearly onto the four nearest pixels
+    float kernelPixels = 1.0f;
+
+    // World-space smoothing length; when positive the kernel grows for bodies close to the camera
+    float worldRadius = 0.0f;
+
+    // Scales the density at which the log curve turns over, relative to the mean of the lit pixels
+    float exposure = 1.0f;
+
+    // Instantiated for float (shared frames) and double (bodies of a double-precision build)
+    template<typename Coord>
+    void render(const Coord *x, const Coord *y, const Coord *z, const Coord *mass, int count,
+                const float viewProjection[16]);
+
+    int width() const { return imageWidth; }
+
+    int height() const { return imageHeight; }
+
+    // Accumulated mass per pixel of the last render, row 0 at the top
+    const std::vector<float> &density() const { return accumulated; }
+
+    // Tone-mapped RGB8 of the last render
+    const std::vector<uint8_t> &image() const { return pixels; }
+
+    bool writePpm(const std::string &path) const;
+
+    // False when built without libpng
+    bool writePng(const std::string &path) const;
+
+    // Appends the frame as bare RGB24, e.g. for ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH
+    bool writeRaw(std::FILE *stream) const;
+
+private:
+    void splat(float *target, float px, float py, float radius, float weight) const;
+
+    void toneMap();
+
+    int imageWidth;
+    int imageHeight;
+
+    std::vector<std::vector<float>> threadImages;
+    std::vector<float> accumulated;
+    std::vector<uint8_t> pixels;
+};
+
+#endif //NBODY3D_SPLAT_H
@@ -0,0 +1,42 @@
+#ifndef NBODY3D_TRIPLEBUFFER_H
+#define NBODY3D_TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer triple buffer. The producer fills back() and publishes it;
+// the consumer picks up the most recently published slot. Neither side ever waits for the other, and
+// frames the consumer was too slow to see are simply overwritten.
+template<typename T>
+class TripleBuffer
+{
+public:
+    T &back() { return slots[backIndex]; }
+
+    void publish()
+    {
+        backIndex = middle.exchange(backIndex | DIRTY, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Returns true if a newer frame than front() was taken
+    bool consume()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & DIRTY))
+            return false;
+
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr unsigned int DIRTY = 4;
+    static constexpr unsigned int INDEX_MASK = 3;
+
+    T slots[3];
+    std::atomic<unsigned int> middle{1};
+    unsigned int backIndex = 0;
+    unsigned int frontIndex = 2;
+};
+
+#endif //NBODY3D_TRIPLEBUFFER_H
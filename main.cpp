@@ -1,142 +1,177 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
-#include "octree.h"
-#include "bhtree.h"
+#include <string>
+#include "simulation.h"
+#include "initialconditions.h"
 #include "render.h"
 
-float nodeX[MAX_NODES];
-float nodeY[MAX_NODES];
-float nodeZ[MAX_NODES];
-
-float nodeWidth[MAX_NODES];
-float nodeHeight[MAX_NODES];
-float nodeDepth[MAX_NODES];
-
-int nodeParticleIndex[MAX_NODES];
-int nodeChildren[MAX_NODES][OCT_CHILD];
-
-float nodeTotalMass[MAX_NODES];
-float nodeCOM_X[MAX_NODES];
-float nodeCOM_Y[MAX_NODES];
-float nodeCOM_Z[MAX_NODES];
-
-float particleX[MAX_PARTICLES];
-float particleY[MAX_PARTICLES];
-float particleZ[MAX_PARTICLES];
-
-float particleVelX[MAX_PARTICLES];
-float particleVelY[MAX_PARTICLES];
-float particleVelZ[MAX_PARTICLES];
-float particleMass[MAX_PARTICLES];
-float accX[MAX_PARTICLES];
-float accY[MAX_PARTICLES];
-float accZ[MAX_PARTICLES];
-
-unsigned int idxSorted[MAX_PARTICLES];
-
-uint64_t nodeMortonCode[MAX_NODES];
-
-void printNode(int nodeIndex, int depth = 0)
+void printNode(const SimulationData &data, int nodeIndex, int depth = 0)
 {
     for (int i = 0; i < depth; i++)
     {
         std::cout << "  ";
     }
 
-    std::cout << "Node [" << nodeX[nodeIndex] << ", " << nodeY[nodeIndex] << ", " << nodeZ[nodeIndex] << ", "
-              << nodeWidth[nodeIndex] << ", " << nodeTotalMass[nodeIndex] << ", ("
-              << nodeCOM_X[nodeIndex] << ", " << nodeCOM_Y[nodeIndex] << ", " << nodeCOM_Z[nodeIndex] << ") ]";
+    std::cout << "Node [" << data.nodeX[nodeIndex] << ", " << data.nodeY[nodeIndex] << ", " << data.nodeZ[nodeIndex]
+              << ", " << data.nodeWidth[nodeIndex] << ", " << data.nodeTotalMass[nodeIndex] << ", ("
+              << data.nodeCOM_X[nodeIndex] << ", " << data.nodeCOM_Y[nodeIndex] << ", " << data.nodeCOM_Z[nodeIndex]
+              << ") ]";
 
-    if (nodeParticleIndex[nodeIndex] != NULL_INDEX)
+    if (data.nodeParticleIndex[nodeIndex] != NULL_INDEX)
     {
-        std::cout << " Particle: (" << particleX[nodeParticleIndex[nodeIndex]] << ", "
-                  << particleY[nodeParticleIndex[nodeIndex]] << ", "
-                  << particleZ[nodeParticleIndex[nodeIndex]] << ")";
+        std::cout << " Particle: (" << data.particleX[data.nodeParticleIndex[nodeIndex]] << ", "
+                  << data.particleY[data.nodeParticleIndex[nodeIndex]] << ", "
+                  << data.particleZ[data.nodeParticleIndex[nodeIndex]] << ")";
     }
 
     std::cout << std::endl;
 
     for (int i = 0; i < 8; i++)
     {
-        if (nodeChildren[nodeIndex][i] != NULL_INDEX)
+        if (data.nodeChildren[nodeIndex][i] != NULL_INDEX)
         {
-            printNode(nodeChildren[nodeIndex][i], depth + 1);
+            printNode(data, data.nodeChildren[nodeIndex][i], depth + 1);
         }
     }
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    particleX[0] = 0.0f;
-    particleY[0] = 0.0f;
-    particleZ[0] = 0.0f;
-    particleMass[0] = 10.0f;
-
-    particleX[1] = 0.0f;
-    particleY[1] = -5.0f;
-    particleZ[1] = 0.0f;
-    particleMass[1] = 1.0f;
-
-//    particleX[2] = 0.0f;
-//    particleY[2] = 5.0f;
-//    particleZ[2] = 5.0f;
-//    particleMass[2] = 1.0f;
-//
-//    particleX[3] = 0.0f;
-//    particleY[3] = 0.0f;
-//    particleZ[3] = 1.0f;
-//    particleMass[3] = 1.0f;
-
-    SimulationData data{};
-
-    data.particleX = particleX;
-    data.nodeX = nodeX;
-    data.nodeY = nodeY;
-    data.nodeZ = nodeZ;
-    data.nodeWidth = nodeWidth;
-    data.nodeHeight = nodeHeight;
-    data.nodeDepth = nodeDepth;
-    data.nodeParticleIndex = nodeParticleIndex;
-    data.nodeChildren = nodeChildren;
-
-    data.nodeTotalMass = nodeTotalMass;
-    data.nodeCOM_X = nodeCOM_X;
-    data.nodeCOM_Y = nodeCOM_Y;
-    data.nodeCOM_Z = nodeCOM_Z;
-
-    data.particleX = particleX;
-    data.particleY = particleY;
-    data.particleZ = particleZ;
-    data.particleVelX = particleVelX;
-    data.particleVelY = particleVelY;
-    data.particleVelZ = particleVelZ;
-    data.particleMass = particleMass;
-    data.accX = accX;
-    data.accY = accY;
-    data.accZ = accZ;
-    data.idxSorted = idxSorted;
-
-    data.nodeMortonCode = nodeMortonCode;
-
-    Octree tree;
-
-    Render render(1920, 1080);
-
-    Shader shader("../shader/shader.vert", "../shader/shader.frag");
-
-    Camera camera(glm::vec3(-30.0f, 0.0f, 0.0f));
+    // --particles N replaces the two-body scene with N uniform bodies; --frames N and --hidden allow
+    // unattended runs, e.g. LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./NBody3D --hidden --frames 300 --particles 100000
+    // --attach NAME only views the frames nbody_batch --share NAME publishes; --particles then caps the bodies drawn
+    // --replay PREFIX plays back the PREFIX_<step>.nbs snapshots at --speed frames per second
+    // --collide R merges bodies that touch, R being the radius of a unit-mass body
+    // --treepm MESH takes long-range forces from a MESH^3 particle mesh and walks the tree only at short range
+    // --integrator NAME picks leapfrog, yoshida or hermite
+    // --box L wraps the bodies in a periodic cube of side L with Ewald-corrected forces
+    int particles = 2;
+    int frames = 0;
+    bool hidden = false;
+    std::string attach;
+    std::string replay;
+    double speed = 30.0;
+    float collide = 0.0f;
+    int treepm = 0;
+    float box = 0.0f;
+    Integrator integrator = Integrator::LEAPFROG;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--particles" && i + 1 < argc)
+            particles = std::atoi(argv[++i]);
+        else if (arg == "--frames" && i + 1 < argc)
+            frames = std::atoi(argv[++i]);
+        else if (arg == "--hidden")
+            hidden = true;
+        else if (arg == "--attach" && i + 1 < argc)
+            attach = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replay = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc)
+            speed = std::atof(argv[++i]);
+        else if (arg == "--collide" && i + 1 < argc)
+            collide = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--treepm" && i + 1 < argc)
+            treepm = std::atoi(argv[++i]);
+        else if (arg == "--box" && i + 1 < argc)
+            box = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--integrator" && i + 1 < argc && parseIntegrator(argv[i + 1], integrator))
+            ++i;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--particles N] [--frames N] [--hidden] [--attach NAME]"
+                      << " [--replay PREFIX [--speed FPS]] [--collide R] [--treepm MESH] [--box L]"
+                      << " [--integrator leapfrog|yoshida|hermite]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    SnapshotPlayer player;
+    if (!replay.empty())
+    {
+        if (!player.open(replay))
+        {
+            std::cerr << "No snapshots found for " << replay << std::endl;
+            return EXIT_FAILURE;
+        }
+        player.setSpeed(speed);
+        particles = static_cast<int>(player.maxParticles());
+    }
+
+    if (!attach.empty() || !replay.empty())
+    {
+        Render render(1920, 1080, hidden);
+
+        Shader shader("../shader/instanced.vert", "../shader/instanced.frag");
+        Shader spriteShader("../shader/sprite.vert", "../shader/sprite.frag");
+
+        Camera camera(glm::vec3(-3000.0f, 0.0f, 0.0f));
+
+        Light light(glm::vec3 (-1000.0f, 1.0f, 1.0f), glm::vec3 (1.0f, 1.0f, 1.0f),
+                    glm::vec3 (0.5f, 0.5f, 0.5f), glm::vec3 (0.2f, 0.2f, 0.2f));
+
+        render.lightSetup(light);
+        render.sphereSetup(5, 2.0f, particles > 2 ? particles : 1 << 20);
+        render.cameraSetup(camera);
+        render.frameLimitSetup(frames);
+
+        if (!replay.empty())
+            render.drawReplay(shader, spriteShader, player);
+        else
+            render.drawShared(shader, spriteShader, attach);
+        return 0;
+    }
+
+    Simulation simulation(std::max(particles, 2), particles > 2 ? 0 : MAX_NODES);
+    SimulationData &data = simulation.data();
+    simulation.collisionSetup(collide);
+    simulation.integratorSetup(integrator);
+    simulation.treePMSetup(treepm);
+
+    if (particles > 2)
+    {
+        data.theta = 0.5f;
+        generateParticles(data, Distribution::UNIFORM, 1000.0f, static_cast<float>(particles), 1);
+    }
+    else
+    {
+        data.particleX[0] = 0.0f;
+        data.particleY[0] = 0.0f;
+        data.particleZ[0] = 0.0f;
+        data.particleMass[0] = 10.0f;
+
+        data.particleX[1] = 0.0f;
+        data.particleY[1] = -5.0f;
+        data.particleZ[1] = 0.0f;
+        data.particleMass[1] = 1.0f;
+    }
+    simulation.periodicSetup(box, "ewald.tab");
+
+    Render render(1920, 1080, hidden);
+
+    Shader shader("../shader/instanced.vert", "../shader/instanced.frag");
+    Shader spriteShader("../shader/sprite.vert", "../shader/sprite.frag");
+
+    Camera camera(glm::vec3(particles > 2 ? -3000.0f : -30.0f, 0.0f, 0.0f));
 
     Light light(glm::vec3 (-1000.0f, 1.0f, 1.0f), glm::vec3 (1.0f, 1.0f, 1.0f),
                 glm::vec3 (0.5f, 0.5f, 0.5f), glm::vec3 (0.2f, 0.2f, 0.2f));
 
     render.lightSetup(light);
 
-    render.sphereSetup(8, 0.5f, 2);
+    render.sphereSetup(particles > 2 ? 5 : 8, particles > 2 ? 2.0f : 0.5f, data.particleCount);
 
     render.cameraSetup(camera);
 
-    render.draw(shader, data, tree);
+    render.frameLimitSetup(frames);
 
-    printNode(0);
+    // Fixed step matching the old frame-time coupling (deltaTime * 0.1) at 60 Hz
+    render.draw(shader, spriteShader, simulation, 0.1f / 60.0f);
+
+    if (particles <= 2)
+        printNode(data, 0);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,30 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec3 Color;
+
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+uniform vec3 lightDiff, lightSpec, lightAmbi;
+uniform vec3 objSpec, objAmbi, objEmit;
+
+void main()
+{
+    vec3 ambient = lightAmbi * objAmbi;
+
+    vec3 norm = normalize(Normal);
+    vec3 lightDir = normalize(lightPos - FragPos);
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * lightDiff * Color;
+
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = spec * lightSpec * objSpec;
+
+    vec3 result = (ambient + diffuse + specular + objEmit);
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 330 core
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec4 aInstance;
+layout(location = 3) in vec4 aColor;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 Color;
+
+uniform mat4 view, projection;
+
+void main()
+{
+    // Unit mesh scaled by the instance radius, so the normal needs no transform
+    FragPos = aInstance.xyz + aPos * aInstance.w;
+    Normal = aNormal;
+    Color = aColor.rgb;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec4 Color;
+
+void main()
+{
+    vec2 offset = gl_PointCoord * 2.0 - 1.0;
+    float radius = dot(offset, offset);
+    if (radius > 1.0)
+        discard;
+
+    FragColor = vec4(Color.rgb * Color.a * (1.0 - 0.5 * radius), 1.0);
+}
\ No newline at end of file
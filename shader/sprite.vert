@@ -0,0 +1,16 @@
+#version 330 core
+
+layout(location = 2) in vec4 aInstance;
+layout(location = 3) in vec4 aColor;
+
+out vec4 Color;
+
+uniform mat4 view, projection;
+
+void main()
+{
+    // w holds the sprite diameter in pixels; alpha carries impostor brightness
+    Color = aColor;
+    gl_PointSize = aInstance.w;
+    gl_Position = projection * view * vec4(aInstance.xyz, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include "autotune.h"
+#include "bhtree.h"
+#include "omp.h"
+
+// A scheduling candidate replaces the current choice only when it is this much faster, so timer noise does not
+// decide between equivalent settings
+constexpr double TUNE_MARGIN = 0.98;
+
+// Each step down in theta must cut the force error by at least 5% for the scan to go on
+constexpr double TUNE_FLOOR = 0.95;
+
+// Sampled bodies and their direct-sum accelerations, the reference every candidate is measured against
+struct TuneReference
+{
+    std::vector<int> bodies;
+    std::vector<double> accX, accY, accZ;
+};
+
+static TuneReference directReference(const SimulationData &data)
+{
+    TuneReference reference;
+    int stride = std::max(1, data.particleCount / TUNE_SAMPLES);
+    for (int i = 0; i < data.particleCount; i += stride)
+        reference.bodies.push_back(i);
+
+    int samples = static_cast<int>(reference.bodies.size());
+    reference.accX.resize(samples);
+    reference.accY.resize(samples);
+    reference.accZ.resize(samples);
+#pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < samples; ++s)
+    {
+        int i = reference.bodies[s];
+        directAcceleration(i, data);
+        reference.accX[s] = data.accX[i];
+        reference.accY[s] = data.accY[i];
+        reference.accZ[s] = data.accZ[i];
+    }
+    return reference;
+}
+
+// 99th percentile relative error of the accelerations just computed. Not the RMS: a few bodies near the centre
+// of a concentrated system feel almost no net force, their relative error stays near 1 at any theta and would
+// swamp it
+static double forceError(const SimulationData &data, const TuneReference &reference)
+{
+    std::vector<double> errors;
+    errors.reserve(reference.bodies.size());
+    for (size_t s = 0; s < reference.bodies.size(); ++s)
+    {
+        int i = reference.bodies[s];
+        double dx = data.accX[i] - reference.accX[s];
+        double dy = data.accY[i] - reference.accY[s];
+        double dz = data.accZ[i] - reference.accZ[s];
+        double norm = reference.accX[s] * reference.accX[s] + reference.accY[s] * reference.accY[s] +
+                      reference.accZ[s] * reference.accZ[s];
+        if (norm > 0.0)
+            errors.push_back(std::sqrt((dx * dx + dy * dy + dz * dz) / norm));
+    }
+    if (errors.empty())
+        return 0.0;
+
+    auto rank = errors.begin() + static_cast<std::ptrdiff_t>(0.99 * static_cast<double>(errors.size() - 1) + 0.5);
+    std::nth_element(errors.begin(), rank, errors.end());
+    return *rank;
+}
+
+// Fastest of passes force passes; the first after a change of layout or mesh also pays for the allocation
+static double timePasses(Simulation &simulation, int passes)
+{
+    double best = std::numeric_limits<double>::infinity();
+    for (int p = 0; p < std::max(passes, 1); ++p)
+    {
+        auto start = std::chrono::steady_clock::now();
+        simulation.evaluateForces();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Anything but letters, digits, dots and dashes becomes an underscore, so a key is one word of the cache file
+static std::string sanitise(const std::string &text)
+{
+    std::string word = text;
+    for (char &c: word)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-')
+            c = '_';
+    }
+    return word;
+}
+
+static bool loadCached(const std::string &path, const std::string &key, TuneResult &result)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string entry;
+        TuneConfig config;
+        int compact = 0;
+        double seconds = 0.0, error = 0.0;
+        if (fields >> entry >> config.theta >> compact >> config.treepmMesh >> config.walkChunk >> config.threads
+                   >> seconds >> error && entry == key)
+        {
+            config.compactNodes = compact != 0;
+            result.config = config;
+            result.seconds = seconds;
+            result.forceError = error;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Replaces the entry of key, keeping every other line
+static void storeCached(const std::string &path, const std::string &key, const TuneResult &result)
+{
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.compare(0, key.size() + 1, key + " ") != 0)
+                lines.push_back(line);
+        }
+    }
+
+    std::ostringstream entry;
+    const TuneConfig &config = result.config;
+    entry << key << " " << config.theta << " " << (config.compactNodes ? 1 : 0) << " " << config.treepmMesh << " "
+          << config.walkChunk << " " << config.threads << " " << result.seconds << " " << result.forceError;
+    lines.push_back(entry.str());
+
+    std::ofstream file(path);
+    for (const std::string &line: lines)
+        file << line << "\n";
+    if (!file)
+        std::cerr << "Failed to write the tuning cache " << path << std::endl;
+}
+
+std::string machineSignature()
+{
+    std::string model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") == 0)
+        {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos)
+                model = line.substr(line.find_first_not_of(' ', colon + 1));
+            break;
+        }
+    }
+    return sanitise(model) + "-" + std::to_string(omp_get_num_procs()) + "cpu";
+}
+
+std::string problemSignature(const Simulation &simulation, const TuneOptions &options)
+{
+    const SimulationData &data = simulation.data();
+    std::ostringstream signature;
+    signature << "n" << std::lround(2.0 * std::log2(std::max(data.particleCount, 1))) << "-depth"
+              << simulation.tree().depth();
+    if (data.boxSize > 0.0f)
+        signature << "-box";
+    if (const ParticleMesh *mesh = simulation.particleMesh())
+        signature << "-pm" << mesh->meshSize();
+    else if (options.searchTreePM)
+        signature << "-pmsearch";
+
+    char budget[32];
+    std::snprintf(budget, sizeof(budget), "%.3g", options.errorBudget);
+    signature << "-" << integratorName(simulation.integrator()) << "-" << Precision::name << "-err" << budget
+              << "-threads" << omp_get_max_threads();
+    return sanitise(signature.str());
+}
+
+void applyTuneConfig(Simulation &simulation, const TuneConfig &config)
+{
+    SimulationData &data = simulation.data();
+    data.theta = config.theta;
+    data.walkChunk = config.walkChunk;
+    if (simulation.compactNodesEnabled() != config.compactNodes)
+        simulation.compactNodesSetup(config.compactNodes);
+
+    const ParticleMesh *mesh = simulation.particleMesh();
+    if ((mesh ? mesh->meshSize() : 0) != config.treepmMesh)
+        simulation.treePMSetup(config.treepmMesh);
+    omp_set_num_threads(config.threads);
+}
+
+TuneResult autotune(Simulation &simulation, const TuneOptions &options)
+{
+    SimulationData &data = simulation.data();
+    int maxThreads = omp_get_max_threads();
+
+    // A first pass with the current settings builds the tree the signature reads and warms the caches
+    simulation.evaluateForces();
+
+    TuneResult result;
+    result.key = machineSignature() + "/" + problemSignature(simulation, options);
+    if (!options.cachePath.empty() && loadCached(options.cachePath, result.key, result))
+    {
+        result.cached = true;
+        result.withinBudget = result.forceError <= options.errorBudget;
+        applyTuneConfig(simulation, result.config);
+        return result;
+    }
+
+    TuneReference reference = directReference(data);
+
+    std::vector<int> meshes;
+    if (const ParticleMesh *mesh = simulation.particleMesh())
+    {
+        meshes.push_back(mesh->meshSize());
+    }
+    else
+    {
+        meshes.push_back(0);
+        // Meshes of up to four cells per body; finer ones only add FFT work
+        bool treePM = options.searchTreePM && data.boxSize <= 0.0f && simulation.integrator() != Integrator::HERMITE;
+        for (int size = 16; treePM && static_cast<double>(size) * size * size <= 4.0 * data.particleCount; size *= 2)
+            meshes.push_back(size);
+    }
+
+    TuneConfig base;
+    base.walkChunk = data.walkChunk;
+    base.threads = maxThreads;
+
+    // One angle per solver and layout: the largest within the budget, scanning down from the cheapest. Where the
+    // error stops falling with theta it is set by something else (bodies sharing a unit cell, the mesh) and
+    // smaller angles would only cost more, so the scan stops there over budget with the last, larger angle
+    struct Choice
+    {
+        TuneConfig config;
+        double error;
+        double seconds;
+    };
+    std::vector<Choice> within, over;
+    for (int mesh: meshes)
+    {
+        for (bool compact: {false, true})
+        {
+            TuneConfig candidate = base;
+            candidate.treepmMesh = mesh;
+            candidate.compactNodes = compact;
+            Choice choice{candidate, std::numeric_limits<double>::infinity(), 0.0};
+            bool admitted = false;
+            for (int t = static_cast<int>(std::size(TUNE_THETAS)) - 1; t >= 0; --t)
+            {
+                candidate.theta = TUNE_THETAS[t];
+                applyTuneConfig(simulation, candidate);
+                simulation.evaluateForces();
+                ++result.candidates;
+
+                double error = forceError(data, reference);
+                admitted = error <= options.errorBudget;
+                if (!admitted && error > TUNE_FLOOR * choice.error)
+                    break;
+                choice.config = candidate;
+                choice.error = error;
+                if (admitted)
+                    break;
+            }
+
+            applyTuneConfig(simulation, choice.config);
+            choice.seconds = timePasses(simulation, options.passes);
+            (admitted ? within : over).push_back(choice);
+        }
+    }
+
+    // Fastest within the budget; failing that, the fastest of those close to the lowest error reached
+    std::vector<Choice> &pool = within.empty() ? over : within;
+    if (within.empty())
+    {
+        double floor = std::min_element(pool.begin(), pool.end(), [](const Choice &a, const Choice &b) {
+            return a.error < b.error;
+        })->error;
+        std::erase_if(pool, [&](const Choice &c) { return c.error > floor / TUNE_FLOOR; });
+        std::cerr << "No solver setting meets the force error budget " << options.errorBudget
+                  << "; the lowest error reached is " << floor << std::endl;
+        result.withinBudget = false;
+    }
+    const Choice &fastest = *std::min_element(pool.begin(), pool.end(), [](const Choice &a, const Choice &b) {
+        return a.seconds < b.seconds;
+    });
+    TuneConfig best = fastest.config;
+    double bestSeconds = fastest.seconds;
+    double bestError = fastest.error;
+
+    // Scheduling leaves the forces as they are and only changes their cost
+    for (int chunk: TUNE_CHUNKS)
+    {
+        if (chunk == best.walkChunk)
+            continue;
+        TuneConfig candidate = best;
+        candidate.walkChunk = chunk;
+        applyTuneConfig(simulation, candidate);
+        double seconds = timePasses(simulation, options.passes);
+        ++result.candidates;
+        if (seconds < TUNE_MARGIN * bestSeconds)
+        {
+            best = candidate;
+            bestSeconds = seconds;
+        }
+    }
+    for (int threads = maxThreads / 2; threads >= 1; threads /= 2)
+    {
+        TuneConfig candidate = best;
+        candidate.threads = threads;
+        applyTuneConfig(simulation, candidate);
+        double seconds = timePasses(simulation, options.passes);
+        ++result.candidates;
+        if (seconds < TUNE_MARGIN * bestSeconds)
+        {
+            best = candidate;
+            bestSeconds = seconds;
+        }
+    }
+
+    applyTuneConfig(simulation, best);
+    result.config = best;
+    result.seconds = bestSeconds;
+    result.forceError = bestError;
+    if (!options.cachePath.empty())
+        storeCached(options.cachePath, result.key, result);
+    return result;
+}
@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <stack>
 #include <iostream>
 #include "bhtree.h"
+#include "compactnode.h"
+#include "ewald.h"
+#include "profiler.h"
 #include "omp.h"
 
-bool isParticleInNode(float pX, float pY, float pZ, float nX, float nY, float nZ, float nW, float nH, float nD)
+bool isParticleInNode(Real pX, Real pY, Real pZ, NodeReal nX, NodeReal nY, NodeReal nZ, NodeReal nW, NodeReal nH,
+                      NodeReal nD)
 {
     return pX >= nX && pX <= nX + nW &&
            pY >= nY && pY <= nY + nH &&
@@ -21,36 +26,224 @@ bool noChildren(const SimulationData &data, int nodeIndex)
     return true;
 }
 
-void netAcceleration(int particleIdx, const SimulationData &data)
+// TreePM short-range factors at separation r for split scale rs: the force and potential fractions the
+// mesh does not supply. erfc is the Abramowitz-Stegun 7.1.26 fit (error below 1.5e-7), which shares its
+// exponential with the force term
+static inline void shortRange(float r, float rs, float &forceFactor, float &potentialFactor)
+{
+    float u = r / (2.0f * rs);
+    float gauss = std::exp(-u * u);
+    float t = 1.0f / (1.0f + 0.3275911f * u);
+    float poly = t * (0.254829592f + t * (-0.284496736f + t * (1.421413741f + t * (-1.453152027f + t * 1.061405429f))));
+    potentialFactor = poly * gauss;
+    forceFactor = (poly + 1.1283791671f * u) * gauss;
+}
+
+// Nearest periodic image of a separation along one axis
+static inline ForceReal minimumImage(ForceReal d, ForceReal box, ForceReal invBox)
+{
+    return d - box * std::floor(d * invBox + ForceReal(0.5));
+}
+
+// The Ewald correction varies on the scale of the box, so it is taken once for a whole node as soon as the walk
+// reaches one this narrow (in box sides); its descendants are then pushed bitwise negated and skip it. The
+// monopole leaves an error near 1e-3 of the RMS force, below the opening-angle error for theta above ~0.2
+constexpr float EWALD_NODE_FRACTION = 0.25f;
+
+// The walk reads a node through one of two views: the full streams, or the compact record with its cell
+// decoded once per visit. Cells are cubes, so one width serves every axis
+struct FullNode
+{
+    const SimulationData &data;
+    int index;
+
+    NodeReal x() const { return data.nodeX[index]; }
+    NodeReal y() const { return data.nodeY[index]; }
+    NodeReal z() const { return data.nodeZ[index]; }
+    NodeReal width() const { return data.nodeWidth[index]; }
+    NodeReal comX() const { return data.nodeCOM_X[index]; }
+    NodeReal comY() const { return data.nodeCOM_Y[index]; }
+    NodeReal comZ() const { return data.nodeCOM_Z[index]; }
+    NodeReal mass() const { return data.nodeTotalMass[index]; }
+    bool leaf() const { return noChildren(data, index); }
+};
+
+struct PackedNode
+{
+    PackedNode(const SimulationData &data, int index)
+    {
+        const CompactNode &node = data.compactNodes[index];
+        compactCell(node.code, cellX, cellY, cellZ, cellWidth);
+        NodeReal step = cellWidth / COMPACT_OFFSET_SCALE;
+        centre[0] = cellX + step * node.com[0];
+        centre[1] = cellY + step * node.com[1];
+        centre[2] = cellZ + step * node.com[2];
+        nodeMass = fromBFloat16(node.mass);
+        isLeaf = (node.code & COMPACT_LEAF) != 0;
+    }
+
+    NodeReal x() const { return cellX; }
+    NodeReal y() const { return cellY; }
+    NodeReal z() const { return cellZ; }
+    NodeReal width() const { return cellWidth; }
+    NodeReal comX() const { return centre[0]; }
+    NodeReal comY() const { return centre[1]; }
+    NodeReal comZ() const { return centre[2]; }
+    NodeReal mass() const { return nodeMass; }
+    bool leaf() const { return isLeaf; }
+
+    NodeReal cellX, cellY, cellZ, cellWidth;
+    NodeReal centre[3];
+    NodeReal nodeMass;
+    bool isLeaf;
+};
+
+template<bool WithPotential, bool Split, bool Periodic, bool WithJerk = false, typename Node = FullNode>
+static int treeWalk(int particleIdx, const SimulationData &data)
 {
     std::stack<int> stack;
     stack.push(0);
 
-    Gravitational gravity;
+    Gravitational gravity{data.softening};
+
+    // Sums are kept in the body precision, each interaction in the force precision
+    Real sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+    Real potential = 0.0;
+    Real jerkX = 0.0, jerkY = 0.0, jerkZ = 0.0;
+
+    Real px = data.particleX[particleIdx], py = data.particleY[particleIdx], pz = data.particleZ[particleIdx];
+
+    ForceReal box = data.boxSize;
+    ForceReal invBox = Periodic ? ForceReal(1.0) / box : ForceReal(0.0);
+
+    int visited = 0;
+    int particleInteractions = 0;
+    int nodeInteractions = 0;
 
     while (!stack.empty())
     {
         auto top = stack.top();
         stack.pop();
+        ++visited;
+
+        bool corrected = false;
+        if constexpr (Periodic)
+        {
+            corrected = top < 0;
+            if (corrected)
+                top = ~top;
+        }
 
-        float distX = data.particleX[particleIdx] - data.nodeCOM_X[top];
-        float distY = data.particleY[particleIdx] - data.nodeCOM_Y[top];
-        float distZ = data.particleZ[particleIdx] - data.nodeCOM_Z[top];
-        float dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
+        Node node{data, top};
 
-        // Check if the current node is sufficiently far away or a leaf node
-        if ((data.nodeWidth[top] / dist <= THETA) || noChildren(data, top))
+        // Nodes wholly beyond the cutoff contribute only through the mesh
+        if constexpr (Split)
+        {
+            auto gap = [](Real p, NodeReal low, NodeReal width) {
+                return static_cast<ForceReal>(std::max({low - p, p - low - width, Real(0.0)}));
+            };
+            ForceReal gapX = gap(px, node.x(), node.width());
+            ForceReal gapY = gap(py, node.y(), node.width());
+            ForceReal gapZ = gap(pz, node.z(), node.width());
+            if (gapX * gapX + gapY * gapY + gapZ * gapZ > data.splitCutoff * data.splitCutoff)
+                continue;
+        }
+
+        // The separation is taken in the body precision before rounding, so it keeps its relative accuracy far
+        // from the origin
+        auto distX = static_cast<ForceReal>(px - node.comX());
+        auto distY = static_cast<ForceReal>(py - node.comY());
+        auto distZ = static_cast<ForceReal>(pz - node.comZ());
+        if constexpr (Periodic)
+        {
+            distX = minimumImage(distX, box, invBox);
+            distY = minimumImage(distY, box, invBox);
+            distZ = minimumImage(distZ, box, invBox);
+        }
+        ForceReal dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
+
+        // Check if the current node is sufficiently far away or a leaf node. In a periodic box nodes wider than
+        // half the box have no single nearest image, so they are always opened
+        bool leaf = node.leaf();
+        bool far = node.width() / dist <= data.theta;
+        bool inside = (Periodic || far || leaf) &&
+                      isParticleInNode(px, py, pz, node.x(), node.y(), node.z(),
+                                       node.width(), node.width(), node.width());
+        if constexpr (Periodic)
+        {
+            far = far && node.width() <= 0.5f * box;
+            // A node still being opened is only corrected as a whole once it sits inside the body's
+            // minimum-image cell, so every descendant shares the node's image
+            bool coarse = node.width() <= EWALD_NODE_FRACTION * box &&
+                          std::max({std::fabs(distX), std::fabs(distY), std::fabs(distZ)}) +
+                          node.width() <= 0.5f * box;
+            if (!corrected && (far || leaf || coarse))
+            {
+                // Monopole of the node's images; the body's own mass is taken out of a node that holds it
+                ForceReal m = node.mass();
+                ForceReal cx = distX, cy = distY, cz = distZ;
+                if (inside)
+                {
+                    auto self = static_cast<ForceReal>(data.particleMass[particleIdx]);
+                    m -= self;
+                    ForceReal shift = m > 0.0f ? self / m : ForceReal(0.0);
+                    cx = minimumImage(cx + shift * distX, box, invBox);
+                    cy = minimumImage(cy + shift * distY, box, invBox);
+                    cz = minimumImage(cz + shift * distZ, box, invBox);
+                }
+                if (m > 0.0f)
+                {
+                    float ex, ey, ez, ep;
+                    data.ewald->correction(cx, cy, cz, invBox, ex, ey, ez, ep);
+                    sumX += m * ex;
+                    sumY += m * ey;
+                    sumZ += m * ez;
+                    potential += m * ep;
+                }
+                corrected = true;
+            }
+        }
+        if (far || leaf)
         {
             // Ensure the particle is not in the current node
-            if (!isParticleInNode(data.particleX[particleIdx], data.particleY[particleIdx], data.particleZ[particleIdx],
-                                  data.nodeX[top], data.nodeY[top], data.nodeZ[top],
-                                  data.nodeWidth[top], data.nodeHeight[top], data.nodeDepth[top]))
+            if (!inside)
             {
                 // Add gravitational acceleration from the current node to the particle
-                vec tmp = gravity(data.nodeTotalMass[top], distX, distY, distZ);
-                data.accX[particleIdx] += tmp.x;
-                data.accY[particleIdx] += tmp.y;
-                data.accY[particleIdx] += tmp.z;
+                vec tmp;
+                ForceReal nodePotential = 0.0f;
+                if constexpr (WithJerk)
+                {
+                    vec nodeJerk{0.0f, 0.0f, 0.0f};
+                    tmp = gravity(node.mass(), distX, distY, distZ,
+                                  static_cast<ForceReal>(data.particleVelX[particleIdx] - data.nodeVelX[top]),
+                                  static_cast<ForceReal>(data.particleVelY[particleIdx] - data.nodeVelY[top]),
+                                  static_cast<ForceReal>(data.particleVelZ[particleIdx] - data.nodeVelZ[top]),
+                                  nodeJerk, nodePotential);
+                    jerkX += nodeJerk.x;
+                    jerkY += nodeJerk.y;
+                    jerkZ += nodeJerk.z;
+                }
+                else if constexpr (WithPotential)
+                    tmp = gravity(node.mass(), distX, distY, distZ, nodePotential);
+                else
+                    tmp = gravity(node.mass(), distX, distY, distZ);
+
+                if constexpr (Split)
+                {
+                    float forceFactor, potentialFactor;
+                    shortRange(dist, data.splitRadius, forceFactor, potentialFactor);
+                    tmp = {tmp.x * forceFactor, tmp.y * forceFactor, tmp.z * forceFactor};
+                    nodePotential *= potentialFactor;
+                }
+                potential += nodePotential;
+                sumX += tmp.x;
+                sumY += tmp.y;
+                sumZ += tmp.z;
+
+                if (leaf)
+                    ++particleInteractions;
+                else
+                    ++nodeInteractions;
             }
         }
         else
@@ -59,56 +252,189 @@ void netAcceleration(int particleIdx, const SimulationData &data)
             for (int i = 0; i < OCT_CHILD; ++i)
             {
                 if (data.nodeChildren[top][i] != NULL_INDEX)
-                    stack.push(data.nodeChildren[top][i]);
+                    stack.push(corrected ? ~data.nodeChildren[top][i] : data.nodeChildren[top][i]);
             }//error?
         }
     }
-}
 
-void boundaryDetection(int particleIdx, float offset, const SimulationData &data)
-{
-    if (data.particleVelX[particleIdx] > 0 && data.particleX[particleIdx] > data.nodeWidth[0])
+    data.accX[particleIdx] = sumX;
+    data.accY[particleIdx] = sumY;
+    data.accZ[particleIdx] = sumZ;
+    if constexpr (WithPotential)
+        data.potential[particleIdx] = potential;
+    if constexpr (WithJerk)
     {
-        data.particleVelX[particleIdx] = -data.particleVelX[particleIdx];
-        data.particleX[particleIdx] = data.nodeWidth[0] - data.nodeX[0] - offset;
-    }
-    else if (data.particleVelX[particleIdx] < 0 && data.particleX[particleIdx] < 0)
-    {
-        data.particleVelX[particleIdx] = -data.particleVelX[particleIdx];
-        data.particleX[particleIdx] = data.nodeX[0] + offset;
+        data.jerkX[particleIdx] = jerkX;
+        data.jerkY[particleIdx] = jerkY;
+        data.jerkZ[particleIdx] = jerkZ;
     }
 
-    if (data.particleVelY[particleIdx] > 0 && data.particleY[particleIdx] > data.nodeHeight[0])
-    {
-        data.particleVelY[particleIdx] = -data.particleVelY[particleIdx];
-        data.particleY[particleIdx] = data.nodeHeight[0] - data.nodeY[0] - offset;
-    }
-    else if (data.particleVelY[particleIdx] < 0 && data.particleY[particleIdx] < 0)
+    PROFILE_COUNT(Counter::NODES_VISITED, visited);
+    PROFILE_COUNT(Counter::PARTICLE_PARTICLE, particleInteractions);
+    PROFILE_COUNT(Counter::PARTICLE_NODE, nodeInteractions);
+
+    return particleInteractions + nodeInteractions;
+}
+
+template<typename Node>
+static int dispatchWalk(int particleIdx, const SimulationData &data)
+{
+    bool withPotential = data.potential != nullptr;
+    if (data.jerkX != nullptr)
+        return withPotential ? treeWalk<true, false, false, true, Node>(particleIdx, data)
+                             : treeWalk<false, false, false, true, Node>(particleIdx, data);
+    if (data.boxSize > 0.0f)
+        return withPotential ? treeWalk<true, false, true, false, Node>(particleIdx, data)
+                             : treeWalk<false, false, true, false, Node>(particleIdx, data);
+    if (data.splitRadius > 0.0f)
+        return withPotential ? treeWalk<true, true, false, false, Node>(particleIdx, data)
+                             : treeWalk<false, true, false, false, Node>(particleIdx, data);
+    return withPotential ? treeWalk<true, false, false, false, Node>(particleIdx, data)
+                         : treeWalk<false, false, false, false, Node>(particleIdx, data);
+}
+
+int netAcceleration(int particleIdx, const SimulationData &data)
+{
+    if (data.compactNodes != nullptr)
+        return dispatchWalk<PackedNode>(particleIdx, data);
+    return dispatchWalk<FullNode>(particleIdx, data);
+}
+
+// Walks for a point rather than a body, so there is no self term to exclude; in a periodic box the nearest image
+// of every node is taken and corrected for the others on its own
+template<bool Periodic, typename Node>
+static Real pointPotential(Real px, Real py, Real pz, const SimulationData &data)
+{
+    std::stack<int> stack;
+    stack.push(0);
+
+    Gravitational gravity{data.softening};
+    ForceReal box = data.boxSize;
+    ForceReal invBox = Periodic ? ForceReal(1.0) / box : ForceReal(0.0);
+
+    Real potential = 0.0;
+    while (!stack.empty())
     {
-        data.particleVelY[particleIdx] = -data.particleVelY[particleIdx];
-        data.particleY[particleIdx] = data.nodeY[0] + offset;
+        int top = stack.top();
+        stack.pop();
+
+        Node node{data, top};
+        auto distX = static_cast<ForceReal>(px - node.comX());
+        auto distY = static_cast<ForceReal>(py - node.comY());
+        auto distZ = static_cast<ForceReal>(pz - node.comZ());
+        if constexpr (Periodic)
+        {
+            distX = minimumImage(distX, box, invBox);
+            distY = minimumImage(distY, box, invBox);
+            distZ = minimumImage(distZ, box, invBox);
+        }
+        ForceReal dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
+
+        bool far = node.width() / dist <= data.theta && (!Periodic || node.width() <= 0.5f * box);
+        if (far || node.leaf())
+        {
+            ForceReal nodePotential = 0.0f;
+            gravity(node.mass(), distX, distY, distZ, nodePotential);
+            if constexpr (Periodic)
+            {
+                float ex, ey, ez, ep;
+                data.ewald->correction(distX, distY, distZ, invBox, ex, ey, ez, ep);
+                nodePotential += node.mass() * ep;
+            }
+            potential += nodePotential;
+            continue;
+        }
+
+        for (unsigned i = 0; i < OCT_CHILD; ++i)
+        {
+            if (data.nodeChildren[top][i] != NULL_INDEX)
+                stack.push(data.nodeChildren[top][i]);
+        }
     }
+    return potential;
+}
+
+Real treePotential(Real px, Real py, Real pz, const SimulationData &data)
+{
+    bool periodic = data.boxSize > 0.0f;
+    if (data.compactNodes != nullptr)
+        return periodic ? pointPotential<true, PackedNode>(px, py, pz, data)
+                        : pointPotential<false, PackedNode>(px, py, pz, data);
+    return periodic ? pointPotential<true, FullNode>(px, py, pz, data)
+                    : pointPotential<false, FullNode>(px, py, pz, data);
+}
+
+int directAcceleration(int particleIdx, const SimulationData &data)
+{
+    Gravitational gravity{data.softening};
 
-    if (data.particleVelZ[particleIdx] > 0 && data.particleZ[particleIdx] > data.nodeDepth[0])
+    ForceReal box = data.boxSize;
+    ForceReal invBox = box > 0.0f ? ForceReal(1.0) / box : ForceReal(0.0);
+
+    bool withPotential = data.potential != nullptr;
+    double sumX = 0.0, sumY = 0.0, sumZ = 0.0, potential = 0.0;
+    int interactions = 0;
+    for (int j = 0; j < data.particleCount; ++j)
     {
-        data.particleVelZ[particleIdx] = -data.particleVelZ[particleIdx];
-        data.particleZ[particleIdx] = data.nodeDepth[0] - data.nodeZ[0] - offset;
+        if (j == particleIdx || data.particleMass[j] <= 0.0f)
+            continue;
+        ++interactions;
+
+        auto dx = static_cast<ForceReal>(data.particleX[particleIdx] - data.particleX[j]);
+        auto dy = static_cast<ForceReal>(data.particleY[particleIdx] - data.particleY[j]);
+        auto dz = static_cast<ForceReal>(data.particleZ[particleIdx] - data.particleZ[j]);
+        if (box > 0.0f)
+        {
+            dx = minimumImage(dx, box, invBox);
+            dy = minimumImage(dy, box, invBox);
+            dz = minimumImage(dz, box, invBox);
+        }
+
+        ForceReal pairPotential = 0.0f;
+        vec tmp = withPotential ? gravity(data.particleMass[j], dx, dy, dz, pairPotential)
+                                : gravity(data.particleMass[j], dx, dy, dz);
+        potential += pairPotential;
+        sumX += tmp.x;
+        sumY += tmp.y;
+        sumZ += tmp.z;
+
+        if (box > 0.0f)
+        {
+            float ex, ey, ez, ep;
+            data.ewald->correction(dx, dy, dz, invBox, ex, ey, ez, ep);
+            sumX += data.particleMass[j] * ex;
+            sumY += data.particleMass[j] * ey;
+            sumZ += data.particleMass[j] * ez;
+            potential += data.particleMass[j] * ep;
+        }
     }
-    else if (data.particleVelZ[particleIdx] < 0 && data.particleZ[particleIdx] < 0)
+
+    data.accX[particleIdx] = static_cast<Real>(sumX);
+    data.accY[particleIdx] = static_cast<Real>(sumY);
+    data.accZ[particleIdx] = static_cast<Real>(sumZ);
+    if (withPotential)
+        data.potential[particleIdx] = static_cast<Real>(potential);
+    return interactions;
+}
+
+void wrapPositions(const SimulationData &data)
+{
+    Real box = data.boxSize;
+    if (box <= 0.0f)
+        return;
+
+    Real invBox = 1.0 / box;
+    Real *x = data.particleX, *y = data.particleY, *z = data.particleZ;
+#pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < data.particleCount; ++i)
     {
-        data.particleVelZ[particleIdx] = -data.particleVelZ[particleIdx];
-        data.particleZ[particleIdx] = data.nodeZ[0] + offset;
+        x[i] = wrapCoordinate(x[i], box, invBox);
+        y[i] = wrapCoordinate(y[i], box, invBox);
+        z[i] = wrapCoordinate(z[i], box, invBox);
     }
 }
 
 void updateAllParticles(float damping, float dt, const SimulationData &data)
 {
     Velocity_Verlet<decltype(&netAcceleration)> (netAcceleration, damping, dt, data);
-
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
-    {
-        //boundaryDetection(i, 1.0f, data);
-        //todo: fix boundarydetection error(minimum is not 0)
-    }
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include "collisions.h"
+#include "profiler.h"
+#include "omp.h"
+
+CollisionStage::CollisionStage(float radius)
+        : unitRadius(radius)
+{
+}
+
+int CollisionStage::apply(SimulationData &data, const Octree &tree)
+{
+    PROFILE_PHASE(Phase::COLLIDE);
+
+    lastStats.candidates = 0;
+    lastStats.merged = 0;
+    if (data.particleCount < 2 || unitRadius <= 0.0f)
+        return 0;
+
+    findPairs(data, tree);
+    lastStats.candidates = static_cast<int>(pairs.size());
+    if (pairs.empty())
+        return 0;
+
+    lastStats.merged = mergeGroups(data);
+    lastStats.totalMerged += lastStats.merged;
+    return compact(data);
+}
+
+void CollisionStage::findPairs(const SimulationData &data, const Octree &tree)
+{
+    int n = data.particleCount;
+    query.update(data, tree);
+
+    Real maxMass = 0.0f;
+#pragma omp parallel for schedule(static) reduction(max:maxMass)
+    for (int i = 0; i < n; ++i)
+        maxMass = std::max(maxMass, data.particleMass[i]);
+    float maxRadius = unitRadius * std::cbrt(maxMass);
+
+    threadPairs.resize(omp_get_max_threads());
+    for (auto &list: threadPairs)
+        list.clear();
+
+#pragma omp parallel
+    {
+        std::vector<std::pair<int, int>> &found = threadPairs[omp_get_thread_num()];
+        std::vector<int> stack;
+
+        // Bodies in Morton order, so neighbouring iterations walk the same part of the tree
+#pragma omp for schedule(dynamic, 256)
+        for (int k = 0; k < n; ++k)
+        {
+            int i = query.particle(k);
+            if (data.particleMass[i] <= 0.0f)
+                continue;
+
+            float px = query.x(k), py = query.y(k), pz = query.z(k);
+            float ri = unitRadius * std::cbrt(data.particleMass[i]);
+            float reach = ri + maxRadius;
+
+            query.walk(px, py, pz, stack, [reach]() { return reach * reach; }, [&](size_t m) {
+                int j = query.particle(m);
+                if (j <= i || data.particleMass[j] <= 0.0f)
+                    return;
+                float dx = query.x(m) - px, dy = query.y(m) - py, dz = query.z(m) - pz;
+                float touch = ri + unitRadius * std::cbrt(data.particleMass[j]);
+                if (dx * dx + dy * dy + dz * dz < touch * touch)
+                    found.emplace_back(i, j);
+            });
+        }
+    }
+
+    pairs.clear();
+    for (const auto &list: threadPairs)
+        pairs.insert(pairs.end(), list.begin(), list.end());
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
+
+int CollisionStage::mergeGroups(SimulationData &data)
+{
+    // Union-find over the bodies in pairs only; every group is rooted at its lowest index
+    parent.resize(data.particleCount);
+    for (const auto &[a, b]: pairs)
+    {
+        parent[a] = a;
+        parent[b] = b;
+    }
+
+    auto find = [this](int i) {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    for (const auto &[a, b]: pairs)
+    {
+        int ra = find(a), rb = find(b);
+        if (ra != rb)
+            parent[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    // Members sorted by root, so each group is one run
+    std::vector<std::pair<int, int>> members;
+    members.reserve(2 * pairs.size());
+    for (const auto &[a, b]: pairs)
+    {
+        members.emplace_back(find(a), a);
+        members.emplace_back(find(b), b);
+    }
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+
+    std::vector<size_t> groupStart;
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        if (m == 0 || members[m].first != members[m - 1].first)
+            groupStart.push_back(m);
+    }
+    groupStart.push_back(members.size());
+
+    removed.assign(data.particleCount, 0);
+    int groups = static_cast<int>(groupStart.size()) - 1;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int g = 0; g < groups; ++g)
+    {
+        double mass = 0.0, position[3] = {}, momentum[3] = {};
+        for (size_t m = groupStart[g]; m < groupStart[g + 1]; ++m)
+        {
+            int p = members[m].second;
+            double pm = data.particleMass[p];
+            mass += pm;
+            position[0] += pm * data.particleX[p];
+            position[1] += pm * data.particleY[p];
+            position[2] += pm * data.particleZ[p];
+            momentum[0] += pm * data.particleVelX[p];
+            momentum[1] += pm * data.particleVelY[p];
+            momentum[2] += pm * data.particleVelZ[p];
+        }
+
+        int survivor = members[groupStart[g]].first;
+        data.particleMass[survivor] = static_cast<Real>(mass);
+        data.particleX[survivor] = static_cast<Real>(position[0] / mass);
+        data.particleY[survivor] = static_cast<Real>(position[1] / mass);
+        data.particleZ[survivor] = static_cast<Real>(position[2] / mass);
+        data.particleVelX[survivor] = static_cast<Real>(momentum[0] / mass);
+        data.particleVelY[survivor] = static_cast<Real>(momentum[1] / mass);
+        data.particleVelZ[survivor] = static_cast<Real>(momentum[2] / mass);
+
+        for (size_t m = groupStart[g] + 1; m < groupStart[g + 1]; ++m)
+            removed[members[m].second] = 1;
+    }
+
+    return static_cast<int>(members.size()) - groups;
+}
+
+int CollisionStage::compact(SimulationData &data)
+{
+    int n = data.particleCount;
+
+    destination.resize(n);
+    int alive = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        destination[i] = alive;
+        alive += removed[i] ? 0 : 1;
+    }
+
+    // Stable, so the survivors keep their relative order and the next sort starts nearly sorted
+    scratch.resize(alive);
+    Real *streams[] = {data.particleX, data.particleY, data.particleZ, data.particleVelX, data.particleVelY,
+                       data.particleVelZ, data.particleMass, data.accX, data.accY, data.accZ};
+    for (Real *stream: streams)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; ++i)
+        {
+            if (!removed[i])
+                scratch[destination[i]] = stream[i];
+        }
+        std::copy(scratch.begin(), scratch.end(), stream);
+    }
+
+    data.particleCount = alive;
+    return n - alive;
+}
@@ -0,0 +1,71 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cmath>
+#include "omp.h"
+
+Diagnostics computeDiagnostics(const SimulationData &data)
+{
+    double kinetic = 0.0, potential = 0.0;
+    double px = 0.0, py = 0.0, pz = 0.0;
+    double lx = 0.0, ly = 0.0, lz = 0.0;
+
+    // Double accumulators; float sums over 1e6 bodies lose the drift we are trying to measure
+#pragma omp parallel for schedule(static) reduction(+:kinetic, potential, px, py, pz, lx, ly, lz)
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        double m = data.particleMass[i];
+        double x = data.particleX[i], y = data.particleY[i], z = data.particleZ[i];
+        double vx = data.particleVelX[i], vy = data.particleVelY[i], vz = data.particleVelZ[i];
+
+        kinetic += 0.5 * m * (vx * vx + vy * vy + vz * vz);
+        potential += 0.5 * m * data.potential[i];
+
+        px += m * vx;
+        py += m * vy;
+        pz += m * vz;
+
+        lx += m * (y * vz - z * vy);
+        ly += m * (z * vx - x * vz);
+        lz += m * (x * vy - y * vx);
+    }
+
+    Diagnostics diagnostics;
+    diagnostics.kinetic = kinetic;
+    diagnostics.potential = potential;
+    diagnostics.total = kinetic + potential;
+    diagnostics.momentum[0] = px;
+    diagnostics.momentum[1] = py;
+    diagnostics.momentum[2] = pz;
+    diagnostics.angularMomentum[0] = lx;
+    diagnostics.angularMomentum[1] = ly;
+    diagnostics.angularMomentum[2] = lz;
+    return diagnostics;
+}
+
+static double norm(const double v[3])
+{
+    return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+void diagnosticsDrift(const Diagnostics &reference, Diagnostics &current)
+{
+    current.energyDrift = (current.total - reference.total) / std::max(std::abs(reference.total), 1.0e-30);
+
+    // Cold starts have zero momentum and angular momentum, so those drifts are absolute
+    double dp[3], dl[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        dp[k] = current.momentum[k] - reference.momentum[k];
+        dl[k] = current.angularMomentum[k] - reference.angularMomentum[k];
+    }
+    current.momentumDrift = norm(dp);
+    current.angularMomentumDrift = norm(dl);
+}
+
+void printDiagnostics(std::ostream &out, const Diagnostics &diagnostics)
+{
+    out << "step " << diagnostics.step << " t " << diagnostics.time << " E " << diagnostics.total
+        << " K " << diagnostics.kinetic << " U " << diagnostics.potential << " dE/E " << diagnostics.energyDrift
+        << " |P| " << norm(diagnostics.momentum) << " dP " << diagnostics.momentumDrift
+        << " |L| " << norm(diagnostics.angularMomentum) << " dL " << diagnostics.angularMomentumDrift << std::endl;
+}
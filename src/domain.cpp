@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stack>
+#include <type_traits>
+#include "domain.h"
+#include "bhtree.h"
+#include "omp.h"
+
+// Weighted Morton samples each rank contributes when the splitters are recomputed
+constexpr int SPLITTER_SAMPLES = 256;
+
+// MPI type of the particle precision
+static MPI_Datatype realType()
+{
+    return std::is_same_v<Real, double> ? MPI_DOUBLE : MPI_FLOAT;
+}
+
+DomainDecomposition::DomainDecomposition(MPI_Comm comm, float imbalanceTolerance)
+        : comm(comm), tolerance(imbalanceTolerance)
+{
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    MPI_Type_contiguous(sizeof(Body) / sizeof(Real), realType(), &bodyType);
+    MPI_Type_commit(&bodyType);
+    MPI_Type_contiguous(sizeof(Pseudo) / sizeof(Real), realType(), &pseudoType);
+    MPI_Type_commit(&pseudoType);
+
+    splitters.assign(ranks - 1, std::numeric_limits<uint64_t>::max());
+}
+
+DomainDecomposition::~DomainDecomposition()
+{
+    MPI_Type_free(&bodyType);
+    MPI_Type_free(&pseudoType);
+}
+
+void DomainDecomposition::setCount(int count)
+{
+    // Grow with headroom so migration and imports do not reallocate every step
+    if (count > capacity)
+    {
+        capacity = count + count / 4 + 64;
+        simulation.resize(capacity);
+        cost.resize(capacity);
+        potential.resize(capacity);
+    }
+    simulation.data().particleCount = count;
+}
+
+long long DomainDecomposition::globalCount() const
+{
+    long long count = local;
+    MPI_Allreduce(MPI_IN_PLACE, &count, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    return count;
+}
+
+void DomainDecomposition::distribute(const SimulationData &global, float theta, float softening)
+{
+    long long total = global.particleCount;
+    int begin = static_cast<int>(total * rank / ranks);
+    int end = static_cast<int>(total * (rank + 1) / ranks);
+
+    local = end - begin;
+    imported = 0;
+    setCount(local);
+
+    SimulationData &data = simulation.data();
+    data.theta = theta;
+    data.softening = softening;
+    for (int i = 0; i < local; ++i)
+    {
+        data.particleX[i] = global.particleX[begin + i];
+        data.particleY[i] = global.particleY[begin + i];
+        data.particleZ[i] = global.particleZ[begin + i];
+        data.particleVelX[i] = global.particleVelX[begin + i];
+        data.particleVelY[i] = global.particleVelY[begin + i];
+        data.particleVelZ[i] = global.particleVelZ[begin + i];
+        data.particleMass[i] = global.particleMass[begin + i];
+        cost[i] = 1.0f;
+    }
+
+    computeSplitters();
+    migrate();
+    forcesReady = false;
+}
+
+void DomainDecomposition::computeSplitters()
+{
+    const SimulationData &data = simulation.data();
+
+    std::vector<uint64_t> keys(local);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < local; ++i)
+        keys[i] = Octree::morton3D(data.particleX[i], data.particleY[i], data.particleZ[i]);
+
+    std::vector<int> order(local);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+
+    // Cut the local curve into chunks of equal cost; each sample is a chunk's last key and its cost
+    double localCost = 0.0;
+    for (int i = 0; i < local; ++i)
+        localCost += std::max(cost[i], 1.0f);
+
+    std::vector<uint64_t> sampleKeys(SPLITTER_SAMPLES, 0);
+    std::vector<double> sampleWeights(SPLITTER_SAMPLES, 0.0);
+    double before = 0.0;
+    for (int i = 0; i < local; ++i)
+    {
+        int p = order[i];
+        int chunk = std::min(SPLITTER_SAMPLES - 1, static_cast<int>(before * SPLITTER_SAMPLES / localCost));
+        sampleKeys[chunk] = keys[p];
+        sampleWeights[chunk] += std::max(cost[p], 1.0f);
+        before += std::max(cost[p], 1.0f);
+    }
+
+    std::vector<uint64_t> allKeys(static_cast<size_t>(SPLITTER_SAMPLES) * ranks);
+    std::vector<double> allWeights(allKeys.size());
+    MPI_Allgather(sampleKeys.data(), SPLITTER_SAMPLES, MPI_UINT64_T, allKeys.data(), SPLITTER_SAMPLES,
+                  MPI_UINT64_T, comm);
+    MPI_Allgather(sampleWeights.data(), SPLITTER_SAMPLES, MPI_DOUBLE, allWeights.data(), SPLITTER_SAMPLES,
+                  MPI_DOUBLE, comm);
+
+    std::vector<int> sampleOrder(allKeys.size());
+    std::iota(sampleOrder.begin(), sampleOrder.end(), 0);
+    std::sort(sampleOrder.begin(), sampleOrder.end(), [&allKeys](int a, int b) { return allKeys[a] < allKeys[b]; });
+
+    double totalCost = std::accumulate(allWeights.begin(), allWeights.end(), 0.0);
+
+    // Splitter k closes the range of rank k: the key where the running cost first reaches (k + 1) / ranks
+    splitters.assign(ranks - 1, std::numeric_limits<uint64_t>::max());
+    double running = 0.0;
+    int next = 0;
+    for (int s: sampleOrder)
+    {
+        if (allWeights[s] <= 0.0)
+            continue;
+        running += allWeights[s];
+        while (next < ranks - 1 && running >= totalCost * (next + 1) / ranks)
+            splitters[next++] = allKeys[s];
+    }
+}
+
+void DomainDecomposition::migrate()
+{
+    SimulationData &data = simulation.data();
+
+    std::vector<int> destination(local);
+    std::vector<int> sendCounts(ranks, 0);
+    for (int i = 0; i < local; ++i)
+    {
+        uint64_t key = Octree::morton3D(data.particleX[i], data.particleY[i], data.particleZ[i]);
+        destination[i] = static_cast<int>(std::lower_bound(splitters.begin(), splitters.end(), key) -
+                                          splitters.begin());
+        ++sendCounts[destination[i]];
+    }
+
+    std::vector<int> sendOffsets(ranks, 0);
+    for (int r = 1; r < ranks; ++r)
+        sendOffsets[r] = sendOffsets[r - 1] + sendCounts[r - 1];
+
+    std::vector<Body> send(local);
+    std::vector<int> cursor = sendOffsets;
+    for (int i = 0; i < local; ++i)
+    {
+        send[cursor[destination[i]]++] = {data.particleX[i], data.particleY[i], data.particleZ[i],
+                                          data.particleVelX[i], data.particleVelY[i], data.particleVelZ[i],
+                                          data.particleMass[i], cost[i]};
+    }
+
+    std::vector<int> receiveCounts(ranks);
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, receiveCounts.data(), 1, MPI_INT, comm);
+
+    std::vector<int> receiveOffsets(ranks, 0);
+    for (int r = 1; r < ranks; ++r)
+        receiveOffsets[r] = receiveOffsets[r - 1] + receiveCounts[r - 1];
+
+    std::vector<Body> receive(receiveOffsets[ranks - 1] + receiveCounts[ranks - 1]);
+    MPI_Alltoallv(send.data(), sendCounts.data(), sendOffsets.data(), bodyType,
+                  receive.data(), receiveCounts.data(), receiveOffsets.data(), bodyType, comm);
+
+    local = static_cast<int>(receive.size());
+    setCount(local);
+    for (int i = 0; i < local; ++i)
+    {
+        const Body &body = receive[i];
+        data.particleX[i] = body.x;
+        data.particleY[i] = body.y;
+        data.particleZ[i] = body.z;
+        data.particleVelX[i] = body.vx;
+        data.particleVelY[i] = body.vy;
+        data.particleVelZ[i] = body.vz;
+        data.particleMass[i] = body.mass;
+        cost[i] = body.cost;
+    }
+}
+
+void DomainDecomposition::selectEssential(const Real box[6], std::vector<Pseudo> &out)
+{
+    const SimulationData &data = simulation.data();
+
+    // A cell the walk of every particle inside box would accept travels as one pseudo-particle at its COM;
+    // the distance to the nearest point of the box bounds each particle's distance from below
+    std::stack<int> stack;
+    stack.push(0);
+    while (!stack.empty())
+    {
+        int top = stack.top();
+        stack.pop();
+
+        Real mass = data.nodeTotalMass[top];
+        if (mass <= 0.0f)
+            continue;
+
+        Real comX = data.nodeCOM_X[top];
+        Real comY = data.nodeCOM_Y[top];
+        Real comZ = data.nodeCOM_Z[top];
+        Real distX = std::max({box[0] - comX, comX - box[3], Real(0.0)});
+        Real distY = std::max({box[1] - comY, comY - box[4], Real(0.0)});
+        Real distZ = std::max({box[2] - comZ, comZ - box[5], Real(0.0)});
+        Real dist = std::sqrt(distX * distX + distY * distY + distZ * distZ);
+
+        if (noChildren(data, top) || (dist > 0.0f && data.nodeWidth[top] / dist <= data.theta))
+        {
+            out.push_back({comX, comY, comZ, mass});
+        }
+        else
+        {
+            for (unsigned i = 0; i < OCT_CHILD; ++i)
+            {
+                if (data.nodeChildren[top][i] != NULL_INDEX)
+                    stack.push(data.nodeChildren[top][i]);
+            }
+        }
+    }
+}
+
+void DomainDecomposition::exchangeEssentialTree()
+{
+    SimulationData &data = simulation.data();
+
+    Real minX = std::numeric_limits<Real>::max(), minY = minX, minZ = minX;
+    Real maxX = std::numeric_limits<Real>::lowest(), maxY = maxX, maxZ = maxX;
+#pragma omp parallel for schedule(static) reduction(min:minX, minY, minZ) reduction(max:maxX, maxY, maxZ)
+    for (int i = 0; i < local; ++i)
+    {
+        minX = std::min(minX, data.particleX[i]);
+        minY = std::min(minY, data.particleY[i]);
+        minZ = std::min(minZ, data.particleZ[i]);
+        maxX = std::max(maxX, data.particleX[i]);
+        maxY = std::max(maxY, data.particleY[i]);
+        maxZ = std::max(maxZ, data.particleZ[i]);
+    }
+
+    // An empty rank's box is inverted and receives nothing
+    Real box[6] = {minX, minY, minZ, maxX, maxY, maxZ};
+    std::vector<Real> boxes(6 * static_cast<size_t>(ranks));
+    MPI_Allgather(box, 6, realType(), boxes.data(), 6, realType(), comm);
+
+    std::vector<std::vector<Pseudo>> essential(ranks);
+#pragma omp parallel for schedule(dynamic)
+    for (int r = 0; r < ranks; ++r)
+    {
+        const Real *remote = &boxes[6 * static_cast<size_t>(r)];
+        if (r != rank && remote[0] <= remote[3])
+            selectEssential(remote, essential[r]);
+    }
+
+    std::vector<int> sendCounts(ranks), sendOffsets(ranks, 0);
+    for (int r = 0; r < ranks; ++r)
+    {
+        sendCounts[r] = static_cast<int>(essential[r].size());
+        if (r > 0)
+            sendOffsets[r] = sendOffsets[r - 1] + sendCounts[r - 1];
+    }
+    std::vector<Pseudo> send(sendOffsets[ranks - 1] + sendCounts[ranks - 1]);
+    for (int r = 0; r < ranks; ++r)
+        std::copy(essential[r].begin(), essential[r].end(), send.begin() + sendOffsets[r]);
+
+    std::vector<int> receiveCounts(ranks), receiveOffsets(ranks, 0);
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, receiveCounts.data(), 1, MPI_INT, comm);
+    for (int r = 1; r < ranks; ++r)
+        receiveOffsets[r] = receiveOffsets[r - 1] + receiveCounts[r - 1];
+
+    std::vector<Pseudo> receive(receiveOffsets[ranks - 1] + receiveCounts[ranks - 1]);
+    MPI_Alltoallv(send.data(), sendCounts.data(), sendOffsets.data(), pseudoType,
+                  receive.data(), receiveCounts.data(), receiveOffsets.data(), pseudoType, comm);
+
+    // Imports follow the local particles and only ever act as sources
+    imported = static_cast<int>(receive.size());
+    setCount(local + imported);
+    for (int i = 0; i < imported; ++i)
+    {
+        int p = local + i;
+        data.particleX[p] = receive[i].x;
+        data.particleY[p] = receive[i].y;
+        data.particleZ[p] = receive[i].z;
+        data.particleMass[p] = receive[i].mass;
+        data.particleVelX[p] = 0.0f;
+        data.particleVelY[p] = 0.0f;
+        data.particleVelZ[p] = 0.0f;
+    }
+}
+
+void DomainDecomposition::computeForces(bool withPotential)
+{
+    SimulationData &data = simulation.data();
+
+    // The local tree selects what to export; the tree walked is rebuilt with the imports inserted
+    double start = MPI_Wtime();
+    setCount(local);
+    octree.buildTree(data);
+    phaseTimings.build += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    exchangeEssentialTree();
+    phaseTimings.essentialTree += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    octree.buildTree(data);
+    phaseTimings.build += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    data.potential = withPotential ? potential.data() : nullptr;
+    double localCost = 0.0;
+#pragma omp parallel for schedule(dynamic) reduction(+:localCost)
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        int p = static_cast<int>(data.idxSorted[i]);
+        if (p < local)
+        {
+            cost[p] = static_cast<float>(netAcceleration(p, data));
+            localCost += cost[p];
+        }
+    }
+    data.potential = nullptr;
+    setCount(local);
+    phaseTimings.force += MPI_Wtime() - start;
+
+    double maxCost = localCost;
+    double sumCost = localCost;
+    MPI_Allreduce(MPI_IN_PLACE, &maxCost, 1, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &sumCost, 1, MPI_DOUBLE, MPI_SUM, comm);
+    lastImbalance = sumCost > 0.0 ? maxCost * ranks / sumCost : 1.0;
+}
+
+void DomainDecomposition::step(float dt)
+{
+    SimulationData &data = simulation.data();
+
+    diagnosticsDue = diagnosticsCadence > 0 && (stepCount == 0 || (stepCount + 1) % diagnosticsCadence == 0);
+
+    if (!forcesReady)
+    {
+        computeForces(false);
+        forcesReady = true;
+    }
+
+    double start = MPI_Wtime();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < local; ++i)
+    {
+        data.particleVelX[i] += 0.5f * data.accX[i] * dt;
+        data.particleVelY[i] += 0.5f * data.accY[i] * dt;
+        data.particleVelZ[i] += 0.5f * data.accZ[i] * dt;
+        data.particleX[i] += data.particleVelX[i] * dt;
+        data.particleY[i] += data.particleVelY[i] * dt;
+        data.particleZ[i] += data.particleVelZ[i] * dt;
+    }
+    phaseTimings.integrate += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    if (lastImbalance > 1.0 + tolerance)
+    {
+        computeSplitters();
+        ++rebalanceCount;
+    }
+    migrate();
+    phaseTimings.migrate += MPI_Wtime() - start;
+
+    computeForces(diagnosticsDue);
+
+    start = MPI_Wtime();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < local; ++i)
+    {
+        data.particleVelX[i] += 0.5f * data.accX[i] * dt;
+        data.particleVelY[i] += 0.5f * data.accY[i] * dt;
+        data.particleVelZ[i] += 0.5f * data.accZ[i] * dt;
+    }
+    phaseTimings.integrate += MPI_Wtime() - start;
+
+    ++stepCount;
+    simulationTime += dt;
+
+    if (diagnosticsDue)
+        reduceDiagnostics();
+}
+
+void DomainDecomposition::reduceDiagnostics()
+{
+    SimulationData &data = simulation.data();
+
+    data.potential = potential.data();
+    Diagnostics partial = computeDiagnostics(data);
+    data.potential = nullptr;
+
+    double sums[8] = {partial.kinetic, partial.potential, partial.momentum[0], partial.momentum[1],
+                      partial.momentum[2], partial.angularMomentum[0], partial.angularMomentum[1],
+                      partial.angularMomentum[2]};
+    MPI_Allreduce(MPI_IN_PLACE, sums, 8, MPI_DOUBLE, MPI_SUM, comm);
+
+    lastDiagnostics = Diagnostics{};
+    lastDiagnostics.step = stepCount;
+    lastDiagnostics.time = simulationTime;
+    lastDiagnostics.kinetic = sums[0];
+    lastDiagnostics.potential = sums[1];
+    lastDiagnostics.total = sums[0] + sums[1];
+    for (int k = 0; k < 3; ++k)
+    {
+        lastDiagnostics.momentum[k] = sums[2 + k];
+        lastDiagnostics.angularMomentum[k] = sums[5 + k];
+    }
+
+    if (firstDiagnostics.step == 0)
+        firstDiagnostics = lastDiagnostics;
+    diagnosticsDrift(firstDiagnostics, lastDiagnostics);
+}
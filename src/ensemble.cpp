@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include "ensemble.h"
+#include "simulation.h"
+#include "bhtree.h"
+#include "octree.h"
+#include "omp.h"
+
+// Every particle stream of a system starts on a 64-byte boundary of the arena
+constexpr size_t ARENA_ALIGN = 64 / sizeof(Real);
+
+// Position, velocity, mass, acceleration and potential
+constexpr int ARENA_STREAMS = 11;
+
+// Node streams of the geometry and moments: position, size, mass and centre of mass
+constexpr int NODE_STREAMS = 10;
+
+static size_t padded(int count)
+{
+    return (static_cast<size_t>(count) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+static uint64_t packRange(uint32_t next, uint32_t end)
+{
+    return static_cast<uint64_t>(next) << 32 | end;
+}
+
+// Tree scratch of one worker, sized for the largest tree system and bound to whichever system it runs
+struct Ensemble::Worker
+{
+    Octree tree;
+    std::vector<NodeReal> nodeStreams;
+    std::vector<int> nodeParticleIndex;
+    std::vector<int> nodeChildren;
+    std::vector<uint64_t> nodeMortonCode;
+    int nodeCapacity = 0;
+    IntegratorState state;
+
+    explicit Worker(int capacity)
+            : nodeStreams(static_cast<size_t>(capacity) * NODE_STREAMS), nodeParticleIndex(capacity),
+              nodeChildren(static_cast<size_t>(capacity) * OCT_CHILD), nodeMortonCode(capacity),
+              nodeCapacity(capacity)
+    {
+    }
+
+    void bind(SimulationData &data)
+    {
+        NodeReal *stream[NODE_STREAMS];
+        for (int k = 0; k < NODE_STREAMS; ++k)
+            stream[k] = nodeStreams.data() + static_cast<size_t>(k) * nodeCapacity;
+        data.nodeX = stream[0];
+        data.nodeY = stream[1];
+        data.nodeZ = stream[2];
+        data.nodeWidth = stream[3];
+        data.nodeHeight = stream[4];
+        data.nodeDepth = stream[5];
+        data.nodeTotalMass = stream[6];
+        data.nodeCOM_X = stream[7];
+        data.nodeCOM_Y = stream[8];
+        data.nodeCOM_Z = stream[9];
+        data.nodeParticleIndex = nodeParticleIndex.data();
+        data.nodeChildren = reinterpret_cast<int (*)[OCT_CHILD]>(nodeChildren.data());
+        data.nodeMortonCode = nodeMortonCode.data();
+        data.nodeCapacity = nodeCapacity;
+    }
+};
+
+// Rebuilds the worker's tree on the current positions before every force pass; fresh marks a tree still built
+// on the positions of the first pass, as the closing pass of the last leapfrog step leaves it
+struct EnsembleTreeForce
+{
+    Octree &tree;
+    SimulationData &data;
+    bool fresh;
+
+    void prepare(const SimulationData &)
+    {
+        if (!fresh)
+            tree.buildTree(data);
+        fresh = false;
+    }
+
+    int operator()(int particleIdx, const SimulationData &current) { return netAcceleration(particleIdx, current); }
+};
+
+template<typename Acc>
+static int advance(Acc acc, const EnsembleOptions &options, const SimulationData &data, IntegratorState &state)
+{
+    if (options.integrator == Integrator::YOSHIDA)
+        return Yoshida4(acc, 1.0f, options.dt, data, state);
+    return Velocity_Verlet(acc, 1.0f, options.dt, data);
+}
+
+Ensemble::Ensemble(std::vector<EnsembleSystem> members)
+        : systems(std::move(members))
+{
+    size_t reals = 0, indices = 0;
+    for (const EnsembleSystem &system: systems)
+    {
+        if (system.particleCount <= 0)
+        {
+            std::cerr << "Ensemble systems need at least one particle" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        reals += ARENA_STREAMS * padded(system.particleCount);
+        indices += padded(system.particleCount);
+    }
+    arena.resize(reals);
+    indexArena.resize(indices);
+
+    // Each system's streams are contiguous, so a worker running it touches one block of the arena
+    systemData.resize(systems.size());
+    potentials.resize(systems.size());
+    Real *next = arena.data();
+    unsigned int *nextIndex = indexArena.data();
+    for (size_t s = 0; s < systems.size(); ++s)
+    {
+        size_t stride = padded(systems[s].particleCount);
+        Real *stream[ARENA_STREAMS];
+        for (auto &entry: stream)
+        {
+            entry = next;
+            next += stride;
+        }
+
+        SimulationData &data = systemData[s];
+        data.particleX = stream[0];
+        data.particleY = stream[1];
+        data.particleZ = stream[2];
+        data.particleVelX = stream[3];
+        data.particleVelY = stream[4];
+        data.particleVelZ = stream[5];
+        data.particleMass = stream[6];
+        data.accX = stream[7];
+        data.accY = stream[8];
+        data.accZ = stream[9];
+        potentials[s] = stream[10];
+        data.idxSorted = nextIndex;
+        data.particleCount = systems[s].particleCount;
+        data.nodeCapacity = 0;
+        nextIndex += stride;
+    }
+}
+
+bool Ensemble::claim(int self, int &index)
+{
+    std::atomic<uint64_t> &own = queues[self].range;
+    uint64_t range = own.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(range >> 32) < static_cast<uint32_t>(range))
+    {
+        auto next = static_cast<uint32_t>(range >> 32);
+        if (own.compare_exchange_weak(range, packRange(next + 1, static_cast<uint32_t>(range)),
+                                      std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            index = static_cast<int>(next);
+            return true;
+        }
+    }
+
+    // Thieves only ever shrink a run from its end, and only the owner refills its own run once it is empty,
+    // so a single CAS on the packed pair is enough on both sides
+    int workers = static_cast<int>(queues.size());
+    for (int offset = 1; offset < workers; ++offset)
+    {
+        std::atomic<uint64_t> &victim = queues[(self + offset) % workers].range;
+        range = victim.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(range >> 32) < static_cast<uint32_t>(range))
+        {
+            auto next = static_cast<uint32_t>(range >> 32);
+            auto end = static_cast<uint32_t>(range);
+            uint32_t split = end - (end - next + 1) / 2;
+            if (victim.compare_exchange_weak(range, packRange(next, split), std::memory_order_acq_rel,
+                                             std::memory_order_acquire))
+            {
+                own.store(packRange(split + 1, end), std::memory_order_release);
+                stealCount.fetch_add(1, std::memory_order_relaxed);
+                index = static_cast<int>(split);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Ensemble::runSystem(int index, const EnsembleOptions &options, Worker &worker)
+{
+    auto start = std::chrono::steady_clock::now();
+    const EnsembleSystem &system = systems[index];
+    SimulationData &data = systemData[index];
+    EnsembleResult &result = systemResults[index];
+    result.direct = system.particleCount <= options.directLimit;
+    result.thread = omp_get_thread_num();
+
+    data.theta = options.theta;
+    data.softening = options.softening;
+    if (!result.direct)
+        worker.bind(data);
+    generateParticles(data, system.distribution, system.radius, system.totalMass, system.seed);
+
+    // The direct sum walks the bodies in storage order; the tree build sorts them along its curve
+    std::iota(data.idxSorted, data.idxSorted + data.particleCount, 0u);
+    worker.state.primed = false;
+
+    // Potentials only on the first and the last step, which bracket the drift
+    for (int step = 0; step < options.steps; ++step)
+    {
+        bool measure = step == 0 || step + 1 == options.steps;
+        data.potential = measure ? potentials[index] : nullptr;
+
+        if (result.direct)
+        {
+            result.forcePasses += advance(directAcceleration, options, data, worker.state);
+        }
+        else
+        {
+            bool fresh = step > 0 && options.integrator == Integrator::LEAPFROG;
+            result.forcePasses += advance(EnsembleTreeForce{worker.tree, data, fresh}, options, data, worker.state);
+        }
+
+        if (measure)
+        {
+            result.last = computeDiagnostics(data);
+            result.last.step = step + 1;
+            result.last.time = static_cast<double>(step + 1) * options.dt;
+            if (step == 0)
+                result.first = result.last;
+        }
+    }
+    diagnosticsDrift(result.first, result.last);
+
+    // The node streams belong to the worker, which moves on to another system
+    data.potential = nullptr;
+    data.nodeX = data.nodeY = data.nodeZ = nullptr;
+    data.nodeWidth = data.nodeHeight = data.nodeDepth = nullptr;
+    data.nodeTotalMass = data.nodeCOM_X = data.nodeCOM_Y = data.nodeCOM_Z = nullptr;
+    data.nodeParticleIndex = nullptr;
+    data.nodeChildren = nullptr;
+    data.nodeMortonCode = nullptr;
+    data.nodeCapacity = 0;
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Ensemble::run(const EnsembleOptions &options)
+{
+    if (options.integrator == Integrator::HERMITE)
+    {
+        std::cerr << "Ensembles run leapfrog or Yoshida; the direct sum has no jerk for Hermite" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    lastOptions = options;
+    systemResults.assign(systems.size(), EnsembleResult{});
+    stealCount.store(0);
+
+    int threads = options.threads > 0 ? options.threads : omp_get_max_threads();
+#ifdef NBODY_PROFILE
+    threads = 1;
+#endif
+    threads = std::clamp(threads, 1, std::max(size(), 1));
+
+    // Expected cost: quadratic for the direct sum, N log N for the tree, equal at the direct limit
+    double limit = std::max(options.directLimit, 2);
+    std::vector<double> cost(systems.size());
+    int treeCapacity = 0;
+    for (size_t s = 0; s < systems.size(); ++s)
+    {
+        double n = systems[s].particleCount;
+        if (systems[s].particleCount <= options.directLimit)
+        {
+            cost[s] = n * n;
+        }
+        else
+        {
+            cost[s] = n * std::log2(n) * limit / std::log2(limit);
+            treeCapacity = std::max(treeCapacity, Simulation::defaultNodeCapacity(systems[s].particleCount));
+        }
+    }
+
+    // Contiguous runs of about equal cost, one per worker; stealing evens out what the estimate misses
+    queues = std::vector<WorkQueue>(threads);
+    double total = std::accumulate(cost.begin(), cost.end(), 0.0);
+    double assigned = 0.0;
+    int begin = 0;
+    for (int w = 0; w < threads; ++w)
+    {
+        int end = begin;
+        double target = total * (w + 1) / threads;
+        while (end < size() && (w + 1 == threads || assigned + 0.5 * cost[end] <= target))
+            assigned += cost[end++];
+        queues[w].range.store(packRange(begin, end));
+        begin = end;
+    }
+
+    // The integrators' own parallel regions then run on the worker that enters them
+    int levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(1);
+#pragma omp parallel num_threads(threads)
+    {
+        Worker worker(treeCapacity);
+        int self = omp_get_thread_num();
+        int index;
+        while (claim(self, index))
+            runSystem(index, options, worker);
+    }
+    omp_set_max_active_levels(levels);
+}
+
+double Ensemble::particleSteps() const
+{
+    double bodies = 0.0;
+    for (const EnsembleSystem &system: systems)
+        bodies += system.particleCount;
+    return bodies * lastOptions.steps;
+}
+
+void Ensemble::writeResults(std::ostream &out, bool json) const
+{
+    if (!json)
+        out << "system,particles,distribution,seed,solver,thread,steps,force_passes,seconds,energy_first,"
+               "energy_last,energy_drift,momentum_drift,angular_momentum_drift\n";
+
+    for (size_t s = 0; s < systemResults.size(); ++s)
+    {
+        const EnsembleSystem &system = systems[s];
+        const EnsembleResult &r = systemResults[s];
+        const char *solver = r.direct ? "direct" : "tree";
+        if (json)
+        {
+            out << "{\"system\":" << s << ",\"particles\":" << system.particleCount << ",\"distribution\":\""
+                << distributionName(system.distribution) << "\",\"seed\":" << system.seed << ",\"solver\":\""
+                << solver << "\",\"thread\":" << r.thread << ",\"steps\":" << r.last.step << ",\"force_passes\":"
+                << r.forcePasses << ",\"seconds\":" << r.seconds << ",\"energy_first\":" << r.first.total
+                << ",\"energy_last\":" << r.last.total << ",\"energy_drift\":" << r.last.energyDrift
+                << ",\"momentum_drift\":" << r.last.momentumDrift << ",\"angular_momentum_drift\":"
+                << r.last.angularMomentumDrift << "}\n";
+        }
+        else
+        {
+            out << s << "," << system.particleCount << "," << distributionName(system.distribution) << ","
+                << system.seed << "," << solver << "," << r.thread << "," << r.last.step << "," << r.forcePasses
+                << "," << r.seconds << "," << r.first.total << "," << r.last.total << "," << r.last.energyDrift
+                << "," << r.last.momentumDrift << "," << r.last.angularMomentumDrift << "\n";
+        }
+    }
+}
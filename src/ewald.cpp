@@ -0,0 +1,142 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "ewald.h"
+#include "omp.h"
+
+// Ewald splitting parameter in units of the box, and the real- and reciprocal-space images summed; at
+// alpha = 2 both truncated tails are below 1e-9 of the field
+constexpr double EWALD_ALPHA = 2.0;
+constexpr int EWALD_REAL_IMAGES = 3;
+constexpr int EWALD_WAVE_VECTORS = 3;
+
+constexpr char EWALD_MAGIC[8] = {'N', 'B', 'E', 'W', 'A', 'L', 'D', '1'};
+
+EwaldTable::EwaldTable(int size)
+        : size(size), scale(2.0f * static_cast<float>(size))
+{
+    if (size < 2)
+    {
+        std::cerr << "Ewald table size must be at least 2" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    table.resize(4 * static_cast<size_t>(size + 1) * (size + 1) * (size + 1));
+}
+
+void EwaldTable::loadOrCompute(const std::string &path)
+{
+    if (!path.empty() && load(path))
+        return;
+
+    compute();
+    if (!path.empty())
+        save(path);
+}
+
+void EwaldTable::compute()
+{
+    int points = size + 1;
+    double alpha2 = EWALD_ALPHA * EWALD_ALPHA;
+
+#pragma omp parallel for schedule(dynamic) collapse(2)
+    for (int iz = 0; iz < points; ++iz)
+    {
+        for (int iy = 0; iy < points; ++iy)
+        {
+            for (int ix = 0; ix < points; ++ix)
+            {
+                double x[3] = {0.5 * ix / size, 0.5 * iy / size, 0.5 * iz / size};
+                double field[3] = {}, potential = M_PI / alpha2;
+
+                // Real-space images: the screened near field of every periodic copy
+                for (int nx = -EWALD_REAL_IMAGES; nx <= EWALD_REAL_IMAGES; ++nx)
+                {
+                    for (int ny = -EWALD_REAL_IMAGES; ny <= EWALD_REAL_IMAGES; ++ny)
+                    {
+                        for (int nz = -EWALD_REAL_IMAGES; nz <= EWALD_REAL_IMAGES; ++nz)
+                        {
+                            double d[3] = {x[0] - nx, x[1] - ny, x[2] - nz};
+                            double r = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                            if (r == 0.0)
+                            {
+                                // The Newtonian term removed below leaves erf(alpha r) / r -> 2 alpha / sqrt(pi)
+                                potential += 2.0 * EWALD_ALPHA / std::sqrt(M_PI);
+                                continue;
+                            }
+                            double screened = std::erfc(EWALD_ALPHA * r);
+                            double factor = screened + 2.0 * EWALD_ALPHA * r / std::sqrt(M_PI) *
+                                                       std::exp(-alpha2 * r * r);
+                            for (int k = 0; k < 3; ++k)
+                                field[k] -= d[k] / (r * r * r) * factor;
+                            potential -= screened / r;
+
+                            // Take the plain Newtonian field of the nearest image back out
+                            if (nx == 0 && ny == 0 && nz == 0)
+                            {
+                                for (int k = 0; k < 3; ++k)
+                                    field[k] += d[k] / (r * r * r);
+                                potential += 1.0 / r;
+                            }
+                        }
+                    }
+                }
+
+                // Reciprocal space: the smooth far field
+                for (int hx = -EWALD_WAVE_VECTORS; hx <= EWALD_WAVE_VECTORS; ++hx)
+                {
+                    for (int hy = -EWALD_WAVE_VECTORS; hy <= EWALD_WAVE_VECTORS; ++hy)
+                    {
+                        for (int hz = -EWALD_WAVE_VECTORS; hz <= EWALD_WAVE_VECTORS; ++hz)
+                        {
+                            int h2 = hx * hx + hy * hy + hz * hz;
+                            if (h2 == 0 || h2 > EWALD_WAVE_VECTORS * EWALD_WAVE_VECTORS + 1)
+                                continue;
+                            double phase = 2.0 * M_PI * (hx * x[0] + hy * x[1] + hz * x[2]);
+                            double damping = std::exp(-M_PI * M_PI * h2 / alpha2) / h2;
+                            double h[3] = {static_cast<double>(hx), static_cast<double>(hy),
+                                           static_cast<double>(hz)};
+                            for (int k = 0; k < 3; ++k)
+                                field[k] -= 2.0 * h[k] * damping * std::sin(phase);
+                            potential -= damping / M_PI * std::cos(phase);
+                        }
+                    }
+                }
+
+                float *entry = &table[4 * index(ix, iy, iz)];
+                for (int k = 0; k < 3; ++k)
+                    entry[k] = static_cast<float>(field[k]);
+                entry[3] = static_cast<float>(potential);
+            }
+        }
+    }
+}
+
+bool EwaldTable::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[8];
+    int32_t stored = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&stored), sizeof(stored));
+    if (!file || std::memcmp(magic, EWALD_MAGIC, sizeof(magic)) != 0 || stored != size)
+        return false;
+
+    file.read(reinterpret_cast<char *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(float)));
+    return static_cast<bool>(file);
+}
+
+void EwaldTable::save(const std::string &path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    auto stored = static_cast<int32_t>(size);
+    file.write(EWALD_MAGIC, sizeof(EWALD_MAGIC));
+    file.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+    file.write(reinterpret_cast<const char *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(float)));
+    if (!file)
+        std::cerr << "Failed to write the Ewald table cache " << path << std::endl;
+}
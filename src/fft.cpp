@@ -0,0 +1,114 @@
+#include <cmath>
+#include <iostream>
+#include "fft.h"
+#include "omp.h"
+
+FFT3D::FFT3D(int n)
+        : n(n)
+{
+    if (n < 2 || (n & (n - 1)) != 0)
+    {
+        std::cerr << "FFT size " << n << " is not a power of two" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    int bits = 0;
+    while ((1 << bits) < n)
+        ++bits;
+
+    bitReverse.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        int reversed = 0;
+        for (int b = 0; b < bits; ++b)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        bitReverse[i] = reversed;
+    }
+
+    // Twiddles in double so the large transforms keep float accuracy
+    twiddles.resize(n / 2);
+    for (int k = 0; k < n / 2; ++k)
+    {
+        double angle = -2.0 * M_PI * k / n;
+        twiddles[k] = {static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle))};
+    }
+}
+
+void FFT3D::line(std::complex<float> *data, bool inverse) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        int j = bitReverse[i];
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    for (int length = 2; length <= n; length <<= 1)
+    {
+        int half = length >> 1;
+        int stride = n / length;
+        for (int start = 0; start < n; start += length)
+        {
+            for (int k = 0; k < half; ++k)
+            {
+                std::complex<float> w = twiddles[k * stride];
+                if (inverse)
+                    w = std::conj(w);
+
+                std::complex<float> even = data[start + k];
+                std::complex<float> odd = data[start + k + half] * w;
+                data[start + k] = even + odd;
+                data[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+void FFT3D::axis(std::complex<float> *grid, int axis, int limitA, int limitB, bool inverse)
+{
+    // Lines are indexed by (a, b), the two coordinates other than axis in x, y, z order
+    size_t strides[3] = {1, static_cast<size_t>(n), static_cast<size_t>(n) * n};
+    size_t step = strides[axis];
+    size_t strideA = axis == 0 ? strides[1] : strides[0];
+    size_t strideB = axis == 2 ? strides[1] : strides[2];
+
+#pragma omp parallel
+    {
+        std::vector<std::complex<float>> buffer(n);
+
+#pragma omp for schedule(static)
+        for (int row = 0; row < limitA * limitB; ++row)
+        {
+            std::complex<float> *base = grid + (row % limitA) * strideA + (row / limitA) * strideB;
+            if (step == 1)
+            {
+                line(base, inverse);
+                continue;
+            }
+
+            for (int k = 0; k < n; ++k)
+                buffer[k] = base[k * step];
+            line(buffer.data(), inverse);
+            for (int k = 0; k < n; ++k)
+                base[k * step] = buffer[k];
+        }
+    }
+}
+
+void FFT3D::transform(std::complex<float> *grid, bool inverse, int limit)
+{
+    if (!inverse)
+    {
+        // x lines are non-zero only for y, z < limit, y lines only for z < limit
+        axis(grid, 0, limit, limit, false);
+        axis(grid, 1, n, limit, false);
+        axis(grid, 2, n, n, false);
+    }
+    else
+    {
+        // The reverse order: every z line, then only the lines that reach the kept corner
+        axis(grid, 2, n, n, true);
+        axis(grid, 1, n, limit, true);
+        axis(grid, 0, limit, limit, true);
+    }
+}
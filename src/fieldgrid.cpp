@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include "fieldgrid.h"
+#include "bhtree.h"
+#include "omp.h"
+
+bool parseDepositKernel(const std::string &name, DepositKernel &kernel)
+{
+    if (name == "ngp")
+        kernel = DepositKernel::NGP;
+    else if (name == "cic")
+        kernel = DepositKernel::CIC;
+    else if (name == "tsc")
+        kernel = DepositKernel::TSC;
+    else
+        return false;
+
+    return true;
+}
+
+const char *depositKernelName(DepositKernel kernel)
+{
+    switch (kernel)
+    {
+        case DepositKernel::NGP:
+            return "ngp";
+        case DepositKernel::CIC:
+            return "cic";
+        case DepositKernel::TSC:
+            return "tsc";
+    }
+    return "unknown";
+}
+
+// First cell and weights along one axis of a body at grid coordinate u; returns the number of cells reached.
+// Every kernel stays within one cell of floor(u)
+template<DepositKernel Kernel>
+static inline int kernelWeights(float u, int &first, float weights[3])
+{
+    if constexpr (Kernel == DepositKernel::NGP)
+    {
+        first = static_cast<int>(std::floor(u));
+        weights[0] = 1.0f;
+        return 1;
+    }
+    else if constexpr (Kernel == DepositKernel::CIC)
+    {
+        float shifted = u - 0.5f;
+        first = static_cast<int>(std::floor(shifted));
+        float d = shifted - static_cast<float>(first);
+        weights[0] = 1.0f - d;
+        weights[1] = d;
+        return 2;
+    }
+    else
+    {
+        int cell = static_cast<int>(std::floor(u));
+        float d = u - static_cast<float>(cell) - 0.5f;
+        first = cell - 1;
+        weights[0] = 0.5f * (0.5f - d) * (0.5f - d);
+        weights[1] = 0.75f - d * d;
+        weights[2] = 0.5f * (0.5f + d) * (0.5f + d);
+        return 3;
+    }
+}
+
+FieldGrid::FieldGrid(int size, float extent, DepositKernel kernel, int projectAxis, bool periodic)
+        : size(size), projectAxis(projectAxis), periodic(periodic), kernel(kernel)
+{
+    spacing = extent / static_cast<float>(size);
+    origin = -0.5f * extent;
+    for (int axis = 0; axis < 3; ++axis)
+        dims[axis] = axis == projectAxis ? 1 : size;
+    slabAxis = projectAxis == 2 ? 1 : 2;
+
+    // Wrapped kernels join the last slab to the first, so the colours only alternate all the way round for an
+    // even count; the last slab takes the cells left over
+    slabCount = std::max(size / FIELD_SLAB_CELLS, 1);
+    if (periodic && slabCount % 2 != 0 && slabCount > 1)
+        --slabCount;
+    slabCells = size / slabCount;
+
+    densityGrid.assign(cells(), 0.0f);
+}
+
+template<DepositKernel Kernel>
+void FieldGrid::depositSlabs(const SimulationData &data)
+{
+    const Real *positions[3] = {data.particleX, data.particleY, data.particleZ};
+    float cellVolume = spacing * spacing * (projectAxis < 0 ? spacing : 1.0f);
+    float inverseVolume = 1.0f / cellVolume;
+    auto wrap = [](int cell, int count) { return ((cell % count) + count) % count; };
+
+    for (int colour = 0; colour < 2; ++colour)
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (int slab = colour; slab < slabCount; slab += 2)
+        {
+            for (int b = slabStart[slab]; b < slabStart[slab + 1]; ++b)
+            {
+                int i = slabBodies[b];
+
+                // Cells and weights along each axis, keeping only the cells inside the grid
+                int cellIndex[3][3] = {};
+                float weights[3][3] = {};
+                int counts[3];
+                bool inside = true;
+                for (int axis = 0; axis < 3 && inside; ++axis)
+                {
+                    float u = gridCoordinate(positions[axis][i]);
+                    if (dims[axis] == 1)
+                    {
+                        // Projected through the cube only
+                        inside = periodic || (u >= 0.0f && u < static_cast<float>(size));
+                        cellIndex[axis][0] = 0;
+                        weights[axis][0] = 1.0f;
+                        counts[axis] = 1;
+                        continue;
+                    }
+                    if (!periodic)
+                        u = std::clamp(u, -2.0f, static_cast<float>(size) + 2.0f);
+
+                    int first;
+                    float w[3];
+                    int reach = kernelWeights<Kernel>(u, first, w);
+                    counts[axis] = 0;
+                    for (int c = 0; c < reach; ++c)
+                    {
+                        int cell = first + c;
+                        if (periodic)
+                            cell = wrap(cell, size);
+                        else if (cell < 0 || cell >= size)
+                            continue;
+                        cellIndex[axis][counts[axis]] = cell;
+                        weights[axis][counts[axis]++] = w[c];
+                    }
+                    inside = counts[axis] > 0;
+                }
+                if (!inside)
+                    continue;
+
+                float m = static_cast<float>(data.particleMass[i]) * inverseVolume;
+                for (int cz = 0; cz < counts[2]; ++cz)
+                {
+                    for (int cy = 0; cy < counts[1]; ++cy)
+                    {
+                        float wzy = m * weights[2][cz] * weights[1][cy];
+                        size_t row = (static_cast<size_t>(cellIndex[2][cz]) * dims[1] + cellIndex[1][cy]) * dims[0];
+                        for (int cx = 0; cx < counts[0]; ++cx)
+                            densityGrid[row + cellIndex[0][cx]] += wzy * weights[0][cx];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void FieldGrid::deposit(const SimulationData &data)
+{
+    int n = data.particleCount;
+    int threads = omp_get_max_threads();
+    const Real *slabPositions = slabAxis == 1 ? data.particleY : data.particleZ;
+
+    bodySlab.resize(n);
+    slabBodies.resize(n);
+    slabStart.assign(slabCount + 1, 0);
+    threadCounts.assign(static_cast<size_t>(threads) * slabCount, 0);
+    potentialGrid.clear();
+
+    // Bucketing by slab in Morton order: each thread counts its share of the sorted bodies, the offsets run
+    // slab by slab with the threads in order inside a slab, and the same static shares are scattered, so every
+    // slab keeps the Morton order and its deposits stay local in the grid
+#pragma omp parallel num_threads(threads)
+    {
+        int *counts = threadCounts.data() + static_cast<size_t>(omp_get_thread_num()) * slabCount;
+
+#pragma omp for schedule(static)
+        for (int k = 0; k < n; ++k)
+        {
+            auto i = static_cast<int>(data.idxSorted[k]);
+            float u = gridCoordinate(slabPositions[i]);
+            int slab = NULL_INDEX;
+            if (periodic)
+            {
+                u -= static_cast<float>(size) * std::floor(u / static_cast<float>(size));
+                slab = std::min(static_cast<int>(u), size - 1) / slabCells;
+            }
+            else if (u >= -1.0f && u < static_cast<float>(size) + 1.0f)
+            {
+                // Bodies within a cell of the grid still reach its edge cells
+                slab = std::clamp(static_cast<int>(std::floor(u)), 0, size - 1) / slabCells;
+            }
+            if (slab != NULL_INDEX)
+            {
+                slab = std::min(slab, slabCount - 1);
+                ++counts[slab];
+            }
+            bodySlab[k] = slab;
+        }
+
+#pragma omp single
+        {
+            int offset = 0;
+            for (int slab = 0; slab < slabCount; ++slab)
+            {
+                slabStart[slab] = offset;
+                for (int t = 0; t < threads; ++t)
+                {
+                    int &count = threadCounts[static_cast<size_t>(t) * slabCount + slab];
+                    int bodies = count;
+                    count = offset;
+                    offset += bodies;
+                }
+            }
+            slabStart[slabCount] = offset;
+        }
+
+#pragma omp for schedule(static)
+        for (int k = 0; k < n; ++k)
+        {
+            if (bodySlab[k] != NULL_INDEX)
+                slabBodies[counts[bodySlab[k]]++] = static_cast<int>(data.idxSorted[k]);
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (size_t c = 0; c < densityGrid.size(); ++c)
+        densityGrid[c] = 0.0f;
+
+    switch (kernel)
+    {
+        case DepositKernel::NGP:
+            depositSlabs<DepositKernel::NGP>(data);
+            break;
+        case DepositKernel::CIC:
+            depositSlabs<DepositKernel::CIC>(data);
+            break;
+        case DepositKernel::TSC:
+            depositSlabs<DepositKernel::TSC>(data);
+            break;
+    }
+}
+
+void FieldGrid::evaluatePotential(const SimulationData &data)
+{
+    potentialGrid.resize(cells());
+    size_t plane = static_cast<size_t>(dims[0]) * dims[1];
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (size_t c = 0; c < potentialGrid.size(); ++c)
+    {
+        int index[3] = {static_cast<int>(c % dims[0]), static_cast<int>(c / dims[0] % dims[1]),
+                        static_cast<int>(c / plane)};
+        Real point[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            point[axis] = dims[axis] == 1 ? Real(0.0)
+                                          : origin + (static_cast<Real>(index[axis]) + Real(0.5)) * spacing;
+        }
+        potentialGrid[c] = static_cast<float>(treePotential(point[0], point[1], point[2], data));
+    }
+}
+
+bool FieldGrid::write(const std::string &path, uint64_t step, double time) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    FieldHeader header{};
+    std::memcpy(header.magic, FIELD_MAGIC, sizeof(header.magic));
+    header.version = FIELD_VERSION;
+    header.kernel = static_cast<uint32_t>(kernel);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        header.size[axis] = static_cast<uint32_t>(dims[axis]);
+        header.origin[axis] = origin;
+    }
+    header.projectAxis = projectAxis;
+    header.hasPotential = potentialGrid.empty() ? 0 : 1;
+    header.step = step;
+    header.time = time;
+    header.cellSize = spacing;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(densityGrid.data()),
+               static_cast<std::streamsize>(densityGrid.size() * sizeof(float)));
+    if (!potentialGrid.empty())
+    {
+        file.write(reinterpret_cast<const char *>(potentialGrid.data()),
+                   static_cast<std::streamsize>(potentialGrid.size() * sizeof(float)));
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "fof.h"
+#include "omp.h"
+
+// Bodies per dynamic chunk of the friend search
+constexpr int FOF_CHUNK = 256;
+
+FriendsOfFriends::FriendsOfFriends(float linkingLength, int minMembers)
+        : link(linkingLength), minMembers(std::max(minMembers, 1))
+{
+}
+
+int FriendsOfFriends::root(int i)
+{
+    // Path halving: point each body passed at its grandparent. Parents only ever move to a smaller index of the
+    // same set, so a CAS that loses against another thread just leaves the path a little longer
+    while (true)
+    {
+        int p = std::atomic_ref<int>(parent[i]).load(std::memory_order_relaxed);
+        if (p == i)
+            return i;
+        int grandparent = std::atomic_ref<int>(parent[p]).load(std::memory_order_relaxed);
+        if (grandparent != p)
+            std::atomic_ref<int>(parent[i]).compare_exchange_weak(p, grandparent, std::memory_order_relaxed);
+        i = grandparent;
+    }
+}
+
+void FriendsOfFriends::unite(int a, int b)
+{
+    // Linking the larger root under the smaller keeps every path decreasing, so no cycle can form; a root that
+    // gained a parent meanwhile fails the CAS and the roots are looked up again
+    while (true)
+    {
+        a = root(a);
+        b = root(b);
+        if (a == b)
+            return;
+        if (a < b)
+            std::swap(a, b);
+        int expected = a;
+        if (std::atomic_ref<int>(parent[a]).compare_exchange_strong(expected, b, std::memory_order_relaxed))
+            return;
+    }
+}
+
+void FriendsOfFriends::find(const SimulationData &data, const Octree &tree, bool withMembers, FofCatalogue &out)
+{
+    int n = data.particleCount;
+    query.update(data, tree);
+    parent.resize(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    stacks.resize(omp_get_max_threads());
+
+    float link2 = link * link;
+#pragma omp parallel
+    {
+        std::vector<int> &stack = stacks[omp_get_thread_num()];
+#pragma omp for schedule(dynamic, FOF_CHUNK)
+        for (int k = 0; k < n; ++k)
+        {
+            int i = query.particle(k);
+            float px = query.x(k), py = query.y(k), pz = query.z(k);
+            query.walk(px, py, pz, stack, [link2]() { return link2; }, [&](size_t m) {
+                // Each pair once, from its lower index
+                int j = query.particle(m);
+                if (j <= i)
+                    return;
+                float dx = query.x(m) - px, dy = query.y(m) - py, dz = query.z(m) - pz;
+                if (dx * dx + dy * dy + dz * dz <= link2)
+                    unite(i, j);
+            });
+        }
+    }
+
+    // Other threads' root() still reads and halves through parent[i], so the store must be atomic too
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i)
+        std::atomic_ref<int>(parent[i]).store(root(i), std::memory_order_relaxed);
+
+    // Member counts at the roots, then group numbers for the roots of large enough groups
+    groupOf.assign(n, 0);
+    for (int i = 0; i < n; ++i)
+        ++groupOf[parent[i]];
+
+    std::vector<int> roots;
+    for (int i = 0; i < n; ++i)
+    {
+        if (parent[i] == i && groupOf[i] >= minMembers)
+            roots.push_back(i);
+    }
+    std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) { return groupOf[a] > groupOf[b]; });
+
+    size_t groups = roots.size();
+    out.groups.assign(groups, FofGroup{});
+    out.memberOffsets.assign(groups + 1, 0);
+    for (size_t g = 0; g < groups; ++g)
+        out.memberOffsets[g + 1] = out.memberOffsets[g] + groupOf[roots[g]];
+    out.grouped = static_cast<int>(out.memberOffsets[groups]);
+
+    std::fill(groupOf.begin(), groupOf.end(), NULL_INDEX);
+    for (size_t g = 0; g < groups; ++g)
+        groupOf[roots[g]] = static_cast<int>(g);
+
+    // Members in ascending index within each group, so the sums below run in a fixed order
+    out.memberIndices.resize(out.grouped);
+    std::vector<size_t> fill(out.memberOffsets.begin(), out.memberOffsets.end() - 1);
+    for (int i = 0; i < n; ++i)
+    {
+        int g = groupOf[parent[i]];
+        if (g != NULL_INDEX)
+            out.memberIndices[fill[g]++] = i;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t g = 0; g < groups; ++g)
+    {
+        FofGroup &group = out.groups[g];
+        double mass = 0.0, com[3] = {}, momentum[3] = {};
+        for (size_t k = out.memberOffsets[g]; k < out.memberOffsets[g + 1]; ++k)
+        {
+            int i = out.memberIndices[k];
+            double m = data.particleMass[i];
+            mass += m;
+            com[0] += m * data.particleX[i];
+            com[1] += m * data.particleY[i];
+            com[2] += m * data.particleZ[i];
+            momentum[0] += m * data.particleVelX[i];
+            momentum[1] += m * data.particleVelY[i];
+            momentum[2] += m * data.particleVelZ[i];
+        }
+
+        double inverse = mass > 0.0 ? 1.0 / mass : 0.0;
+        group.members = static_cast<int>(out.memberOffsets[g + 1] - out.memberOffsets[g]);
+        group.mass = mass;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            group.com[axis] = com[axis] * inverse;
+            group.velocity[axis] = momentum[axis] * inverse;
+        }
+    }
+
+    if (!withMembers)
+    {
+        out.memberOffsets.clear();
+        out.memberIndices.clear();
+    }
+}
+
+float fofLinkingLength(const SimulationData &data, float factor)
+{
+    double volume;
+    if (data.boxSize > 0.0f)
+    {
+        volume = static_cast<double>(data.boxSize) * data.boxSize * data.boxSize;
+    }
+    else
+    {
+        double low[3], high[3];
+        std::fill(low, low + 3, std::numeric_limits<double>::max());
+        std::fill(high, high + 3, std::numeric_limits<double>::lowest());
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            double position[3] = {data.particleX[i], data.particleY[i], data.particleZ[i]};
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                low[axis] = std::min(low[axis], position[axis]);
+                high[axis] = std::max(high[axis], position[axis]);
+            }
+        }
+        volume = 1.0;
+        for (int axis = 0; axis < 3; ++axis)
+            volume *= std::max(high[axis] - low[axis], 1.0);
+    }
+    return factor * static_cast<float>(std::cbrt(volume / std::max(data.particleCount, 1)));
+}
+
+void writeFofCatalogue(std::ostream &out, const FofCatalogue &catalogue)
+{
+    out << "group,members,mass,com_x,com_y,com_z,vel_x,vel_y,vel_z\n";
+    for (size_t g = 0; g < catalogue.groups.size(); ++g)
+    {
+        const FofGroup &group = catalogue.groups[g];
+        out << g << "," << group.members << "," << group.mass << "," << group.com[0] << "," << group.com[1] << ","
+            << group.com[2] << "," << group.velocity[0] << "," << group.velocity[1] << "," << group.velocity[2]
+            << "\n";
+    }
+}
+
+void writeFofMembers(std::ostream &out, const FofCatalogue &catalogue)
+{
+    for (size_t g = 0; g + 1 < catalogue.memberOffsets.size(); ++g)
+    {
+        for (size_t k = catalogue.memberOffsets[g]; k < catalogue.memberOffsets[g + 1]; ++k)
+            out << (k > catalogue.memberOffsets[g] ? " " : "") << catalogue.memberIndices[k];
+        out << "\n";
+    }
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "initialconditions.h"
+
+namespace
+{
+    void uniformSphere(const SimulationData &data, float radius, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            float x, y, z;
+            do
+            {
+                x = unit(rng);
+                y = unit(rng);
+                z = unit(rng);
+            } while (x * x + y * y + z * z > 1.0f);
+
+            data.particleX[i] = x * radius;
+            data.particleY[i] = y * radius;
+            data.particleZ[i] = z * radius;
+        }
+    }
+
+    void uniformCube(const SimulationData &data, float radius, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            data.particleX[i] = unit(rng) * radius;
+            data.particleY[i] = unit(rng) * radius;
+            data.particleZ[i] = unit(rng) * radius;
+        }
+    }
+
+    void randomDirection(std::mt19937 &rng, float length, Real &x, Real &y, Real &z)
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float cosTheta = 2.0f * unit(rng) - 1.0f;
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        float phi = 2.0f * static_cast<float>(M_PI) * unit(rng);
+
+        x = length * sinTheta * std::cos(phi);
+        y = length * sinTheta * std::sin(phi);
+        z = length * cosTheta;
+    }
+
+    // Plummer sphere in virial equilibrium (Aarseth, Henon & Wielen 1974), G = 1, truncated at radius;
+    // the scale length is radius / 10
+    void plummerSphere(const SimulationData &data, float radius, float totalMass, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float scale = radius / 10.0f;
+
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            float r;
+            do
+            {
+                float m = std::max(unit(rng), 1.0e-6f);
+                r = scale / std::sqrt(std::pow(m, -2.0f / 3.0f) - 1.0f);
+            } while (r > radius);
+
+            randomDirection(rng, r, data.particleX[i], data.particleY[i], data.particleZ[i]);
+
+            // Speed as a fraction q of the local escape speed, sampled from g(q) = q^2 (1 - q^2)^3.5
+            float q, g;
+            do
+            {
+                q = unit(rng);
+                g = 0.1f * unit(rng);
+            } while (g > q * q * std::pow(1.0f - q * q, 3.5f));
+
+            float escape = std::sqrt(2.0f * totalMass) * std::pow(r * r + scale * scale, -0.25f);
+            randomDirection(rng, q * escape, data.particleVelX[i], data.particleVelY[i], data.particleVelZ[i]);
+        }
+    }
+
+    // Gaussian clumps with centres spread uniformly over the sphere
+    void clusteredSphere(const SimulationData &data, float radius, std::mt19937 &rng)
+    {
+        constexpr int CLUSTERS = 32;
+
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::normal_distribution<float> normal(0.0f, radius / 50.0f);
+        std::uniform_int_distribution<int> pick(0, CLUSTERS - 1);
+
+        float centre[CLUSTERS][3];
+        for (auto &c: centre)
+        {
+            do
+            {
+                c[0] = unit(rng);
+                c[1] = unit(rng);
+                c[2] = unit(rng);
+            } while (c[0] * c[0] + c[1] * c[1] + c[2] * c[2] > 1.0f);
+        }
+
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            const float *c = centre[pick(rng)];
+            data.particleX[i] = c[0] * radius + normal(rng);
+            data.particleY[i] = c[1] * radius + normal(rng);
+            data.particleZ[i] = c[2] * radius + normal(rng);
+        }
+    }
+}
+
+bool parseDistribution(const std::string &name, Distribution &distribution)
+{
+    if (name == "uniform")
+        distribution = Distribution::UNIFORM;
+    else if (name == "plummer")
+        distribution = Distribution::PLUMMER;
+    else if (name == "clustered")
+        distribution = Distribution::CLUSTERED;
+    else if (name == "cube")
+        distribution = Distribution::CUBE;
+    else
+        return false;
+
+    return true;
+}
+
+const char *distributionName(Distribution distribution)
+{
+    switch (distribution)
+    {
+        case Distribution::UNIFORM:
+            return "uniform";
+        case Distribution::PLUMMER:
+            return "plummer";
+        case Distribution::CLUSTERED:
+            return "clustered";
+        case Distribution::CUBE:
+            return "cube";
+    }
+    return "unknown";
+}
+
+void generateParticles(const SimulationData &data, Distribution distribution, float radius, float totalMass,
+                       unsigned int seed)
+{
+    std::mt19937 rng(seed);
+
+    float mass = totalMass / static_cast<float>(data.particleCount);
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        data.particleMass[i] = mass;
+        data.particleVelX[i] = 0.0f;
+        data.particleVelY[i] = 0.0f;
+        data.particleVelZ[i] = 0.0f;
+        data.accX[i] = 0.0f;
+        data.accY[i] = 0.0f;
+        data.accZ[i] = 0.0f;
+    }
+
+    switch (distribution)
+    {
+        case Distribution::UNIFORM:
+            uniformSphere(data, radius, rng);
+            break;
+        case Distribution::PLUMMER:
+            plummerSphere(data, radius, totalMass, rng);
+            break;
+        case Distribution::CLUSTERED:
+            clusteredSphere(data, radius, rng);
+            break;
+        case Distribution::CUBE:
+            uniformCube(data, radius, rng);
+            break;
+    }
+}
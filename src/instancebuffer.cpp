@@ -0,0 +1,95 @@
+#include <cstdlib>
+#include <iostream>
+#include "instancebuffer.h"
+
+InstanceBuffer::InstanceBuffer(int capacity, int regionCount)
+        : instanceCapacity(capacity), regions(regionCount),
+          regionBytes(static_cast<size_t>(capacity) * sizeof(SphereInstance)),
+          fences(regionCount, nullptr)
+{
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    GLsizeiptr totalBytes = static_cast<GLsizeiptr>(regionBytes * regions);
+
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_buffer_storage)
+    bool bufferStorage = false;
+#ifdef GL_VERSION_4_4
+    bufferStorage = bufferStorage || GLAD_GL_VERSION_4_4;
+#endif
+#ifdef GL_ARB_buffer_storage
+    bufferStorage = bufferStorage || GLAD_GL_ARB_buffer_storage;
+#endif
+    if (bufferStorage)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, totalBytes, nullptr, flags);
+        persistentMapping = static_cast<SphereInstance *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, totalBytes, flags));
+        if (persistentMapping == nullptr)
+        {
+            std::cerr << "Persistent instance mapping failed" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    else
+#endif
+    {
+        glBufferData(GL_ARRAY_BUFFER, totalBytes, nullptr, GL_STREAM_DRAW);
+    }
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    for (GLsync sync: fences)
+    {
+        if (sync != nullptr)
+            glDeleteSync(sync);
+    }
+
+    if (persistentMapping != nullptr)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &VBO);
+}
+
+SphereInstance *InstanceBuffer::map()
+{
+    current = (current + 1) % regions;
+
+    // The region was last drawn regions frames ago; this normally returns at once
+    GLsync &sync = fences[current];
+    if (sync != nullptr)
+    {
+        while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(sync);
+        sync = nullptr;
+    }
+
+    if (persistentMapping != nullptr)
+        return persistentMapping + static_cast<size_t>(current) * instanceCapacity;
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    return static_cast<SphereInstance *>(glMapBufferRange(
+            GL_ARRAY_BUFFER, static_cast<GLintptr>(regionBytes * current), static_cast<GLsizeiptr>(regionBytes),
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+}
+
+size_t InstanceBuffer::unmap()
+{
+    // Coherent persistent mappings need no flush; the classic path hands the region back here
+    if (persistentMapping == nullptr)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    return regionBytes * current;
+}
+
+void InstanceBuffer::fence()
+{
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,29 @@
+#include "integrator.h"
+
+bool parseIntegrator(const std::string &name, Integrator &integrator)
+{
+    if (name == "leapfrog")
+        integrator = Integrator::LEAPFROG;
+    else if (name == "yoshida")
+        integrator = Integrator::YOSHIDA;
+    else if (name == "hermite")
+        integrator = Integrator::HERMITE;
+    else
+        return false;
+
+    return true;
+}
+
+const char *integratorName(Integrator integrator)
+{
+    switch (integrator)
+    {
+        case Integrator::LEAPFROG:
+            return "leapfrog";
+        case Integrator::YOSHIDA:
+            return "yoshida";
+        case Integrator::HERMITE:
+            return "hermite";
+    }
+    return "unknown";
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cmath>
+#include "lod.h"
+
+LodRenderer::LodRenderer(int maxSubdivision, float sphereSize, int capacity)
+        : selector(sphereSize), instances(capacity)
+{
+    // Coarse levels stay cheap whatever the finest subdivision asked for
+    int subdivisions[LOD_LEVELS] = {1, std::min(3, maxSubdivision), maxSubdivision};
+    for (int l = 0; l < LOD_LEVELS; ++l)
+        levels[l] = std::make_unique<Sphere>(std::max(subdivisions[l], 1), 1.0f);
+
+    // Sprites have no mesh, only the instance attributes bound at draw time
+    glGenVertexArrays(1, &spriteVAO);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+}
+
+LodRenderer::~LodRenderer()
+{
+    glDeleteVertexArrays(1, &spriteVAO);
+}
+
+void LodRenderer::prepare(const FrameView &frame, const glm::mat4 &projection, const glm::mat4 &view,
+                          const glm::vec3 &eye, float fovY, int screenHeight)
+{
+    float pixelScale = static_cast<float>(screenHeight) / (2.0f * std::tan(0.5f * fovY));
+    glm::mat4 viewProjection = projection * view;
+    float eyePosition[3] = {eye.x, eye.y, eye.z};
+
+    // Lists are laid out in the region back to back, mesh levels first, so every list is written in place.
+    // Every selected body or impostor stands for at least one particle, so one region always suffices
+    size_t counts[LOD_LISTS];
+    selector.count(frame, &viewProjection[0][0], eyePosition, pixelScale, counts);
+
+    SphereInstance *region = instances.map();
+    SphereInstance *lists[LOD_LISTS];
+    size_t placed = 0;
+    for (int l = 0; l < LOD_LISTS; ++l)
+    {
+        counts[l] = std::min(counts[l], static_cast<size_t>(instances.capacity()) - placed);
+        lists[l] = region + placed;
+        offsets[l] = placed * sizeof(SphereInstance);
+        placed += counts[l];
+    }
+    selector.write(frame, &viewProjection[0][0], eyePosition, pixelScale, lists, counts, written);
+    base = instances.unmap();
+}
+
+void LodRenderer::draw(const Shader &sphereShader, const Shader &spriteShader, const glm::mat4 &projection,
+                       const glm::mat4 &view)
+{
+    glm::vec3 specular(1.0f, 1.0f, 1.0f);
+    glm::vec3 ambient(0.1f, 0.1f, 0.1f);
+    for (int l = 0; l < LOD_LEVELS; ++l)
+    {
+        if (written[l] > 0)
+            levels[l]->drawInstanced(sphereShader, instances, base + offsets[l], static_cast<int>(written[l]),
+                                     specular, ambient, glm::vec3(0.0f, 0.0f, 0.0f));
+    }
+
+    if (written[LOD_LEVELS] > 0)
+    {
+        spriteShader.use();
+        spriteShader.setMat4("projection", projection);
+        spriteShader.setMat4("view", view);
+
+        glBindVertexArray(spriteVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instances.buffer());
+        size_t offset = base + offsets[LOD_LEVELS];
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void *) offset);
+        glEnableVertexAttribArray(2);
+        glVertexAttribDivisor(2, 1);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance),
+                              (void *) (offset + offsetof(SphereInstance, r)));
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+
+        glDrawArraysInstanced(GL_POINTS, 0, 1, static_cast<GLsizei>(written[LOD_LEVELS]));
+    }
+
+    instances.fence();
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include "lodselect.h"
+
+// Cool for light bodies, warm for heavy ones; relative is mass over the mean body mass
+static void massColour(float relative, SphereInstance &instance)
+{
+    float warm = std::clamp(std::log2(std::max(relative, 1.0e-3f)) * 0.25f + 0.5f, 0.0f, 1.0f);
+    instance.r = 0.3f + 0.7f * warm;
+    instance.g = 0.4f + 0.4f * warm;
+    instance.b = 0.8f - 0.3f * warm;
+}
+
+static float distance(float x, float y, float z, const float eye[3])
+{
+    float dx = x - eye[0], dy = y - eye[1], dz = z - eye[2];
+    return std::max(std::sqrt(dx * dx + dy * dy + dz * dz), 1.0e-3f);
+}
+
+template<typename Emit>
+void LodSelector::selectBody(const FrameView &frame, int p, float relative, const float eye[3], float pixelScale,
+                             LodStats &stats, Emit &&emit) const
+{
+    float radius = sphereSize * std::cbrt(relative);
+    float pixels = radius * pixelScale / distance(frame.x[p], frame.y[p], frame.z[p], eye);
+
+    SphereInstance instance{frame.x[p], frame.y[p], frame.z[p], radius, 0.0f, 0.0f, 0.0f, 1.0f};
+    massColour(relative, instance);
+    if (pixels < pointPixels)
+    {
+        instance.radius = std::max(2.0f * pixels, 1.0f);
+        emit(LOD_LEVELS, instance);
+        ++stats.points;
+    }
+    else
+    {
+        int level = 0;
+        while (level < LOD_LEVELS - 1 && pixels >= levelPixels[level])
+            ++level;
+        emit(level, instance);
+        ++stats.meshes[level];
+    }
+}
+
+template<typename Emit>
+void LodSelector::select(const FrameView &frame, const float viewProjection[16], const float eye[3],
+                         float pixelScale, LodStats &stats, Emit &&emit) const
+{
+    stats = LodStats{};
+    if (frame.count == 0)
+        return;
+
+    // Frustum planes (normal, offset) from the rows of the combined matrix; inside is dot(n, p) + d >= 0
+    const float *m = viewProjection;
+    float planes[6][4];
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            planes[2 * k][c] = m[4 * c + 3] + m[4 * c + k];
+            planes[2 * k + 1][c] = m[4 * c + 3] - m[4 * c + k];
+        }
+    }
+
+    // Frames without a tree (e.g. read from shared memory) are culled body by body
+    if (frame.nodeCount == 0)
+    {
+        double totalMass = 0.0;
+        for (size_t p = 0; p < frame.count; ++p)
+            totalMass += frame.mass[p];
+        float meanMass = static_cast<float>(totalMass / static_cast<double>(frame.count));
+        if (meanMass <= 0.0f)
+            return;
+
+        for (size_t p = 0; p < frame.count; ++p)
+        {
+            float relative = frame.mass[p] / meanMass;
+            float pad = sphereSize * std::cbrt(relative);
+
+            bool outside = false;
+            for (const float *plane: planes)
+            {
+                float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+                if (plane[0] * frame.x[p] + plane[1] * frame.y[p] + plane[2] * frame.z[p] + plane[3] < -pad * length)
+                {
+                    outside = true;
+                    break;
+                }
+            }
+            if (outside)
+                continue;
+
+            selectBody(frame, static_cast<int>(p), relative, eye, pixelScale, stats, emit);
+        }
+        return;
+    }
+
+    const RenderNode *nodes = frame.nodes;
+    float meanMass = nodes[0].mass / static_cast<float>(frame.count);
+
+    int i = 0;
+    int count = static_cast<int>(frame.nodeCount);
+    while (i < count)
+    {
+        const RenderNode &node = nodes[i];
+
+        float relative = node.mass / meanMass;
+
+        // Bounds hold the body centres; pad by the largest sphere a body of the node's mass could draw
+        float pad = sphereSize * std::cbrt(relative);
+        float low[3] = {node.x - pad, node.y - pad, node.z - pad};
+        float side = node.width + 2.0f * pad;
+
+        // Culled when the box corner furthest along a plane's normal is still outside it
+        bool outside = false;
+        for (const float *plane: planes)
+        {
+            float reach = plane[3];
+            for (int axis = 0; axis < 3; ++axis)
+                reach += plane[axis] * (plane[axis] >= 0.0f ? low[axis] + side : low[axis]);
+            if (reach < 0.0f)
+            {
+                outside = true;
+                break;
+            }
+        }
+        if (outside)
+        {
+            ++stats.culledNodes;
+            i = node.next;
+            continue;
+        }
+
+        if (node.particle != NULL_INDEX)
+        {
+            selectBody(frame, node.particle, relative, eye, pixelScale, stats, emit);
+            i = node.next;
+            continue;
+        }
+
+        float pixels = node.width * pixelScale / distance(node.comX, node.comY, node.comZ, eye);
+        if (pixels < impostorPixels)
+        {
+            // Brightness follows the aggregated mass, compressed so dense regions do not saturate at once
+            SphereInstance impostor{node.comX, node.comY, node.comZ, impostorPixels, 0.0f, 0.0f, 0.0f,
+                                    std::min(0.35f + 0.15f * std::log2(std::max(relative, 1.0f)), 1.0f)};
+            massColour(1.0f, impostor);
+            emit(LOD_LEVELS, impostor);
+            ++stats.impostors;
+            i = node.next;
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+void LodSelector::count(const FrameView &frame, const float viewProjection[16], const float eye[3],
+                        float pixelScale, size_t counts[LOD_LISTS])
+{
+    std::fill(counts, counts + LOD_LISTS, 0);
+    LodStats stats;
+    select(frame, viewProjection, eye, pixelScale, stats, [counts](int list, const SphereInstance &) {
+        ++counts[list];
+    });
+}
+
+void LodSelector::write(const FrameView &frame, const float viewProjection[16], const float eye[3],
+                        float pixelScale, SphereInstance *const lists[LOD_LISTS], const size_t limits[LOD_LISTS],
+                        size_t written[LOD_LISTS])
+{
+    std::fill(written, written + LOD_LISTS, 0);
+    select(frame, viewProjection, eye, pixelScale, lastStats, [=](int list, const SphereInstance &instance) {
+        if (written[list] < limits[list])
+            lists[list][written[list]++] = instance;
+    });
+}
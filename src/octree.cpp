@@ -2,7 +2,11 @@
 #include <stack>
 #include <numeric>
 #include <cmath>
+#include <iostream>
+#include <vector>
 #include "octree.h"
+#include "compactnode.h"
+#include "profiler.h"
 #include "omp.h"
 
 uint64_t Octree::expandBits(uint64_t v)
@@ -16,7 +20,7 @@ uint64_t Octree::expandBits(uint64_t v)
     return v;
 }
 
-uint64_t Octree::morton3D(float x, float y, float z)
+uint64_t Octree::morton3D(Real x, Real y, Real z)
 {
     x += 32768.0f;
     y += 32768.0f;
@@ -30,13 +34,25 @@ uint64_t Octree::morton3D(float x, float y, float z)
     scaledY = std::max(0U, std::min(scaledY, 65536U));
     scaledZ = std::max(0U, std::min(scaledZ, 65536U));
 
-    uint64_t xx = expandBits(scaledX);
-    uint64_t yy = expandBits(scaledY);
-    uint64_t zz = expandBits(scaledZ);
+    return morton3D(scaledX, scaledY, scaledZ);
+}
+
+uint64_t Octree::morton3D(unsigned int x, unsigned int y, unsigned int z)
+{
+    uint64_t xx = expandBits(x);
+    uint64_t yy = expandBits(y);
+    uint64_t zz = expandBits(z);
 
     return xx | (yy << 1) | (zz << 2);
 }
 
+void Octree::mortonDecode3D(uint64_t code, unsigned int &x, unsigned int &y, unsigned int &z)
+{
+    x = static_cast<unsigned int>(compactBits(code));
+    y = static_cast<unsigned int>(compactBits(code >> 1));
+    z = static_cast<unsigned int>(compactBits(code >> 2));
+}
+
 bool Octree::noChildren(const SimulationData &data, int nodeIndex)
 {
     for (int i = 0; i < OCT_CHILD; ++i)
@@ -48,13 +64,19 @@ bool Octree::noChildren(const SimulationData &data, int nodeIndex)
     return true;
 }
 
-int Octree::createNode(float x, float y, float z, float size, uint64_t mortonCode,
+int Octree::createNode(NodeReal x, NodeReal y, NodeReal z, NodeReal size, uint64_t mortonCode,
                        const SimulationData &data)
 {
     int index;
 #pragma omp atomic capture
     index = nodeCount++;
 
+    if (index >= data.nodeCapacity)
+    {
+        std::cerr << "Octree node capacity " << data.nodeCapacity << " exceeded" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
     data.nodeX[index] = x;
     data.nodeY[index] = y;
     data.nodeZ[index] = z;
@@ -80,8 +102,6 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
 
     int depth;
 
-    uint64_t mortonCode = 1;
-
     while (!stack.empty())
     {
         auto top = stack.top();
@@ -94,6 +114,7 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
         if (data.nodeParticleIndex[nodeIndex] == NULL_INDEX && noChildren(data, nodeIndex))
         {
             data.nodeParticleIndex[nodeIndex] = particleIndex;
+            treeDepth = std::max(treeDepth, depth);
 
             data.nodeTotalMass[nodeIndex] = data.particleMass[particleIndex];
             data.nodeCOM_X[nodeIndex] = data.particleX[particleIndex];
@@ -103,9 +124,9 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
         }
         else
         {
-            float halfWidth = data.nodeWidth[nodeIndex] / 2.0f;
-            float halfHeight = data.nodeHeight[nodeIndex] / 2.0f;
-            float halfDepth = data.nodeDepth[nodeIndex] / 2.0f;
+            NodeReal halfWidth = data.nodeWidth[nodeIndex] / 2.0f;
+            NodeReal halfHeight = data.nodeHeight[nodeIndex] / 2.0f;
+            NodeReal halfDepth = data.nodeDepth[nodeIndex] / 2.0f;
             // If the node already contains a particle or has children, we need to update the COM and mass
             // Generate new node for existing particle and push them to stack
             if (data.nodeParticleIndex[nodeIndex] != NULL_INDEX || !noChildren(data, nodeIndex))
@@ -132,25 +153,25 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
 
                     if (data.nodeChildren[nodeIndex][childIndex] == NULL_INDEX && depth < maxDepth)
                     {
-                        float childX = data.nodeX[nodeIndex] + (childIndex & 1 ? halfWidth : 0);
-                        float childY = data.nodeY[nodeIndex] + (childIndex & 2 ? halfHeight : 0);
-                        float childZ = data.nodeZ[nodeIndex] + (childIndex & 4 ? halfDepth : 0);
-
-                        mortonCode = (mortonCode << 3 | childIndex);
+                        NodeReal childX = data.nodeX[nodeIndex] + (childIndex & 1 ? halfWidth : 0);
+                        NodeReal childY = data.nodeY[nodeIndex] + (childIndex & 2 ? halfHeight : 0);
+                        NodeReal childZ = data.nodeZ[nodeIndex] + (childIndex & 4 ? halfDepth : 0);
 
+                        // Level-marked: the parent's code followed by the octant
+                        uint64_t mortonCode = data.nodeMortonCode[nodeIndex] << 3 | childIndex;
                         data.nodeChildren[nodeIndex][childIndex] = createNode(childX, childY, childZ,
                                                                               halfWidth, mortonCode,
                                                                               data);
                     }
                     if (depth < maxDepth)
-                        stack.push({data.nodeChildren[nodeIndex][childIndex], existingParticleIndex, ++depth});
+                        stack.push({data.nodeChildren[nodeIndex][childIndex], existingParticleIndex, depth + 1});
                 }
                 // Calculate the new COM and total mass by including the new particle
-                float newParticleMass = data.particleMass[particleIndex];
-                float newParticleX = data.particleX[particleIndex];
-                float newParticleY = data.particleY[particleIndex];
-                float newParticleZ = data.particleZ[particleIndex];
-                float totalMassBeforeInsert = data.nodeTotalMass[nodeIndex];
+                NodeReal newParticleMass = data.particleMass[particleIndex];
+                NodeReal newParticleX = data.particleX[particleIndex];
+                NodeReal newParticleY = data.particleY[particleIndex];
+                NodeReal newParticleZ = data.particleZ[particleIndex];
+                NodeReal totalMassBeforeInsert = data.nodeTotalMass[nodeIndex];
 
                 // Update the node's total mass
                 data.nodeTotalMass[nodeIndex] += newParticleMass;
@@ -179,10 +200,11 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
 
             if (data.nodeChildren[nodeIndex][childIndex] == NULL_INDEX && depth < maxDepth)
             {
-                float childX = data.nodeX[nodeIndex] + (childIndex & 1 ? halfWidth : 0);
-                float childY = data.nodeY[nodeIndex] + (childIndex & 2 ? halfHeight : 0);
-                float childZ = data.nodeZ[nodeIndex] + (childIndex & 4 ? halfDepth : 0);
+                NodeReal childX = data.nodeX[nodeIndex] + (childIndex & 1 ? halfWidth : 0);
+                NodeReal childY = data.nodeY[nodeIndex] + (childIndex & 2 ? halfHeight : 0);
+                NodeReal childZ = data.nodeZ[nodeIndex] + (childIndex & 4 ? halfDepth : 0);
 
+                uint64_t mortonCode = data.nodeMortonCode[nodeIndex] << 3 | childIndex;
                 data.nodeChildren[nodeIndex][childIndex] = createNode(childX, childY, childZ,
                                                                       halfWidth, mortonCode,
                                                                       data);
@@ -190,7 +212,7 @@ void Octree::insertParticleToNode(int nodeIndex, int particleIndex, int maxDepth
 
             // Push the new particle to the appropriate child node
             if (depth < maxDepth)
-                stack.push({data.nodeChildren[nodeIndex][childIndex], particleIndex, ++depth});
+                stack.push({data.nodeChildren[nodeIndex][childIndex], particleIndex, depth + 1});
         }
     }
 }
@@ -204,13 +226,17 @@ void Octree::makeLeafNode(SimulationData& data)
         {
             int particleIdx = data.nodeParticleIndex[i];
 
-            float leafX = 1.0f < data.nodeWidth[i] ? std::floor(data.particleX[particleIdx]) : data.nodeX[i];
-            float leafY = 1.0f < data.nodeHeight[i] ? std::floor(data.particleY[particleIdx]) : data.nodeY[i];
-            float leafZ = 1.0f < data.nodeDepth[i] ? std::floor(data.particleZ[particleIdx]) : data.nodeZ[i];
+            NodeReal leafX = 1.0f < data.nodeWidth[i] ? std::floor(data.particleX[particleIdx]) : data.nodeX[i];
+            NodeReal leafY = 1.0f < data.nodeHeight[i] ? std::floor(data.particleY[particleIdx]) : data.nodeY[i];
+            NodeReal leafZ = 1.0f < data.nodeDepth[i] ? std::floor(data.particleZ[particleIdx]) : data.nodeZ[i];
 
+            // The unit cell sits at the deepest level wherever the body is, so its code is not the leaf's
+            uint64_t unitCode = 1.0f < data.nodeWidth[i]
+                                ? uint64_t(1) << (3 * COMPACT_UNIT_DEPTH) | morton3D(leafX, leafY, leafZ)
+                                : data.nodeMortonCode[i];
             data.nodeChildren[i][0] = createNode(leafX, leafY, leafZ,
                                                           1.0f < data.nodeWidth[i] ? 1.0f : data.nodeWidth[i],
-                                                          morton3D(leafX, leafY, leafZ), data);
+                                                          unitCode, data);
 
             int childIdx = data.nodeChildren[i][0];
 
@@ -222,32 +248,104 @@ void Octree::makeLeafNode(SimulationData& data)
     }
 }
 
+void Octree::nodeVelocities(SimulationData &data) const
+{
+    // Children are always created after their parent, so a reverse sweep sees them first. A body's leaf and
+    // the unit cell makeLeafNode hangs below it both move with the body
+    for (int i = nodeCount - 1; i >= 0; --i)
+    {
+        int particleIdx = data.nodeParticleIndex[i];
+        if (particleIdx != NULL_INDEX)
+        {
+            for (int node: {i, data.nodeChildren[i][0]})
+            {
+                data.nodeVelX[node] = data.particleVelX[particleIdx];
+                data.nodeVelY[node] = data.particleVelY[particleIdx];
+                data.nodeVelZ[node] = data.particleVelZ[particleIdx];
+            }
+            continue;
+        }
+
+        NodeReal mass = 0.0f, momentumX = 0.0f, momentumY = 0.0f, momentumZ = 0.0f;
+        for (unsigned c = 0; c < OCT_CHILD; ++c)
+        {
+            int child = data.nodeChildren[i][c];
+            if (child == NULL_INDEX)
+                continue;
+            mass += data.nodeTotalMass[child];
+            momentumX += data.nodeTotalMass[child] * data.nodeVelX[child];
+            momentumY += data.nodeTotalMass[child] * data.nodeVelY[child];
+            momentumZ += data.nodeTotalMass[child] * data.nodeVelZ[child];
+        }
+        NodeReal inverse = mass > 0.0f ? 1.0f / mass : 0.0f;
+        data.nodeVelX[i] = momentumX * inverse;
+        data.nodeVelY[i] = momentumY * inverse;
+        data.nodeVelZ[i] = momentumZ * inverse;
+    }
+}
+
+void Octree::packCompactNodes(SimulationData &data) const
+{
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        CompactNode &node = data.compactNodes[i];
+        node.code = data.nodeMortonCode[i] | (noChildren(data, i) ? COMPACT_LEAF : 0);
+
+        NodeReal inverse = 1.0f / data.nodeWidth[i];
+        node.com[0] = quantiseOffset((data.nodeCOM_X[i] - data.nodeX[i]) * inverse);
+        node.com[1] = quantiseOffset((data.nodeCOM_Y[i] - data.nodeY[i]) * inverse);
+        node.com[2] = quantiseOffset((data.nodeCOM_Z[i] - data.nodeZ[i]) * inverse);
+        node.mass = toBFloat16(static_cast<float>(data.nodeTotalMass[i]));
+    }
+}
+
 void Octree::buildTree(SimulationData &data)
 {
     nodeCount = 0;
+    treeDepth = 0;
     int rootNodeIndex = createNode(-32768.0f, -32768.0f, -32768.0f,
                                    65536.0f, 1, data);
 
-    unsigned int mortonIndex[MAX_PARTICLES];
-
-    std::iota(data.idxSorted, data.idxSorted + MAX_PARTICLES, 0);
+    std::vector<uint64_t> mortonIndex(data.particleCount);
 
-    for (int i = 0; i < MAX_PARTICLES; ++i)
     {
-        mortonIndex[i] = morton3D(data.particleX[i], data.particleY[i], data.particleZ[i]);
+        PROFILE_PHASE(Phase::MORTON_KEYS);
+        std::iota(data.idxSorted, data.idxSorted + data.particleCount, 0);
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            mortonIndex[i] = morton3D(data.particleX[i], data.particleY[i], data.particleZ[i]);
+        }
     }
 
-    std::sort(data.idxSorted, data.idxSorted + MAX_PARTICLES,
-              [&mortonIndex](int i1, int i2) { return mortonIndex[i1] < mortonIndex[i2]; });
+    {
+        PROFILE_PHASE(Phase::SORT);
+        std::sort(data.idxSorted, data.idxSorted + data.particleCount,
+                  [&mortonIndex](int i1, int i2) { return mortonIndex[i1] < mortonIndex[i2]; });
+    }
 
-    for (int i = 0; i < MAX_PARTICLES; i++)
     {
-        int sortedParticleIndex = static_cast<int>(data.idxSorted[i]);
-        if (data.particleMass[sortedParticleIndex] > 0)
+        // Internal-node mass and COM are accumulated while inserting
+        PROFILE_PHASE(Phase::TREE_BUILD);
+        for (int i = 0; i < data.particleCount; i++)
         {
-            insertParticleToNode(rootNodeIndex, sortedParticleIndex, 16, data);
+            int sortedParticleIndex = static_cast<int>(data.idxSorted[i]);
+            if (data.particleMass[sortedParticleIndex] > 0)
+            {
+                insertParticleToNode(rootNodeIndex, sortedParticleIndex, OCTREE_MAX_DEPTH, data);
+            }
         }
     }
 
-    makeLeafNode(data);
+    {
+        // Leaf cells take their moments from the single particle they hold
+        PROFILE_PHASE(Phase::MOMENTS);
+        makeLeafNode(data);
+        if (data.nodeVelX != nullptr)
+            nodeVelocities(data);
+        if (data.compactNodes != nullptr)
+            packCompactNodes(data);
+    }
 }
\ No newline at end of file
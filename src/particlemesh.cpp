@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "particlemesh.h"
+#include "profiler.h"
+#include "omp.h"
+
+// Checked in the initialiser list, so a bad mesh size is reported here rather than by the FFT of the padding
+static int paddedSize(int meshSize, float splitCells, int margin)
+{
+    if (meshSize < 4 * margin || (meshSize & (meshSize - 1)) != 0 || splitCells <= 0.0f)
+    {
+        std::cerr << "Mesh size must be a power of two of at least " << 4 * margin
+                  << " and the split scale positive" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return 2 * meshSize;
+}
+
+ParticleMesh::ParticleMesh(int meshSize, float splitCells)
+        : n(meshSize), padded(paddedSize(meshSize, splitCells, PM_MARGIN)), splitCells(splitCells), fft(padded)
+{
+    size_t cells = static_cast<size_t>(n) * n * n;
+    grid.resize(static_cast<size_t>(padded) * padded * padded);
+    green.resize(grid.size());
+    for (auto *mesh: {&potential, &forceX, &forceY, &forceZ})
+        mesh->assign(cells, 0.0f);
+    slabStart.resize(n + 1);
+}
+
+void ParticleMesh::fit(SimulationData &data)
+{
+    Real low[3] = {INFINITY, INFINITY, INFINITY}, high[3] = {-INFINITY, -INFINITY, -INFINITY};
+    const Real *positions[3] = {data.particleX, data.particleY, data.particleZ};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        Real lo = INFINITY, hi = -INFINITY;
+        const Real *p = positions[axis];
+#pragma omp parallel for schedule(static) reduction(min:lo) reduction(max:hi)
+        for (int i = 0; i < data.particleCount; ++i)
+        {
+            lo = std::min(lo, p[i]);
+            hi = std::max(hi, p[i]);
+        }
+        low[axis] = lo;
+        high[axis] = hi;
+    }
+
+    auto extent = static_cast<float>(std::max({high[0] - low[0], high[1] - low[1], high[2] - low[2], Real(1.0e-3)}));
+    float needed = extent / static_cast<float>(n - 2 * PM_MARGIN - 1);
+
+    // Refit with headroom for the drift within a step, and keep the spacing while the bodies still fill
+    // more than half the mesh so the Green's function is rebuilt rarely
+    if (spacing == 0.0f || needed > spacing / 1.05f || needed < 0.5f * spacing)
+    {
+        spacing = 1.2f * needed;
+        buildGreen();
+    }
+
+    data.splitRadius = splitRadius();
+    data.splitCutoff = PM_CUTOFF * splitRadius();
+}
+
+void ParticleMesh::buildGreen()
+{
+    float rs = splitRadius();
+    int half = padded / 2;
+
+    // Long-range potential of a unit mass at every separation the padded mesh can express, wrapped
+#pragma omp parallel for schedule(static)
+    for (int z = 0; z < padded; ++z)
+    {
+        float dz = static_cast<float>(z < half ? z : z - padded);
+        for (int y = 0; y < padded; ++y)
+        {
+            float dy = static_cast<float>(y < half ? y : y - padded);
+            for (int x = 0; x < padded; ++x)
+            {
+                float dx = static_cast<float>(x < half ? x : x - padded);
+                float r = spacing * std::sqrt(dx * dx + dy * dy + dz * dz);
+                float g = r > 0.0f ? -std::erf(r / (2.0f * rs)) / r : -1.0f / (std::sqrt(static_cast<float>(M_PI)) * rs);
+                grid[paddedIndex(x, y, z)] = g;
+            }
+        }
+    }
+
+    fft.forward(grid.data());
+
+    // Divide out the cloud-in-cell window twice (deposit and interpolation) and fold in the 1 / padded^3 of
+    // the inverse transform
+    std::vector<float> window(padded);
+    for (int k = 0; k < padded; ++k)
+    {
+        float wrapped = static_cast<float>(k < half ? k : k - padded);
+        float arg = static_cast<float>(M_PI) * wrapped / static_cast<float>(padded);
+        float sinc = k == 0 ? 1.0f : std::sin(arg) / arg;
+        window[k] = sinc * sinc;
+    }
+
+    float normalisation = 1.0f / (static_cast<float>(padded) * padded * padded);
+#pragma omp parallel for schedule(static)
+    for (int z = 0; z < padded; ++z)
+    {
+        for (int y = 0; y < padded; ++y)
+        {
+            for (int x = 0; x < padded; ++x)
+            {
+                float w = window[x] * window[y] * window[z];
+                size_t index = paddedIndex(x, y, z);
+                green[index] = grid[index].real() * normalisation / (w * w);
+            }
+        }
+    }
+}
+
+void ParticleMesh::deposit(const SimulationData &data)
+{
+    // Bodies bucketed by x cell; a body writes its cell and the next, so every other slab can be deposited in
+    // parallel without two threads touching the same cells
+    std::fill(slabStart.begin(), slabStart.end(), 0);
+    slabBodies.resize(data.particleCount);
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        int cell;
+        float weight;
+        locate(data.particleX[i], origin[0], cell, weight);
+        ++slabStart[cell + 1];
+    }
+    for (int s = 0; s < n; ++s)
+        slabStart[s + 1] += slabStart[s];
+
+    std::vector<int> fill(slabStart.begin(), slabStart.end() - 1);
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        int cell;
+        float weight;
+        locate(data.particleX[i], origin[0], cell, weight);
+        slabBodies[fill[cell]++] = i;
+    }
+
+    for (int colour = 0; colour < 2; ++colour)
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (int slab = colour; slab < n; slab += 2)
+        {
+            for (int b = slabStart[slab]; b < slabStart[slab + 1]; ++b)
+            {
+                int i = slabBodies[b];
+                int cx, cy, cz;
+                float wx, wy, wz;
+                locate(data.particleX[i], origin[0], cx, wx);
+                locate(data.particleY[i], origin[1], cy, wy);
+                locate(data.particleZ[i], origin[2], cz, wz);
+
+                float m = data.particleMass[i];
+                for (int c = 0; c < CIC_CORNERS; ++c)
+                {
+                    float w = m * (c & 1 ? wx : 1.0f - wx) * (c & 2 ? wy : 1.0f - wy) * (c & 4 ? wz : 1.0f - wz);
+                    grid[paddedIndex(cx + (c & 1), cy + (c & 2 ? 1 : 0), cz + (c & 4 ? 1 : 0))] += w;
+                }
+            }
+        }
+    }
+}
+
+void ParticleMesh::solve(const SimulationData &data)
+{
+    PROFILE_PHASE(Phase::MESH);
+
+    // The mesh follows the bodies; translating it leaves the Green's function unchanged
+    const Real *positions[3] = {data.particleX, data.particleY, data.particleZ};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        Real lo = INFINITY;
+        const Real *p = positions[axis];
+#pragma omp parallel for schedule(static) reduction(min:lo)
+        for (int i = 0; i < data.particleCount; ++i)
+            lo = std::min(lo, p[i]);
+        origin[axis] = static_cast<float>(lo) - PM_MARGIN * spacing;
+    }
+
+    std::fill(grid.begin(), grid.end(), std::complex<float>(0.0f, 0.0f));
+    deposit(data);
+
+    fft.forward(grid.data(), n);
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < grid.size(); ++k)
+        grid[k] *= green[k];
+    fft.inverse(grid.data(), n);
+
+    // Only the first meshSize cells per side hold the isolated potential; the rest is wrap-around
+#pragma omp parallel for schedule(static)
+    for (int z = 0; z < n; ++z)
+    {
+        for (int y = 0; y < n; ++y)
+        {
+            for (int x = 0; x < n; ++x)
+                potential[meshIndex(x, y, z)] = grid[paddedIndex(x, y, z)].real();
+        }
+    }
+
+    // Four-point central differences; bodies never sit within PM_MARGIN cells of the mesh edge
+    float scale = 1.0f / spacing;
+#pragma omp parallel for schedule(static)
+    for (int z = PM_MARGIN; z < n - PM_MARGIN; ++z)
+    {
+        for (int y = PM_MARGIN; y < n - PM_MARGIN; ++y)
+        {
+            for (int x = PM_MARGIN; x < n - PM_MARGIN; ++x)
+            {
+                auto difference = [&](size_t stride) {
+                    size_t c = meshIndex(x, y, z);
+                    float near = potential[c + stride] - potential[c - stride];
+                    float far = potential[c + 2 * stride] - potential[c - 2 * stride];
+                    return -(2.0f / 3.0f * near - 1.0f / 12.0f * far) * scale;
+                };
+                size_t c = meshIndex(x, y, z);
+                forceX[c] = difference(1);
+                forceY[c] = difference(n);
+                forceZ[c] = difference(static_cast<size_t>(n) * n);
+            }
+        }
+    }
+}
+
+void ParticleMesh::addAcceleration(int i, const SimulationData &data) const
+{
+    int cx, cy, cz;
+    float wx, wy, wz;
+    locate(data.particleX[i], origin[0], cx, wx);
+    locate(data.particleY[i], origin[1], cy, wy);
+    locate(data.particleZ[i], origin[2], cz, wz);
+
+    float ax = 0.0f, ay = 0.0f, az = 0.0f, phi = 0.0f;
+    for (int c = 0; c < CIC_CORNERS; ++c)
+    {
+        float w = (c & 1 ? wx : 1.0f - wx) * (c & 2 ? wy : 1.0f - wy) * (c & 4 ? wz : 1.0f - wz);
+        size_t index = meshIndex(cx + (c & 1), cy + (c & 2 ? 1 : 0), cz + (c & 4 ? 1 : 0));
+        ax += w * forceX[index];
+        ay += w * forceY[index];
+        az += w * forceZ[index];
+        phi += w * potential[index];
+    }
+
+    data.accX[i] += ax;
+    data.accY[i] += ay;
+    data.accZ[i] += az;
+
+    // The mesh potential includes the body's own smoothed mass, -m / (sqrt(pi) r_s) at zero separation
+    if (data.potential != nullptr)
+        data.potential[i] += phi + data.particleMass[i] / (std::sqrt(static_cast<float>(M_PI)) * splitRadius());
+}
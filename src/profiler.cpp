@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <iostream>
+#include "profiler.h"
+#include "omp.h"
+
+const char *phaseName(Phase phase)
+{
+    switch (phase)
+    {
+        case Phase::MORTON_KEYS:
+            return "morton_keys";
+        case Phase::SORT:
+            return "sort";
+        case Phase::TREE_BUILD:
+            return "tree_build";
+        case Phase::MOMENTS:
+            return "moments";
+        case Phase::FORCE_WALK:
+            return "force_walk";
+        case Phase::INTEGRATE:
+            return "integrate";
+        case Phase::COLLIDE:
+            return "collide";
+        case Phase::MESH:
+            return "mesh";
+        case Phase::OUTPUT:
+            return "output";
+        case Phase::COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+const char *counterName(Counter counter)
+{
+    switch (counter)
+    {
+        case Counter::NODES_VISITED:
+            return "nodes_visited";
+        case Counter::PARTICLE_PARTICLE:
+            return "particle_particle";
+        case Counter::PARTICLE_NODE:
+            return "particle_node";
+        case Counter::COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+Profiler &Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+        : slots(), threads(std::min(omp_get_max_threads(), MAX_PROFILE_THREADS)), ring(RING_CAPACITY)
+{
+}
+
+void Profiler::openCsv(const std::string &path)
+{
+    csv.open(path);
+    if (!csv)
+    {
+        std::cerr << "Failed to open metrics file " << path << std::endl;
+        return;
+    }
+
+    csv << "step,step_seconds";
+    for (int p = 0; p < PHASE_COUNT; ++p)
+        csv << "," << phaseName(static_cast<Phase>(p));
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+        csv << "," << counterName(static_cast<Counter>(c));
+    csv << ",node_count,tree_depth";
+    for (int t = 0; t < threads; ++t)
+        csv << ",busy_" << t << ",idle_" << t;
+    csv << "\n";
+}
+
+void Profiler::openJson(const std::string &path)
+{
+    json.open(path);
+    if (!json)
+        std::cerr << "Failed to open metrics file " << path << std::endl;
+}
+
+void Profiler::beginStep(uint64_t step)
+{
+    current.step = step;
+    current.stepSeconds = 0.0;
+    std::fill(std::begin(current.phaseSeconds), std::end(current.phaseSeconds), 0.0);
+    std::fill(std::begin(current.counters), std::end(current.counters), 0);
+    parallelSeconds = 0.0;
+
+    for (int t = 0; t < threads; ++t)
+        slots[t] = ThreadSlot{};
+
+    stepStart = std::chrono::steady_clock::now();
+}
+
+void Profiler::addPhase(Phase phase, double seconds, bool parallel)
+{
+    current.phaseSeconds[static_cast<int>(phase)] += seconds;
+    if (parallel)
+        parallelSeconds += seconds;
+}
+
+void Profiler::endStep(int nodeCount, int treeDepth)
+{
+    current.stepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+    current.nodeCount = nodeCount;
+    current.treeDepth = treeDepth;
+
+    current.threadBusy.resize(threads);
+    current.threadIdle.resize(threads);
+    for (int t = 0; t < threads; ++t)
+    {
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            current.counters[c] += slots[t].counters[c];
+
+        current.threadBusy[t] = slots[t].busy;
+        current.threadIdle[t] = std::max(0.0, parallelSeconds - slots[t].busy);
+    }
+
+    // Copy-assignment reuses the slot's vectors, so steady-state recording does not allocate
+    StepMetrics &slot = ring[ringHead];
+    slot = current;
+    ringHead = (ringHead + 1) % RING_CAPACITY;
+    ringSize = std::min(ringSize + 1, RING_CAPACITY);
+
+    if (csv.is_open())
+        writeCsv(slot);
+    if (json.is_open())
+        writeJson(slot);
+}
+
+std::vector<StepMetrics> Profiler::recent() const
+{
+    std::vector<StepMetrics> steps;
+    steps.reserve(ringSize);
+    for (size_t i = 0; i < ringSize; ++i)
+        steps.push_back(ring[(ringHead + RING_CAPACITY - ringSize + i) % RING_CAPACITY]);
+    return steps;
+}
+
+void Profiler::writeCsv(const StepMetrics &metrics)
+{
+    csv << metrics.step << "," << metrics.stepSeconds;
+    for (double seconds: metrics.phaseSeconds)
+        csv << "," << seconds;
+    for (uint64_t counter: metrics.counters)
+        csv << "," << counter;
+    csv << "," << metrics.nodeCount << "," << metrics.treeDepth;
+    for (int t = 0; t < threads; ++t)
+        csv << "," << metrics.threadBusy[t] << "," << metrics.threadIdle[t];
+    csv << "\n";
+}
+
+void Profiler::writeJson(const StepMetrics &metrics)
+{
+    // One JSON object per line
+    json << "{\"step\":" << metrics.step << ",\"step_seconds\":" << metrics.stepSeconds << ",\"phases\":{";
+    for (int p = 0; p < PHASE_COUNT; ++p)
+        json << (p ? "," : "") << "\"" << phaseName(static_cast<Phase>(p)) << "\":" << metrics.phaseSeconds[p];
+    json << "},\"counters\":{";
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+        json << (c ? "," : "") << "\"" << counterName(static_cast<Counter>(c)) << "\":" << metrics.counters[c];
+    json << "},\"node_count\":" << metrics.nodeCount << ",\"tree_depth\":" << metrics.treeDepth << ",\"busy\":[";
+    for (int t = 0; t < threads; ++t)
+        json << (t ? "," : "") << metrics.threadBusy[t];
+    json << "],\"idle\":[";
+    for (int t = 0; t < threads; ++t)
+        json << (t ? "," : "") << metrics.threadIdle[t];
+    json << "]}\n";
+}
@@ -1,6 +1,7 @@
+#include <cmath>
 #include "render.h"
 
-Render::Render(int scrWidth, int scrHeight)
+Render::Render(int scrWidth, int scrHeight, bool hidden)
 {
     SCR_WIDTH = scrWidth;
     SCR_HEIGHT = scrHeight;
@@ -13,6 +14,8 @@ Render::Render(int scrWidth, int scrHeight)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (hidden)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "NBodySim", nullptr, nullptr);
     glfwSetWindowUserPointer(window, this);
@@ -25,7 +28,7 @@ Render::Render(int scrWidth, int scrHeight)
     }
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+    glfwSwapInterval(hidden ? 0 : 1);
     glfwSetFramebufferSizeCallback(window, [](GLFWwindow *w, int width, int height) {
         auto *win = static_cast<Render *>(glfwGetWindowUserPointer(w));
         win->frameBufferSizeCallback(width, height);
@@ -62,8 +65,7 @@ void Render::cameraSetup(Camera &worldCamera)
 
 void Render::sphereSetup(int subdivision, float size, int number)
 {
-    for (int i = 0; i < number; ++i)
-        spheres.emplace_back(subdivision, size);
+    lod = std::make_unique<LodRenderer>(subdivision, size, number);
 }
 
 void Render::lightSetup(Light &light)
@@ -71,6 +73,17 @@ void Render::lightSetup(Light &light)
     this->lightSource = &light;
 }
 
+void Render::snapshotSetup(SnapshotWriter &writer, int interval)
+{
+    this->snapshotWriter = &writer;
+    this->snapshotInterval = interval;
+}
+
+void Render::frameLimitSetup(int frames)
+{
+    this->frameLimit = frames;
+}
+
 void Render::frameBufferSizeCallback(int width, int height)
 {
     glViewport(0, 0, width, height);
@@ -137,55 +150,240 @@ void Render::processInput(GLFWwindow *pWindow)
         camera.processKeyboard(ROLL_LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
         camera.processKeyboard(ROLL_RIGHT, deltaTime);
+
+    if (keyPressed(GLFW_KEY_P))
+        splatRequested = true;
 }
 
-void Render::draw(Shader &sphereShader, SimulationData& data, Octree& tree)
+bool Render::keyPressed(int key)
 {
-    glm::vec3 ambient(0.1f, 0.1f, 0.1f);
-    glm::vec3 diffuse(0.3f, 0.4f, 0.8f);
-    glm::vec3 specular(1.0f, 1.0f, 1.0f);
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    bool pressed = down && !keyDown[key];
+    keyDown[key] = down;
+    return pressed;
+}
 
-    float shininess = 32.0f;
+void Render::processReplayInput(SnapshotPlayer &player)
+{
+    double last = static_cast<double>(player.frameCount() - 1);
+    bool shift = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS;
 
-    while (!glfwWindowShouldClose(window))
+    if (keyPressed(GLFW_KEY_SPACE))
+    {
+        // Pausing remembers the speed to resume with
+        if (player.speed() != 0.0)
+        {
+            replaySpeed = player.speed();
+            player.setSpeed(0.0);
+        }
+        else
+        {
+            player.setSpeed(replaySpeed);
+        }
+    }
+
+    double stepSize = shift ? 10.0 : 1.0;
+    if (keyPressed(GLFW_KEY_RIGHT))
+    {
+        player.setSpeed(0.0);
+        player.seek(std::floor(player.position()) + stepSize);
+    }
+    if (keyPressed(GLFW_KEY_LEFT))
+    {
+        player.setSpeed(0.0);
+        player.seek(std::floor(player.position()) - stepSize);
+    }
+
+    double speed = player.speed() != 0.0 ? player.speed() : replaySpeed;
+    if (keyPressed(GLFW_KEY_UP))
+        speed *= 2.0;
+    if (keyPressed(GLFW_KEY_DOWN))
+        speed *= 0.5;
+    if (keyPressed(GLFW_KEY_R))
+        speed = -speed;
+    if (player.speed() != 0.0 && speed != player.speed())
+        player.setSpeed(speed);
+    replaySpeed = speed;
+
+    if (keyPressed(GLFW_KEY_HOME))
+        player.seek(0.0);
+    if (keyPressed(GLFW_KEY_END))
+        player.seek(last);
+    for (int digit = 0; digit <= 9; ++digit)
+    {
+        if (keyPressed(GLFW_KEY_0 + digit))
+            player.seek(std::round(last * digit / 10.0));
+    }
+}
+
+void Render::writeSplat(const SplatRenderer &splat, uint64_t step) const
+{
+    std::string path = "splat_" + std::to_string(step) + ".ppm";
+    if (splat.writePpm(path))
+        std::cout << "Wrote " << path << std::endl;
+    else
+        std::cerr << "Failed to write " << path << std::endl;
+}
+
+bool Render::drawFrame(Shader &sphereShader, Shader &spriteShader, const FrameView &frame, const std::string &source,
+                       const SharedFrameReader *reader)
+{
+    float currentFrame = static_cast<float>(glfwGetTime());
+    deltaTime = currentFrame - lastFrame;
+    lastFrame = currentFrame;
+    if (firstFrameTime < 0.0f)
+        firstFrameTime = currentFrame;
+
+    processInput(window);
+
+    glm::mat4 projection = camera.getProjectionMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
+    glm::mat4 view = camera.getViewMatrix();
+
+    lod->prepare(frame, projection, view, camera.position, glm::radians(camera.zoom), SCR_HEIGHT);
+
+    std::unique_ptr<SplatRenderer> splat;
+    if (splatRequested)
+    {
+        splat = std::make_unique<SplatRenderer>(SCR_WIDTH, SCR_HEIGHT);
+        splat->render(frame.x, frame.y, frame.z, frame.mass, static_cast<int>(frame.count),
+                      glm::value_ptr(projection * view));
+    }
+
+    // Everything drawn from frame has been copied out by now; a torn frame keeps the last one on screen
+    if (reader != nullptr && frame.count > 0 && !reader->valid())
+    {
+        glfwPollEvents();
+        return false;
+    }
+
+    if (splat != nullptr)
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        writeSplat(*splat, frame.step);
+        splatRequested = false;
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    sphereShader.use();
+    sphereShader.setMat4("projection", projection);
+    sphereShader.setMat4("view", view);
+
+    sphereShader.setVec3("viewPos", camera.position);
+
+    lightSource->draw(sphereShader);
+
+    lod->draw(sphereShader, spriteShader, projection, view);
+
+    ++titleFrames;
+    if (currentFrame - titleTime >= 0.5f)
+    {
+        const LodStats &stats = lod->stats();
+        std::string title = "NBodySim - " + std::to_string(titleFrames / (currentFrame - titleTime)) +
+                            " FPS, " + source + ", " +
+                            std::to_string(stats.meshes[0] + stats.meshes[1] + stats.meshes[2]) + " meshes, " +
+                            std::to_string(stats.points) + " points, " + std::to_string(stats.impostors) +
+                            " impostors, " + std::to_string(stats.culledNodes) + " culled";
+        glfwSetWindowTitle(window, title.c_str());
+        titleTime = currentFrame;
+        titleFrames = 0;
+    }
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+
+    if (frameLimit > 0 && ++framesDrawn >= frameLimit)
+    {
+        glFinish();
+        float seconds = static_cast<float>(glfwGetTime()) - firstFrameTime;
+        const LodStats &stats = lod->stats();
+        std::cout << framesDrawn << " frames, " << 1000.0f * seconds / framesDrawn << " ms/frame; last frame "
+                  << stats.meshes[0] << "/" << stats.meshes[1] << "/" << stats.meshes[2] << " meshes, "
+                  << stats.points << " points, " << stats.impostors << " impostors, " << stats.culledNodes
+                  << " culled nodes" << std::endl;
+        glfwSetWindowShouldClose(window, true);
+    }
+    return true;
+}
+
+void Render::draw(Shader &sphereShader, Shader &spriteShader, Simulation &simulation, float dt, float damping)
+{
+    SimulationThread simulationThread(simulation, dt, damping);
+    simulationThread.renderTreeSetup(true);
+    if (snapshotWriter != nullptr)
+        simulationThread.snapshotSetup(*snapshotWriter, snapshotInterval);
+    simulationThread.start();
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT,
-                                                0.1f, 60000.0f);
-        glm::mat4 view = camera.getViewMatrix();
+    while (!glfwWindowShouldClose(window))
+    {
+        drawFrame(sphereShader, spriteShader, simulationThread.latestFrame().view(),
+                  std::to_string(simulationThread.stepsPerSecond()) + " steps/s");
+    }
 
-        sphereShader.setMat4("projection", projection);
-        sphereShader.setMat4("view", view);
+    simulationThread.stop();
+}
 
-        sphereShader.setVec3("viewPos", camera.position);
+void Render::drawShared(Shader &sphereShader, Shader &spriteShader, const std::string &name)
+{
+    SharedFrameReader reader;
+    FrameView shown{};
+    uint64_t shownStep = 0;
+    int tornFrames = 0;
+    float lastUpdate = static_cast<float>(glfwGetTime());
 
-        lightSource->draw(sphereShader);
+    while (!glfwWindowShouldClose(window))
+    {
+        float now = static_cast<float>(glfwGetTime());
 
-        processInput(window);
+        // Wait for the solver to create the ring, and re-attach when it stalls in case it was restarted
+        if (!reader.attached() || now - lastUpdate > 1.0f)
+        {
+            if (reader.attach(name))
+                shown = FrameView{};
+            lastUpdate = now;
+        }
 
-        tree.buildTree(data);
-        updateAllParticles(0.99f, deltaTime * 0.1f, data);
+        FrameView latest{};
+        if (reader.acquire(latest))
+        {
+            if (latest.step != shownStep)
+                lastUpdate = now;
+            shown = latest;
+            shownStep = latest.step;
+        }
 
-        for (size_t i = 0; i < spheres.size(); ++i)
+        // The bodies are read in place; if the solver lapped the ring meanwhile, the frame is not drawn
+        if (!drawFrame(sphereShader, spriteShader, shown,
+                       reader.attached() ? "step " + std::to_string(shownStep) + ", " + std::to_string(tornFrames) +
+                                           " torn" : "waiting for /" + name, &reader))
         {
-            spheres[i].worldMatrix = glm::translate(glm::mat4(1.0f),
-                                                    glm::vec3(data.particleX[i],
-                                                              data.particleY[i],
-                                                              data.particleZ[i]));
-            spheres[i].draw(sphereShader, diffuse, specular, ambient,
-                            glm::vec3 (0.0f, 0.0f, 0.0f));
-
-            std::cout << data.accX[i] <<" "<< data.accY[i] <<" "<< data.accZ[i] << "\n";
+            ++tornFrames;
+            shown = FrameView{};
         }
-        std::cout << "\n";
+    }
+}
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+void Render::drawReplay(Shader &sphereShader, Shader &spriteShader, SnapshotPlayer &player)
+{
+    replaySpeed = player.speed();
+    double previous = glfwGetTime();
+
+    while (!glfwWindowShouldClose(window))
+    {
+        double now = glfwGetTime();
+        processReplayInput(player);
+        player.advance(now - previous);
+        previous = now;
+
+        // A frame that could not be read draws empty and says so in the title
+        FrameView frame{};
+        bool presented = player.present(frame);
+
+        size_t index = static_cast<size_t>(player.position());
+        std::string state = !presented && player.loadFailed(index) ? ", unreadable" : "";
+        drawFrame(sphereShader, spriteShader, frame,
+                  "frame " + std::to_string(index + 1) + "/" + std::to_string(player.frameCount()) + state +
+                  ", step " + std::to_string(frame.step) + ", " + std::to_string(player.speed()) + " frames/s, " +
+                  std::to_string(player.misses()) + " late");
     }
-}
\ No newline at end of file
+}
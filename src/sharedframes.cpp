@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sharedframes.h"
+#include "snapshot.h"
+
+static size_t headerBytes()
+{
+    return alignUp(sizeof(SharedFramesHeader), 4096);
+}
+
+static std::string objectName(const std::string &name)
+{
+    return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+static const float *slotStream(const SharedFramesHeader *header, int slot, int stream)
+{
+    const char *base = reinterpret_cast<const char *>(header) + headerBytes() + header->slotBytes * slot;
+    return reinterpret_cast<const float *>(base + alignUp(header->capacity * sizeof(float), 64) * stream);
+}
+
+SharedFrameWriter::SharedFrameWriter(const std::string &name, int capacity)
+        : name(objectName(name))
+{
+    uint64_t slotBytes = 4 * alignUp(static_cast<uint64_t>(capacity) * sizeof(float), 64);
+    mappedBytes = headerBytes() + slotBytes * SHARED_FRAMES_SLOTS;
+
+    // A fresh object, so readers of a previous run do not see a header that changes under them
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(mappedBytes)) != 0)
+    {
+        std::cerr << "Failed to create shared memory " << this->name << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    void *mapping = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cerr << "Failed to map shared memory " << this->name << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    header = new(mapping) SharedFramesHeader{};
+    header->version = SHARED_FRAMES_VERSION;
+    header->slotCount = SHARED_FRAMES_SLOTS;
+    header->capacity = capacity;
+    header->slotBytes = slotBytes;
+
+    // The magic goes last so a reader never accepts a half-initialised header
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, SHARED_FRAMES_MAGIC, sizeof(header->magic));
+}
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+    if (header != nullptr)
+        munmap(header, mappedBytes);
+    shm_unlink(name.c_str());
+}
+
+void SharedFrameWriter::publish(const SimulationData &data, uint64_t step, double time)
+{
+    int slot = static_cast<int>(frameCount % SHARED_FRAMES_SLOTS);
+    SharedFrameSlot &entry = header->slots[slot];
+
+    uint64_t sequence = entry.sequence.load(std::memory_order_relaxed);
+    entry.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int count = std::min(data.particleCount, static_cast<int>(header->capacity));
+    const Real *sources[4] = {data.particleX, data.particleY, data.particleZ, data.particleMass};
+    float *targets[4];
+    for (int s = 0; s < 4; ++s)
+        targets[s] = const_cast<float *>(slotStream(header, slot, s));
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int s = 0; s < 4; ++s)
+    {
+        for (int chunk = 0; chunk < 16; ++chunk)
+        {
+            size_t begin = static_cast<size_t>(count) * chunk / 16;
+            size_t end = static_cast<size_t>(count) * (chunk + 1) / 16;
+            // Frames are float whatever the solver precision; a plain copy when they match
+            std::copy(sources[s] + begin, sources[s] + end, targets[s] + begin);
+        }
+    }
+
+    entry.frame = frameCount;
+    entry.step = step;
+    entry.time = time;
+    entry.count = count;
+
+    entry.sequence.store(sequence + 2, std::memory_order_release);
+    header->published.store(++frameCount, std::memory_order_release);
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    if (header != nullptr)
+        munmap(const_cast<SharedFramesHeader *>(header), mappedBytes);
+}
+
+bool SharedFrameReader::attach(const std::string &name)
+{
+    int fd = shm_open(objectName(name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat status{};
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < headerBytes())
+    {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    auto *candidate = static_cast<const SharedFramesHeader *>(mapping);
+    if (std::memcmp(candidate->magic, SHARED_FRAMES_MAGIC, sizeof(candidate->magic)) != 0 ||
+        candidate->version != SHARED_FRAMES_VERSION ||
+        headerBytes() + candidate->slotBytes * candidate->slotCount > static_cast<size_t>(status.st_size))
+    {
+        munmap(mapping, status.st_size);
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (header != nullptr)
+        munmap(const_cast<SharedFramesHeader *>(header), mappedBytes);
+    header = candidate;
+    mappedBytes = status.st_size;
+    currentSlot = -1;
+    return true;
+}
+
+bool SharedFrameReader::acquire(FrameView &view)
+{
+    if (header == nullptr)
+        return false;
+
+    uint64_t published = header->published.load(std::memory_order_acquire);
+    if (published == 0)
+        return false;
+
+    int slot = static_cast<int>((published - 1) % header->slotCount);
+    const SharedFrameSlot &entry = header->slots[slot];
+    uint64_t sequence = entry.sequence.load(std::memory_order_acquire);
+    if (sequence & 1)
+        return false;
+
+    view.x = slotStream(header, slot, 0);
+    view.y = slotStream(header, slot, 1);
+    view.z = slotStream(header, slot, 2);
+    view.mass = slotStream(header, slot, 3);
+    view.count = entry.count;
+    view.nodes = nullptr;
+    view.nodeCount = 0;
+    view.step = entry.step;
+    view.time = entry.time;
+
+    // The metadata was read after the sequence; make sure it was not a later writer's
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.sequence.load(std::memory_order_relaxed) != sequence)
+        return false;
+
+    currentSlot = slot;
+    currentSequence = sequence;
+    return true;
+}
+
+bool SharedFrameReader::valid() const
+{
+    if (header == nullptr || currentSlot < 0)
+        return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->slots[currentSlot].sequence.load(std::memory_order_relaxed) == currentSequence;
+}
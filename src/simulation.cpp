@@ -0,0 +1,303 @@
+#include <iostream>
+#include "simulation.h"
+#include "bhtree.h"
+
+// The integrators move the bodies between force passes, so the tree is rebuilt on the current positions before
+// each one; fresh marks a tree already built on the positions of the first pass
+template<typename Acc>
+struct RebuiltTreeForce
+{
+    Octree &tree;
+    SimulationData &data;
+    Acc acc;
+    bool fresh;
+
+    void prepare(const SimulationData &)
+    {
+        if (!fresh)
+            tree.buildTree(data);
+        fresh = false;
+        prepareForces(acc, data);
+    }
+
+    int operator()(int particleIdx, const SimulationData &current) { return acc(particleIdx, current); }
+};
+
+Simulation::Simulation(int particleCount, int nodeCapacity)
+{
+    resize(particleCount, nodeCapacity);
+}
+
+void Simulation::resize(int particleCount, int nodeCapacity)
+{
+    if (nodeCapacity <= 0)
+        nodeCapacity = defaultNodeCapacity(particleCount);
+
+    size_t nodes = nodeCapacity;
+    size_t particles = particleCount;
+
+    for (auto *stream: {&nodeX, &nodeY, &nodeZ, &nodeWidth, &nodeHeight, &nodeDepth,
+                        &nodeTotalMass, &nodeCOM_X, &nodeCOM_Y, &nodeCOM_Z})
+        stream->resize(nodes);
+    nodeParticleIndex.resize(nodes);
+    nodeChildren.resize(nodes * OCT_CHILD);
+    nodeMortonCode.resize(nodes);
+
+    for (auto *stream: {&particleX, &particleY, &particleZ, &particleVelX, &particleVelY, &particleVelZ,
+                        &particleMass, &accX, &accY, &accZ})
+        stream->resize(particles);
+    idxSorted.resize(particles);
+    if (!potential.empty())
+        potential.resize(particles);
+    if (!jerkX.empty())
+    {
+        for (auto *stream: {&jerkX, &jerkY, &jerkZ})
+            stream->resize(particles);
+        for (auto *stream: {&nodeVelX, &nodeVelY, &nodeVelZ})
+            stream->resize(nodes);
+    }
+    if (!compactNodes.empty())
+        compactNodes.resize(nodes);
+
+    simData.nodeX = nodeX.data();
+    simData.nodeY = nodeY.data();
+    simData.nodeZ = nodeZ.data();
+    simData.nodeWidth = nodeWidth.data();
+    simData.nodeHeight = nodeHeight.data();
+    simData.nodeDepth = nodeDepth.data();
+    simData.nodeParticleIndex = nodeParticleIndex.data();
+    simData.nodeChildren = reinterpret_cast<int (*)[OCT_CHILD]>(nodeChildren.data());
+
+    simData.nodeTotalMass = nodeTotalMass.data();
+    simData.nodeCOM_X = nodeCOM_X.data();
+    simData.nodeCOM_Y = nodeCOM_Y.data();
+    simData.nodeCOM_Z = nodeCOM_Z.data();
+    simData.nodeMortonCode = nodeMortonCode.data();
+
+    simData.particleX = particleX.data();
+    simData.particleY = particleY.data();
+    simData.particleZ = particleZ.data();
+    simData.particleVelX = particleVelX.data();
+    simData.particleVelY = particleVelY.data();
+    simData.particleVelZ = particleVelZ.data();
+    simData.particleMass = particleMass.data();
+    simData.accX = accX.data();
+    simData.accY = accY.data();
+    simData.accZ = accZ.data();
+    simData.idxSorted = idxSorted.data();
+
+    bool hermite = !jerkX.empty();
+    simData.jerkX = hermite ? jerkX.data() : nullptr;
+    simData.jerkY = hermite ? jerkY.data() : nullptr;
+    simData.jerkZ = hermite ? jerkZ.data() : nullptr;
+    simData.nodeVelX = hermite ? nodeVelX.data() : nullptr;
+    simData.nodeVelY = hermite ? nodeVelY.data() : nullptr;
+    simData.nodeVelZ = hermite ? nodeVelZ.data() : nullptr;
+    simData.compactNodes = compactNodes.empty() ? nullptr : compactNodes.data();
+
+    // Accelerations carried over from the last step no longer line up with the bodies
+    integratorState.primed = false;
+
+    simData.particleCount = particleCount;
+    simData.nodeCapacity = nodeCapacity;
+}
+
+int Simulation::defaultNodeCapacity(int particleCount)
+{
+    // Internal nodes plus one leaf per particle, and the single-child chain from the root down to the
+    // occupied region; heavily clustered inputs may need an explicit capacity
+    return 4 * particleCount + 64;
+}
+
+void Simulation::diagnosticsSetup(int cadence)
+{
+    diagnosticsCadence = cadence;
+    if (cadence > 0)
+        potential.resize(simData.particleCount);
+}
+
+void Simulation::compactNodesSetup(bool enabled)
+{
+    compactNodes.clear();
+    compactNodes.shrink_to_fit();
+    if (enabled)
+        compactNodes.resize(simData.nodeCapacity);
+    resize(simData.particleCount, simData.nodeCapacity);
+}
+
+void Simulation::collisionSetup(float radius)
+{
+    // Pairs are found without minimum-image separations, so bodies touching across the boundary would never merge
+    if (radius > 0.0f && simData.boxSize > 0.0f)
+    {
+        std::cerr << "Collisions are not available in a periodic box" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (radius > 0.0f)
+        collisions = std::make_unique<CollisionStage>(radius);
+    else
+        collisions.reset();
+}
+
+void Simulation::treePMSetup(int meshSize, float splitCells)
+{
+    if (meshSize > 0)
+    {
+        if (simData.boxSize > 0.0f || integratorKind == Integrator::HERMITE)
+        {
+            std::cerr << "TreePM is not available in a periodic box or with the Hermite integrator" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        mesh = std::make_unique<ParticleMesh>(meshSize, splitCells);
+    }
+    else
+    {
+        mesh.reset();
+        simData.splitRadius = 0.0f;
+        simData.splitCutoff = 0.0f;
+    }
+}
+
+void Simulation::integratorSetup(Integrator kind)
+{
+    if (kind == Integrator::HERMITE && (mesh || simData.boxSize > 0.0f))
+    {
+        std::cerr << "The Hermite integrator needs open boundaries and the pure tree force" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    integratorKind = kind;
+    for (auto *stream: {&jerkX, &jerkY, &jerkZ})
+    {
+        stream->clear();
+        stream->shrink_to_fit();
+    }
+    for (auto *stream: {&nodeVelX, &nodeVelY, &nodeVelZ})
+    {
+        stream->clear();
+        stream->shrink_to_fit();
+    }
+    if (kind == Integrator::HERMITE)
+    {
+        for (auto *stream: {&jerkX, &jerkY, &jerkZ})
+            stream->assign(simData.particleCount, 0.0f);
+        for (auto *stream: {&nodeVelX, &nodeVelY, &nodeVelZ})
+            stream->assign(simData.nodeCapacity, 0.0f);
+    }
+    resize(simData.particleCount, simData.nodeCapacity);
+}
+
+void Simulation::periodicSetup(float boxSize, const std::string &ewaldCache)
+{
+    if (boxSize <= 0.0f)
+    {
+        ewald.reset();
+        simData.boxSize = 0.0f;
+        simData.ewald = nullptr;
+        return;
+    }
+
+    // The root cell spans [-32768, 32768)
+    if (mesh || collisions || integratorKind == Integrator::HERMITE || boxSize > 65536.0f)
+    {
+        std::cerr << "Periodic box must be at most 65536 wide, with TreePM, collisions and the Hermite integrator "
+                     "disabled" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    ewald = std::make_unique<EwaldTable>();
+    ewald->loadOrCompute(ewaldCache);
+    simData.boxSize = boxSize;
+    simData.ewald = ewald.get();
+    wrapPositions(simData);
+}
+
+template<typename Acc>
+void Simulation::advance(Acc acc, float dt, float damping, bool fresh)
+{
+    RebuiltTreeForce<Acc> force{octree, simData, acc, fresh};
+    switch (integratorKind)
+    {
+        case Integrator::LEAPFROG:
+            forcePassCount += Velocity_Verlet(force, damping, dt, simData);
+            break;
+        case Integrator::YOSHIDA:
+            forcePassCount += Yoshida4(force, damping, dt, simData, integratorState);
+            break;
+        case Integrator::HERMITE:
+            forcePassCount += Hermite4(force, damping, dt, simData, integratorState);
+            break;
+    }
+}
+
+const Octree &Simulation::rebuildTree()
+{
+    octree.buildTree(simData);
+    return octree;
+}
+
+void Simulation::evaluateForces()
+{
+    octree.buildTree(simData);
+    if (mesh)
+    {
+        mesh->fit(simData);
+        TreePMForce force{*mesh};
+        forcePass(force, simData);
+    }
+    else
+    {
+        auto force = netAcceleration;
+        forcePass(force, simData);
+    }
+
+    // The accelerations now come from whatever solver settings were just evaluated
+    integratorState.primed = false;
+}
+
+void Simulation::step(float dt, float damping)
+{
+    diagnosticsDue = diagnosticsCadence > 0 && (stepCount == 0 || (stepCount + 1) % diagnosticsCadence == 0);
+    simData.potential = diagnosticsDue ? potential.data() : nullptr;
+
+    // The first force pass sees the start-of-step positions under leapfrog and when priming a fourth-order
+    // integrator, and can walk the tree built here; otherwise it is only needed for the collision broad phase
+    bool fresh = integratorKind == Integrator::LEAPFROG || !integratorState.primed;
+    if (fresh || collisions)
+        octree.buildTree(simData);
+
+    // Merging moves the survivors and compacts the streams, so the tree is rebuilt from what is left
+    if (collisions && collisions->apply(simData, octree) > 0)
+    {
+        resize(simData.particleCount, simData.nodeCapacity);
+        octree.buildTree(simData);
+        fresh = true;
+    }
+
+    if (mesh)
+    {
+        mesh->fit(simData);
+        advance(TreePMForce{*mesh}, dt, damping, fresh);
+    }
+    else
+    {
+        advance(netAcceleration, dt, damping, fresh);
+    }
+
+    ++stepCount;
+    simulationTime += dt;
+
+    if (diagnosticsDue)
+    {
+        // The closing force walk saw the end-of-step positions, matching the kicked velocities (for Hermite the
+        // prediction, which the corrector moves only at fourth order)
+        lastDiagnostics = computeDiagnostics(simData);
+        lastDiagnostics.step = stepCount;
+        lastDiagnostics.time = simulationTime;
+        if (firstDiagnostics.step == 0)
+            firstDiagnostics = lastDiagnostics;
+        diagnosticsDrift(firstDiagnostics, lastDiagnostics);
+        simData.potential = nullptr;
+    }
+}
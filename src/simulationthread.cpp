@@ -0,0 +1,157 @@
+#include <chrono>
+#include <stack>
+#include "simulationthread.h"
+#include "profiler.h"
+
+SimulationThread::SimulationThread(Simulation &simulation, float dt, float damping)
+        : simulation(simulation), dt(dt), damping(damping)
+{
+    // Make the initial conditions visible before the first step completes
+    publish();
+    frames.consume();
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::snapshotSetup(SnapshotWriter &writer, int interval)
+{
+    this->snapshotWriter = &writer;
+    this->snapshotInterval = interval;
+}
+
+void SimulationThread::start()
+{
+    if (running.exchange(true))
+        return;
+
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+
+    if (snapshotWriter != nullptr)
+        snapshotWriter->flush();
+}
+
+const PositionFrame &SimulationThread::latestFrame()
+{
+    frames.consume();
+    return frames.front();
+}
+
+void SimulationThread::publish()
+{
+    const SimulationData &data = simulation.data();
+    PositionFrame &frame = frames.back();
+
+    size_t n = data.particleCount;
+    frame.x.resize(n);
+    frame.y.resize(n);
+    frame.z.resize(n);
+    frame.mass.resize(n);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        frame.x[i] = data.particleX[i];
+        frame.y[i] = data.particleY[i];
+        frame.z[i] = data.particleZ[i];
+        frame.mass[i] = data.particleMass[i];
+    }
+
+    if (publishTree)
+        publishRenderNodes(simulation.data(), simulation.tree(), frame.nodes);
+    else
+        frame.nodes.clear();
+
+    frame.step = simulation.steps();
+    frame.time = simulation.time();
+
+    frames.publish();
+}
+
+void publishRenderNodes(const SimulationData &data, const Octree &tree, std::vector<RenderNode> &nodes)
+{
+    nodes.clear();
+    if (tree.size() == 0)
+        return;
+
+    // Depth-first copy of the massive nodes; the unit cells below particle nodes add nothing for rendering.
+    // A negative stack entry marks the end of the subtree of node ~entry, where its skip index is known.
+    std::stack<int> stack;
+    stack.push(0);
+    while (!stack.empty())
+    {
+        int top = stack.top();
+        stack.pop();
+
+        if (top < 0)
+        {
+            nodes[~top].next = static_cast<int>(nodes.size());
+            continue;
+        }
+        if (data.nodeTotalMass[top] <= 0.0f)
+            continue;
+
+        int self = static_cast<int>(nodes.size());
+        int particle = data.nodeParticleIndex[top];
+        RenderNode node{};
+        node.x = static_cast<float>(data.nodeX[top]);
+        node.y = static_cast<float>(data.nodeY[top]);
+        node.z = static_cast<float>(data.nodeZ[top]);
+        node.width = static_cast<float>(data.nodeWidth[top]);
+        node.comX = static_cast<float>(data.nodeCOM_X[top]);
+        node.comY = static_cast<float>(data.nodeCOM_Y[top]);
+        node.comZ = static_cast<float>(data.nodeCOM_Z[top]);
+        node.mass = static_cast<float>(data.nodeTotalMass[top]);
+        node.particle = particle;
+        node.next = self + 1;
+        nodes.push_back(node);
+        if (particle != NULL_INDEX)
+            continue;
+
+        stack.push(~self);
+        for (int i = OCT_CHILD - 1; i >= 0; --i)
+        {
+            if (data.nodeChildren[top][i] != NULL_INDEX)
+                stack.push(data.nodeChildren[top][i]);
+        }
+    }
+}
+
+void SimulationThread::run()
+{
+    auto windowStart = std::chrono::steady_clock::now();
+    uint64_t windowSteps = 0;
+
+    while (running.load(std::memory_order_relaxed))
+    {
+        PROFILE_STEP_BEGIN(simulation.steps() + 1);
+        simulation.step(dt, damping);
+
+        {
+            PROFILE_PHASE(Phase::OUTPUT);
+            publish();
+
+            if (snapshotWriter != nullptr && snapshotInterval > 0 && simulation.steps() % snapshotInterval == 0)
+                snapshotWriter->submit(simulation.data(), simulation.steps(), simulation.time());
+        }
+        PROFILE_STEP_END(simulation.tree().size(), simulation.tree().depth());
+
+        ++windowSteps;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - windowStart).count();
+        if (elapsed >= 0.5)
+        {
+            stepRate.store(windowSteps / elapsed, std::memory_order_relaxed);
+            windowStart = std::chrono::steady_clock::now();
+            windowSteps = 0;
+        }
+    }
+}
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "snapshotcodec.h"
+#include "octree.h"
+#include "omp.h"
+
+namespace
+{
+    constexpr double ROOT_OFFSET = 32768.0;
+    constexpr unsigned int MAX_CELL = 65535;
+    constexpr uint32_t MAX_FRACTION_BITS = 20;
+
+    uint64_t zigzag(int64_t v)
+    {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    int64_t unzigzag(uint64_t v)
+    {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    void putVarint(std::vector<char> &out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    uint64_t getVarint(const char *&in)
+    {
+        uint64_t v = 0;
+        int shift = 0;
+        while (true)
+        {
+            auto byte = static_cast<uint8_t>(*in++);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return v;
+            shift += 7;
+        }
+    }
+
+    void putRaw(std::vector<char> &out, const void *src, size_t bytes)
+    {
+        const char *p = static_cast<const char *>(src);
+        out.insert(out.end(), p, p + bytes);
+    }
+
+    size_t varintSize(uint64_t v)
+    {
+        size_t n = 1;
+        while (v >= 0x80)
+        {
+            v >>= 7;
+            ++n;
+        }
+        return n;
+    }
+
+    struct BitWriter
+    {
+        std::vector<char> &out;
+        uint64_t bits = 0;
+        int count = 0;
+
+        void put(uint64_t value, int width)
+        {
+            for (int written = 0; written < width;)
+            {
+                int take = std::min(width - written, 64 - count);
+                uint64_t part = (value >> written) & ((take == 64) ? ~0ULL : ((1ULL << take) - 1));
+                bits |= part << count;
+                count += take;
+                written += take;
+                if (count == 64)
+                {
+                    putRaw(out, &bits, sizeof(bits));
+                    bits = 0;
+                    count = 0;
+                }
+            }
+        }
+
+        void finish()
+        {
+            putRaw(out, &bits, (count + 7) / 8);
+        }
+    };
+
+    struct BitReader
+    {
+        const char *&in;
+        uint64_t bits = 0;
+        int count = 0;
+
+        uint64_t get(int width)
+        {
+            uint64_t value = 0;
+            for (int read = 0; read < width;)
+            {
+                if (count == 0)
+                {
+                    bits = static_cast<uint8_t>(*in++);
+                    count = 8;
+                }
+                int take = std::min(width - read, count);
+                value |= (bits & ((1ULL << take) - 1)) << read;
+                bits >>= take;
+                count -= take;
+                read += take;
+            }
+            return value;
+        }
+    };
+
+    unsigned int cellOf(double shifted)
+    {
+        if (!(shifted > 0.0))
+            return 0;
+        return std::min(static_cast<unsigned int>(shifted), MAX_CELL);
+    }
+
+    void encodeBlock(const float *const streams[SNAP_STREAM_COUNT], const unsigned int *order, size_t begin,
+                     size_t end, const CompressedSnapshotInfo &info, std::vector<char> &out)
+    {
+        size_t n = end - begin;
+        double fractionScale = std::ldexp(1.0, static_cast<int>(info.fractionBits));
+
+        // Velocities are delta coded against the Morton predecessor only where that is smaller
+        std::vector<int64_t> quantized(3 * n);
+        uint8_t velocityModes = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            size_t absolute = 0, delta = 0;
+            int64_t previous = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                int64_t q = std::llround(streams[SNAP_VX + c][order[begin + i]] / info.velocityQuantum);
+                quantized[c * n + i] = q;
+                absolute += varintSize(zigzag(q));
+                delta += varintSize(zigzag(q - previous));
+                previous = q;
+            }
+            if (delta < absolute)
+                velocityModes |= 1 << c;
+        }
+
+        float firstMass = streams[SNAP_MASS][order[begin]];
+        uint8_t massMode = 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            if (streams[SNAP_MASS][order[begin + i]] != firstMass)
+            {
+                massMode = 1;
+                break;
+            }
+        }
+
+        out.push_back(static_cast<char>(velocityModes));
+        out.push_back(static_cast<char>(massMode));
+
+        std::vector<uint64_t> fractions(3 * n);
+        uint64_t previousKey = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            unsigned int p = order[begin + i];
+            unsigned int cell[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                double shifted = static_cast<double>(streams[SNAP_X + c][p]) + ROOT_OFFSET;
+                cell[c] = cellOf(shifted);
+                double fraction = std::clamp(shifted - cell[c], 0.0, 1.0);
+                fractions[3 * i + c] = std::min(static_cast<uint64_t>(fraction * fractionScale),
+                                                static_cast<uint64_t>(fractionScale) - 1);
+            }
+
+            uint64_t key = Octree::morton3D(cell[0], cell[1], cell[2]);
+            putVarint(out, zigzag(static_cast<int64_t>(key - previousKey)));
+            previousKey = key;
+        }
+
+        if (info.fractionBits > 0)
+        {
+            BitWriter writer{out};
+            for (uint64_t fraction: fractions)
+                writer.put(fraction, static_cast<int>(info.fractionBits));
+            writer.finish();
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            int64_t previous = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                int64_t q = quantized[c * n + i];
+                putVarint(out, zigzag((velocityModes & (1 << c)) ? q - previous : q));
+                previous = q;
+            }
+        }
+
+        if (massMode == 0)
+        {
+            putRaw(out, &firstMass, sizeof(float));
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+                putRaw(out, &streams[SNAP_MASS][order[begin + i]], sizeof(float));
+        }
+
+        if (info.flags & CODEC_STORE_IDS)
+            putRaw(out, order + begin, n * sizeof(unsigned int));
+    }
+}
+
+std::vector<char> encodeSnapshot(const float *const streams[SNAP_STREAM_COUNT], const unsigned int *order,
+                                 size_t particleCount, const SnapshotCodecOptions &options)
+{
+    CompressedSnapshotInfo info{};
+
+    // Smallest power-of-two fraction whose step stays within the requested error: the bin centre is half a step
+    // away at most, but rounding it to float can add up to the other half where floats are as coarse as the step
+    uint32_t fractionBits = 0;
+    while (fractionBits < MAX_FRACTION_BITS && std::ldexp(1.0, -static_cast<int>(fractionBits)) > options.positionError)
+        ++fractionBits;
+
+    info.positionError = static_cast<float>(std::ldexp(1.0, -static_cast<int>(fractionBits)));
+    // Power of two as well, so dividing by it and decoding q * quantum are exact in float and the bound holds
+    info.velocityQuantum = std::ldexp(1.0f, std::ilogb(2.0f * options.velocityError));
+    info.fractionBits = fractionBits;
+    info.blockSize = std::max(options.blockSize, 1u);
+    info.particleCount = particleCount;
+    info.blockCount = (particleCount + info.blockSize - 1) / info.blockSize;
+    info.flags = options.storeIds ? CODEC_STORE_IDS : 0;
+
+    std::vector<std::vector<char>> encoded(info.blockCount);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < static_cast<int64_t>(info.blockCount); ++b)
+    {
+        size_t begin = b * info.blockSize;
+        size_t end = std::min(particleCount, begin + info.blockSize);
+        encoded[b].reserve((end - begin) * 12);
+        encodeBlock(streams, order, begin, end, info, encoded[b]);
+    }
+
+    std::vector<uint64_t> offsets(info.blockCount + 1, 0);
+    for (size_t b = 0; b < info.blockCount; ++b)
+        offsets[b + 1] = offsets[b] + encoded[b].size();
+
+    size_t tableBytes = sizeof(info) + offsets.size() * sizeof(uint64_t);
+    std::vector<char> payload(tableBytes + offsets.back());
+    std::memcpy(payload.data(), &info, sizeof(info));
+    std::memcpy(payload.data() + sizeof(info), offsets.data(), offsets.size() * sizeof(uint64_t));
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < static_cast<int64_t>(info.blockCount); ++b)
+        std::memcpy(payload.data() + tableBytes + offsets[b], encoded[b].data(), encoded[b].size());
+
+    return payload;
+}
+
+bool CompressedSnapshot::open(const char *payload, size_t bytes)
+{
+    if (bytes < sizeof(CompressedSnapshotInfo))
+        return false;
+
+    std::memcpy(&header, payload, sizeof(header));
+    size_t tableBytes = sizeof(header) + (header.blockCount + 1) * sizeof(uint64_t);
+    if (bytes < tableBytes)
+        return false;
+
+    offsets = reinterpret_cast<const uint64_t *>(payload + sizeof(header));
+    blocks = payload + tableBytes;
+
+    return bytes >= tableBytes + offsets[header.blockCount];
+}
+
+void CompressedSnapshot::decodeBlock(size_t block, float *const streams[SNAP_STREAM_COUNT], unsigned int *ids) const
+{
+    size_t begin = block * header.blockSize;
+    size_t n = std::min<size_t>(header.particleCount - begin, header.blockSize);
+    double fractionScale = std::ldexp(1.0, static_cast<int>(header.fractionBits));
+
+    const char *in = blocks + offsets[block];
+    auto velocityModes = static_cast<uint8_t>(*in++);
+    auto massMode = static_cast<uint8_t>(*in++);
+
+    uint64_t key = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        key += static_cast<uint64_t>(unzigzag(getVarint(in)));
+        unsigned int cell[3];
+        Octree::mortonDecode3D(key, cell[0], cell[1], cell[2]);
+        for (int c = 0; c < 3; ++c)
+            streams[SNAP_X + c][begin + i] = static_cast<float>(cell[c] - ROOT_OFFSET);
+    }
+
+    if (header.fractionBits > 0)
+    {
+        BitReader reader{in};
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                double fraction = (static_cast<double>(reader.get(static_cast<int>(header.fractionBits))) + 0.5) /
+                                  fractionScale;
+                streams[SNAP_X + c][begin + i] = static_cast<float>(streams[SNAP_X + c][begin + i] + fraction);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                streams[SNAP_X + c][begin + i] += 0.5f;
+        }
+    }
+
+    for (int c = 0; c < 3; ++c)
+    {
+        int64_t previous = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int64_t q = unzigzag(getVarint(in));
+            if (velocityModes & (1 << c))
+                q += previous;
+            previous = q;
+            streams[SNAP_VX + c][begin + i] = static_cast<float>(q) * header.velocityQuantum;
+        }
+    }
+
+    if (massMode == 0)
+    {
+        float mass;
+        std::memcpy(&mass, in, sizeof(float));
+        in += sizeof(float);
+        std::fill(streams[SNAP_MASS] + begin, streams[SNAP_MASS] + begin + n, mass);
+    }
+    else
+    {
+        std::memcpy(streams[SNAP_MASS] + begin, in, n * sizeof(float));
+        in += n * sizeof(float);
+    }
+
+    if (ids != nullptr && (header.flags & CODEC_STORE_IDS))
+        std::memcpy(ids + begin, in, n * sizeof(unsigned int));
+}
+
+void CompressedSnapshot::decodeAll(float *const streams[SNAP_STREAM_COUNT], unsigned int *ids) const
+{
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < static_cast<int64_t>(header.blockCount); ++b)
+        decodeBlock(b, streams, ids);
+}
+
+bool loadSnapshot(const std::string &path, SnapshotHeader &header, std::vector<float> (&streams)[SNAP_STREAM_COUNT],
+                  std::vector<unsigned int> *ids)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open snapshot file " << path << std::endl;
+        return false;
+    }
+
+    std::vector<char> page(SNAPSHOT_ALIGNMENT);
+    if (!file.read(page.data(), SNAPSHOT_ALIGNMENT))
+        return false;
+    std::memcpy(&header, page.data(), sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << path << " is not a snapshot file" << std::endl;
+        return false;
+    }
+
+    std::vector<char> payload(header.payloadBytes);
+    if (!file.read(payload.data(), static_cast<std::streamsize>(payload.size())))
+        return false;
+
+    size_t n = header.particleCount;
+    float *out[SNAP_STREAM_COUNT];
+    for (int s = 0; s < SNAP_STREAM_COUNT; ++s)
+    {
+        streams[s].resize(n);
+        out[s] = streams[s].data();
+    }
+
+    if (header.encoding == SNAPSHOT_RAW)
+    {
+        for (int s = 0; s < SNAP_STREAM_COUNT; ++s)
+            std::memcpy(out[s], payload.data() + snapshotStreamOffset(n, s) - SNAPSHOT_ALIGNMENT, n * sizeof(float));
+        return true;
+    }
+
+    CompressedSnapshot snapshot;
+    if (header.encoding != SNAPSHOT_MORTON_QUANTIZED || !snapshot.open(payload.data(), payload.size()))
+    {
+        std::cerr << "Unsupported or corrupt snapshot encoding in " << path << std::endl;
+        return false;
+    }
+
+    if (ids != nullptr)
+        ids->resize((snapshot.info().flags & CODEC_STORE_IDS) ? n : 0);
+    snapshot.decodeAll(out, ids != nullptr && !ids->empty() ? ids->data() : nullptr);
+    return true;
+}
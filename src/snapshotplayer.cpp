@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshotplayer.h"
+#include "snapshotcodec.h"
+
+SnapshotPlayer::SnapshotPlayer(int prefetch)
+        : prefetch(std::max(prefetch, 1))
+{
+}
+
+SnapshotPlayer::~SnapshotPlayer()
+{
+    close();
+}
+
+void SnapshotPlayer::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    moved.notify_all();
+    if (prefetcher.joinable())
+        prefetcher.join();
+
+    entries.clear();
+    resident.clear();
+    current.reset();
+    currentIndex = 0;
+    missCount = 0;
+    playhead = 0.0;
+    stopping = false;
+}
+
+SnapshotPlayer::Frame::~Frame()
+{
+    if (mapping != nullptr)
+        munmap(mapping, mappedBytes);
+}
+
+bool SnapshotPlayer::open(const std::string &prefix)
+{
+    namespace fs = std::filesystem;
+
+    close();
+
+    fs::path base(prefix);
+    fs::path directory = base.has_parent_path() ? base.parent_path() : fs::path(".");
+    std::string stem = base.filename().string() + "_";
+
+    std::error_code error;
+    for (const fs::directory_entry &file: fs::directory_iterator(directory, error))
+    {
+        std::string name = file.path().filename().string();
+        if (name.size() <= stem.size() + 4 || name.compare(0, stem.size(), stem) != 0 ||
+            name.compare(name.size() - 4, 4, ".nbs") != 0)
+            continue;
+        std::string digits = name.substr(stem.size(), name.size() - stem.size() - 4);
+        if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            continue;
+
+        // Only the header page is read here; payloads are left to the prefetcher
+        SnapshotHeader header{};
+        std::ifstream stream(file.path(), std::ios::binary);
+        if (!stream.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        {
+            std::cerr << file.path().string() << " is not a snapshot file, skipped" << std::endl;
+            continue;
+        }
+        entries.push_back({file.path().string(), header.step, header.time, header.particleCount, header.encoding});
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.step < b.step; });
+    if (entries.empty())
+        return false;
+
+    prefetcher = std::thread(&SnapshotPlayer::prefetchLoop, this);
+    return true;
+}
+
+size_t SnapshotPlayer::maxParticles() const
+{
+    size_t count = 0;
+    for (const Entry &entry: entries)
+        count = std::max<size_t>(count, entry.particleCount);
+    return count;
+}
+
+double SnapshotPlayer::position()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return playhead;
+}
+
+void SnapshotPlayer::moveTo(double frame)
+{
+    double last = static_cast<double>(entries.size() - 1);
+    if (loop && !entries.empty())
+    {
+        double span = last + 1.0;
+        frame = std::fmod(frame, span);
+        if (frame < 0.0)
+            frame += span;
+    }
+    frame = std::clamp(frame, 0.0, std::max(last, 0.0));
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake = std::floor(frame) != std::floor(playhead);
+        playhead = frame;
+    }
+    if (wake)
+        moved.notify_one();
+}
+
+void SnapshotPlayer::seek(double frame)
+{
+    moveTo(frame);
+}
+
+void SnapshotPlayer::seekTime(double time)
+{
+    auto found = std::lower_bound(entries.begin(), entries.end(), time,
+                                  [](const Entry &entry, double t) { return entry.time < t; });
+    moveTo(static_cast<double>(std::min<size_t>(found - entries.begin(), entries.size() - 1)));
+}
+
+void SnapshotPlayer::setSpeed(double framesPerSecond)
+{
+    {
+        // The prefetch window follows the playing direction
+        std::lock_guard<std::mutex> lock(mutex);
+        playSpeed = framesPerSecond;
+    }
+    moved.notify_one();
+}
+
+void SnapshotPlayer::setLoop(bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loop = enabled;
+    }
+    moved.notify_one();
+}
+
+void SnapshotPlayer::advance(double seconds)
+{
+    if (playSpeed != 0.0)
+        moveTo(position() + playSpeed * seconds);
+}
+
+bool SnapshotPlayer::present(FrameView &view)
+{
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index = static_cast<size_t>(playhead);
+        auto found = resident.find(index);
+        if (found != resident.end())
+        {
+            if (found->second == nullptr)
+                return false;
+            current = found->second;
+            currentIndex = index;
+        }
+    }
+
+    if (current == nullptr)
+        return false;
+    if (currentIndex != index)
+        ++missCount;
+
+    view = current->view;
+    return true;
+}
+
+bool SnapshotPlayer::loadFailed(size_t frame)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = resident.find(frame);
+    return found != resident.end() && found->second == nullptr;
+}
+
+std::vector<size_t> SnapshotPlayer::window(size_t center) const
+{
+    std::vector<size_t> indices{center};
+    long count = static_cast<long>(entries.size());
+    long direction = playSpeed < 0.0 ? -1 : 1;
+
+    // Ahead of the playhead, then one frame behind it for stepping back
+    for (long k = 1; k <= prefetch; ++k)
+    {
+        long index = static_cast<long>(center) + direction * k;
+        if (loop)
+            index = (index % count + count) % count;
+        if (index >= 0 && index < count)
+            indices.push_back(static_cast<size_t>(index));
+    }
+    long behind = static_cast<long>(center) - direction;
+    if (loop)
+        behind = (behind % count + count) % count;
+    if (behind >= 0 && behind < count)
+        indices.push_back(static_cast<size_t>(behind));
+    return indices;
+}
+
+void SnapshotPlayer::prefetchLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        std::vector<size_t> wanted = window(static_cast<size_t>(playhead));
+
+        // Frames out of the window are released outside the lock; one still presented stays mapped
+        // through the render thread's reference
+        std::vector<std::shared_ptr<Frame>> released;
+        for (auto it = resident.begin(); it != resident.end();)
+        {
+            if (std::find(wanted.begin(), wanted.end(), it->first) == wanted.end())
+            {
+                released.push_back(std::move(it->second));
+                it = resident.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        auto missing = std::find_if(wanted.begin(), wanted.end(),
+                                    [this](size_t index) { return resident.count(index) == 0; });
+        if (missing == wanted.end())
+        {
+            lock.unlock();
+            released.clear();
+            lock.lock();
+            moved.wait(lock, [&] { return stopping || window(static_cast<size_t>(playhead)) != wanted; });
+            continue;
+        }
+
+        size_t index = *missing;
+        lock.unlock();
+        released.clear();
+        std::shared_ptr<Frame> frame = load(index);
+        lock.lock();
+        resident[index] = std::move(frame);
+    }
+}
+
+std::shared_ptr<SnapshotPlayer::Frame> SnapshotPlayer::load(size_t index) const
+{
+    const Entry &entry = entries[index];
+    auto frame = std::make_shared<Frame>();
+    frame->view.step = entry.step;
+    frame->view.time = entry.time;
+
+    size_t n = entry.particleCount;
+
+    if (entry.encoding == SNAPSHOT_RAW)
+    {
+        int fd = ::open(entry.path.c_str(), O_RDONLY);
+        struct stat status{};
+        if (fd < 0 || fstat(fd, &status) != 0 ||
+            static_cast<size_t>(status.st_size) < snapshotStreamOffset(n, SNAP_MASS) + n * sizeof(float))
+        {
+            std::cerr << "Failed to open snapshot file " << entry.path << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return nullptr;
+        }
+
+        void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "Failed to map snapshot file " << entry.path << std::endl;
+            return nullptr;
+        }
+        frame->mapping = mapping;
+        frame->mappedBytes = status.st_size;
+
+        // Fault in the streams a renderer reads; velocities are never touched
+        const char *base = static_cast<const char *>(mapping);
+        const float *streams[4];
+        const int used[4] = {SNAP_X, SNAP_Y, SNAP_Z, SNAP_MASS};
+        long page = sysconf(_SC_PAGESIZE);
+        for (int s = 0; s < 4; ++s)
+        {
+            size_t offset = snapshotStreamOffset(n, used[s]);
+            size_t begin = offset / page * page;
+            madvise(const_cast<char *>(base) + begin, offset + n * sizeof(float) - begin, MADV_WILLNEED);
+
+            char touched = 0;
+            for (size_t p = begin; p < offset + n * sizeof(float); p += page)
+                touched ^= base[p];
+            volatile char sink = touched;
+            static_cast<void>(sink);
+
+            streams[s] = reinterpret_cast<const float *>(base + offset);
+        }
+
+        frame->view.x = streams[0];
+        frame->view.y = streams[1];
+        frame->view.z = streams[2];
+        frame->view.mass = streams[3];
+        frame->view.count = n;
+        return frame;
+    }
+
+    SnapshotHeader header{};
+    if (!loadSnapshot(entry.path, header, frame->decoded))
+        return nullptr;
+
+    frame->view.x = frame->decoded[SNAP_X].data();
+    frame->view.y = frame->decoded[SNAP_Y].data();
+    frame->view.z = frame->decoded[SNAP_Z].data();
+    frame->view.mass = frame->decoded[SNAP_MASS].data();
+    frame->view.count = header.particleCount;
+    return frame;
+}
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "snapshotwriter.h"
+#include "omp.h"
+
+namespace
+{
+    constexpr size_t WRITE_CHUNK = 8u << 20;
+
+    double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void parallelCopy(char *dst, const void *src, size_t bytes)
+    {
+        const char *source = static_cast<const char *>(src);
+#pragma omp parallel
+        {
+            size_t threads = omp_get_num_threads();
+            size_t chunk = alignUp((bytes + threads - 1) / threads, SNAPSHOT_STREAM_ALIGNMENT);
+            size_t begin = std::min(bytes, chunk * omp_get_thread_num());
+            size_t end = std::min(bytes, begin + chunk);
+
+            std::memcpy(dst + begin, source + begin, end - begin);
+        }
+    }
+
+    // Snapshots store float whatever the solver precision; narrower streams are copied as they are
+    void parallelCopy(char *dst, const Real *src, size_t count)
+    {
+        if constexpr (std::is_same_v<Real, float>)
+        {
+            parallelCopy(dst, static_cast<const void *>(src), count * sizeof(float));
+        }
+        else
+        {
+            auto *target = reinterpret_cast<float *>(dst);
+#pragma omp parallel for simd schedule(static)
+            for (size_t i = 0; i < count; ++i)
+                target[i] = static_cast<float>(src[i]);
+        }
+    }
+}
+
+SnapshotWriter::SnapshotWriter(std::string prefix, bool directIO, int bufferCount)
+        : prefix(std::move(prefix)), directIO(directIO), buffers(std::max(bufferCount, 1))
+{
+    for (int i = 0; i < static_cast<int>(buffers.size()); ++i)
+        freeBuffers.push_back(i);
+
+    writer = std::thread(&SnapshotWriter::writerLoop, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    bufferFilled.notify_one();
+    writer.join();
+
+    for (auto &buffer: buffers)
+        std::free(buffer.memory);
+    std::free(encoded.memory);
+}
+
+void SnapshotWriter::enableCompression(const SnapshotCodecOptions &options)
+{
+    // Checked here rather than on the writer thread, where encoding happens
+    if (!(options.positionError > 0.0f) || !(options.velocityError > 0.0f))
+    {
+        std::cerr << "Snapshot position and velocity errors must be positive" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    compress = true;
+    codecOptions = options;
+}
+
+void SnapshotWriter::reserve(Buffer &buffer, size_t bytes)
+{
+    // aligned_alloc wants a whole number of alignment units
+    bytes = alignUp(bytes, SNAPSHOT_ALIGNMENT);
+    if (buffer.capacity >= bytes)
+        return;
+
+    std::free(buffer.memory);
+    buffer.memory = static_cast<char *>(std::aligned_alloc(SNAPSHOT_ALIGNMENT, bytes));
+    if (buffer.memory == nullptr)
+    {
+        std::cerr << "Failed to allocate snapshot buffer of " << bytes << " bytes" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    buffer.capacity = bytes;
+}
+
+void SnapshotWriter::submit(const SimulationData &data, uint64_t step, double time)
+{
+    auto stallStart = std::chrono::steady_clock::now();
+
+    int index;
+    {
+        // Back-pressure: if the writer still owns every buffer the step loop waits here
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferFreed.wait(lock, [this] { return !freeBuffers.empty(); });
+        index = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+
+    Buffer &buffer = buffers[index];
+    buffer.stallSeconds = secondsSince(stallStart);
+
+    auto copyStart = std::chrono::steady_clock::now();
+
+    size_t particleCount = data.particleCount;
+    buffer.size = snapshotRawSize(particleCount);
+    buffer.particleCount = particleCount;
+    buffer.step = step;
+
+    // The codec walks particles in idxSorted order, which is kept past the raw image
+    reserve(buffer, buffer.size + particleCount * sizeof(unsigned int));
+
+    std::memset(buffer.memory, 0, SNAPSHOT_ALIGNMENT);
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.encoding = SNAPSHOT_RAW;
+    header.step = step;
+    header.time = time;
+    header.particleCount = particleCount;
+    header.payloadBytes = snapshotStreamOffset(particleCount, SNAP_STREAM_COUNT) - SNAPSHOT_ALIGNMENT;
+    std::memcpy(buffer.memory, &header, sizeof(header));
+
+    const Real *streams[SNAP_STREAM_COUNT] = {data.particleX, data.particleY, data.particleZ,
+                                              data.particleVelX, data.particleVelY, data.particleVelZ,
+                                              data.particleMass};
+    for (int s = 0; s < SNAP_STREAM_COUNT; ++s)
+        parallelCopy(buffer.memory + snapshotStreamOffset(particleCount, s), streams[s], particleCount);
+    parallelCopy(buffer.memory + buffer.size, data.idxSorted, particleCount * sizeof(unsigned int));
+
+    buffer.copySeconds = secondsSince(copyStart);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        filledBuffers.push_back(index);
+    }
+    bufferFilled.notify_one();
+}
+
+void SnapshotWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    bufferFreed.wait(lock, [this] { return filledBuffers.empty() && writing == 0; });
+}
+
+std::vector<SnapshotReport> SnapshotWriter::reports()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<SnapshotReport> taken;
+    taken.swap(finished);
+    return taken;
+}
+
+void SnapshotWriter::writerLoop()
+{
+    while (true)
+    {
+        int index;
+        bool compressing;
+        SnapshotCodecOptions options;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bufferFilled.wait(lock, [this] { return stopping || !filledBuffers.empty(); });
+            if (filledBuffers.empty())
+                return;
+
+            index = filledBuffers.front();
+            filledBuffers.pop_front();
+            ++writing;
+
+            compressing = compress;
+            options = codecOptions;
+        }
+
+        const Buffer &buffer = buffers[index];
+
+        const char *memory = buffer.memory;
+        size_t size = buffer.size;
+        double encodeSeconds = 0.0;
+        if (compressing)
+        {
+            auto encodeStart = std::chrono::steady_clock::now();
+            size = encode(buffer, options);
+            memory = encoded.memory;
+            encodeSeconds = secondsSince(encodeStart);
+        }
+
+        double writeSeconds = 0.0;
+        bool written = writeBuffer(memory, size, buffer.step, writeSeconds);
+
+        SnapshotReport report{};
+        report.step = buffer.step;
+        report.bytes = written ? size : 0;
+        report.stallSeconds = buffer.stallSeconds;
+        report.copySeconds = buffer.copySeconds;
+        report.encodeSeconds = encodeSeconds;
+        report.writeSeconds = writeSeconds;
+        report.throughputMBs = writeSeconds > 0.0 ? static_cast<double>(report.bytes) / writeSeconds / 1.0e6 : 0.0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(report);
+            freeBuffers.push_back(index);
+            --writing;
+        }
+        bufferFreed.notify_all();
+    }
+}
+
+size_t SnapshotWriter::encode(const Buffer &buffer, const SnapshotCodecOptions &options)
+{
+    size_t n = buffer.particleCount;
+    const float *streams[SNAP_STREAM_COUNT];
+    for (int s = 0; s < SNAP_STREAM_COUNT; ++s)
+        streams[s] = reinterpret_cast<const float *>(buffer.memory + snapshotStreamOffset(n, s));
+    auto order = reinterpret_cast<const unsigned int *>(buffer.memory + buffer.size);
+
+    std::vector<char> payload = encodeSnapshot(streams, order, n, options);
+
+    size_t size = alignUp(SNAPSHOT_ALIGNMENT + payload.size(), SNAPSHOT_ALIGNMENT);
+    reserve(encoded, size);
+
+    SnapshotHeader header;
+    std::memcpy(&header, buffer.memory, sizeof(header));
+    header.encoding = SNAPSHOT_MORTON_QUANTIZED;
+    header.payloadBytes = payload.size();
+
+    std::memset(encoded.memory, 0, SNAPSHOT_ALIGNMENT);
+    std::memcpy(encoded.memory, &header, sizeof(header));
+    std::memcpy(encoded.memory + SNAPSHOT_ALIGNMENT, payload.data(), payload.size());
+    std::memset(encoded.memory + SNAPSHOT_ALIGNMENT + payload.size(), 0, size - SNAPSHOT_ALIGNMENT - payload.size());
+
+    return size;
+}
+
+bool SnapshotWriter::writeBuffer(const char *memory, size_t size, uint64_t step, double &writeSeconds)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    char path[4096];
+    std::snprintf(path, sizeof(path), "%s_%08llu.nbs", prefix.c_str(), static_cast<unsigned long long>(step));
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+#ifdef O_DIRECT
+    if (directIO)
+    {
+        fd = open(path, flags | O_DIRECT, 0644);
+        if (fd < 0)
+            std::cerr << "O_DIRECT unavailable for " << path << ", falling back to buffered writes" << std::endl;
+    }
+#endif
+    if (fd < 0)
+        fd = open(path, flags, 0644);
+
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open snapshot file " << path << std::endl;
+        return false;
+    }
+
+    // Buffers and sizes are multiples of SNAPSHOT_ALIGNMENT, so every chunk satisfies O_DIRECT
+    size_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t n = write(fd, memory + offset, std::min(WRITE_CHUNK, size - offset));
+        if (n <= 0)
+        {
+            std::cerr << "Failed to write snapshot file " << path << std::endl;
+            close(fd);
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+
+    close(fd);
+    writeSeconds = secondsSince(start);
+    return true;
+}
@@ -0,0 +1,246 @@
+#include <cmath>
+#include <numeric>
+#include "spatialquery.h"
+#include "omp.h"
+
+// Targets per scheduling chunk; consecutive Morton targets share most of their walk through the tree
+constexpr int QUERY_CHUNK = 64;
+
+void SpatialQuery::update(const SimulationData &data, const Octree &tree)
+{
+    this->data = &data;
+
+    size_t n = data.particleCount;
+    sortedKeys.resize(n);
+    sortedX.resize(n);
+    sortedY.resize(n);
+    sortedZ.resize(n);
+
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < n; ++k)
+    {
+        unsigned int p = data.idxSorted[k];
+        sortedX[k] = data.particleX[p];
+        sortedY[k] = data.particleY[p];
+        sortedZ[k] = data.particleZ[p];
+        sortedKeys[k] = Octree::morton3D(sortedX[k], sortedY[k], sortedZ[k]);
+    }
+
+    // Node ranges once here rather than two binary searches per node visited by every query
+    int nodes = tree.size();
+    nodeBegin.resize(nodes);
+    nodeEnd.resize(nodes);
+#pragma omp parallel for schedule(static)
+    for (int node = 0; node < nodes; ++node)
+    {
+        std::pair<size_t, size_t> range = keyRange(data.nodeX[node], data.nodeY[node], data.nodeZ[node],
+                                                   data.nodeWidth[node]);
+        nodeBegin[node] = static_cast<uint32_t>(range.first);
+        nodeEnd[node] = static_cast<uint32_t>(range.second);
+    }
+
+    // Only nodes holding bodies the tree dropped need their empty octants searched
+    nodeLoose.resize(nodes);
+#pragma omp parallel for schedule(static)
+    for (int node = 0; node < nodes; ++node)
+    {
+        uint32_t covered = data.nodeParticleIndex[node] != NULL_INDEX ? 1 : 0;
+        for (unsigned c = 0; c < OCT_CHILD; ++c)
+        {
+            int child = data.nodeChildren[node][c];
+            if (child != NULL_INDEX)
+                covered += nodeEnd[child] - nodeBegin[child];
+        }
+        nodeLoose[node] = covered < nodeEnd[node] - nodeBegin[node];
+    }
+}
+
+void SpatialQuery::targetOrder(const float *x, const float *y, const float *z, int count)
+{
+    targetKeys.resize(count);
+    order.resize(count);
+
+#pragma omp parallel for schedule(static)
+    for (int t = 0; t < count; ++t)
+        targetKeys[t] = Octree::morton3D(x[t], y[t], z[t]);
+
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return targetKeys[a] < targetKeys[b]; });
+}
+
+void SpatialQuery::nearest(const float *x, const float *y, const float *z, int count, int k, NeighbourList &out)
+{
+    targetOrder(x, y, z, count);
+    nearestBatch(x, y, z, count, false, k, out);
+}
+
+void SpatialQuery::particleOrder()
+{
+    // The particles are their own targets, already in Morton order
+    order.resize(sortedKeys.size());
+    for (size_t m = 0; m < order.size(); ++m)
+        order[m] = particle(m);
+}
+
+void SpatialQuery::nearestParticles(int k, NeighbourList &out)
+{
+    particleOrder();
+    nearestBatch(data->particleX, data->particleY, data->particleZ, static_cast<int>(order.size()), true, k, out);
+}
+
+void SpatialQuery::within(const float *x, const float *y, const float *z, int count, float radius,
+                          NeighbourList &out)
+{
+    targetOrder(x, y, z, count);
+    withinBatch(x, y, z, count, false, radius, out);
+}
+
+void SpatialQuery::withinParticles(float radius, NeighbourList &out)
+{
+    particleOrder();
+    withinBatch(data->particleX, data->particleY, data->particleZ, static_cast<int>(order.size()), true, radius,
+                out);
+}
+
+// Replaces the farthest entry of a full max-heap and sifts the new one down; one pass instead of pop_heap
+// followed by push_heap
+static void replaceFarthest(std::vector<std::pair<float, int>> &heap, float distance2, int index)
+{
+    size_t size = heap.size(), slot = 0;
+    while (true)
+    {
+        size_t child = 2 * slot + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && heap[child + 1].first > heap[child].first)
+            ++child;
+        if (heap[child].first <= distance2)
+            break;
+        heap[slot] = heap[child];
+        slot = child;
+    }
+    heap[slot] = {distance2, index};
+}
+
+template<typename Coord>
+void SpatialQuery::nearestBatch(const Coord *x, const Coord *y, const Coord *z, int count, bool excludeSelf, int k,
+                                NeighbourList &out)
+{
+    // Every target gets the same number of neighbours, so results go straight to their final place
+    size_t available = sortedKeys.size() - (excludeSelf ? 1 : 0);
+    size_t per = std::min(static_cast<size_t>(std::max(k, 0)), available);
+
+    out.offsets.resize(count + 1);
+    out.indices.resize(per * count);
+    out.distances.resize(per * count);
+    for (int t = 0; t <= count; ++t)
+        out.offsets[t] = per * t;
+    if (per == 0)
+        return;
+
+    scratch.resize(omp_get_max_threads());
+    auto farther = [](const std::pair<float, int> &a, const std::pair<float, int> &b) { return a.first < b.first; };
+
+#pragma omp parallel
+    {
+        Scratch &local = scratch[omp_get_thread_num()];
+        std::vector<std::pair<float, int>> &heap = local.heap;
+        heap.reserve(per);
+
+#pragma omp for schedule(dynamic, QUERY_CHUNK)
+        for (int o = 0; o < count; ++o)
+        {
+            int t = order[o];
+            auto px = static_cast<float>(x[t]), py = static_cast<float>(y[t]), pz = static_cast<float>(z[t]);
+
+            // Particle targets are walked in Morton order, so a target's own position is o
+            size_t self = excludeSelf ? static_cast<size_t>(o) : std::numeric_limits<size_t>::max();
+
+            // Max-heap on squared distance, bounded at per entries
+            heap.clear();
+            auto offer = [&](size_t m) {
+                float dx = sortedX[m] - px, dy = sortedY[m] - py, dz = sortedZ[m] - pz;
+                float distance2 = dx * dx + dy * dy + dz * dz;
+                if (m == self)
+                    return;
+                if (heap.size() < per)
+                {
+                    heap.emplace_back(distance2, particle(m));
+                    std::push_heap(heap.begin(), heap.end(), farther);
+                }
+                else if (distance2 < heap.front().first)
+                    replaceFarthest(heap, distance2, particle(m));
+            };
+
+            auto bound = [&]() {
+                return heap.size() < per ? std::numeric_limits<float>::max() : heap.front().first;
+            };
+            walk(px, py, pz, local.stack, bound, offer);
+
+            std::sort_heap(heap.begin(), heap.end(), farther);
+            size_t base = out.offsets[t];
+            for (size_t n = 0; n < per; ++n)
+            {
+                out.indices[base + n] = heap[n].second;
+                out.distances[base + n] = std::sqrt(heap[n].first);
+            }
+        }
+    }
+}
+
+template<typename Coord>
+void SpatialQuery::withinBatch(const Coord *x, const Coord *y, const Coord *z, int count, bool excludeSelf,
+                               float radius, NeighbourList &out)
+{
+    float radius2 = radius * radius;
+    scratch.resize(omp_get_max_threads());
+    out.offsets.assign(count + 1, 0);
+    resultThread.resize(count);
+    resultStart.resize(count);
+
+#pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        Scratch &local = scratch[thread];
+        local.indices.clear();
+        local.distances.clear();
+
+#pragma omp for schedule(dynamic, QUERY_CHUNK)
+        for (int o = 0; o < count; ++o)
+        {
+            int t = order[o];
+            auto px = static_cast<float>(x[t]), py = static_cast<float>(y[t]), pz = static_cast<float>(z[t]);
+            int skip = excludeSelf ? t : NULL_INDEX;
+
+            size_t start = local.indices.size();
+            walk(px, py, pz, local.stack, [radius2]() { return radius2; }, [&](size_t m) {
+                float dx = sortedX[m] - px, dy = sortedY[m] - py, dz = sortedZ[m] - pz;
+                float distance2 = dx * dx + dy * dy + dz * dz;
+                int j = particle(m);
+                if (distance2 <= radius2 && j != skip)
+                {
+                    local.indices.push_back(j);
+                    local.distances.push_back(std::sqrt(distance2));
+                }
+            });
+
+            resultThread[t] = thread;
+            resultStart[t] = start;
+            out.offsets[t + 1] = local.indices.size() - start;
+        }
+    }
+
+    // Counts to offsets, then every target's run is copied out of its thread's scratch
+    std::partial_sum(out.offsets.begin(), out.offsets.end(), out.offsets.begin());
+    out.indices.resize(out.offsets[count]);
+    out.distances.resize(out.offsets[count]);
+
+#pragma omp parallel for schedule(static)
+    for (int t = 0; t < count; ++t)
+    {
+        const Scratch &source = scratch[resultThread[t]];
+        size_t length = out.offsets[t + 1] - out.offsets[t];
+        std::copy_n(source.indices.begin() + resultStart[t], length, out.indices.begin() + out.offsets[t]);
+        std::copy_n(source.distances.begin() + resultStart[t], length, out.distances.begin() + out.offsets[t]);
+    }
+}
@@ -114,4 +114,29 @@ void Sphere::draw(const Shader &shader, const glm::vec3& diffuse, const glm::vec
             glDrawElements(GL_PATCHES, indices.size(), GL_UNSIGNED_INT, nullptr);
             break;
     }
+}
+
+void Sphere::drawInstanced(const Shader &shader, const InstanceBuffer &instances, size_t offset, int count,
+                           const glm::vec3 &specular, const glm::vec3 &ambient, const glm::vec3 &emit)
+{
+    shader.use();
+
+    shader.setVec3("objSpec", specular);
+    shader.setVec3("objAmbi", ambient);
+    shader.setVec3("objEmit", emit);
+
+    glBindVertexArray(VAO);
+
+    // Re-pointed every frame because the ring hands out a different region each time
+    glBindBuffer(GL_ARRAY_BUFFER, instances.buffer());
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void *) offset);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance),
+                          (void *) (offset + offsetof(SphereInstance, r)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+
+    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr, count);
 }
\ No newline at end of file
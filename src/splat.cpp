@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include "splat.h"
+#include "omp.h"
+
+#ifdef NBODY_HAVE_PNG
+#include <png.h>
+#endif
+
+void lookAtMatrix(const float eye[3], const float center[3], const float up[3], float out[16])
+{
+    auto normalize = [](float v[3]) {
+        float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+    };
+
+    float f[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+    normalize(f);
+    float s[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0]};
+    normalize(s);
+    float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0]};
+
+    std::fill(out, out + 16, 0.0f);
+    for (int k = 0; k < 3; ++k)
+    {
+        out[k * 4 + 0] = s[k];
+        out[k * 4 + 1] = u[k];
+        out[k * 4 + 2] = -f[k];
+    }
+    out[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+    out[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+    out[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+    out[15] = 1.0f;
+}
+
+void perspectiveMatrix(float fovY, float aspect, float zNear, float zFar, float out[16])
+{
+    float tanHalf = std::tan(0.5f * fovY);
+
+    std::fill(out, out + 16, 0.0f);
+    out[0] = 1.0f / (aspect * tanHalf);
+    out[5] = 1.0f / tanHalf;
+    out[10] = -(zFar + zNear) / (zFar - zNear);
+    out[11] = -1.0f;
+    out[14] = -(2.0f * zFar * zNear) / (zFar - zNear);
+}
+
+void multiplyMatrix(const float a[16], const float b[16], float out[16])
+{
+    float result[16];
+    for (int c = 0; c < 4; ++c)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k)
+                sum += a[k * 4 + r] * b[c * 4 + k];
+            result[c * 4 + r] = sum;
+        }
+    }
+    std::copy(result, result + 16, out);
+}
+
+SplatRenderer::SplatRenderer(int width, int height)
+        : imageWidth(width), imageHeight(height),
+          accumulated(static_cast<size_t>(width) * height),
+          pixels(static_cast<size_t>(width) * height * 3)
+{
+}
+
+void SplatRenderer::splat(float *target, float px, float py, float radius, float weight) const
+{
+    if (radius <= 1.0f)
+    {
+        int x0 = static_cast<int>(std::floor(px));
+        int y0 = static_cast<int>(std::floor(py));
+        float fx = px - static_cast<float>(x0);
+        float fy = py - static_cast<float>(y0);
+
+        float weights[4] = {(1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy};
+        for (int k = 0; k < 4; ++k)
+        {
+            int x = x0 + (k & 1);
+            int y = y0 + (k >> 1);
+            if (x >= 0 && x < imageWidth && y >= 0 && y < imageHeight)
+                target[static_cast<size_t>(y) * imageWidth + x] += weight * weights[k];
+        }
+        return;
+    }
+
+    // (1 - r^2/h^2)^2 over the disk integrates to pi h^2 / 3, which keeps the deposited mass independent of h
+    float inverse = 1.0f / (radius * radius);
+    float norm = weight * 3.0f / (3.14159265f * radius * radius);
+
+    int xBegin = std::max(static_cast<int>(std::ceil(px - radius)), 0);
+    int xEnd = std::min(static_cast<int>(std::floor(px + radius)), imageWidth - 1);
+    int yBegin = std::max(static_cast<int>(std::ceil(py - radius)), 0);
+    int yEnd = std::min(static_cast<int>(std::floor(py + radius)), imageHeight - 1);
+
+    for (int y = yBegin; y <= yEnd; ++y)
+    {
+        float dy = static_cast<float>(y) - py;
+        float *row = target + static_cast<size_t>(y) * imageWidth;
+        for (int x = xBegin; x <= xEnd; ++x)
+        {
+            float dx = static_cast<float>(x) - px;
+            float q = 1.0f - (dx * dx + dy * dy) * inverse;
+            if (q > 0.0f)
+                row[x] += norm * q * q;
+        }
+    }
+}
+
+template<typename Coord>
+void SplatRenderer::render(const Coord *x, const Coord *y, const Coord *z, const Coord *mass, int count,
+                           const float viewProjection[16])
+{
+    const float *m = viewProjection;
+    size_t pixelCount = static_cast<size_t>(imageWidth) * imageHeight;
+
+    // Pixels per world unit at clip w = 1, from the second row of the rotation-scale part
+    float focal = 0.5f * static_cast<float>(imageHeight) * std::sqrt(m[1] * m[1] + m[5] * m[5] + m[9] * m[9]);
+    float halfWidth = 0.5f * static_cast<float>(imageWidth);
+    float halfHeight = 0.5f * static_cast<float>(imageHeight);
+
+    int team = 1;
+#pragma omp parallel
+    {
+        // The team can be smaller than omp_get_max_threads (thread limits, nesting), so the images follow the
+        // threads actually present
+#pragma omp single
+        {
+            team = omp_get_num_threads();
+            threadImages.resize(team);
+        }
+
+        std::vector<float> &image = threadImages[omp_get_thread_num()];
+        image.assign(pixelCount, 0.0f);
+        float *target = image.data();
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < count; ++i)
+        {
+            float clipX = m[0] * x[i] + m[4] * y[i] + m[8] * z[i] + m[12];
+            float clipY = m[1] * x[i] + m[5] * y[i] + m[9] * z[i] + m[13];
+            float clipZ = m[2] * x[i] + m[6] * y[i] + m[10] * z[i] + m[14];
+            float clipW = m[3] * x[i] + m[7] * y[i] + m[11] * z[i] + m[15];
+
+            // Behind the eye or outside the depth range
+            if (clipW <= 0.0f || clipZ < -clipW || clipZ > clipW)
+                continue;
+
+            float inverseW = 1.0f / clipW;
+            float px = (clipX * inverseW + 1.0f) * halfWidth - 0.5f;
+            float py = (1.0f - clipY * inverseW) * halfHeight - 0.5f;
+
+            float radius = kernelPixels;
+            if (worldRadius > 0.0f)
+                radius = std::max(radius, worldRadius * focal * inverseW);
+
+            if (px + radius < -1.0f || px - radius > static_cast<float>(imageWidth) ||
+                py + radius < -1.0f || py - radius > static_cast<float>(imageHeight))
+                continue;
+
+            splat(target, px, py, radius, mass[i]);
+        }
+
+        // Each thread sums one band of pixels across every thread's image
+#pragma omp for schedule(static)
+        for (size_t p = 0; p < pixelCount; ++p)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < team; ++t)
+                sum += threadImages[t][p];
+            accumulated[p] = sum;
+        }
+    }
+
+    toneMap();
+}
+
+template void SplatRenderer::render<float>(const float *, const float *, const float *, const float *, int,
+                                           const float[16]);
+template void SplatRenderer::render<double>(const double *, const double *, const double *, const double *, int,
+                                            const float[16]);
+
+void SplatRenderer::toneMap()
+{
+    size_t pixelCount = accumulated.size();
+
+    float peak = 0.0f;
+    double litSum = 0.0;
+    long long lit = 0;
+#pragma omp parallel for schedule(static) reduction(max:peak) reduction(+:litSum, lit)
+    for (size_t p = 0; p < pixelCount; ++p)
+    {
+        float value = accumulated[p];
+        peak = std::max(peak, value);
+        if (value > 0.0f)
+        {
+            litSum += value;
+            ++lit;
+        }
+    }
+
+    // log(1 + d / s) / log(1 + peak / s): linear below s, compressed above it
+    float scale = lit > 0 ? static_cast<float>(litSum / lit) / std::max(exposure, 1.0e-6f) : 1.0f;
+    float inverseRange = peak > 0.0f ? 1.0f / std::log1p(peak / scale) : 0.0f;
+
+#pragma omp parallel for schedule(static)
+    for (size_t p = 0; p < pixelCount; ++p)
+    {
+        float v = std::log1p(accumulated[p] / scale) * inverseRange;
+
+        // Black through red and yellow to white
+        pixels[3 * p + 0] = static_cast<uint8_t>(255.0f * std::clamp(3.0f * v, 0.0f, 1.0f));
+        pixels[3 * p + 1] = static_cast<uint8_t>(255.0f * std::clamp(3.0f * v - 1.0f, 0.0f, 1.0f));
+        pixels[3 * p + 2] = static_cast<uint8_t>(255.0f * std::clamp(3.0f * v - 2.0f, 0.0f, 1.0f));
+    }
+}
+
+bool SplatRenderer::writePpm(const std::string &path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << "P6\n" << imageWidth << " " << imageHeight << "\n255\n";
+    file.write(reinterpret_cast<const char *>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+    return static_cast<bool>(file);
+}
+
+bool SplatRenderer::writePng(const std::string &path) const
+{
+#ifdef NBODY_HAVE_PNG
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    if (png == nullptr || info == nullptr || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        std::fclose(file);
+        return false;
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, imageWidth, imageHeight, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_compression_level(png, 1);
+    png_write_info(png, info);
+    for (int y = 0; y < imageHeight; ++y)
+        png_write_row(png, pixels.data() + static_cast<size_t>(y) * imageWidth * 3);
+    png_write_end(png, nullptr);
+
+    png_destroy_write_struct(&png, &info);
+    return std::fclose(file) == 0;
+#else
+    static_cast<void>(path);
+    return false;
+#endif
+}
+
+bool SplatRenderer::writeRaw(std::FILE *stream) const
+{
+    return std::fwrite(pixels.data(), 1, pixels.size(), stream) == pixels.size();
+}
@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ensemble.h"
+#include "simulation.h"
+#include "initialconditions.h"
+#include "omp.h"
+
+// Parameter sweeps over many small systems: runs them as one ensemble, whole systems per thread, and writes one
+// result row per system. The summary on stderr carries the sweep throughput.
+
+struct SweepOptions
+{
+    int systems = 1000;
+    std::vector<int> particles{100, 200, 500};
+    std::vector<Distribution> distributions{Distribution::PLUMMER};
+    float radius = 1000.0f;
+    float totalMass = 10000.0f;
+    unsigned int seed = 1;
+
+    EnsembleOptions run;
+
+    bool compare = false;
+    std::string format = "csv";
+    std::string output;
+};
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --systems K           systems in the sweep (default 1000)\n"
+              << "  --particles LIST      bodies per system, cycled over the systems (default 100,200,500)\n"
+              << "  --distributions LIST  uniform, plummer, clustered, cube, cycled (default plummer)\n"
+              << "  --radius R            initial radius (default 1000)\n"
+              << "  --mass M              total mass of each system (default 10000)\n"
+              << "  --seed S              system k is generated from seed S + k (default 1)\n"
+              << "  --steps N             steps per system (default 100)\n"
+              << "  --dt DT               step size (default 0.01)\n"
+              << "  --theta T             opening angle of the tree systems (default 0.5)\n"
+              << "  --softening E         softening length (default 0.5)\n"
+              << "  --integrator NAME     leapfrog or yoshida (default leapfrog)\n"
+              << "  --direct-limit N      direct sum up to N bodies, tree above (default "
+              << ENSEMBLE_DIRECT_LIMIT << ")\n"
+              << "  --threads N           worker threads (default: runtime)\n"
+              << "  --compare             also run the systems one after another, each across all threads\n"
+              << "  --format csv|json     output format (default csv)\n"
+              << "  --output PATH         write results to PATH instead of stdout\n";
+}
+
+static std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static bool parseOptions(int argc, char **argv, SweepOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--systems")
+            options.systems = std::atoi(value().c_str());
+        else if (arg == "--particles")
+        {
+            options.particles.clear();
+            for (auto &item: splitList(value()))
+                options.particles.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--distributions")
+        {
+            options.distributions.clear();
+            for (auto &item: splitList(value()))
+            {
+                Distribution distribution;
+                if (!parseDistribution(item, distribution))
+                {
+                    std::cerr << "Unknown distribution " << item << std::endl;
+                    return false;
+                }
+                options.distributions.push_back(distribution);
+            }
+        }
+        else if (arg == "--radius")
+            options.radius = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--mass")
+            options.totalMass = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned int>(std::strtoul(value().c_str(), nullptr, 10));
+        else if (arg == "--steps")
+            options.run.steps = std::atoi(value().c_str());
+        else if (arg == "--dt")
+            options.run.dt = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--theta")
+            options.run.theta = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--softening")
+            options.run.softening = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--integrator")
+        {
+            std::string name = value();
+            if (!parseIntegrator(name, options.run.integrator) || options.run.integrator == Integrator::HERMITE)
+            {
+                std::cerr << "Sweeps run leapfrog or yoshida, not " << name << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--direct-limit")
+            options.run.directLimit = std::atoi(value().c_str());
+        else if (arg == "--threads")
+            options.run.threads = std::atoi(value().c_str());
+        else if (arg == "--compare")
+            options.compare = true;
+        else if (arg == "--format")
+            options.format = value();
+        else if (arg == "--output")
+            options.output = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.systems <= 0 || options.run.steps <= 0 || options.particles.empty() ||
+        options.distributions.empty())
+    {
+        std::cerr << "System and step counts must be positive and the particle and distribution lists non-empty"
+                  << std::endl;
+        return false;
+    }
+    for (int particles: options.particles)
+    {
+        if (particles <= 1)
+        {
+            std::cerr << "Systems need at least two particles" << std::endl;
+            return false;
+        }
+    }
+    if (options.format != "csv" && options.format != "json")
+    {
+        std::cerr << "Unknown format " << options.format << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The same systems one after another through Simulation, each step split across all threads
+static double runSequential(const SweepOptions &options, const std::vector<EnsembleSystem> &systems)
+{
+    if (options.run.threads > 0)
+        omp_set_num_threads(options.run.threads);
+
+    auto start = std::chrono::steady_clock::now();
+    for (const EnsembleSystem &system: systems)
+    {
+        Simulation simulation(system.particleCount);
+        SimulationData &data = simulation.data();
+        data.theta = options.run.theta;
+        data.softening = options.run.softening;
+        generateParticles(data, system.distribution, system.radius, system.totalMass, system.seed);
+        simulation.integratorSetup(options.run.integrator);
+        for (int step = 0; step < options.run.steps; ++step)
+            simulation.step(options.run.dt);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    SweepOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<EnsembleSystem> systems(options.systems);
+    for (int k = 0; k < options.systems; ++k)
+    {
+        systems[k].particleCount = options.particles[k % options.particles.size()];
+        systems[k].distribution = options.distributions[k % options.distributions.size()];
+        systems[k].radius = options.radius;
+        systems[k].totalMass = options.totalMass;
+        systems[k].seed = options.seed + static_cast<unsigned int>(k);
+    }
+
+    Ensemble ensemble(systems);
+    auto start = std::chrono::steady_clock::now();
+    ensemble.run(options.run);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.output.empty())
+    {
+        ensemble.writeResults(std::cout, options.format == "json");
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            return EXIT_FAILURE;
+        }
+        ensemble.writeResults(file, options.format == "json");
+    }
+
+    int threads = options.run.threads > 0 ? options.run.threads : omp_get_max_threads();
+    std::cerr << "systems " << options.systems << ", steps " << options.run.steps << ", integrator "
+              << integratorName(options.run.integrator) << ", precision " << Precision::name << ", threads "
+              << threads << ", steals " << ensemble.steals() << std::endl;
+    std::cerr << "ensemble wall " << seconds << " s, " << options.systems / seconds << " systems/s, "
+              << ensemble.particleSteps() / seconds << " particle-steps/s" << std::endl;
+
+    if (options.compare)
+    {
+        double sequential = runSequential(options, systems);
+        std::cerr << "sequential wall " << sequential << " s, " << options.systems / sequential << " systems/s, "
+                  << ensemble.particleSteps() / sequential << " particle-steps/s, ensemble speedup "
+                  << sequential / seconds << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,956 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <unistd.h>
+#include "simulation.h"
+#include "bhtree.h"
+#include "fof.h"
+#include "initialconditions.h"
+#include "lodselect.h"
+#include "particlemesh.h"
+#include "sharedframes.h"
+#include "snapshotcodec.h"
+#include "snapshotwriter.h"
+#include "simulationthread.h"
+#include "spatialquery.h"
+#include "splat.h"
+#include "omp.h"
+
+// Force-accuracy versus cost: runs each force solver (the tree with full or compact nodes, TreePM, the periodic
+// tree with Ewald corrections) and an exact direct sum on the same particles and reports the relative force error
+// distribution for every solver and theta. The exact kernels on the same tree (neighbour queries,
+// friends-of-friends) are compared against brute force, the published render tree is checked for consistency,
+// the viewer's frustum culling against a per-body clip test, the shared frame ring for torn reads, and compressed
+// snapshots against their error bounds. Exits non-zero when a gate is exceeded or an exact check fails.
+
+// Smallest group compared in the friends-of-friends check; pairs upwards, so a uniform set has groups too
+constexpr int FOF_CHECK_MEMBERS = 2;
+
+// Force solvers swept; each is compared against the direct sum under its own boundaries
+enum class Solver
+{
+    TREE,
+    COMPACT,
+    TREEPM,
+    PERIODIC
+};
+
+static const char *solverName(Solver solver)
+{
+    switch (solver)
+    {
+        case Solver::TREE:
+            return "tree";
+        case Solver::COMPACT:
+            return "compact";
+        case Solver::TREEPM:
+            return "treepm";
+        case Solver::PERIODIC:
+            return "periodic";
+    }
+    return "unknown";
+}
+
+static bool parseSolver(const std::string &name, Solver &solver)
+{
+    if (name == "tree")
+        solver = Solver::TREE;
+    else if (name == "compact")
+        solver = Solver::COMPACT;
+    else if (name == "treepm")
+        solver = Solver::TREEPM;
+    else if (name == "periodic")
+        solver = Solver::PERIODIC;
+    else
+        return false;
+
+    return true;
+}
+
+struct ValidateOptions
+{
+    int particles = 20000;
+    int sample = 2000;
+    std::vector<Distribution> distributions{Distribution::UNIFORM, Distribution::PLUMMER, Distribution::CLUSTERED};
+    std::vector<float> thetas{0.0f, 0.3f, 0.5f, 0.7f, 1.0f};
+    float softening = SOFTENING;
+    float radius = 1000.0f;
+    unsigned int seed = 1;
+
+    std::vector<Solver> solvers{Solver::TREE, Solver::COMPACT, Solver::TREEPM, Solver::PERIODIC};
+    int treepmMesh = 64;
+    float box = 0.0f;       // periodic box side; 0 takes four times the radius
+    std::string ewaldTable = "ewald.tab";
+
+    // Gates apply to every row; negative disables
+    double maxMedian = -1.0;
+    double maxP99 = -1.0;
+    double maxError = -1.0;
+
+    // Gate on the theta=0 rows of the tree solver, where every body is summed one by one and only rounding is
+    // left; on by default so a plain run catches a walk that misses bodies. Negative disables
+    double maxExactError = 1.0e-3;
+
+    // Bodies whose kNN and radius queries are checked against brute force; 0 disables
+    int queries = 500;
+    int neighbours = 16;
+
+    // Friends-of-friends linking length in mean separations for the check against an O(N^2) linking pass;
+    // 0 disables
+    float fofFactor = FOF_LINKING_FACTOR;
+
+    // Error bounds the compressed snapshot round trip is checked against
+    float positionError = SnapshotCodecOptions{}.positionError;
+    float velocityError = SnapshotCodecOptions{}.velocityError;
+
+    std::string format = "csv";
+    std::string output;
+};
+
+struct ValidateResult
+{
+    Distribution distribution;
+    Solver solver;
+    float theta;
+
+    double treeSeconds;         // tree walk over all particles
+    double directSeconds;       // direct sum over all particles, extrapolated from the sample
+    long long interactions;
+
+    double errMedian;
+    double errP99;
+    double errMax;
+    bool pass;
+};
+
+// An exact kernel compared against brute force on one distribution
+struct ExactResult
+{
+    Distribution distribution;
+    std::string check;
+    int cases;
+    int mismatches;
+};
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --particles N         bodies per set (default 20000)\n"
+              << "  --sample N            particles compared against the direct sum (default 2000, 0 = all)\n"
+              << "  --distributions LIST  uniform, plummer, clustered (default all)\n"
+              << "  --theta LIST          opening angles to sweep (default 0,0.3,0.5,0.7,1)\n"
+              << "  --softening E         softening length (default 0.5)\n"
+              << "  --radius R            initial radius (default 1000)\n"
+              << "  --seed S              random seed (default 1)\n"
+              << "  --solvers LIST        tree, compact, treepm, periodic (default all)\n"
+              << "  --treepm MESH         TreePM mesh size, a power of two (default 64)\n"
+              << "  --box L               periodic box side (default 4 times the radius)\n"
+              << "  --ewald-table PATH    Ewald table cache, computed on first use (default ewald.tab)\n"
+              << "  --max-median E        fail if any median relative error exceeds E\n"
+              << "  --max-p99 E           fail if any 99th percentile relative error exceeds E\n"
+              << "  --max-error E         fail if any maximum relative error exceeds E\n"
+              << "  --max-exact-error E   fail if the maximum relative error of the tree at theta 0 exceeds E\n"
+              << "                        (default 0.001, negative = off)\n"
+              << "  --queries N           bodies whose kNN and radius queries are checked against brute force\n"
+              << "                        (default 500, 0 = off)\n"
+              << "  --neighbours K        neighbours per kNN query, also setting the radius (default 16)\n"
+              << "  --fof-factor F        linking length, in mean separations, of the friends-of-friends check\n"
+              << "                        against all pairs (default 0.2, 0 = off)\n"
+              << "  --position-error E    position error bound of the compressed snapshot check (default 0.001)\n"
+              << "  --velocity-error E    velocity error bound of the compressed snapshot check (default 0.001)\n"
+              << "  --format csv|json     output format (default csv)\n"
+              << "  --output PATH         write results to PATH instead of stdout\n";
+}
+
+static std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static bool parseOptions(int argc, char **argv, ValidateOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--particles")
+            options.particles = std::atoi(value().c_str());
+        else if (arg == "--sample")
+            options.sample = std::atoi(value().c_str());
+        else if (arg == "--distributions")
+        {
+            options.distributions.clear();
+            for (auto &item: splitList(value()))
+            {
+                Distribution distribution;
+                if (!parseDistribution(item, distribution))
+                {
+                    std::cerr << "Unknown distribution " << item << std::endl;
+                    return false;
+                }
+                options.distributions.push_back(distribution);
+            }
+        }
+        else if (arg == "--theta")
+        {
+            options.thetas.clear();
+            for (auto &item: splitList(value()))
+                options.thetas.push_back(std::strtof(item.c_str(), nullptr));
+        }
+        else if (arg == "--softening")
+            options.softening = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--radius")
+            options.radius = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned int>(std::strtoul(value().c_str(), nullptr, 10));
+        else if (arg == "--solvers")
+        {
+            options.solvers.clear();
+            for (auto &item: splitList(value()))
+            {
+                Solver solver;
+                if (!parseSolver(item, solver))
+                {
+                    std::cerr << "Unknown solver " << item << std::endl;
+                    return false;
+                }
+                options.solvers.push_back(solver);
+            }
+        }
+        else if (arg == "--treepm")
+            options.treepmMesh = std::atoi(value().c_str());
+        else if (arg == "--box")
+            options.box = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--ewald-table")
+            options.ewaldTable = value();
+        else if (arg == "--max-median")
+            options.maxMedian = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--max-p99")
+            options.maxP99 = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--max-error")
+            options.maxError = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--max-exact-error")
+            options.maxExactError = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--queries")
+            options.queries = std::atoi(value().c_str());
+        else if (arg == "--neighbours")
+            options.neighbours = std::atoi(value().c_str());
+        else if (arg == "--fof-factor")
+            options.fofFactor = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--position-error")
+            options.positionError = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--velocity-error")
+            options.velocityError = std::strtof(value().c_str(), nullptr);
+        else if (arg == "--format")
+            options.format = value();
+        else if (arg == "--output")
+            options.output = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.particles <= 1)
+    {
+        std::cerr << "Need at least two particles" << std::endl;
+        return false;
+    }
+    if (options.format != "csv" && options.format != "json")
+    {
+        std::cerr << "Unknown format " << options.format << std::endl;
+        return false;
+    }
+    if (options.sample <= 0 || options.sample > options.particles)
+        options.sample = options.particles;
+    options.queries = std::clamp(options.queries, 0, options.particles);
+    if (options.neighbours < 1)
+    {
+        std::cerr << "Need at least one neighbour" << std::endl;
+        return false;
+    }
+    if (options.treepmMesh < 8 || (options.treepmMesh & (options.treepmMesh - 1)) != 0)
+    {
+        std::cerr << "TreePM mesh size must be a power of two of at least 8" << std::endl;
+        return false;
+    }
+    if (options.box < 0.0f || options.box > 65536.0f)
+    {
+        std::cerr << "Box size must be between 0 and 65536" << std::endl;
+        return false;
+    }
+    if (options.box == 0.0f)
+        options.box = std::min(4.0f * options.radius, 65536.0f);
+    if (!(options.positionError > 0.0f) || !(options.velocityError > 0.0f))
+    {
+        std::cerr << "Snapshot position and velocity errors must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Squared distances computed as the query walk does, in float
+static float distance2(const SimulationData &data, int i, int j)
+{
+    float dx = static_cast<float>(data.particleX[j]) - static_cast<float>(data.particleX[i]);
+    float dy = static_cast<float>(data.particleY[j]) - static_cast<float>(data.particleY[i]);
+    float dz = static_cast<float>(data.particleZ[j]) - static_cast<float>(data.particleZ[i]);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Two squared distances that differ only by rounding (contraction into FMAs, summation order)
+static bool sameDistance2(float a, float b)
+{
+    return std::fabs(a - b) <= 1.0e-5f * std::max(a, b);
+}
+
+// kNN and radius queries of the sampled bodies against a scan over all bodies. A kNN result must hold the k
+// smallest distances, so ties may pick either body; a radius result must hold exactly the bodies within the
+// radius, ignoring those that lie on it to within rounding
+static void validateQueries(const ValidateOptions &options, Distribution distribution, const SimulationData &data,
+                            const Octree &tree, const std::vector<int> &sample, std::vector<ExactResult> &exact)
+{
+    int k = std::min(options.neighbours, options.particles - 1);
+    float reach = options.radius * std::cbrt(static_cast<float>(k) / static_cast<float>(options.particles));
+    float reach2 = reach * reach;
+
+    SpatialQuery query;
+    query.update(data, tree);
+    NeighbourList nearest, within;
+    query.nearestParticles(k, nearest);
+    query.withinParticles(reach, within);
+
+    int knnMismatches = 0, radiusMismatches = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:knnMismatches, radiusMismatches)
+    for (int s = 0; s < options.queries; ++s)
+    {
+        int i = sample[s];
+        std::vector<std::pair<float, int>> all;
+        all.reserve(options.particles - 1);
+        for (int j = 0; j < options.particles; ++j)
+        {
+            if (j != i)
+                all.emplace_back(distance2(data, i, j), j);
+        }
+        std::sort(all.begin(), all.end());
+
+        bool knnMatches = nearest.count(i) == static_cast<size_t>(k);
+        std::vector<int> found;
+        for (size_t n = nearest.offsets[i]; knnMatches && n < nearest.offsets[i + 1]; ++n)
+        {
+            int j = nearest.indices[n];
+            float reported = nearest.distances[n] * nearest.distances[n];
+            size_t rank = n - nearest.offsets[i];
+            knnMatches = j >= 0 && j < options.particles && j != i && sameDistance2(reported, distance2(data, i, j)) &&
+                         sameDistance2(reported, all[rank].first);
+            found.push_back(j);
+        }
+        std::sort(found.begin(), found.end());
+        knnMatches = knnMatches && std::adjacent_find(found.begin(), found.end()) == found.end();
+        knnMismatches += knnMatches ? 0 : 1;
+
+        std::vector<int> expected, reported(within.indices.begin() + within.offsets[i],
+                                            within.indices.begin() + within.offsets[i + 1]);
+        for (const auto &[d2, j]: all)
+        {
+            if (d2 > reach2 && !sameDistance2(d2, reach2))
+                break;
+            if (sameDistance2(d2, reach2))
+                reported.erase(std::remove(reported.begin(), reported.end(), j), reported.end());
+            else
+                expected.push_back(j);
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(reported.begin(), reported.end());
+        radiusMismatches += expected == reported ? 0 : 1;
+    }
+
+    exact.push_back({distribution, "knn", options.queries, knnMismatches});
+    exact.push_back({distribution, "radius", options.queries, radiusMismatches});
+}
+
+// Connected components of the pairs closer than link2 by a scan over all pairs, each body labelled with the
+// lowest index of its component
+static std::vector<int> linkAllPairs(const SimulationData &data, float link2)
+{
+    int n = data.particleCount;
+    std::vector<std::vector<std::pair<int, int>>> links(omp_get_max_threads());
+#pragma omp parallel
+    {
+        std::vector<std::pair<int, int>> &local = links[omp_get_thread_num()];
+#pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = i + 1; j < n; ++j)
+            {
+                if (distance2(data, i, j) <= link2)
+                    local.emplace_back(i, j);
+            }
+        }
+    }
+
+    std::vector<int> label(n);
+    std::iota(label.begin(), label.end(), 0);
+    auto root = [&](int i) {
+        while (label[i] != i)
+            i = label[i] = label[label[i]];
+        return i;
+    };
+    for (const auto &local: links)
+    {
+        for (const auto &[i, j]: local)
+        {
+            int a = root(i), b = root(j);
+            if (a != b)
+                label[std::max(a, b)] = std::min(a, b);
+        }
+    }
+    for (int i = 0; i < n; ++i)
+        label[i] = root(i);
+    return label;
+}
+
+// Catalogued groups that are not exactly a component of at least minMembers bodies, plus any difference in
+// the number of groups
+static int groupMismatches(const FofCatalogue &catalogue, const std::vector<int> &label, int minMembers)
+{
+    std::vector<int> members(label.size(), 0);
+    for (int l: label)
+        ++members[l];
+    int expected = 0;
+    for (size_t i = 0; i < label.size(); ++i)
+        expected += label[i] == static_cast<int>(i) && members[i] >= minMembers ? 1 : 0;
+
+    // Groups are disjoint, so groups that each fill a whole component are distinct components
+    int mismatches = std::abs(expected - static_cast<int>(catalogue.groups.size()));
+    for (size_t g = 0; g < catalogue.groups.size(); ++g)
+    {
+        size_t begin = catalogue.memberOffsets[g], end = catalogue.memberOffsets[g + 1];
+        int component = label[catalogue.memberIndices[begin]];
+        bool same = members[component] == static_cast<int>(end - begin);
+        for (size_t k = begin; same && k < end; ++k)
+            same = label[catalogue.memberIndices[k]] == component;
+        mismatches += same ? 0 : 1;
+    }
+    return mismatches;
+}
+
+// Friends-of-friends groups against an O(N^2) linking pass. Pairs at the linking length to within rounding may
+// go either way, so the groups must match the components of the strict or of the loose reading of it
+static void validateFof(const ValidateOptions &options, Distribution distribution, const SimulationData &data,
+                        const Octree &tree, std::vector<ExactResult> &exact)
+{
+    float link = fofLinkingLength(data, options.fofFactor);
+    FriendsOfFriends fof(link, FOF_CHECK_MEMBERS);
+    FofCatalogue catalogue;
+    fof.find(data, tree, true, catalogue);
+
+    float link2 = link * link;
+    int strict = groupMismatches(catalogue, linkAllPairs(data, link2 * (1.0f - 1.0e-5f)), FOF_CHECK_MEMBERS);
+    int loose = strict == 0 ? 0
+                            : groupMismatches(catalogue, linkAllPairs(data, link2 * (1.0f + 1.0e-5f)),
+                                              FOF_CHECK_MEMBERS);
+    exact.push_back({distribution, "fof", static_cast<int>(catalogue.groups.size()), std::min(strict, loose)});
+}
+
+static bool inside(const RenderNode &inner, const RenderNode &outer)
+{
+    return inner.width < outer.width && inner.x >= outer.x && inner.y >= outer.y && inner.z >= outer.z &&
+           inner.x + inner.width <= outer.x + outer.width && inner.y + inner.width <= outer.y + outer.width &&
+           inner.z + inner.width <= outer.z + outer.width;
+}
+
+// The render tree the viewer culls with: every node's skip index must end exactly its subtree (the nodes up to
+// it lie inside the node, the one at it does not), and the skip walk must reach every body the tree holds
+// exactly once
+static void validateRenderTree(Distribution distribution, const SimulationData &data, const Octree &tree,
+                               std::vector<ExactResult> &exact)
+{
+    std::vector<RenderNode> nodes;
+    publishRenderNodes(data, tree, nodes);
+    int count = static_cast<int>(nodes.size());
+
+    int mismatches = 0;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+:mismatches)
+    for (int i = 0; i < count; ++i)
+    {
+        const RenderNode &node = nodes[i];
+        bool nested = node.next > i && node.next <= count && (node.particle == NULL_INDEX || node.next == i + 1);
+        for (int j = i + 1; nested && j < node.next; ++j)
+            nested = inside(nodes[j], node);
+        if (nested && node.next < count)
+            nested = !inside(nodes[node.next], node);
+        mismatches += nested ? 0 : 1;
+    }
+
+    // The walk follows the skip indices, so it only runs over a consistent tree
+    if (mismatches == 0)
+    {
+        std::vector<int> visits(data.particleCount, 0), held(data.particleCount, 0);
+        for (int k = 0; k < tree.size(); ++k)
+        {
+            if (data.nodeParticleIndex[k] != NULL_INDEX)
+                held[data.nodeParticleIndex[k]] = 1;
+        }
+        for (int i = 0; i < count;)
+        {
+            if (nodes[i].particle == NULL_INDEX)
+            {
+                ++i;
+                continue;
+            }
+            ++visits[nodes[i].particle];
+            i = nodes[i].next;
+        }
+        for (int p = 0; p < data.particleCount; ++p)
+            mismatches += visits[p] == held[p] ? 0 : 1;
+    }
+
+    exact.push_back({distribution, "render-tree", count, mismatches});
+}
+
+// The viewer's level-of-detail selection with impostors off, from a camera inside the cloud: every body the tree
+// holds whose centre is inside the view frustum must come out as an instance, and counting must agree with writing
+static void validateLodSelection(Distribution distribution, const SimulationData &data, const Octree &tree,
+                                 float radius, std::vector<ExactResult> &exact)
+{
+    std::vector<RenderNode> nodes;
+    publishRenderNodes(data, tree, nodes);
+    FrameView frame{data.particleX, data.particleY, data.particleZ, data.particleMass,
+                    static_cast<size_t>(data.particleCount), nodes.data(), nodes.size(), 0, 0.0};
+
+    float eye[3] = {0.25f * radius, 0.1f * radius, 0.3f * radius};
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    float up[3] = {0.0f, 1.0f, 0.0f};
+    float view[16], projection[16], viewProjection[16];
+    lookAtMatrix(eye, center, up, view);
+    perspectiveMatrix(1.0f, 1.5f, 0.01f * radius, 4.0f * radius, projection);
+    multiplyMatrix(projection, view, viewProjection);
+
+    LodSelector selector(0.001f * radius);
+    selector.impostorPixels = 0.0f;
+    float pixelScale = 1000.0f;
+
+    size_t counts[LOD_LISTS];
+    selector.count(frame, viewProjection, eye, pixelScale, counts);
+    size_t total = 0;
+    for (size_t listCount: counts)
+        total += listCount;
+
+    std::vector<SphereInstance> instances(total);
+    SphereInstance *lists[LOD_LISTS];
+    size_t placed = 0;
+    for (int l = 0; l < LOD_LISTS; ++l)
+    {
+        lists[l] = instances.data() + placed;
+        placed += counts[l];
+    }
+    size_t written[LOD_LISTS];
+    selector.write(frame, viewProjection, eye, pixelScale, lists, counts, written);
+
+    int mismatches = 0;
+    for (int l = 0; l < LOD_LISTS; ++l)
+        mismatches += written[l] == counts[l] ? 0 : 1;
+
+    auto before = [](const SphereInstance &a, const SphereInstance &b) {
+        return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+    };
+    std::sort(instances.begin(), instances.end(), before);
+
+    std::vector<int> held(data.particleCount, 0);
+    for (int k = 0; k < tree.size(); ++k)
+    {
+        if (data.nodeParticleIndex[k] != NULL_INDEX)
+            held[data.nodeParticleIndex[k]] = 1;
+    }
+
+    int cases = 0;
+    const float *m = viewProjection;
+    for (int p = 0; p < data.particleCount; ++p)
+    {
+        float position[4] = {data.particleX[p], data.particleY[p], data.particleZ[p], 1.0f};
+        float clip[4] = {};
+        for (int row = 0; row < 4; ++row)
+        {
+            for (int c = 0; c < 4; ++c)
+                clip[row] += m[4 * c + row] * position[c];
+        }
+        if (!held[p] || std::abs(clip[0]) > clip[3] || std::abs(clip[1]) > clip[3] || std::abs(clip[2]) > clip[3])
+            continue;
+
+        ++cases;
+        SphereInstance body{position[0], position[1], position[2], 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        mismatches += std::binary_search(instances.begin(), instances.end(), body, before) ? 0 : 1;
+    }
+
+    exact.push_back({distribution, "lod-frustum", cases, mismatches});
+}
+
+// The shared-memory frame ring the viewer reads in place: a published frame is acquired intact, its view stays
+// valid while the writer fills the other slots, and turns invalid once the writer laps back onto its slot
+static void validateSharedFrames(Distribution distribution, const SimulationData &data,
+                                 std::vector<ExactResult> &exact)
+{
+    std::string name = "nbody_validate_" + std::to_string(getpid()) + "_" + distributionName(distribution);
+    SharedFrameWriter writer(name, data.particleCount);
+    SharedFrameReader reader;
+
+    int cases = 0, mismatches = 0;
+    auto expect = [&cases, &mismatches](bool passed) {
+        ++cases;
+        mismatches += passed ? 0 : 1;
+    };
+
+    uint64_t step = 1;
+    writer.publish(data, step, 0.5);
+    expect(reader.attach(name));
+
+    FrameView view{};
+    bool acquired = reader.acquire(view);
+    expect(acquired);
+    if (acquired)
+    {
+        bool same = view.count == static_cast<size_t>(data.particleCount) && view.step == step && view.time == 0.5;
+        for (int p = 0; same && p < data.particleCount; ++p)
+        {
+            same = view.x[p] == data.particleX[p] && view.y[p] == data.particleY[p] &&
+                   view.z[p] == data.particleZ[p] && view.mass[p] == data.particleMass[p];
+        }
+        expect(same);
+    }
+
+    for (int slot = 1; slot < SHARED_FRAMES_SLOTS; ++slot)
+        writer.publish(data, ++step, 0.5);
+    expect(reader.valid());
+
+    writer.publish(data, ++step, 0.5);
+    expect(!reader.valid());
+
+    expect(reader.acquire(view) && view.step == step && reader.valid());
+
+    exact.push_back({distribution, "shared-frames", cases, mismatches});
+}
+
+// Compressed snapshots through the writer and back through loadSnapshot: every position and velocity component
+// must come back within its error bound, and the masses exactly
+static void validateSnapshotCodec(const ValidateOptions &options, Distribution distribution,
+                                  const SimulationData &data, std::vector<ExactResult> &exact)
+{
+    std::string name = "nbody_validate_" + std::to_string(getpid()) + "_" + distributionName(distribution);
+    std::string prefix = (std::filesystem::temp_directory_path() / name).string();
+    SnapshotCodecOptions codec;
+    codec.positionError = options.positionError;
+    codec.velocityError = options.velocityError;
+    {
+        SnapshotWriter writer(prefix);
+        writer.enableCompression(codec);
+        writer.submit(data, 1, 0.0);
+        writer.flush();
+    }
+
+    std::string path = prefix + "_00000001.nbs";
+    SnapshotHeader header{};
+    std::vector<float> streams[SNAP_STREAM_COUNT];
+    bool loaded = loadSnapshot(path, header, streams);
+    std::filesystem::remove(path);
+
+    int mismatches = 0;
+    if (!loaded || header.encoding != SNAPSHOT_MORTON_QUANTIZED ||
+        header.particleCount != static_cast<uint64_t>(data.particleCount))
+    {
+        exact.push_back({distribution, "snapshot-codec", 1, 1});
+        return;
+    }
+
+    const Real *original[SNAP_STREAM_COUNT] = {data.particleX, data.particleY, data.particleZ, data.particleVelX,
+                                               data.particleVelY, data.particleVelZ, data.particleMass};
+    float bounds[SNAP_STREAM_COUNT] = {codec.positionError, codec.positionError, codec.positionError,
+                                       codec.velocityError, codec.velocityError, codec.velocityError, 0.0f};
+    // Bodies come back in the idxSorted order they were encoded in
+    for (int i = 0; i < data.particleCount; ++i)
+    {
+        unsigned int p = data.idxSorted[i];
+        bool within = true;
+        for (int s = 0; s < SNAP_STREAM_COUNT; ++s)
+            within = within && std::abs(streams[s][i] - static_cast<float>(original[s][p])) <= bounds[s];
+        mismatches += within ? 0 : 1;
+    }
+
+    exact.push_back({distribution, "snapshot-codec", data.particleCount, mismatches});
+}
+
+// Direct-sum accelerations of the sampled bodies under data's boundaries
+struct DirectReference
+{
+    std::vector<float> accX, accY, accZ;
+    double seconds;     // over all particles, extrapolated from the sample
+};
+
+static DirectReference directReference(const ValidateOptions &options, const SimulationData &data,
+                                       const std::vector<int> &sample)
+{
+    auto start = std::chrono::steady_clock::now();
+#pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < options.sample; ++s)
+        directAcceleration(sample[s], data);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    DirectReference reference;
+    reference.seconds = seconds * options.particles / options.sample;
+    reference.accX.resize(options.sample);
+    reference.accY.resize(options.sample);
+    reference.accZ.resize(options.sample);
+    for (int s = 0; s < options.sample; ++s)
+    {
+        reference.accX[s] = data.accX[sample[s]];
+        reference.accY[s] = data.accY[sample[s]];
+        reference.accZ[s] = data.accZ[sample[s]];
+    }
+    return reference;
+}
+
+// One row per theta: a force pass of acc over the tree just built, timed, and the sampled bodies compared with
+// the reference
+template<typename Acc>
+static void sweepThetas(const ValidateOptions &options, Distribution distribution, Solver solver,
+                        SimulationData &data, const std::vector<int> &sample, const DirectReference &reference,
+                        Acc acc, std::vector<ValidateResult> &results)
+{
+    for (float theta: options.thetas)
+    {
+        data.theta = theta;
+
+        // Clear first so a walk that accumulates into stale accelerations shows up as error
+        std::fill(data.accX, data.accX + data.particleCount, 0.0f);
+        std::fill(data.accY, data.accY + data.particleCount, 0.0f);
+        std::fill(data.accZ, data.accZ + data.particleCount, 0.0f);
+
+        long long interactions = 0;
+        auto treeStart = std::chrono::steady_clock::now();
+        prepareForces(acc, data);
+#pragma omp parallel for schedule(dynamic) reduction(+:interactions)
+        for (int i = 0; i < data.particleCount; ++i)
+            interactions += acc(static_cast<int>(data.idxSorted[i]), data);
+        double treeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - treeStart).count();
+
+        std::vector<double> errors(options.sample);
+        for (int s = 0; s < options.sample; ++s)
+        {
+            int p = sample[s];
+            double dx = data.accX[p] - reference.accX[s];
+            double dy = data.accY[p] - reference.accY[s];
+            double dz = data.accZ[p] - reference.accZ[s];
+            double norm = std::sqrt(static_cast<double>(reference.accX[s]) * reference.accX[s] +
+                                    static_cast<double>(reference.accY[s]) * reference.accY[s] +
+                                    static_cast<double>(reference.accZ[s]) * reference.accZ[s]);
+            errors[s] = std::sqrt(dx * dx + dy * dy + dz * dz) / std::max(norm, 1.0e-30);
+        }
+        std::sort(errors.begin(), errors.end());
+
+        ValidateResult result{};
+        result.distribution = distribution;
+        result.solver = solver;
+        result.theta = theta;
+        result.treeSeconds = treeSeconds;
+        result.directSeconds = reference.seconds;
+        result.interactions = interactions;
+        result.errMedian = percentile(errors, 0.5);
+        result.errP99 = percentile(errors, 0.99);
+        result.errMax = errors.back();
+        bool exactRow = solver == Solver::TREE && theta == 0.0f;
+        result.pass = (options.maxMedian < 0.0 || result.errMedian <= options.maxMedian) &&
+                      (options.maxP99 < 0.0 || result.errP99 <= options.maxP99) &&
+                      (options.maxError < 0.0 || result.errMax <= options.maxError) &&
+                      (!exactRow || options.maxExactError < 0.0 || result.errMax <= options.maxExactError);
+        results.push_back(result);
+    }
+}
+
+// The periodic tree on its own copy of the bodies, wrapped into the box, against the Ewald-corrected direct sum
+static void validatePeriodic(const ValidateOptions &options, Distribution distribution,
+                             const std::vector<int> &sample, std::vector<ValidateResult> &results)
+{
+    Simulation simulation(options.particles);
+    SimulationData &data = simulation.data();
+    data.softening = options.softening;
+    generateParticles(data, distribution, options.radius, static_cast<float>(options.particles), options.seed);
+    simulation.periodicSetup(options.box, options.ewaldTable);
+
+    DirectReference reference = directReference(options, data, sample);
+    Octree tree;
+    tree.buildTree(data);
+    sweepThetas(options, distribution, Solver::PERIODIC, data, sample, reference, netAcceleration, results);
+}
+
+static void validateDistribution(const ValidateOptions &options, Distribution distribution,
+                                 std::vector<ValidateResult> &results, std::vector<ExactResult> &exact)
+{
+    Simulation simulation(options.particles);
+    SimulationData &data = simulation.data();
+    data.softening = options.softening;
+    generateParticles(data, distribution, options.radius, static_cast<float>(options.particles), options.seed);
+
+    // Sampled particles, chosen once so every theta is compared on the same set; the query check takes the
+    // first of them
+    std::vector<int> sample(options.particles);
+    std::iota(sample.begin(), sample.end(), 0);
+    std::shuffle(sample.begin(), sample.end(), std::mt19937(options.seed));
+    sample.resize(std::max(options.sample, options.queries));
+
+    DirectReference reference = directReference(options, data, sample);
+
+    Octree tree;
+    tree.buildTree(data);
+
+    if (options.queries > 0)
+        validateQueries(options, distribution, data, tree, sample, exact);
+    if (options.fofFactor > 0.0f)
+        validateFof(options, distribution, data, tree, exact);
+    validateRenderTree(distribution, data, tree, exact);
+    validateLodSelection(distribution, data, tree, options.radius, exact);
+    validateSharedFrames(distribution, data, exact);
+    validateSnapshotCodec(options, distribution, data, exact);
+
+    for (Solver solver: options.solvers)
+    {
+        switch (solver)
+        {
+            case Solver::TREE:
+            case Solver::COMPACT:
+                simulation.compactNodesSetup(solver == Solver::COMPACT);
+                tree.buildTree(data);
+                sweepThetas(options, distribution, solver, data, sample, reference, netAcceleration, results);
+                break;
+            case Solver::TREEPM:
+            {
+                simulation.compactNodesSetup(false);
+                tree.buildTree(data);
+                ParticleMesh mesh(options.treepmMesh, PM_DEFAULT_SPLIT);
+                mesh.fit(data);
+                sweepThetas(options, distribution, solver, data, sample, reference, TreePMForce{mesh}, results);
+                data.splitRadius = 0.0f;
+                data.splitCutoff = 0.0f;
+                break;
+            }
+            case Solver::PERIODIC:
+                validatePeriodic(options, distribution, sample, results);
+                break;
+        }
+    }
+}
+
+static void writeResults(const ValidateOptions &options, const std::vector<ValidateResult> &results,
+                         std::ostream &out)
+{
+    if (options.format == "csv")
+    {
+        out << "distribution,solver,particles,sample,theta,softening,tree_seconds,direct_seconds,interactions,"
+               "interactions_per_particle,err_median,err_p99,err_max,pass\n";
+        for (const auto &r: results)
+        {
+            out << distributionName(r.distribution) << "," << solverName(r.solver) << "," << options.particles << ","
+                << options.sample << "," << r.theta << "," << options.softening << "," << r.treeSeconds << "," << r.directSeconds << ","
+                << r.interactions << "," << static_cast<double>(r.interactions) / options.particles << ","
+                << r.errMedian << "," << r.errP99 << "," << r.errMax << "," << (r.pass ? 1 : 0) << "\n";
+        }
+    }
+    else
+    {
+        for (const auto &r: results)
+        {
+            out << "{\"distribution\":\"" << distributionName(r.distribution) << "\",\"solver\":\""
+                << solverName(r.solver) << "\",\"particles\":"
+                << options.particles << ",\"sample\":" << options.sample << ",\"theta\":" << r.theta
+                << ",\"softening\":" << options.softening << ",\"tree_seconds\":" << r.treeSeconds
+                << ",\"direct_seconds\":" << r.directSeconds << ",\"interactions\":" << r.interactions
+                << ",\"interactions_per_particle\":" << static_cast<double>(r.interactions) / options.particles
+                << ",\"err_median\":" << r.errMedian << ",\"err_p99\":" << r.errP99 << ",\"err_max\":"
+                << r.errMax << ",\"pass\":" << (r.pass ? "true" : "false") << "}\n";
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ValidateOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ValidateResult> results;
+    std::vector<ExactResult> exact;
+    for (Distribution distribution: options.distributions)
+        validateDistribution(options, distribution, results, exact);
+
+    if (options.output.empty())
+    {
+        writeResults(options, results, std::cout);
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            return EXIT_FAILURE;
+        }
+        writeResults(options, results, file);
+    }
+
+    // Exact kernels report on stderr, leaving stdout to the table
+    int differing = 0;
+    for (const auto &e: exact)
+    {
+        std::cerr << e.check << " " << distributionName(e.distribution) << ": " << e.cases << " cases, "
+                  << e.mismatches << " mismatches" << std::endl;
+        differing += e.mismatches > 0 ? 1 : 0;
+    }
+
+    int failed = static_cast<int>(std::count_if(results.begin(), results.end(),
+                                                [](const ValidateResult &r) { return !r.pass; }));
+    if (failed > 0)
+        std::cerr << failed << " of " << results.size() << " solver settings exceed the accuracy gate" << std::endl;
+    if (differing > 0)
+        std::cerr << differing << " exact checks failed" << std::endl;
+    return failed > 0 || differing > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}